@@ -3,8 +3,18 @@
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <src/HNSWIndex.h>
+#include <src/IVFIndex.h>
 #include <src/LPQ.h>
 #include <src/NaiveQuantizer.h>
+#include <src/PQIndex.h>
+#include <src/QueryCache.h>
+#include <src/RerankingIndex.h>
+#include <src/SearchFuture.h>
+#include <src/SearchStats.h>
+#include <src/ShardedSearch.h>
+#include <src/ThreadPool.h>
+#include <src/VamanaIndex.h>
 
 namespace lpq::python {
 
@@ -12,31 +22,569 @@ namespace py = pybind11;
 
 using lpq::LowPrecisionQuantizer;
 using lpq::NaiveQuantizer;
+using lpq::index::AllowList;
 using lpq::index::ExactSearchIndex;
+using lpq::index::HNSWIndex;
+using lpq::index::IVFIndex;
+using lpq::index::LatencyHistogram;
+using lpq::index::PQIndex;
+using lpq::index::QueryCache;
+using lpq::index::RerankingIndex;
+using lpq::index::SearchCancelled;
+using lpq::index::SearchFuture;
+using lpq::index::SearchParallelism;
+using lpq::index::SearchStats;
+using lpq::index::ShardedSearchIndex;
+using lpq::index::VamanaIndex;
+
+/**
+ * Completes `asyncio_future` with the outcome of `future`. Must run on the
+ * thread of the asyncio future's event loop.
+ */
+void resolveAsyncioFuture(py::object asyncio_future,
+                          const SearchFuture &future) {
+  if (asyncio_future.attr("done")().cast<bool>()) {
+    return;
+  }
+  try {
+    asyncio_future.attr("set_result")(py::cast(future.get()));
+  } catch (const SearchCancelled &) {
+    asyncio_future.attr("cancel")();
+  } catch (const std::invalid_argument &exception) {
+    asyncio_future.attr("set_exception")(
+        py::handle(PyExc_ValueError)(exception.what()));
+  } catch (const std::exception &exception) {
+    asyncio_future.attr("set_exception")(
+        py::handle(PyExc_RuntimeError)(exception.what()));
+  }
+}
+
+void defineSearchFuture(py::module_ &index_submodule) {
+  py::register_exception<SearchCancelled>(index_submodule, "SearchCancelled");
+
+  /**
+   * Callbacks run on the executor thread that completes the search, which
+   * does not hold the GIL. They take it before touching Python objects,
+   * and move their captured objects out so that those are released while
+   * the GIL is still held.
+   */
+  py::class_<SearchFuture>(index_submodule, "SearchFuture")
+      .def("done", &SearchFuture::isReady,
+           "Returns whether the search finished, failed or was cancelled.")
+      .def("wait", &SearchFuture::wait,
+           py::call_guard<py::gil_scoped_release>(),
+           "Blocks until the search is done.")
+      .def("result", &SearchFuture::get,
+           py::call_guard<py::gil_scoped_release>(),
+           "Waits for the search and returns (distances, ids), or raises "
+           "its error. Raises SearchCancelled if it was cancelled.")
+      .def("cancel", &SearchFuture::cancel,
+           "Cancels the search if it has not started yet and returns "
+           "whether it did.")
+      .def("cancelled", &SearchFuture::isCancelled,
+           "Returns whether the search was cancelled.")
+      .def(
+          "add_done_callback",
+          [](SearchFuture &future, py::function callback) {
+            future.onComplete([callback = std::move(callback)](
+                                  const SearchFuture &completed) mutable {
+              py::gil_scoped_acquire gil;
+              py::function function = std::move(callback);
+              try {
+                function(completed);
+              } catch (py::error_already_set &error) {
+                error.discard_as_unraisable("SearchFuture callback");
+              }
+            });
+          },
+          py::arg("callback"),
+          "Calls callback(future) once the search is done, from the thread "
+          "that completes it.")
+      .def(
+          "__await__",
+          [](SearchFuture &future) {
+            py::object loop =
+                py::module_::import("asyncio").attr("get_running_loop")();
+            py::object asyncio_future = loop.attr("create_future")();
+            // Cancelling the awaiting task cancels a search still queued.
+            asyncio_future.attr("add_done_callback")(
+                py::cpp_function([future](py::object done) {
+                  if (done.attr("cancelled")().cast<bool>()) {
+                    SearchFuture(future).cancel();
+                  }
+                }));
+            future.onComplete([loop, asyncio_future](
+                                  const SearchFuture &completed) mutable {
+              py::gil_scoped_acquire gil;
+              py::object event_loop = std::move(loop);
+              py::object target = std::move(asyncio_future);
+              try {
+                event_loop.attr("call_soon_threadsafe")(
+                    py::cpp_function([completed](py::object target) {
+                      resolveAsyncioFuture(target, completed);
+                    }),
+                    target);
+              } catch (py::error_already_set &error) {
+                // The event loop was closed in the meantime.
+                error.discard_as_unraisable("SearchFuture.__await__");
+              }
+            });
+            return asyncio_future.attr("__await__")();
+          },
+          "Makes the future awaitable from asyncio. The search runs on the "
+          "executor threads without holding the GIL.");
+}
+
+void defineSearchStats(py::module_ &index_submodule) {
+  py::class_<LatencyHistogram>(index_submodule, "LatencyHistogram")
+      .def_property_readonly("count", &LatencyHistogram::count)
+      .def_property_readonly("mean", &LatencyHistogram::mean,
+                             "Mean latency in nanoseconds.")
+      .def_property_readonly("min", &LatencyHistogram::min)
+      .def_property_readonly("max", &LatencyHistogram::max)
+      .def("percentile", &LatencyHistogram::percentile,
+           py::arg("percentile"),
+           "Returns the given percentile (0-100) of the latencies in "
+           "nanoseconds, with a relative error of at most 1/32.");
+
+  py::class_<SearchStats>(index_submodule, "SearchStats")
+      .def_readonly("num_searches", &SearchStats::num_searches)
+      .def_readonly("num_queries", &SearchStats::num_queries)
+      .def_readonly("last_search_nanoseconds",
+                    &SearchStats::last_search_nanoseconds)
+      .def_readonly("total_search_nanoseconds",
+                    &SearchStats::total_search_nanoseconds)
+      .def_property_readonly("distances_computed",
+                             [](const SearchStats &stats) {
+                               return stats.scan.distances_computed;
+                             })
+      .def_property_readonly(
+          "early_abandoned",
+          [](const SearchStats &stats) { return stats.scan.early_abandoned; })
+      .def_property_readonly(
+          "filtered_out",
+          [](const SearchStats &stats) { return stats.scan.filtered_out; })
+      .def_property_readonly(
+          "heap_insertions",
+          [](const SearchStats &stats) { return stats.scan.heap_insertions; })
+      .def_readonly("search_latency", &SearchStats::search_latency,
+                    "Wall time of every search call.")
+      .def_readonly("query_latency", &SearchStats::query_latency,
+                    "Time until the results of every query were final.");
+
+  py::class_<QueryCache::Stats>(index_submodule, "QueryCacheStats")
+      .def_readonly("hits", &QueryCache::Stats::hits)
+      .def_readonly("misses", &QueryCache::Stats::misses)
+      .def_readonly("entries", &QueryCache::Stats::entries);
+}
 
 void defineIndexSubmodule(py::module_ &index_submodule) {
+  defineSearchFuture(index_submodule);
+  defineSearchStats(index_submodule);
+
+  py::enum_<SearchParallelism>(index_submodule, "SearchParallelism")
+      .value("Auto", SearchParallelism::Auto)
+      .value("QueryParallel", SearchParallelism::QueryParallel)
+      .value("BaseParallel", SearchParallelism::BaseParallel)
+      .value("ChunkedBatch", SearchParallelism::ChunkedBatch);
+
+  py::class_<AllowList>(index_submodule, "AllowList")
+      .def(py::init<std::vector<uint32_t>>(), py::arg("keys"),
+           "Builds an allow list from internal ordinals. Use "
+           "create_allow_list on the index to build one from ids.")
+      .def_static("from_bitmap", &AllowList::fromBitmap, py::arg("words"),
+                  "Builds an allow list from a dense bitmap with 64 keys per "
+                  "word.")
+      .def("__contains__", &AllowList::contains)
+      .def("__len__", &AllowList::cardinality);
+
   py::class_<ExactSearchIndex<int_least8_t>,
              std::shared_ptr<ExactSearchIndex<int_least8_t>>>(
       index_submodule, "ExactSearchIndex")
       .def(py::init<std::string>(), py::arg("distance_metric"),
            "Initializes an exact search index for int8 type.")
-      .def("add", &ExactSearchIndex<int_least8_t>::addDataset,
-           py::arg("dataset"), "Indexes the given dataset")
-      .def("search", &ExactSearchIndex<int_least8_t>::search,
+      .def("add",
+           py::overload_cast<const std::vector<std::vector<int_least8_t>> &>(
+               &ExactSearchIndex<int_least8_t>::add),
+           py::arg("dataset"), py::call_guard<py::gil_scoped_release>(),
+           "Appends the given vectors to the index and returns their ids. "
+           "Can be called while other threads search.")
+      .def("add",
+           py::overload_cast<const std::vector<std::vector<int_least8_t>> &,
+                             const std::vector<uint64_t> &>(
+               &ExactSearchIndex<int_least8_t>::add),
+           py::arg("dataset"), py::arg("ids"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Appends the given vectors to the index under the given 64-bit "
+           "ids, which search returns.")
+      .def("search",
+           py::overload_cast<const std::vector<std::vector<int_least8_t>> &,
+                             uint32_t, const std::vector<AllowList> &>(
+               &ExactSearchIndex<int_least8_t>::search, py::const_),
            py::arg("queries"), py::arg("top_k"),
+           py::arg("allow_lists") = std::vector<AllowList>(),
+           py::call_guard<py::gil_scoped_release>(),
            "Searches exhaustively for the top k closest vectors to the given "
-           "queries");
+           "queries, optionally only among the vectors of one shared or one "
+           "per-query allow list")
+      .def("search_async", &ExactSearchIndex<int_least8_t>::searchAsync,
+           py::arg("queries"), py::arg("top_k"),
+           py::arg("allow_lists") = std::vector<AllowList>(),
+           py::call_guard<py::gil_scoped_release>(),
+           "Queues the same search as search on a background executor and "
+           "returns a SearchFuture, which can be awaited from asyncio.")
+      .def("set_quantization_parameters",
+           &ExactSearchIndex<int_least8_t>::setQuantizationParameters,
+           py::arg("quantization_parameters"),
+           "Sets the per-dimension (scale, zero point) pairs used to quantize "
+           "the indexed vectors. Required by search_asymmetric.")
+      .def_property_readonly(
+          "quantization_parameters",
+          &ExactSearchIndex<int_least8_t>::getQuantizationParameters,
+          "Gets the (scale, zero point) pairs set on the index.")
+      .def("search_asymmetric",
+           py::overload_cast<const std::vector<std::vector<float>> &, uint32_t,
+                             const std::vector<AllowList> &>(
+               &ExactSearchIndex<int_least8_t>::searchAsymmetric, py::const_),
+           py::arg("queries"), py::arg("top_k"),
+           py::arg("allow_lists") = std::vector<AllowList>(),
+           py::call_guard<py::gil_scoped_release>(),
+           "Searches for the top k closest vectors to the given float "
+           "queries without quantizing them (asymmetric distance "
+           "computation).")
+      .def("range_search", &ExactSearchIndex<int_least8_t>::rangeSearch,
+           py::arg("queries"), py::arg("radius"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Returns (offsets, ids, distances) of every vector within radius "
+           "of each query. The neighbors of query i are "
+           "ids[offsets[i]:offsets[i + 1]].")
+      .def("set_search_parallelism",
+           &ExactSearchIndex<int_least8_t>::setSearchParallelism,
+           py::arg("parallelism"),
+           "Chooses whether search parallelizes over queries, over slices "
+           "of the index, or picks automatically based on the batch size.")
+      .def("set_search_stats_enabled",
+           &ExactSearchIndex<int_least8_t>::setSearchStatsEnabled,
+           py::arg("enabled"),
+           "Turns the collection of search statistics on or off. It is off "
+           "by default and costs nothing while off.")
+      .def("search_stats", &ExactSearchIndex<int_least8_t>::getSearchStats,
+           "Returns the statistics of the searches since they were enabled "
+           "or last reset.")
+      .def("reset_search_stats",
+           &ExactSearchIndex<int_least8_t>::resetSearchStats)
+      .def("set_query_cache_capacity",
+           &ExactSearchIndex<int_least8_t>::setQueryCacheCapacity,
+           py::arg("capacity"),
+           "Caches the results of up to `capacity` repeated searches until "
+           "the next add or remove. 0 (the default) turns the cache off.")
+      .def("query_cache_stats",
+           &ExactSearchIndex<int_least8_t>::getQueryCacheStats)
+      .def("set_scan_chunk_size",
+           &ExactSearchIndex<int_least8_t>::setScanChunkSize,
+           py::arg("chunk_bytes"),
+           "Sets how many bytes of codes a chunked batch search reads "
+           "per chunk.")
+      .def("remove", &ExactSearchIndex<int_least8_t>::remove, py::arg("ids"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Removes the vectors with the given ids and returns how many "
+           "were removed.")
+      .def("compact", &ExactSearchIndex<int_least8_t>::compact,
+           py::call_guard<py::gil_scoped_release>(),
+           "Rewrites the index without the removed vectors.")
+      .def("set_compaction_threshold",
+           &ExactSearchIndex<int_least8_t>::setCompactionThreshold,
+           py::arg("compaction_threshold"),
+           "Sets the fraction of removed vectors above which remove "
+           "compacts the index.")
+      .def("create_allow_list",
+           &ExactSearchIndex<int_least8_t>::createAllowList, py::arg("ids"),
+           "Returns an allow list holding the vectors with the given ids.")
+      .def("set_id_lookup", &ExactSearchIndex<int_least8_t>::setIdLookup,
+           py::arg("enabled"),
+           "Enables the hash index from ids to vectors, which speeds up "
+           "remove for caller supplied ids.")
+      .def("set_deduplication",
+           &ExactSearchIndex<int_least8_t>::setDeduplication,
+           py::arg("enabled"),
+           "Stores vectors with identical codes once and returns all of "
+           "their ids from search.")
+      .def("save", &ExactSearchIndex<int_least8_t>::save, py::arg("path"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Writes the index to a file that load() maps back.")
+      .def_static("load", &ExactSearchIndex<int_least8_t>::load,
+                  py::arg("path"),
+                  py::call_guard<py::gil_scoped_release>(),
+                  "Loads a saved index by memory-mapping the file, so "
+                  "loading is instant and processes share the pages.")
+      .def("__len__", &ExactSearchIndex<int_least8_t>::size)
+      .def("memory_usage", &ExactSearchIndex<int_least8_t>::getMemoryUsage,
+           "Returns the number of bytes used by the index.");
 
   py::class_<ExactSearchIndex<float>, std::shared_ptr<ExactSearchIndex<float>>>(
       index_submodule, "ExactSearchIndexF")
       .def(py::init<std::string>(), py::arg("distance_metric"),
            "Initializes an exact search index for float32 type.")
-      .def("add", &ExactSearchIndex<float>::addDataset, py::arg("dataset"),
-           "Indexes the given dataset")
-      .def("search", &ExactSearchIndex<float>::search, py::arg("queries"),
-           py::arg("top_k"),
+      .def("add",
+           py::overload_cast<const std::vector<std::vector<float>> &>(
+               &ExactSearchIndex<float>::add),
+           py::arg("dataset"), py::call_guard<py::gil_scoped_release>(),
+           "Appends the given vectors to the index and returns their ids. "
+           "Can be called while other threads search.")
+      .def("add",
+           py::overload_cast<const std::vector<std::vector<float>> &,
+                             const std::vector<uint64_t> &>(
+               &ExactSearchIndex<float>::add),
+           py::arg("dataset"), py::arg("ids"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Appends the given vectors to the index under the given 64-bit "
+           "ids, which search returns.")
+      .def("search",
+           py::overload_cast<const std::vector<std::vector<float>> &, uint32_t,
+                             const std::vector<AllowList> &>(
+               &ExactSearchIndex<float>::search, py::const_),
+           py::arg("queries"), py::arg("top_k"),
+           py::arg("allow_lists") = std::vector<AllowList>(),
+           py::call_guard<py::gil_scoped_release>(),
            "Searches exhaustively for the top k closest vectors to the given "
-           "queries");
+           "queries, optionally only among the vectors of one shared or one "
+           "per-query allow list")
+      .def("search_async", &ExactSearchIndex<float>::searchAsync,
+           py::arg("queries"), py::arg("top_k"),
+           py::arg("allow_lists") = std::vector<AllowList>(),
+           py::call_guard<py::gil_scoped_release>(),
+           "Queues the same search as search on a background executor and "
+           "returns a SearchFuture, which can be awaited from asyncio.")
+      .def("range_search", &ExactSearchIndex<float>::rangeSearch,
+           py::arg("queries"), py::arg("radius"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Returns (offsets, ids, distances) of every vector within radius "
+           "of each query. The neighbors of query i are "
+           "ids[offsets[i]:offsets[i + 1]].")
+      .def("set_search_parallelism",
+           &ExactSearchIndex<float>::setSearchParallelism,
+           py::arg("parallelism"),
+           "Chooses whether search parallelizes over queries, over slices "
+           "of the index, or picks automatically based on the batch size.")
+      .def("set_search_stats_enabled",
+           &ExactSearchIndex<float>::setSearchStatsEnabled,
+           py::arg("enabled"),
+           "Turns the collection of search statistics on or off. It is off "
+           "by default and costs nothing while off.")
+      .def("search_stats", &ExactSearchIndex<float>::getSearchStats,
+           "Returns the statistics of the searches since they were enabled "
+           "or last reset.")
+      .def("reset_search_stats",
+           &ExactSearchIndex<float>::resetSearchStats)
+      .def("set_query_cache_capacity",
+           &ExactSearchIndex<float>::setQueryCacheCapacity,
+           py::arg("capacity"),
+           "Caches the results of up to `capacity` repeated searches until "
+           "the next add or remove. 0 (the default) turns the cache off.")
+      .def("query_cache_stats",
+           &ExactSearchIndex<float>::getQueryCacheStats)
+      .def("set_scan_chunk_size",
+           &ExactSearchIndex<float>::setScanChunkSize,
+           py::arg("chunk_bytes"),
+           "Sets how many bytes of codes a chunked batch search reads "
+           "per chunk.")
+      .def("remove", &ExactSearchIndex<float>::remove, py::arg("ids"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Removes the vectors with the given ids and returns how many "
+           "were removed.")
+      .def("compact", &ExactSearchIndex<float>::compact,
+           py::call_guard<py::gil_scoped_release>(),
+           "Rewrites the index without the removed vectors.")
+      .def("set_compaction_threshold",
+           &ExactSearchIndex<float>::setCompactionThreshold,
+           py::arg("compaction_threshold"),
+           "Sets the fraction of removed vectors above which remove "
+           "compacts the index.")
+      .def("create_allow_list", &ExactSearchIndex<float>::createAllowList,
+           py::arg("ids"),
+           "Returns an allow list holding the vectors with the given ids.")
+      .def("set_id_lookup", &ExactSearchIndex<float>::setIdLookup,
+           py::arg("enabled"),
+           "Enables the hash index from ids to vectors, which speeds up "
+           "remove for caller supplied ids.")
+      .def("set_deduplication",
+           &ExactSearchIndex<float>::setDeduplication, py::arg("enabled"),
+           "Stores vectors with identical codes once and returns all of "
+           "their ids from search.")
+      .def("save", &ExactSearchIndex<float>::save, py::arg("path"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Writes the index to a file that load() maps back.")
+      .def_static("load", &ExactSearchIndex<float>::load, py::arg("path"),
+                  py::call_guard<py::gil_scoped_release>(),
+                  "Loads a saved index by memory-mapping the file, so "
+                  "loading is instant and processes share the pages.")
+      .def("__len__", &ExactSearchIndex<float>::size)
+      .def("memory_usage", &ExactSearchIndex<float>::getMemoryUsage,
+           "Returns the number of bytes used by the index.");
+
+  py::class_<PQIndex, std::shared_ptr<PQIndex>>(index_submodule, "PQIndex")
+      .def(py::init<std::string, uint32_t, uint32_t>(),
+           py::arg("distance_metric"), py::arg("num_subspaces"),
+           py::arg("rerank_oversample") = 0,
+           "Initializes a product quantization index with 4-bit codes in "
+           "num_subspaces subspaces. With rerank_oversample > 0, "
+           "top_k * rerank_oversample candidates are reranked against int8 "
+           "codes.")
+      .def("train", &PQIndex::train, py::arg("dataset"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Trains the codebooks without adding the vectors.")
+      .def("add", &PQIndex::add, py::arg("dataset"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Encodes and appends the given vectors and returns their ids. "
+           "Trains on the first batch if the index is untrained.")
+      .def("search", &PQIndex::search, py::arg("queries"), py::arg("top_k"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Returns the approximate top k vectors for the given queries.")
+      .def_property_readonly("num_subspaces", &PQIndex::getNumSubspaces)
+      .def_property_readonly("rerank_oversample",
+                             &PQIndex::getRerankOversample)
+      .def("__len__", &PQIndex::size)
+      .def("memory_usage", &PQIndex::getMemoryUsage,
+           "Returns the number of bytes used by the index.");
+
+  py::class_<RerankingIndex, std::shared_ptr<RerankingIndex>>(
+      index_submodule, "RerankingIndex")
+      .def(py::init<std::string, uint32_t>(), py::arg("distance_metric"),
+           py::arg("oversample") = RerankingIndex::DEFAULT_OVERSAMPLE,
+           "Initializes a two-stage index that scans int8 codes for "
+           "top_k * oversample candidates and reranks them in float32.")
+      .def("add", &RerankingIndex::add, py::arg("dataset"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Quantizes and appends the given vectors, keeping a float32 copy "
+           "for reranking, and returns their ids.")
+      .def("add_from_file", &RerankingIndex::addFromFile, py::arg("path"),
+           py::arg("dimension"), py::call_guard<py::gil_scoped_release>(),
+           "Indexes a file of raw float32 rows (e.g. written by "
+           "numpy.ndarray.tofile). The file is memory-mapped for reranking "
+           "instead of being loaded.")
+      .def("search", &RerankingIndex::search, py::arg("queries"),
+           py::arg("top_k"), py::call_guard<py::gil_scoped_release>(),
+           "Returns the top k vectors for the given queries with exact "
+           "float32 distances.")
+      .def("__len__", &RerankingIndex::size)
+      .def("memory_usage", &RerankingIndex::getMemoryUsage,
+           "Returns the number of bytes held in RAM by the index.");
+
+  py::class_<HNSWIndex<int8_t>, std::shared_ptr<HNSWIndex<int8_t>>>(
+      index_submodule, "HNSWIndex")
+      .def(py::init<std::string, uint32_t, uint32_t>(),
+           py::arg("distance_metric"),
+           py::arg("m") = HNSWIndex<int8_t>::DEFAULT_M,
+           py::arg("ef_construction") =
+               HNSWIndex<int8_t>::DEFAULT_EF_CONSTRUCTION,
+           "Initializes a graph index over int8 codes where nodes link to "
+           "up to m neighbours (2 * m on the bottom layer).")
+      .def("add", &HNSWIndex<int8_t>::add, py::arg("dataset"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Quantizes the given vectors, inserts them into the graph in "
+           "parallel and returns their ids.")
+      .def("search", &HNSWIndex<int8_t>::search, py::arg("queries"),
+           py::arg("top_k"), py::call_guard<py::gil_scoped_release>(),
+           "Returns the approximate top k vectors for the given queries.")
+      .def("set_ef_search", &HNSWIndex<int8_t>::setEfSearch,
+           py::arg("ef_search"),
+           "Sets the beam width of a search. Wider beams raise the recall "
+           "and the latency alike.")
+      .def_property_readonly("ef_search", &HNSWIndex<int8_t>::getEfSearch)
+      .def_property_readonly("m", &HNSWIndex<int8_t>::getM)
+      .def_property_readonly("ef_construction",
+                             &HNSWIndex<int8_t>::getEfConstruction)
+      .def("__len__", &HNSWIndex<int8_t>::size)
+      .def("memory_usage", &HNSWIndex<int8_t>::getMemoryUsage,
+           "Returns the number of bytes used by the index.");
+
+  py::class_<IVFIndex<int8_t>, std::shared_ptr<IVFIndex<int8_t>>>(
+      index_submodule, "IVFIndex")
+      .def(py::init<std::string, uint32_t>(), py::arg("distance_metric"),
+           py::arg("num_lists"),
+           "Initializes an inverted file index that clusters the vectors "
+           "into num_lists lists with k-means and stores int8 residuals.")
+      .def("train", &IVFIndex<int8_t>::train, py::arg("dataset"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Fits the centroids and the residual quantization grid without "
+           "adding the vectors.")
+      .def("add", &IVFIndex<int8_t>::add, py::arg("dataset"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Appends the given vectors to the lists of their nearest "
+           "centroids and returns their ids. Trains on the first batch if "
+           "the index is untrained.")
+      .def("search", &IVFIndex<int8_t>::search, py::arg("queries"),
+           py::arg("top_k"), py::call_guard<py::gil_scoped_release>(),
+           "Returns the approximate top k vectors for the given queries, "
+           "scanning the num_probes closest lists of every query.")
+      .def("set_num_probes", &IVFIndex<int8_t>::setNumProbes,
+           py::arg("num_probes"),
+           "Sets the number of lists scanned per query.")
+      .def_property_readonly("num_probes", &IVFIndex<int8_t>::getNumProbes)
+      .def_property_readonly("num_lists", &IVFIndex<int8_t>::getNumLists)
+      .def("list_sizes", &IVFIndex<int8_t>::getListSizes,
+           "Returns the number of vectors in every list.")
+      .def("__len__", &IVFIndex<int8_t>::size)
+      .def("memory_usage", &IVFIndex<int8_t>::getMemoryUsage,
+           "Returns the number of bytes used by the index.");
+
+  py::class_<ShardedSearchIndex, std::shared_ptr<ShardedSearchIndex>>(
+      index_submodule, "ShardedSearchIndex")
+      .def(py::init<std::vector<std::string>, std::string, bool>(),
+           py::arg("shard_paths"), py::arg("worker_executable"),
+           py::arg("pin_workers") = true,
+           py::call_guard<py::gil_scoped_release>(),
+           "Starts one worker process per shard file (pinned per NUMA node) "
+           "and searches all of them.")
+      .def_static("write_shards", &ShardedSearchIndex::writeShards,
+                  py::arg("distance_metric"), py::arg("dataset"),
+                  py::arg("num_shards"), py::arg("directory"),
+                  py::call_guard<py::gil_scoped_release>(),
+                  "Splits the dataset into shard files and returns their "
+                  "paths.")
+      .def("search", &ShardedSearchIndex::search, py::arg("queries"),
+           py::arg("top_k"), py::call_guard<py::gil_scoped_release>(),
+           "Searches every shard and merges the top k lists.")
+      .def_property_readonly("num_shards", &ShardedSearchIndex::numShards)
+      .def("__len__", &ShardedSearchIndex::size);
+
+  py::class_<VamanaIndex, std::shared_ptr<VamanaIndex>>(index_submodule,
+                                                         "VamanaIndex")
+      .def_static("build", &VamanaIndex::build, py::arg("dataset"),
+                  py::arg("distance_metric"), py::arg("path"),
+                  py::arg("max_degree") = VamanaIndex::DEFAULT_MAX_DEGREE,
+                  py::arg("build_list_size") =
+                      VamanaIndex::DEFAULT_BUILD_LIST_SIZE,
+                  py::arg("alpha") = VamanaIndex::DEFAULT_ALPHA,
+                  py::call_guard<py::gil_scoped_release>(),
+                  "Builds a Vamana graph over the dataset and writes the "
+                  "vectors and the graph to a file of 4 KiB sectors.")
+      .def_static("load", &VamanaIndex::load, py::arg("path"),
+                  py::arg("num_io_threads") =
+                      VamanaIndex::DEFAULT_NUM_IO_THREADS,
+                  py::call_guard<py::gil_scoped_release>(),
+                  "Opens a built index. Only int8 codes of the vectors are "
+                  "read into RAM; the graph stays on disk.")
+      .def("search", &VamanaIndex::search, py::arg("queries"),
+           py::arg("top_k"), py::call_guard<py::gil_scoped_release>(),
+           "Returns the approximate top k vectors for the given queries "
+           "with exact float32 distances.")
+      .def("set_search_list_size", &VamanaIndex::setSearchListSize,
+           py::arg("search_list_size"),
+           "Sets the number of candidates a search keeps, which bounds the "
+           "number of nodes it reads.")
+      .def_property_readonly("search_list_size",
+                             &VamanaIndex::getSearchListSize)
+      .def("set_beam_width", &VamanaIndex::setBeamWidth,
+           py::arg("beam_width"),
+           "Sets the number of nodes a search reads in parallel per step.")
+      .def_property_readonly("beam_width", &VamanaIndex::getBeamWidth)
+      .def_property_readonly("max_degree", &VamanaIndex::getMaxDegree)
+      .def("num_node_reads", &VamanaIndex::getNumNodeReads,
+           "Returns the number of nodes read from disk so far.")
+      .def("__len__", &VamanaIndex::size)
+      .def("memory_usage", &VamanaIndex::getMemoryUsage,
+           "Returns the number of bytes held in RAM by the index.");
 }
 
 void defineQuantizationSubmodule(py::module_ &quantizer_submodule) {
@@ -55,15 +603,29 @@ void defineQuantizationSubmodule(py::module_ &quantizer_submodule) {
       quantizer_submodule, "LowPrecisionQuantizer")
       .def(py::init<>(), "Initializes a low-precision quantizer (int8) object.")
       .def("quantize_vectors",
-           &LowPrecisionQuantizer<int_least8_t>::quantizeVectors,
+           py::overload_cast<const std::vector<std::vector<float>> &>(
+               &LowPrecisionQuantizer<int_least8_t>::quantizeVectors),
            py::arg("vectors"),
            "Quantizes input vectors based on the low precision quantization "
            "rule.Based on the current implementation, this could be an affine "
            "quantization or the LPQ quantization from the original paper.")
+      .def("quantize_vectors",
+           py::overload_cast<
+               const std::vector<std::vector<float>> &,
+               const std::vector<std::tuple<float, int_least8_t>> &>(
+               &LowPrecisionQuantizer<int_least8_t>::quantizeVectors),
+           py::arg("vectors"), py::arg("quantization_parameters"),
+           "Quantizes input vectors with the given (scale, zero point) pairs, "
+           "e.g. those of an earlier call to quantize_vectors.")
 
       .def_property_readonly("bit_width",
                              &LowPrecisionQuantizer<int_least8_t>::getBitWidth,
-                             "Gets the bit width used by the quantizer");
+                             "Gets the bit width used by the quantizer")
+      .def_property_readonly(
+          "quantization_parameters",
+          &LowPrecisionQuantizer<int_least8_t>::getQuantizationParameters,
+          "Gets the per-dimension (scale, zero point) pairs computed by the "
+          "last call to quantize_vectors");
 }
 
 PYBIND11_MODULE(lpq, module) {
@@ -73,6 +635,16 @@ PYBIND11_MODULE(lpq, module) {
 
   defineQuantizationSubmodule(quantizer_submodule);
   defineIndexSubmodule(index_submodule);
+
+  module.def(
+      "set_num_threads",
+      [](uint32_t num_threads, bool pin_threads) {
+        lpq::ThreadPool::global().resize(num_threads, pin_threads);
+      },
+      py::arg("num_threads"), py::arg("pin_threads") = false,
+      "Restarts the thread pool used by search and quantization with "
+      "num_threads threads, optionally pinned to one CPU each. Must not be "
+      "called while a search is running.");
 }
 
 } // namespace lpq::python
\ No newline at end of file
@@ -68,16 +68,12 @@ def train_and_eval(
     quantize=False,
     test_run=True,
 ):
-    if metric == "angular":
-        # We normalize for the 'angular' distance metric since the implementation
-        # uses inner product. And inner product is equivalent to angular similarity
-        # when the data is normalized
-        train_set = train_set / np.linalg.norm(train_set, axis=1)[:, np.newaxis]
-
     if quantize:
+        # Queries are kept in float and scored with asymmetric distance
+        # computation, so only the training set needs to be quantized.
         quantizer_ = LowPrecisionQuantizer()
         train_set = quantizer_.quantize_vectors(vectors=train_set)
-        queries = quantizer_.quantize_vectors(vectors=queries)
+        idx.set_quantization_parameters(quantizer_.quantization_parameters)
 
     print(f"[EXPERIMENT]: {dataset_name}")
     start = time.time()
@@ -87,7 +83,10 @@ def train_and_eval(
     print(f"Indexing time: {indexing_time} secs")
 
     start = time.time()
-    distances, computed_neighbors = idx.search(queries, top_k)
+    if quantize:
+        distances, computed_neighbors = idx.search_asymmetric(queries, top_k)
+    else:
+        distances, computed_neighbors = idx.search(queries, top_k)
     end = time.time()
     querying_time = end - start
     print(f"Querying time: {querying_time} secs")
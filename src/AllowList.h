@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * A set of 32-bit keys used to restrict a search to a subset of the index
+ * (e.g. one tenant or category). The keys are the internal ordinals of the
+ * indexed vectors, see ExactSearchIndex::createAllowList.
+ *
+ * The layout follows roaring bitmaps: the key space is split into chunks
+ * of 2^16 keys, and every chunk stores its keys either as a sorted array
+ * of 16-bit offsets (sparse) or as a 2^16 bit bitmap (dense), whichever
+ * is smaller. Chunks without keys are not stored at all. The scan asks
+ * for the allowed keys 64 at a time with `getBits`, so a block of the
+ * index that holds no allowed vector is skipped with one call.
+ */
+class AllowList {
+public:
+  static constexpr uint32_t CHUNK_SIZE = 1 << 16;
+  static constexpr uint32_t WORDS_PER_CHUNK = CHUNK_SIZE / 64;
+  /**
+   * A sparse chunk uses 2 bytes per key and a dense one 8 KiB, so a chunk
+   * becomes dense once it holds more than 4096 keys.
+   */
+  static constexpr uint32_t MAX_SPARSE_SIZE = 4096;
+
+  AllowList() = default;
+
+  /**
+   * Builds a (roaring-style) allow list holding `keys`. The keys do not
+   * need to be sorted and may contain duplicates.
+   */
+  explicit AllowList(std::vector<uint32_t> keys) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    size_t begin = 0;
+    while (begin < keys.size()) {
+      uint32_t chunk_key = keys[begin] / CHUNK_SIZE;
+      size_t end = begin;
+      while (end < keys.size() && keys[end] / CHUNK_SIZE == chunk_key) {
+        end++;
+      }
+
+      Chunk &chunk = addChunk(chunk_key);
+      if (end - begin > MAX_SPARSE_SIZE) {
+        chunk.dense.assign(WORDS_PER_CHUNK, 0);
+        for (size_t index = begin; index < end; index++) {
+          uint32_t offset = keys[index] % CHUNK_SIZE;
+          chunk.dense[offset / 64] |= uint64_t(1) << (offset % 64);
+        }
+      } else {
+        for (size_t index = begin; index < end; index++) {
+          chunk.sparse.push_back(keys[index] % CHUNK_SIZE);
+        }
+      }
+      _cardinality += end - begin;
+      begin = end;
+    }
+  }
+
+  /**
+   * Builds a dense allow list from a bitmap in which bit k % 64 of word
+   * k / 64 is set if key k is allowed.
+   */
+  static AllowList fromBitmap(const std::vector<uint64_t> &words) {
+    AllowList allow_list;
+    for (size_t first_word = 0; first_word < words.size();
+         first_word += WORDS_PER_CHUNK) {
+      size_t last_word =
+          std::min<size_t>(words.size(), first_word + WORDS_PER_CHUNK);
+      uint64_t chunk_cardinality = 0;
+      for (size_t word = first_word; word < last_word; word++) {
+        chunk_cardinality += __builtin_popcountll(words[word]);
+      }
+      if (chunk_cardinality == 0) {
+        continue;
+      }
+
+      Chunk &chunk = allow_list.addChunk(first_word / WORDS_PER_CHUNK);
+      chunk.dense.assign(WORDS_PER_CHUNK, 0);
+      std::copy(words.begin() + first_word, words.begin() + last_word,
+                chunk.dense.begin());
+      allow_list._cardinality += chunk_cardinality;
+    }
+    return allow_list;
+  }
+
+  bool contains(uint32_t key) const {
+    const Chunk *chunk = getChunk(key / CHUNK_SIZE);
+    if (!chunk) {
+      return false;
+    }
+    uint32_t offset = key % CHUNK_SIZE;
+    if (!chunk->dense.empty()) {
+      return chunk->dense[offset / 64] >> (offset % 64) & 1;
+    }
+    return std::binary_search(chunk->sparse.begin(), chunk->sparse.end(),
+                              offset);
+  }
+
+  /**
+   * Returns the membership of keys [first_key, first_key + 64) as a word
+   * in which bit i is set if first_key + i is allowed.
+   */
+  uint64_t getBits(uint32_t first_key) const {
+    uint32_t offset = first_key % CHUNK_SIZE;
+    uint64_t bits = getChunkBits(first_key / CHUNK_SIZE, offset);
+    // The 64 keys span two chunks unless they start 64 keys before the end
+    // of the first one.
+    if (offset > CHUNK_SIZE - 64) {
+      uint32_t keys_in_first_chunk = CHUNK_SIZE - offset;
+      bits |= getChunkBits(first_key / CHUNK_SIZE + 1, 0)
+              << keys_in_first_chunk;
+    }
+    return bits;
+  }
+
+  /**
+   * Returns true if any key in [first_key, last_key] is allowed.
+   */
+  bool anyInRange(uint32_t first_key, uint32_t last_key) const {
+    for (uint64_t chunk_key = first_key / CHUNK_SIZE;
+         chunk_key <= last_key / CHUNK_SIZE; chunk_key++) {
+      const Chunk *chunk = getChunk(chunk_key);
+      if (!chunk) {
+        continue;
+      }
+      uint32_t first_offset =
+          chunk_key == first_key / CHUNK_SIZE ? first_key % CHUNK_SIZE : 0;
+      uint32_t last_offset = chunk_key == last_key / CHUNK_SIZE
+                                 ? last_key % CHUNK_SIZE
+                                 : CHUNK_SIZE - 1;
+
+      if (chunk->dense.empty()) {
+        auto iterator = std::lower_bound(chunk->sparse.begin(),
+                                         chunk->sparse.end(), first_offset);
+        if (iterator != chunk->sparse.end() && *iterator <= last_offset) {
+          return true;
+        }
+        continue;
+      }
+      for (uint32_t word = first_offset / 64; word <= last_offset / 64;
+           word++) {
+        uint64_t bits = chunk->dense[word];
+        if (word == first_offset / 64) {
+          bits &= ~uint64_t(0) << (first_offset % 64);
+        }
+        if (word == last_offset / 64 && last_offset % 64 != 63) {
+          bits &= (uint64_t(1) << (last_offset % 64 + 1)) - 1;
+        }
+        if (bits) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  uint64_t cardinality() const { return _cardinality; }
+
+  /**
+   * Returns a 64-bit hash of the allowed keys, which identifies the allow
+   * list in the keys of the query cache. Allow lists built the same way
+   * from the same keys have the same fingerprint.
+   */
+  uint64_t fingerprint() const {
+    uint64_t hash = 0xcbf29ce484222325ull ^ _cardinality;
+    auto mix = [&hash](uint64_t value) {
+      hash = (hash ^ value) * 0x9e3779b97f4a7c15ull;
+      hash ^= hash >> 32;
+    };
+    for (uint32_t chunk_key = 0; chunk_key < _chunk_positions.size();
+         chunk_key++) {
+      const Chunk *chunk = getChunk(chunk_key);
+      if (!chunk) {
+        continue;
+      }
+      mix(chunk_key);
+      for (uint16_t offset : chunk->sparse) {
+        mix(offset);
+      }
+      for (uint64_t word : chunk->dense) {
+        mix(word);
+      }
+    }
+    return hash;
+  }
+
+  size_t getMemoryUsage() const {
+    size_t memory_usage = sizeof(*this) +
+                          _chunk_positions.capacity() * sizeof(int32_t) +
+                          _chunks.capacity() * sizeof(Chunk);
+    for (const auto &chunk : _chunks) {
+      memory_usage += chunk.sparse.capacity() * sizeof(uint16_t) +
+                      chunk.dense.capacity() * sizeof(uint64_t);
+    }
+    return memory_usage;
+  }
+
+private:
+  struct Chunk {
+    // Exactly one of the two is non-empty.
+    std::vector<uint16_t> sparse;
+    std::vector<uint64_t> dense;
+  };
+
+  Chunk &addChunk(uint32_t chunk_key) {
+    if (chunk_key >= _chunk_positions.size()) {
+      _chunk_positions.resize(chunk_key + 1, -1);
+    }
+    _chunk_positions[chunk_key] = _chunks.size();
+    return _chunks.emplace_back();
+  }
+
+  const Chunk *getChunk(uint64_t chunk_key) const {
+    if (chunk_key >= _chunk_positions.size() ||
+        _chunk_positions[chunk_key] < 0) {
+      return nullptr;
+    }
+    return &_chunks[_chunk_positions[chunk_key]];
+  }
+
+  /**
+   * Membership of keys [offset, offset + 64) of a chunk, truncated at the
+   * end of the chunk.
+   */
+  uint64_t getChunkBits(uint32_t chunk_key, uint32_t offset) const {
+    const Chunk *chunk = getChunk(chunk_key);
+    if (!chunk) {
+      return 0;
+    }
+    if (!chunk->dense.empty()) {
+      uint32_t word = offset / 64;
+      uint32_t shift = offset % 64;
+      uint64_t bits = chunk->dense[word] >> shift;
+      if (shift && word + 1 < WORDS_PER_CHUNK) {
+        bits |= chunk->dense[word + 1] << (64 - shift);
+      }
+      return bits;
+    }
+
+    uint64_t bits = 0;
+    auto iterator =
+        std::lower_bound(chunk->sparse.begin(), chunk->sparse.end(), offset);
+    for (; iterator != chunk->sparse.end() && *iterator < offset + 64;
+         iterator++) {
+      bits |= uint64_t(1) << (*iterator - offset);
+    }
+    return bits;
+  }
+
+  // Position of every chunk in `_chunks`, or -1 for chunks without keys.
+  std::vector<int32_t> _chunk_positions;
+  std::vector<Chunk> _chunks;
+  uint64_t _cardinality = 0;
+};
+
+} // namespace lpq::index
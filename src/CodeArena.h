@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Alignment (in bytes) of every row stored in a CodeArena. 64 bytes is
+ * both the cache line size and the width of an AVX-512 register, so a
+ * row never straddles more cache lines than it has to and vector loads
+ * are always aligned.
+ */
+constexpr size_t CODE_ALIGNMENT = 64;
+
+/**
+ * Minimal std::allocator replacement that returns CODE_ALIGNMENT aligned
+ * memory.
+ */
+template <typename T> struct AlignedAllocator {
+  using value_type = T;
+
+  AlignedAllocator() = default;
+  template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+
+  T *allocate(size_t count) {
+    size_t bytes = count * sizeof(T);
+    // std::aligned_alloc requires the size to be a multiple of the alignment
+    bytes = (bytes + CODE_ALIGNMENT - 1) / CODE_ALIGNMENT * CODE_ALIGNMENT;
+    void *pointer = std::aligned_alloc(CODE_ALIGNMENT, bytes);
+    if (!pointer) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(pointer);
+  }
+
+  void deallocate(T *pointer, size_t) { std::free(pointer); }
+
+  template <typename U> bool operator==(const AlignedAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const AlignedAllocator<U> &) const {
+    return false;
+  }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+/**
+ * Stores fixed-dimension vectors row by row in a single contiguous,
+ * 64-byte aligned buffer. Every row is zero padded up to a multiple of
+ * CODE_ALIGNMENT bytes (the stride), so each row starts on its own cache
+ * line and scan kernels can run over the full stride without a scalar
+ * remainder loop. Zero padding does not change inner products or
+ * euclidean distances as long as queries are padded the same way.
+ *
+ * The buffer only moves when the arena grows past its capacity. Callers
+ * that reserve the final capacity up front can therefore keep writing new
+ * rows while other threads read the rows that already exist.
+ */
+template <typename PRECISION_TYPE> class CodeArena {
+public:
+  explicit CodeArena(uint32_t dimension = 0, size_t capacity = 0)
+      : _dimension(dimension), _stride(computeStride(dimension)),
+        _num_rows(0), _capacity(0) {
+    reserve(capacity);
+  }
+
+  /**
+   * Returns a read-only arena over `num_rows` rows that are stored
+   * elsewhere (e.g. in a memory-mapped index file) in the arena layout:
+   * CODE_ALIGNMENT aligned and padded to the stride. The memory must
+   * outlive the arena. Growing the arena copies the rows into owned
+   * memory first.
+   */
+  static CodeArena fromMappedRows(const PRECISION_TYPE *rows,
+                                  uint32_t dimension, size_t num_rows) {
+    CodeArena arena(dimension);
+    arena._mapped_rows = rows;
+    arena._num_rows = num_rows;
+    arena._capacity = num_rows;
+    return arena;
+  }
+
+  static uint32_t computeStride(uint32_t dimension) {
+    constexpr uint32_t elements_per_line =
+        std::max<uint32_t>(1, CODE_ALIGNMENT / sizeof(PRECISION_TYPE));
+    return (dimension + elements_per_line - 1) / elements_per_line *
+           elements_per_line;
+  }
+
+  /**
+   * Makes room for `capacity` rows. New rows are zero initialized so that
+   * their padding is already in place.
+   */
+  void reserve(size_t capacity) {
+    if (capacity <= _capacity) {
+      return;
+    }
+    if (_mapped_rows) {
+      _codes.assign(_mapped_rows, _mapped_rows + _num_rows * _stride);
+      _mapped_rows = nullptr;
+    }
+    _codes.resize(capacity * _stride, PRECISION_TYPE(0));
+    _capacity = capacity;
+  }
+
+  /**
+   * Makes rows [size(), num_rows) addressable so that they can be filled
+   * in parallel through `getMutableRow`. Grows geometrically if needed.
+   */
+  void resize(size_t num_rows) {
+    if (num_rows > _capacity) {
+      reserve(std::max(num_rows, 2 * _capacity));
+    }
+    _num_rows = num_rows;
+  }
+
+  /**
+   * Copies `_dimension` values from `row` to the end of the arena.
+   */
+  void append(const PRECISION_TYPE *row) {
+    resize(_num_rows + 1);
+    std::copy(row, row + _dimension, getMutableRow(_num_rows - 1));
+  }
+
+  const PRECISION_TYPE *getRow(size_t row_index) const {
+    return (_mapped_rows ? _mapped_rows : _codes.data()) +
+           row_index * _stride;
+  }
+
+  PRECISION_TYPE *getMutableRow(size_t row_index) {
+    return _codes.data() + row_index * _stride;
+  }
+
+  size_t size() const { return _num_rows; }
+  bool isMapped() const { return _mapped_rows != nullptr; }
+  bool empty() const { return _num_rows == 0; }
+  size_t capacity() const { return _capacity; }
+  uint32_t getDimension() const { return _dimension; }
+  uint32_t getStride() const { return _stride; }
+
+  /**
+   * Bytes held by the code buffer, including padding and any capacity
+   * reserved for future rows. Mapped rows are not counted.
+   */
+  size_t getMemoryUsage() const {
+    return _codes.capacity() * sizeof(PRECISION_TYPE);
+  }
+
+private:
+  uint32_t _dimension;
+  uint32_t _stride;
+  size_t _num_rows;
+  size_t _capacity;
+  AlignedVector<PRECISION_TYPE> _codes;
+  // Rows of a mapped file used in place of `_codes`, see fromMappedRows.
+  const PRECISION_TYPE *_mapped_rows = nullptr;
+};
+
+} // namespace lpq::index
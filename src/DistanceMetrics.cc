@@ -0,0 +1,20 @@
+#include <src/DistanceMetrics.h>
+#include <src/ThreadPool.h>
+
+namespace lpq::index {
+
+std::vector<std::vector<float>>
+normalizeVectors(const std::vector<std::vector<float>> &vectors) {
+  std::vector<std::vector<float>> normalized_vectors(vectors);
+  ThreadPool::global().parallelFor(0, vectors.size(), [&](uint64_t index) {
+    auto &vector = normalized_vectors[index];
+    const float inverse_norm =
+        inverseNorm(dotProduct(vector.data(), vector.data(), vector.size()));
+    for (auto &value : vector) {
+      value *= inverse_norm;
+    }
+  });
+  return normalized_vectors;
+}
+
+} // namespace lpq::index
@@ -1,20 +1,186 @@
 #pragma once
 
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <src/CodeArena.h>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <vector>
 
 namespace lpq::index {
 
+enum class DistanceMetric { Euclidean, InnerProduct, Cosine };
+
+/**
+ * Maps the user facing metric name to a DistanceMetric. The lookup is
+ * case insensitive so that "Euclidean" and "euclidean" are equivalent.
+ */
+inline DistanceMetric parseDistanceMetric(const std::string &metric) {
+  std::string metric_to_lower = metric;
+  std::transform(metric.begin(), metric.end(), metric_to_lower.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+
+  if (metric_to_lower == "euclidean") {
+    return DistanceMetric::Euclidean;
+  }
+  if (metric_to_lower == "dot") {
+    return DistanceMetric::InnerProduct;
+  }
+  if (metric_to_lower == "angular" || metric_to_lower == "cosine") {
+    return DistanceMetric::Cosine;
+  }
+  throw std::invalid_argument(
+      "Invalid metric distance. Supported metric include 'euclidean', "
+      "'angular' (or 'cosine') and 'dot'");
+}
+
+/**
+ * Inner product and cosine are similarities (larger is closer) while
+ * euclidean is a distance (smaller is closer).
+ */
+inline bool isSimilarityMetric(DistanceMetric metric) {
+  return metric != DistanceMetric::Euclidean;
+}
+
+/**
+ * The type used to accumulate products of PRECISION_TYPE values. Integer
+ * codes are accumulated exactly in a wide integer so that the compiler can
+ * lower the dot product to integer multiply-add instructions (pmaddwd,
+ * vpdpbusd) instead of converting every element to float.
+ */
+template <typename PRECISION_TYPE> struct DistanceAccumulator {
+  using type = float;
+};
+template <> struct DistanceAccumulator<int_least8_t> {
+  using type = int32_t;
+};
+template <> struct DistanceAccumulator<uint8_t> {
+  using type = int32_t;
+};
+template <> struct DistanceAccumulator<int_least16_t> {
+  using type = int64_t;
+};
+
+/**
+ * The single scan kernel shared by every metric. Euclidean distances are
+ * derived from it via ||q||^2 + ||x||^2 - 2 q.x, so all metrics have the
+ * same inner loop.
+ */
 template <typename PRECISION_TYPE>
-static float norm(const std::vector<PRECISION_TYPE> &vector) {
-  float sum = 0;
-  std::for_each(
-      vector.begin(), vector.end(),
-      [&sum](const PRECISION_TYPE &element) { sum += element * element; });
+static typename DistanceAccumulator<PRECISION_TYPE>::type
+dotProduct(const PRECISION_TYPE *first_vector,
+           const PRECISION_TYPE *second_vector, uint32_t dimension) {
+  using AccumulatorType = typename DistanceAccumulator<PRECISION_TYPE>::type;
+
+  AccumulatorType sum = 0;
+#pragma omp simd reduction(+ : sum)
+  for (uint32_t i = 0; i < dimension; i++) {
+    sum += static_cast<AccumulatorType>(first_vector[i]) *
+           static_cast<AccumulatorType>(second_vector[i]);
+  }
+  return sum;
+}
+
+/**
+ * Asymmetric (ADC) kernel: scores a float query against quantized codes
+ * without quantizing the query. The caller folds the per-dimension scale
+ * into the query beforehand, so this is a plain float-accumulating dot
+ * product over the codes and reads only one byte per int8 dimension.
+ */
+template <typename PRECISION_TYPE>
+static float asymmetricDotProduct(const float *query,
+                                  const PRECISION_TYPE *codes,
+                                  uint32_t dimension) {
+  float sum = 0.f;
+#pragma omp simd reduction(+ : sum)
+  for (uint32_t i = 0; i < dimension; i++) {
+    sum += query[i] * static_cast<float>(codes[i]);
+  }
   return sum;
 }
 
+/**
+ * Number of dimensions accumulated between two threshold checks in the
+ * early-abandon kernel. Checking once per block keeps the inner loop
+ * branch free so that it still vectorizes.
+ */
+constexpr uint32_t EARLY_ABANDON_BLOCK_SIZE = 64;
+
+/**
+ * Squared euclidean distance that gives up as soon as the partial sum
+ * exceeds `threshold`. Since the partial sums only grow, an abandoned
+ * candidate can never be closer than `threshold`. The returned value is
+ * the exact distance if it is at most `threshold`, and some partial sum
+ * larger than `threshold` otherwise.
+ */
+template <typename PRECISION_TYPE>
+static float earlyAbandonEuclideanDistance(const PRECISION_TYPE *first_vector,
+                                           const PRECISION_TYPE *second_vector,
+                                           uint32_t dimension,
+                                           float threshold) {
+  using AccumulatorType = typename DistanceAccumulator<PRECISION_TYPE>::type;
+
+  AccumulatorType distance = 0;
+  for (uint32_t block_start = 0; block_start < dimension;
+       block_start += EARLY_ABANDON_BLOCK_SIZE) {
+    uint32_t block_end =
+        std::min(block_start + EARLY_ABANDON_BLOCK_SIZE, dimension);
+
+    AccumulatorType block_distance = 0;
+#pragma omp simd reduction(+ : block_distance)
+    for (uint32_t i = block_start; i < block_end; i++) {
+      AccumulatorType difference =
+          static_cast<AccumulatorType>(first_vector[i]) -
+          static_cast<AccumulatorType>(second_vector[i]);
+      block_distance += difference * difference;
+    }
+    distance += block_distance;
+
+    if (static_cast<float>(distance) > threshold) {
+      break;
+    }
+  }
+  return static_cast<float>(distance);
+}
+
+/**
+ * Returns the squared L2 norm of the input vector.
+ */
+template <typename PRECISION_TYPE>
+static typename DistanceAccumulator<PRECISION_TYPE>::type
+norm(const std::vector<PRECISION_TYPE> &vector) {
+  return dotProduct(vector.data(), vector.data(), vector.size());
+}
+
+/**
+ * Returns 1 / ||x|| given the squared norm of x. The zero vector maps to 0
+ * so that its cosine similarity with anything is 0 instead of NaN.
+ */
+template <typename ACCUMULATOR_TYPE>
+static float inverseNorm(ACCUMULATOR_TYPE squared_norm) {
+  if (squared_norm <= 0) {
+    return 0.f;
+  }
+  return 1.f / std::sqrt(static_cast<float>(squared_norm));
+}
+
+/**
+ * Recovers the squared euclidean distance from the precomputed squared
+ * norms and the inner product of the two vectors. Floating point
+ * cancellation can push the result slightly below zero for near-duplicate
+ * vectors, so we clamp it.
+ */
+template <typename ACCUMULATOR_TYPE>
+static float euclideanDistanceFromNorms(ACCUMULATOR_TYPE first_norm,
+                                        ACCUMULATOR_TYPE second_norm,
+                                        ACCUMULATOR_TYPE inner_product) {
+  auto distance = first_norm + second_norm - 2 * inner_product;
+  return std::max(static_cast<float>(distance), 0.f);
+}
+
 template <typename PRECISION_TYPE>
 static float
 euclideanDistance(const std::vector<PRECISION_TYPE> &first_vector,
@@ -43,6 +209,14 @@ innerProductDistance(const std::vector<PRECISION_TYPE> &first_vector,
   return distance;
 }
 
+template <typename PRECISION_TYPE>
+static float
+cosineSimilarity(const std::vector<PRECISION_TYPE> &first_vector,
+                 const std::vector<PRECISION_TYPE> &second_vector) {
+  return innerProductDistance(first_vector, second_vector) *
+         inverseNorm(norm(first_vector)) * inverseNorm(norm(second_vector));
+}
+
 template <typename PRECISION_TYPE>
 static float computeDistance(const std::vector<PRECISION_TYPE> &first_vector,
                              const std::vector<PRECISION_TYPE> &second_vector,
@@ -51,18 +225,92 @@ static float computeDistance(const std::vector<PRECISION_TYPE> &first_vector,
     throw std::invalid_argument("Input vectors must be of the same size in "
                                 "order to compute the euclidean distance.");
   }
-  std::string metric_to_lower = metric;
-  std::for_each(metric.begin(), metric.end(),
-                [&](char c) { c = std::tolower(c); });
-
-  if (metric_to_lower == "euclidean") {
+  switch (parseDistanceMetric(metric)) {
+  case DistanceMetric::Euclidean:
     return euclideanDistance(first_vector, second_vector);
-  }
-  if (metric_to_lower == "angular" || metric_to_lower == "dot") {
+  case DistanceMetric::Cosine:
+    return cosineSimilarity(first_vector, second_vector);
+  default:
     return innerProductDistance(first_vector, second_vector);
   }
+}
+
+/**
+ * Returns a copy of `vectors` scaled to unit norm, so that the cosine
+ * similarity of two normalized vectors is their inner product. The zero
+ * vector stays zero.
+ */
+std::vector<std::vector<float>>
+normalizeVectors(const std::vector<std::vector<float>> &vectors);
+
+/**
+ * A float query prepared for `asymmetricDotProduct` against codes of an
+ * affine quantization grid, see `prepareAsymmetricQuery`.
+ */
+struct AsymmetricQuery {
+  AlignedVector<float> transformed_query;
+  float zero_point_offset;
+  // The squared norm of the float query itself.
+  float squared_norm;
+};
+
+/**
+ * A code c dequantizes to s * (c - z) per dimension, so
+ *      q . x = sum_j (q_j * s_j) * c_j - sum_j (q_j * s_j) * z_j.
+ * We fold the scales into a transformed query, padded with zeros to
+ * `stride` values, and precompute the zero point term. Scoring a code is
+ * then asymmetricDotProduct(transformed_query, code, stride) minus
+ * zero_point_offset. Position j of a code holds the original dimension
+ * dimension_order[j], or dimension j if no order is given.
+ */
+template <typename PRECISION_TYPE>
+AsymmetricQuery prepareAsymmetricQuery(
+    const std::vector<std::tuple<float, PRECISION_TYPE>>
+        &quantization_parameters,
+    const float *vector, uint32_t stride,
+    const std::vector<uint32_t> &dimension_order = {}) {
+  AsymmetricQuery query;
+  query.transformed_query.assign(stride, 0.f);
+  query.zero_point_offset = 0.f;
+  query.squared_norm = 0.f;
+  for (uint32_t dim_index = 0; dim_index < quantization_parameters.size();
+       dim_index++) {
+    const uint32_t original_dim_index =
+        dimension_order.empty() ? dim_index : dimension_order[dim_index];
+    auto [scale, zero_point] = quantization_parameters[original_dim_index];
+    const float value = vector[original_dim_index];
+
+    query.transformed_query[dim_index] = value * scale;
+    query.zero_point_offset +=
+        query.transformed_query[dim_index] * static_cast<float>(zero_point);
+    query.squared_norm += value * value;
+  }
+  return query;
+}
 
-  throw std::invalid_argument("Invalid metric distance. Supported metric "
-                              "include 'euclidean' and 'angular' and 'dot'");
+/**
+ * Returns the squared norm of the float vector that `code` dequantizes
+ * to, with the dimensions of the code ordered as in
+ * `prepareAsymmetricQuery`.
+ */
+template <typename PRECISION_TYPE>
+float dequantizedSquaredNorm(
+    const std::vector<std::tuple<float, PRECISION_TYPE>>
+        &quantization_parameters,
+    const PRECISION_TYPE *code,
+    const std::vector<uint32_t> &dimension_order = {}) {
+  float squared_norm = 0.f;
+  for (uint32_t dim_index = 0; dim_index < quantization_parameters.size();
+       dim_index++) {
+    auto [scale, zero_point] =
+        quantization_parameters[dimension_order.empty()
+                                    ? dim_index
+                                    : dimension_order[dim_index]];
+    const float value = scale * (static_cast<float>(code[dim_index]) -
+                                 static_cast<float>(zero_point));
+    squared_norm += value * value;
+  }
+  return squared_norm;
 }
+
 } // namespace lpq::index
\ No newline at end of file
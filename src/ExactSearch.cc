@@ -1,125 +1,2198 @@
-
-#include <cassert>
+#include <algorithm>
 #include <cstdint>
-#include <iostream>
-#include <queue>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
 #include <src/DistanceMetrics.h>
 #include <src/ExactSearch.h>
+#include <src/IndexFile.h>
+#include <src/ThreadPool.h>
+#include <string>
 #include <tuple>
+#include <unordered_set>
 #include <utility>
 
 namespace lpq::index {
 
+namespace {
+
+/**
+ * Returns the selector of the calling thread, emptied and set to k. Every
+ * pool worker keeps one selector of each type for all the searches it
+ * runs, so its storage is only allocated when k grows.
+ */
+template <typename SELECTOR> SELECTOR &getThreadSelector(uint32_t top_k) {
+  static thread_local SELECTOR selector;
+  selector.reset(top_k);
+  return selector;
+}
+
+} // namespace
+
+template <typename PRECISION_TYPE>
+ExactSearchIndex<PRECISION_TYPE>::ExactSearchIndex(
+    const std::string &distance_metric)
+    : ExactSearchIndex(parseDistanceMetric(distance_metric)) {}
+
+template <typename PRECISION_TYPE>
+ExactSearchIndex<PRECISION_TYPE>::ExactSearchIndex(
+    DistanceMetric distance_metric)
+    : _distance_metric(distance_metric),
+      _parallelism(SearchParallelism::Auto),
+      _scan_chunk_bytes(DEFAULT_SCAN_CHUNK_BYTES),
+      _compaction_threshold(DEFAULT_COMPACTION_THRESHOLD), _dimension(0),
+      _next_ordinal(0), _has_external_ids(false), _id_lookup_enabled(false),
+      _deduplication_enabled(false),
+      _snapshot(std::make_shared<const Snapshot>()),
+      _search_stats_enabled(false) {}
+
+template <typename PRECISION_TYPE>
+std::vector<uint64_t> ExactSearchIndex<PRECISION_TYPE>::add(
+    const std::vector<std::vector<PRECISION_TYPE>> &vectors) {
+  return addVectors(/* vectors = */ vectors, /* ids = */ nullptr);
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint64_t> ExactSearchIndex<PRECISION_TYPE>::add(
+    const std::vector<std::vector<PRECISION_TYPE>> &vectors,
+    const std::vector<uint64_t> &ids) {
+  if (ids.size() != vectors.size()) {
+    throw std::invalid_argument(
+        "The number of ids must match the number of vectors.");
+  }
+  return addVectors(/* vectors = */ vectors, /* ids = */ ids.data());
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint64_t> ExactSearchIndex<PRECISION_TYPE>::addVectors(
+    const std::vector<std::vector<PRECISION_TYPE>> &vectors,
+    const uint64_t *ids) {
+  if (vectors.empty()) {
+    return {};
+  }
+  std::lock_guard<std::mutex> lock(_write_mutex);
+
+  auto snapshot = getSnapshot();
+  const uint32_t dimension =
+      _next_ordinal == 0 ? vectors[0].size() : _dimension;
+  for (const auto &vector : vectors) {
+    if (vector.size() != dimension) {
+      throw std::invalid_argument(
+          "Every vector in the dataset must have the same dimension.");
+    }
+  }
+  if (!_quantization_parameters.empty() &&
+      _quantization_parameters.size() != dimension) {
+    throw std::invalid_argument(
+        "The number of quantization parameters must match the dimension of "
+        "the indexed vectors.");
+  }
+  const uint32_t num_vectors = vectors.size();
+  if (ids && _id_lookup_enabled) {
+    std::unordered_set<uint64_t> batch_ids;
+    for (uint32_t index = 0; index < num_vectors; index++) {
+      if (_id_to_ordinal.count(ids[index]) ||
+          !batch_ids.insert(ids[index]).second) {
+        throw std::invalid_argument("The id " + std::to_string(ids[index]) +
+                                    " is already in the index.");
+      }
+    }
+  }
+  if (ids && snapshot->duplicates) {
+    // Search returns the ID a row was written with for every ID of its
+    // duplicate group, so it cannot be reused while the group lives.
+    const auto &duplicates = *snapshot->duplicates;
+    for (uint32_t index = 0; index < num_vectors; index++) {
+      if (duplicates.groups.count(ids[index]) &&
+          !duplicates.group_keys.count(ids[index])) {
+        throw std::invalid_argument(
+            "The id " + std::to_string(ids[index]) +
+            " still identifies a group of duplicates.");
+      }
+    }
+  }
+
+  if (_next_ordinal == 0) {
+    _dimension = dimension;
+    /**
+     * Euclidean search on high dimensional data uses the early-abandon
+     * kernel, which stops as soon as a candidate provably falls out of the
+     * top k. Storing the dimensions with the largest variance first makes
+     * the partial distance grow as fast as possible. The order is computed
+     * from the first batch and kept for every later one.
+     */
+    if (_distance_metric == DistanceMetric::Euclidean &&
+        dimension > EARLY_ABANDON_BLOCK_SIZE) {
+      computeDimensionOrder(vectors);
+    }
+  }
+
+  const uint32_t first_ordinal = _next_ordinal;
+  std::vector<uint64_t> assigned_ids(num_vectors);
+  if (ids) {
+    std::copy(ids, ids + num_vectors, assigned_ids.begin());
+  } else {
+    std::iota(assigned_ids.begin(), assigned_ids.end(), first_ordinal);
+  }
+
+  // Every vector gets an ordinal, but only vectors with new codes get a
+  // row, see `setDeduplication`.
+  std::vector<uint32_t> row_ordinals(num_vectors);
+  if (_deduplication_enabled) {
+    row_ordinals = findDuplicateRows(/* snapshot = */ *snapshot,
+                                     /* vectors = */ vectors,
+                                     /* first_ordinal = */ first_ordinal);
+  } else {
+    std::iota(row_ordinals.begin(), row_ordinals.end(), first_ordinal);
+  }
+  std::vector<std::vector<PRECISION_TYPE>> unique_vectors;
+  std::vector<uint32_t> unique_ordinals;
+  std::vector<uint64_t> unique_ids;
+  for (uint32_t index = 0; index < num_vectors; index++) {
+    if (row_ordinals[index] == first_ordinal + index) {
+      unique_ordinals.push_back(first_ordinal + index);
+      unique_ids.push_back(assigned_ids[index]);
+    }
+  }
+  const uint32_t num_rows = unique_ordinals.size();
+  if (num_rows < num_vectors) {
+    for (auto ordinal : unique_ordinals) {
+      unique_vectors.push_back(vectors[ordinal - first_ordinal]);
+    }
+  }
+  const auto &row_vectors = num_rows < num_vectors ? unique_vectors : vectors;
+
+  /**
+   * Fill the free capacity of the last segment first. Whatever does not
+   * fit goes into a new segment that is at least as large as the whole
+   * index so far, so that capacities grow geometrically and existing rows
+   * are never copied.
+   */
+  auto new_snapshot = std::make_shared<Snapshot>(*snapshot);
+  uint32_t rows_written = 0;
+
+  if (!new_snapshot->segments.empty()) {
+    auto &segment = *new_snapshot->segments.back();
+    uint32_t segment_size = new_snapshot->segment_sizes.back();
+    uint32_t free_rows = segment.codes.capacity() - segment_size;
+    uint32_t count = std::min(free_rows, num_rows);
+
+    if (count > 0) {
+      writeRows(/* segment = */ segment, /* first_row = */ segment_size,
+                /* vectors = */ row_vectors, /* first_vector = */ 0,
+                /* count = */ count,
+                /* ordinals = */ unique_ordinals.data(),
+                /* ids = */ unique_ids.data());
+      new_snapshot->segment_sizes.back() += count;
+      rows_written = count;
+    }
+  }
+
+  if (rows_written < num_rows) {
+    uint32_t count = num_rows - rows_written;
+    uint32_t capacity = std::max(
+        {count, snapshot->num_vectors, uint32_t(MIN_SEGMENT_CAPACITY)});
+    auto segment = std::make_shared<Segment>(/* dimension = */ dimension,
+                                             /* capacity = */ capacity);
+    writeRows(/* segment = */ *segment, /* first_row = */ 0,
+              /* vectors = */ row_vectors, /* first_vector = */ rows_written,
+              /* count = */ count,
+              /* ordinals = */ unique_ordinals.data() + rows_written,
+              /* ids = */ unique_ids.data() + rows_written);
+
+    new_snapshot->segment_offsets.push_back(snapshot->num_vectors +
+                                            rows_written);
+    new_snapshot->segments.push_back(std::move(segment));
+    new_snapshot->segment_sizes.push_back(count);
+    new_snapshot->segment_deleted.push_back(0);
+  }
+  new_snapshot->num_vectors += num_rows;
+  new_snapshot->version++;
+  _next_ordinal += num_vectors;
+
+  if (num_rows < num_vectors) {
+    auto duplicates =
+        snapshot->duplicates
+            ? std::make_shared<DuplicateGroups>(*snapshot->duplicates)
+            : std::make_shared<DuplicateGroups>();
+    for (uint32_t index = 0; index < num_vectors; index++) {
+      const uint32_t row_ordinal = row_ordinals[index];
+      if (row_ordinal == first_ordinal + index) {
+        continue;
+      }
+      uint64_t row_id;
+      if (row_ordinal >= first_ordinal) {
+        row_id = assigned_ids[row_ordinal - first_ordinal];
+      } else {
+        uint32_t segment_index, row_index;
+        findRow(/* snapshot = */ *snapshot, /* ordinal = */ row_ordinal,
+                /* segment_index = */ segment_index,
+                /* row_index = */ row_index);
+        const Segment &segment = *snapshot->segments[segment_index];
+        row_id = segment.ids[row_index];
+      }
+      auto [group, is_new_group] = duplicates->groups.try_emplace(row_id);
+      if (is_new_group) {
+        group->second.row_ordinal = row_ordinal;
+        group->second.ids.push_back(row_id);
+        duplicates->group_keys[row_id] = row_id;
+      }
+      group->second.ids.push_back(assigned_ids[index]);
+      duplicates->group_keys[assigned_ids[index]] = row_id;
+    }
+    new_snapshot->duplicates = std::move(duplicates);
+    new_snapshot->num_duplicates += num_vectors - num_rows;
+  }
+
+  // Publishing the new snapshot makes the whole batch visible at once.
+  std::atomic_store(&_snapshot,
+                    std::shared_ptr<const Snapshot>(std::move(new_snapshot)));
+
+  if (ids) {
+    _has_external_ids = true;
+  }
+  if (_id_lookup_enabled) {
+    for (uint32_t index = 0; index < num_vectors; index++) {
+      _id_to_ordinal[assigned_ids[index]] = row_ordinals[index];
+    }
+  }
+  return assigned_ids;
+}
+
+template <typename PRECISION_TYPE>
+uint64_t
+ExactSearchIndex<PRECISION_TYPE>::hashCodes(const PRECISION_TYPE *codes) const {
+  constexpr uint64_t MULTIPLIER = 0x9e3779b97f4a7c15ull;
+  constexpr uint32_t NUM_LANES = 4;
+  const auto *bytes = reinterpret_cast<const char *>(codes);
+  const size_t num_bytes = _dimension * sizeof(PRECISION_TYPE);
+
+  // The lanes do not depend on each other, so their multiplications
+  // overlap (or are vectorized) instead of forming one long chain.
+  uint64_t lanes[NUM_LANES] = {1, 2, 3, 4};
+  auto mixBlock = [&lanes](const char *block) {
+    for (uint32_t lane = 0; lane < NUM_LANES; lane++) {
+      uint64_t word;
+      std::memcpy(&word, block + lane * sizeof(word), sizeof(word));
+      lanes[lane] = (lanes[lane] ^ word) * MULTIPLIER;
+      lanes[lane] ^= lanes[lane] >> 29;
+    }
+  };
+  constexpr size_t BLOCK_BYTES = NUM_LANES * sizeof(uint64_t);
+  size_t offset = 0;
+  for (; offset + BLOCK_BYTES <= num_bytes; offset += BLOCK_BYTES) {
+    mixBlock(bytes + offset);
+  }
+  if (offset < num_bytes) {
+    char last_block[BLOCK_BYTES] = {};
+    std::memcpy(last_block, bytes + offset, num_bytes - offset);
+    mixBlock(last_block);
+  }
+
+  uint64_t hash = num_bytes;
+  for (uint64_t lane : lanes) {
+    hash = (hash ^ lane) * MULTIPLIER;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint32_t> ExactSearchIndex<PRECISION_TYPE>::findDuplicateRows(
+    const Snapshot &snapshot,
+    const std::vector<std::vector<PRECISION_TYPE>> &vectors,
+    uint32_t first_ordinal) {
+  const uint32_t num_vectors = vectors.size();
+  std::vector<uint64_t> hashes(num_vectors);
+  ThreadPool::global().parallelFor(
+      /* begin = */ 0, /* end = */ num_vectors,
+      /* function = */ [this, &vectors, &hashes](uint64_t index) {
+        hashes[index] = hashCodes(vectors[index].data());
+      });
+
+  // Stored rows have their dimensions permuted.
+  auto matchesRow = [this](const PRECISION_TYPE *row,
+                           const std::vector<PRECISION_TYPE> &vector) {
+    for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+      if (row[dim_index] != vector[getOriginalDimension(dim_index)]) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // Matching is sequential since a vector may duplicate an earlier
+  // vector of the same batch.
+  std::vector<uint32_t> row_ordinals(num_vectors);
+  for (uint32_t index = 0; index < num_vectors; index++) {
+    const auto &vector = vectors[index];
+    row_ordinals[index] = first_ordinal + index;
+    auto [begin, end] = _row_hashes.equal_range(hashes[index]);
+    for (auto candidate = begin; candidate != end; candidate++) {
+      const uint32_t ordinal = candidate->second;
+      bool is_duplicate;
+      if (ordinal >= first_ordinal) {
+        is_duplicate = vectors[ordinal - first_ordinal] == vector;
+      } else {
+        uint32_t segment_index, row_index;
+        is_duplicate =
+            findRow(/* snapshot = */ snapshot, /* ordinal = */ ordinal,
+                    /* segment_index = */ segment_index,
+                    /* row_index = */ row_index) &&
+            matchesRow(
+                snapshot.segments[segment_index]->codes.getRow(row_index),
+                vector);
+      }
+      if (is_duplicate) {
+        row_ordinals[index] = ordinal;
+        break;
+      }
+    }
+    if (row_ordinals[index] == first_ordinal + index) {
+      _row_hashes.emplace(hashes[index], first_ordinal + index);
+    }
+  }
+  return row_ordinals;
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::forgetRowHash(const Segment &segment,
+                                                     uint32_t row_index) {
+  // The hash is of the codes in their original dimension order.
+  const auto *row = segment.codes.getRow(row_index);
+  std::vector<PRECISION_TYPE> codes(_dimension);
+  for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+    codes[getOriginalDimension(dim_index)] = row[dim_index];
+  }
+  auto [begin, end] = _row_hashes.equal_range(hashCodes(codes.data()));
+  for (auto entry = begin; entry != end; entry++) {
+    if (entry->second == segment.ordinals[row_index]) {
+      _row_hashes.erase(entry);
+      return;
+    }
+  }
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::writeRows(
+    Segment &segment, uint32_t first_row,
+    const std::vector<std::vector<PRECISION_TYPE>> &vectors,
+    uint32_t first_vector, uint32_t count, const uint32_t *ordinals,
+    const uint64_t *ids) {
+  const uint32_t capacity = segment.codes.capacity();
+  const uint32_t stride = segment.codes.getStride();
+
+  /**
+   * Euclidean search needs the squared norms and cosine search needs the
+   * inverse norms. We only cache the one the metric uses. The arrays are
+   * allocated for the full capacity so that they never move either.
+   */
+  segment.codes.resize(first_row + count);
+  segment.ordinals.resize(capacity);
+  segment.ids.resize(capacity);
+  if (_distance_metric == DistanceMetric::Euclidean) {
+    segment.squared_norms.resize(capacity);
+  } else if (_distance_metric == DistanceMetric::Cosine) {
+    segment.inverse_norms.resize(capacity);
+  }
+  const bool cache_dequantized_norms =
+      !_quantization_parameters.empty() &&
+      _distance_metric != DistanceMetric::InnerProduct;
+  if (cache_dequantized_norms) {
+    segment.dequantized_norms.resize(capacity);
+  }
+
+  ThreadPool::global().parallelFor(0, count, [&](uint64_t index) {
+    const auto &vector = vectors[first_vector + index];
+    const uint32_t row_index = first_row + index;
+    segment.ordinals[row_index] = ordinals[index];
+    segment.ids[row_index] = ids[index];
+    auto *row = segment.codes.getMutableRow(row_index);
+    for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+      row[dim_index] = vector[getOriginalDimension(dim_index)];
+    }
+
+    if (_distance_metric == DistanceMetric::Euclidean) {
+      segment.squared_norms[row_index] =
+          lpq::index::dotProduct(row, row, stride);
+    } else if (_distance_metric == DistanceMetric::Cosine) {
+      segment.inverse_norms[row_index] =
+          lpq::index::inverseNorm(lpq::index::dotProduct(row, row, stride));
+    }
+    if (cache_dequantized_norms) {
+      segment.dequantized_norms[row_index] = computeDequantizedNorm(row);
+    }
+  });
+}
+
+template <typename PRECISION_TYPE>
+uint32_t
+ExactSearchIndex<PRECISION_TYPE>::remove(const std::vector<uint64_t> &ids) {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+
+  auto snapshot = getSnapshot();
+  auto new_snapshot = std::make_shared<Snapshot>(*snapshot);
+  uint32_t num_removed = 0;
+
+  std::vector<uint32_t> ordinals;
+  if (snapshot->duplicates) {
+    auto duplicates = std::make_shared<DuplicateGroups>(*snapshot->duplicates);
+    std::vector<uint64_t> row_ids;
+    std::unordered_set<uint32_t> group_rows;
+    for (auto id : ids) {
+      auto group_key = duplicates->group_keys.find(id);
+      if (group_key == duplicates->group_keys.end()) {
+        // The row of a group is not removed by its key once the key
+        // itself was removed.
+        auto group = duplicates->groups.find(id);
+        if (group != duplicates->groups.end()) {
+          group_rows.insert(group->second.row_ordinal);
+        }
+        row_ids.push_back(id);
+        continue;
+      }
+      auto group = duplicates->groups.find(group_key->second);
+      auto &group_ids = group->second.ids;
+      group_ids.erase(std::find(group_ids.begin(), group_ids.end(), id));
+      duplicates->group_keys.erase(group_key);
+      if (_id_lookup_enabled) {
+        _id_to_ordinal.erase(id);
+      }
+      if (group_ids.empty()) {
+        // Removing the last ID removes the row, which is counted below.
+        ordinals.push_back(group->second.row_ordinal);
+        duplicates->groups.erase(group);
+      } else {
+        new_snapshot->num_duplicates--;
+        num_removed++;
+      }
+    }
+    for (auto ordinal : findOrdinals(*snapshot, row_ids)) {
+      if (!group_rows.count(ordinal)) {
+        ordinals.push_back(ordinal);
+      }
+    }
+    new_snapshot->duplicates = std::move(duplicates);
+  } else {
+    ordinals = findOrdinals(*snapshot, ids);
+  }
+
+  for (auto ordinal : ordinals) {
+    uint32_t segment_index, row_index;
+    if (!findRow(/* snapshot = */ *snapshot, /* ordinal = */ ordinal,
+                 /* segment_index = */ segment_index,
+                 /* row_index = */ row_index)) {
+      continue;
+    }
+
+    auto &segment = *snapshot->segments[segment_index];
+    uint64_t mask = uint64_t(1) << (row_index % ROWS_PER_BITMAP_WORD);
+    uint64_t previous = segment.deleted[row_index / ROWS_PER_BITMAP_WORD]
+                            .fetch_or(mask, std::memory_order_relaxed);
+    if (!(previous & mask)) {
+      new_snapshot->segment_deleted[segment_index]++;
+      new_snapshot->num_deleted++;
+      num_removed++;
+      if (_id_lookup_enabled) {
+        _id_to_ordinal.erase(std::as_const(segment.ids)[row_index]);
+      }
+      if (!_row_hashes.empty()) {
+        forgetRowHash(/* segment = */ segment, /* row_index = */ row_index);
+      }
+    }
+  }
+  if (num_removed > 0) {
+    new_snapshot->version++;
+  }
+
+  bool needs_compaction =
+      new_snapshot->num_deleted >
+      _compaction_threshold * new_snapshot->num_vectors;
+  std::atomic_store(&_snapshot,
+                    std::shared_ptr<const Snapshot>(std::move(new_snapshot)));
+  if (needs_compaction) {
+    compactSegments();
+  }
+  return num_removed;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint32_t> ExactSearchIndex<PRECISION_TYPE>::findOrdinals(
+    const Snapshot &snapshot, const std::vector<uint64_t> &ids) const {
+  std::vector<uint32_t> ordinals;
+  if (_id_lookup_enabled) {
+    for (auto id : ids) {
+      auto iterator = _id_to_ordinal.find(id);
+      if (iterator != _id_to_ordinal.end()) {
+        ordinals.push_back(iterator->second);
+      }
+    }
+    return ordinals;
+  }
+
+  if (!_has_external_ids) {
+    // Every ID is the ordinal of its vector.
+    for (auto id : ids) {
+      if (id < _next_ordinal) {
+        ordinals.push_back(id);
+      }
+    }
+    return ordinals;
+  }
+
+  /**
+   * Without the lookup there is no way around comparing against the ID of
+   * every row. Removed rows are matched too, which is harmless since
+   * `remove` only counts rows whose bit it actually sets.
+   */
+  std::unordered_set<uint64_t> requested_ids(ids.begin(), ids.end());
+  for (uint32_t segment_index = 0; segment_index < snapshot.segments.size();
+       segment_index++) {
+    const auto &segment = *snapshot.segments[segment_index];
+    for (uint32_t row_index = 0;
+         row_index < snapshot.segment_sizes[segment_index]; row_index++) {
+      if (requested_ids.count(segment.ids[row_index])) {
+        ordinals.push_back(segment.ordinals[row_index]);
+      }
+    }
+  }
+  return ordinals;
+}
+
+template <typename PRECISION_TYPE>
+bool ExactSearchIndex<PRECISION_TYPE>::findRow(const Snapshot &snapshot,
+                                               uint32_t ordinal,
+                                               uint32_t &segment_index,
+                                               uint32_t &row_index) const {
+  /**
+   * The segment holding `ordinal` is the last one whose first ordinal is
+   * not larger, and the row is found with a binary search inside that
+   * segment.
+   */
+  const auto &segments = snapshot.segments;
+  auto segment_iterator = std::upper_bound(
+      segments.begin(), segments.end(), ordinal,
+      [](uint32_t ordinal, const std::shared_ptr<Segment> &segment) {
+        const auto &ordinals = segment->ordinals;
+        return ordinal < ordinals[0];
+      });
+  if (segment_iterator == segments.begin()) {
+    return false;
+  }
+  segment_index = segment_iterator - segments.begin() - 1;
+
+  const auto &segment_ordinals = segments[segment_index]->ordinals;
+  auto segment_end =
+      segment_ordinals.begin() + snapshot.segment_sizes[segment_index];
+  auto row_iterator =
+      std::lower_bound(segment_ordinals.begin(), segment_end, ordinal);
+  if (row_iterator == segment_end || *row_iterator != ordinal) {
+    return false;
+  }
+  row_index = row_iterator - segment_ordinals.begin();
+  return true;
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::setIdLookup(bool enabled) {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  _id_to_ordinal.clear();
+  _id_lookup_enabled = false;
+  if (!enabled) {
+    return;
+  }
+
+  auto insertId = [this](uint64_t id, uint32_t ordinal) {
+    if (!_id_to_ordinal.emplace(id, ordinal).second) {
+      _id_to_ordinal.clear();
+      throw std::invalid_argument(
+          "The id lookup requires unique ids, but the id " +
+          std::to_string(id) + " is used twice.");
+    }
+  };
+
+  auto snapshot = getSnapshot();
+  const auto *duplicates = snapshot->duplicates.get();
+  for (uint32_t segment_index = 0; segment_index < snapshot->segments.size();
+       segment_index++) {
+    const auto &segment = *snapshot->segments[segment_index];
+    for (uint32_t row_index = 0;
+         row_index < snapshot->segment_sizes[segment_index]; row_index++) {
+      uint64_t deleted = segment.deleted[row_index / ROWS_PER_BITMAP_WORD].load(
+          std::memory_order_relaxed);
+      if (deleted >> (row_index % ROWS_PER_BITMAP_WORD) & 1) {
+        continue;
+      }
+      // The IDs of rows with duplicates are added from their groups.
+      if (duplicates && duplicates->groups.count(segment.ids[row_index])) {
+        continue;
+      }
+      insertId(segment.ids[row_index], segment.ordinals[row_index]);
+    }
+  }
+  if (duplicates) {
+    for (const auto &[group_key, group] : duplicates->groups) {
+      for (auto id : group.ids) {
+        insertId(id, group.row_ordinal);
+      }
+    }
+  }
+  _id_lookup_enabled = true;
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::setDeduplication(bool enabled) {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  _row_hashes.clear();
+  _deduplication_enabled = enabled;
+  if (!enabled) {
+    return;
+  }
+
+  auto snapshot = getSnapshot();
+  for (uint32_t segment_index = 0; segment_index < snapshot->segments.size();
+       segment_index++) {
+    const auto &segment = *snapshot->segments[segment_index];
+    for (uint32_t row_index = 0;
+         row_index < snapshot->segment_sizes[segment_index]; row_index++) {
+      uint64_t deleted = segment.deleted[row_index / ROWS_PER_BITMAP_WORD].load(
+          std::memory_order_relaxed);
+      if (deleted >> (row_index % ROWS_PER_BITMAP_WORD) & 1) {
+        continue;
+      }
+      const auto *row = segment.codes.getRow(row_index);
+      std::vector<PRECISION_TYPE> codes(_dimension);
+      for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+        codes[getOriginalDimension(dim_index)] = row[dim_index];
+      }
+      _row_hashes.emplace(hashCodes(codes.data()),
+                          segment.ordinals[row_index]);
+    }
+  }
+}
+
+template <typename PRECISION_TYPE>
+AllowList ExactSearchIndex<PRECISION_TYPE>::createAllowList(
+    const std::vector<uint64_t> &ids) const {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  auto snapshot = getSnapshot();
+  if (!snapshot->duplicates) {
+    return AllowList(findOrdinals(/* snapshot = */ *snapshot, /* ids = */ ids));
+  }
+
+  // The IDs of a duplicate group select the row of the group, see
+  // `remove` for why removed group keys are left out.
+  const auto &duplicates = *snapshot->duplicates;
+  std::vector<uint32_t> ordinals;
+  std::vector<uint64_t> row_ids;
+  std::unordered_set<uint32_t> group_rows;
+  for (auto id : ids) {
+    auto group_key = duplicates.group_keys.find(id);
+    if (group_key != duplicates.group_keys.end()) {
+      ordinals.push_back(
+          duplicates.groups.at(group_key->second).row_ordinal);
+      continue;
+    }
+    auto group = duplicates.groups.find(id);
+    if (group != duplicates.groups.end()) {
+      group_rows.insert(group->second.row_ordinal);
+    }
+    row_ids.push_back(id);
+  }
+  for (auto ordinal : findOrdinals(*snapshot, row_ids)) {
+    if (!group_rows.count(ordinal)) {
+      ordinals.push_back(ordinal);
+    }
+  }
+  return AllowList(ordinals);
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::compact() {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  compactSegments();
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::setCompactionThreshold(
+    float compaction_threshold) {
+  if (compaction_threshold < 0.f || compaction_threshold > 1.f) {
+    throw std::invalid_argument(
+        "The compaction threshold must be a fraction between 0 and 1.");
+  }
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  _compaction_threshold = compaction_threshold;
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::compactSegments() {
+  auto snapshot = getSnapshot();
+  auto new_snapshot = std::make_shared<Snapshot>();
+  const uint32_t num_segments = snapshot->segments.size();
+
+  for (uint32_t segment_index = 0; segment_index < num_segments;
+       segment_index++) {
+    auto segment = snapshot->segments[segment_index];
+    uint32_t segment_size = snapshot->segment_sizes[segment_index];
+    uint32_t segment_deleted = snapshot->segment_deleted[segment_index];
+
+    uint32_t live_rows = segment_size - segment_deleted;
+    if (live_rows == 0) {
+      continue;
+    }
+    if (segment_deleted > _compaction_threshold * segment_size) {
+      bool is_last_segment = segment_index + 1 == num_segments;
+      /**
+       * The last segment keeps its capacity since `add` keeps appending
+       * to it. Any other segment is shrunk to its live rows.
+       */
+      uint32_t capacity =
+          is_last_segment ? segment->codes.capacity() : live_rows;
+      segment = rewriteSegment(/* segment = */ *segment,
+                               /* segment_size = */ segment_size,
+                               /* capacity = */ capacity);
+      segment_size = live_rows;
+      segment_deleted = 0;
+    }
+
+    new_snapshot->segment_offsets.push_back(new_snapshot->num_vectors);
+    new_snapshot->segments.push_back(std::move(segment));
+    new_snapshot->segment_sizes.push_back(segment_size);
+    new_snapshot->segment_deleted.push_back(segment_deleted);
+    new_snapshot->num_vectors += segment_size;
+    new_snapshot->num_deleted += segment_deleted;
+  }
+  // Compaction does not change any search results.
+  new_snapshot->version = snapshot->version;
+  new_snapshot->duplicates = snapshot->duplicates;
+  new_snapshot->num_duplicates = snapshot->num_duplicates;
+
+  // Searches that already hold the old snapshot keep the old segments
+  // alive until they finish.
+  std::atomic_store(&_snapshot,
+                    std::shared_ptr<const Snapshot>(std::move(new_snapshot)));
+}
+
 template <typename PRECISION_TYPE>
-void ExactSearchIndex<PRECISION_TYPE>::addDataset(
-    const std::vector<std::vector<PRECISION_TYPE>> &dataset) {
-  assert(_index.size() == 0);
-  for (uint32_t index = 0; index < dataset.size(); index++) {
-    auto current_item = std::make_pair(std::move(dataset[index]), index);
-    _index.push_back(std::move(current_item));
+std::shared_ptr<typename ExactSearchIndex<PRECISION_TYPE>::Segment>
+ExactSearchIndex<PRECISION_TYPE>::rewriteSegment(const Segment &segment,
+                                                 uint32_t segment_size,
+                                                 uint32_t capacity) const {
+  const uint32_t num_words =
+      (segment_size + ROWS_PER_BITMAP_WORD - 1) / ROWS_PER_BITMAP_WORD;
+
+  /**
+   * The destination of every live row is the number of live rows before
+   * it. We count the live rows of every bitmap word and take the prefix
+   * sum, after which every word can be copied independently.
+   */
+  std::vector<uint32_t> word_offsets(num_words + 1, 0);
+  for (uint32_t word_index = 0; word_index < num_words; word_index++) {
+    uint32_t rows_in_word = std::min<uint32_t>(
+        ROWS_PER_BITMAP_WORD, segment_size - word_index * ROWS_PER_BITMAP_WORD);
+    uint64_t deleted =
+        segment.deleted[word_index].load(std::memory_order_relaxed);
+    word_offsets[word_index + 1] = word_offsets[word_index] + rows_in_word -
+                                   __builtin_popcountll(deleted);
   }
+  const uint32_t live_rows = word_offsets[num_words];
+
+  auto compacted = std::make_shared<Segment>(/* dimension = */ _dimension,
+                                             /* capacity = */ capacity);
+  compacted->codes.resize(live_rows);
+  compacted->ordinals.resize(capacity);
+  compacted->ids.resize(capacity);
+  compacted->squared_norms.resize(
+      segment.squared_norms.empty() ? 0 : capacity);
+  compacted->inverse_norms.resize(
+      segment.inverse_norms.empty() ? 0 : capacity);
+  compacted->dequantized_norms.resize(
+      segment.dequantized_norms.empty() ? 0 : capacity);
+  const uint32_t stride = segment.codes.getStride();
+
+  ThreadPool::global().parallelFor(0, num_words, [&](uint64_t word_index) {
+    uint64_t deleted =
+        segment.deleted[word_index].load(std::memory_order_relaxed);
+    uint32_t destination = word_offsets[word_index];
+    uint32_t word_end = std::min<uint32_t>(
+        segment_size, (word_index + 1) * ROWS_PER_BITMAP_WORD);
+
+    for (uint32_t row_index = word_index * ROWS_PER_BITMAP_WORD;
+         row_index < word_end; row_index++) {
+      if (deleted >> (row_index % ROWS_PER_BITMAP_WORD) & 1) {
+        continue;
+      }
+      const auto *row = segment.codes.getRow(row_index);
+      std::copy(row, row + stride,
+                compacted->codes.getMutableRow(destination));
+      compacted->ordinals[destination] = segment.ordinals[row_index];
+      compacted->ids[destination] = segment.ids[row_index];
+      if (!segment.squared_norms.empty()) {
+        compacted->squared_norms[destination] =
+            segment.squared_norms[row_index];
+      }
+      if (!segment.inverse_norms.empty()) {
+        compacted->inverse_norms[destination] =
+            segment.inverse_norms[row_index];
+      }
+      if (!segment.dequantized_norms.empty()) {
+        compacted->dequantized_norms[destination] =
+            segment.dequantized_norms[row_index];
+      }
+      destination++;
+    }
+  });
+  return compacted;
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::computeDimensionOrder(
+    const std::vector<std::vector<PRECISION_TYPE>> &vectors) {
+  const uint32_t dimension = vectors[0].size();
+  const uint32_t dataset_size = vectors.size();
+  std::vector<float> variances(dimension);
+
+  ThreadPool::global().parallelFor(0, dimension, [&](uint64_t dim_index) {
+    double mean = 0.0;
+    double second_moment = 0.0;
+    for (uint32_t row_index = 0; row_index < dataset_size; row_index++) {
+      double value = vectors[row_index][dim_index];
+      mean += value;
+      second_moment += value * value;
+    }
+    mean /= dataset_size;
+    variances[dim_index] = second_moment / dataset_size - mean * mean;
+  });
+
+  _dimension_order.resize(dimension);
+  std::iota(_dimension_order.begin(), _dimension_order.end(), 0);
+  std::stable_sort(_dimension_order.begin(), _dimension_order.end(),
+                   [&variances](uint32_t first, uint32_t second) {
+                     return variances[first] > variances[second];
+                   });
+}
+
+template <typename PRECISION_TYPE>
+bool ExactSearchIndex<PRECISION_TYPE>::useEarlyAbandon() const {
+  return !_dimension_order.empty();
 }
 
 template <typename PRECISION_TYPE>
-std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint32_t>>>
+void ExactSearchIndex<PRECISION_TYPE>::setQuantizationParameters(
+    const std::vector<std::tuple<float, PRECISION_TYPE>>
+        &quantization_parameters) {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+
+  auto snapshot = getSnapshot();
+  if (_next_ordinal > 0 &&
+      quantization_parameters.size() != _dimension) {
+    throw std::invalid_argument(
+        "The number of quantization parameters must match the dimension of "
+        "the indexed vectors.");
+  }
+  _quantization_parameters = quantization_parameters;
+  if (_distance_metric == DistanceMetric::InnerProduct) {
+    return;
+  }
+
+  for (uint32_t segment_index = 0; segment_index < snapshot->segments.size();
+       segment_index++) {
+    auto &segment = *snapshot->segments[segment_index];
+    const uint32_t segment_size = snapshot->segment_sizes[segment_index];
+    segment.dequantized_norms.resize(segment.codes.capacity());
+
+    ThreadPool::global().parallelFor(0, segment_size, [&](uint64_t row_index) {
+      segment.dequantized_norms[row_index] =
+          computeDequantizedNorm(segment.codes.getRow(row_index));
+    });
+  }
+}
+
+template <typename PRECISION_TYPE>
+float ExactSearchIndex<PRECISION_TYPE>::computeDequantizedNorm(
+    const PRECISION_TYPE *row) const {
+  const float squared_norm = lpq::index::dequantizedSquaredNorm(
+      /* quantization_parameters = */ _quantization_parameters,
+      /* code = */ row, /* dimension_order = */ _dimension_order);
+  return _distance_metric == DistanceMetric::Cosine
+             ? lpq::index::inverseNorm(squared_norm)
+             : squared_norm;
+}
+
+template <typename PRECISION_TYPE>
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+ExactSearchIndex<PRECISION_TYPE>::search(
+    const std::vector<std::vector<PRECISION_TYPE>> &queries,
+    uint32_t top_k) const {
+  return search(/* queries = */ queries, /* top_k = */ top_k,
+                /* allow_lists = */ {});
+}
+
+template <typename PRECISION_TYPE>
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
 ExactSearchIndex<PRECISION_TYPE>::search(
-    const std::vector<std::vector<PRECISION_TYPE>> &queries, uint32_t top_k) {
+    const std::vector<std::vector<PRECISION_TYPE>> &queries, uint32_t top_k,
+    const std::vector<AllowList> &allow_lists) const {
+  auto prepare_function = [this](const std::vector<PRECISION_TYPE> &query) {
+    return prepareQuery(query);
+  };
+  auto snapshot = getSnapshot();
+  auto query_cache = std::atomic_load(&_query_cache);
+  if (!query_cache) {
+    return runSearch(/* snapshot = */ *snapshot, /* queries = */ queries,
+                     /* top_k = */ top_k,
+                     /* prepare_function = */ prepare_function,
+                     /* allow_lists = */ allow_lists);
+  }
+  checkAllowLists(/* allow_lists = */ allow_lists,
+                  /* num_queries = */ queries.size());
 
-  std::vector<std::vector<float>> distances(queries.size());
-  std::vector<std::vector<uint32_t>> ids(queries.size());
+  /**
+   * Hits and misses are both answered from `snapshot`, and the results
+   * of the misses are cached under its version, so that a concurrent add
+   * or remove never mixes into the results of this call.
+   */
+  const uint32_t num_queries = queries.size();
+  std::vector<std::vector<float>> distances(num_queries);
+  std::vector<std::vector<uint64_t>> ids(num_queries);
+  const uint64_t shared_fingerprint =
+      allow_lists.size() == 1 ? allow_lists[0].fingerprint() : 0;
 
-#pragma omp parallel for default(none) shared(distances, ids, queries, top_k)
-  for (uint32_t index = 0; index < queries.size(); index++) {
+  std::vector<QueryCache::Key> missed_keys;
+  std::vector<uint32_t> missed_indices;
+  for (uint32_t query_index = 0; query_index < num_queries; query_index++) {
+    const auto &query = queries[query_index];
+    uint64_t filter_fingerprint =
+        allow_lists.size() > 1 ? allow_lists[query_index].fingerprint()
+                               : shared_fingerprint;
+    auto key = QueryCache::makeKey(
+        /* codes = */ query.data(),
+        /* num_bytes = */ query.size() * sizeof(PRECISION_TYPE),
+        /* top_k = */ top_k, /* filter_fingerprint = */ filter_fingerprint);
+    if (!query_cache->lookup(/* key = */ key,
+                             /* version = */ snapshot->version,
+                             /* distances = */ distances[query_index],
+                             /* ids = */ ids[query_index])) {
+      missed_keys.push_back(std::move(key));
+      missed_indices.push_back(query_index);
+    }
+  }
+  if (missed_indices.empty()) {
+    return {distances, ids};
+  }
 
-    auto [top_k_distances, top_k_ids] = getTopKClosestVectors(
-        /* query_vector=*/queries[index], /* top_k=*/top_k);
+  std::vector<std::vector<float>> missed_distances;
+  std::vector<std::vector<uint64_t>> missed_ids;
+  if (missed_indices.size() == num_queries) {
+    std::tie(missed_distances, missed_ids) = runSearch(
+        /* snapshot = */ *snapshot, /* queries = */ queries,
+        /* top_k = */ top_k, /* prepare_function = */ prepare_function,
+        /* allow_lists = */ allow_lists);
+  } else {
+    std::vector<std::vector<PRECISION_TYPE>> missed_queries;
+    std::vector<AllowList> missed_allow_lists;
+    for (uint32_t query_index : missed_indices) {
+      missed_queries.push_back(queries[query_index]);
+      if (allow_lists.size() > 1) {
+        missed_allow_lists.push_back(allow_lists[query_index]);
+      }
+    }
+    std::tie(missed_distances, missed_ids) = runSearch(
+        /* snapshot = */ *snapshot, /* queries = */ missed_queries,
+        /* top_k = */ top_k, /* prepare_function = */ prepare_function,
+        /* allow_lists = */ allow_lists.size() > 1 ? missed_allow_lists
+                                                   : allow_lists);
+  }
 
-    distances[index] = std::move(top_k_distances);
-    ids[index] = std::move(top_k_ids);
+  for (uint32_t miss = 0; miss < missed_indices.size(); miss++) {
+    const uint32_t query_index = missed_indices[miss];
+    distances[query_index] = std::move(missed_distances[miss]);
+    ids[query_index] = std::move(missed_ids[miss]);
+    query_cache->insert(/* key = */ std::move(missed_keys[miss]),
+                        /* version = */ snapshot->version,
+                        /* distances = */ distances[query_index],
+                        /* ids = */ ids[query_index]);
   }
-  std::cout << "[SEARCH-FINISHED]\n" << std::flush;
   return {distances, ids};
 }
 
 template <typename PRECISION_TYPE>
-std::tuple<std::vector<float>, std::vector<uint32_t>>
-ExactSearchIndex<PRECISION_TYPE>::getTopKClosestVectors(
-    const std::vector<PRECISION_TYPE> &query_vector, uint32_t top_k) {
+SearchFuture ExactSearchIndex<PRECISION_TYPE>::searchAsync(
+    std::vector<std::vector<PRECISION_TYPE>> queries, uint32_t top_k,
+    std::vector<AllowList> allow_lists) const {
+  auto owner = this->weak_from_this().lock();
+  return SearchExecutor::global().submit(
+      [this, owner, queries = std::move(queries), top_k,
+       allow_lists = std::move(allow_lists)]() -> SearchResults {
+        return search(queries, top_k, allow_lists);
+      });
+}
+
+template <typename PRECISION_TYPE>
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+ExactSearchIndex<PRECISION_TYPE>::searchAsymmetric(
+    const std::vector<std::vector<float>> &queries, uint32_t top_k) const {
+  return searchAsymmetric(/* queries = */ queries, /* top_k = */ top_k,
+                          /* allow_lists = */ {});
+}
+
+template <typename PRECISION_TYPE>
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+ExactSearchIndex<PRECISION_TYPE>::searchAsymmetric(
+    const std::vector<std::vector<float>> &queries, uint32_t top_k,
+    const std::vector<AllowList> &allow_lists) const {
+  if (_quantization_parameters.empty()) {
+    throw std::invalid_argument(
+        "Asymmetric search requires the quantization parameters of the "
+        "indexed codes. Call setQuantizationParameters first.");
+  }
+
+  return runSearch(
+      /* snapshot = */ *getSnapshot(), /* queries = */ queries,
+      /* top_k = */ top_k,
+      /* prepare_function = */
+      [this](const std::vector<float> &query_vector) {
+        return prepareAsymmetricQuery(query_vector);
+      },
+      /* allow_lists = */ allow_lists);
+}
+
+template <typename PRECISION_TYPE>
+std::tuple<std::vector<uint64_t>, std::vector<uint64_t>, std::vector<float>>
+ExactSearchIndex<PRECISION_TYPE>::rangeSearch(
+    const std::vector<std::vector<PRECISION_TYPE>> &queries,
+    float radius) const {
+  const uint32_t num_queries = queries.size();
+  std::vector<uint64_t> offsets(num_queries + 1, 0);
+  std::vector<uint64_t> ids;
+  std::vector<float> distances;
+
+  auto snapshot = getSnapshot();
+  if (snapshot->num_vectors == 0) {
+    return {offsets, ids, distances};
+  }
+  for (const auto &query_vector : queries) {
+    if (query_vector.size() != _dimension) {
+      throw std::invalid_argument("Input vectors must be of the same size in "
+                                  "order to compute the distance.");
+    }
+  }
 
   /**
-   * We use a priority queue. Every element in the queue
-   * consists of a pair of the distance and the actual
-   * vector in the index. We use a max heap for the Euclidean distance
-   * metric instead of min heap since the invariant here is that if any
-   * vector is not in the top k closest vectors, it will be removed
-   * from the heap at some point. But this means we have to sort the
-   * resulting output since the top will contain the k^th closest vector.
-   * The final sorting step takes O(klogk). So, the bottleneck is the
-   * pre-processing step which takes O(n logk);
+   * The work is split into (query, partition) items, so that small batches
+   * still use every thread. Every item appends its results to its own
+   * buffers. Once all items are done, the item sizes give every item its
+   * final position, and the buffers are copied there in parallel. No step
+   * needs a lock.
    */
-  std::vector<std::pair<float, uint32_t>> top_k_results;
-  if (_distance_metric == "angular" || _distance_metric == "dot") {
+  auto &thread_pool = ThreadPool::global();
+  const uint32_t num_partitions =
+      useBaseParallelism(num_queries, snapshot->num_vectors)
+          ? thread_pool.numThreads()
+          : 1;
+  const uint64_t num_items = uint64_t(num_queries) * num_partitions;
+  // The selector minimizes keys, so similarities are negated.
+  const float key_radius =
+      isSimilarityMetric(_distance_metric) ? -radius : radius;
 
-    std::priority_queue<std::pair<float, uint32_t>,
-                        std::vector<std::pair<float, uint32_t>>,
-                        std::greater<std::pair<float, uint32_t>>>
-        heap;
-    for (uint32_t vec_index = 0; vec_index < _index.size(); vec_index++) {
-      auto distance = lpq::index::computeDistance(
-          /* first_vector = */ query_vector,
-          /* second_vector = */ _index[vec_index].first,
-          /* metric = */ _distance_metric);
+  std::vector<std::vector<uint64_t>> item_ids(num_items);
+  std::vector<std::vector<float>> item_distances(num_items);
+  thread_pool.parallelFor(
+      0, num_items,
+      [&](uint64_t item) {
+        uint32_t query_index = item / num_partitions;
+        uint32_t partition = item % num_partitions;
+        uint64_t begin =
+            uint64_t(snapshot->num_vectors) * partition / num_partitions;
+        uint64_t end = uint64_t(snapshot->num_vectors) * (partition + 1) /
+                       num_partitions;
 
-      auto current_pair = std::make_pair(distance, _index[vec_index].second);
-      heap.push(current_pair);
+        RangeCollector collector{key_radius, &item_distances[item],
+                                 &item_ids[item]};
+        scanRange(/* query = */ prepareQuery(queries[query_index]),
+                  /* snapshot = */ *snapshot, /* begin = */ begin,
+                  /* end = */ end, /* allow_list = */ nullptr,
+                  /* selector = */ collector);
+      },
+      /* grain_size = */ 1);
+
+  std::vector<uint64_t> item_offsets(num_items + 1, 0);
+  for (uint64_t item = 0; item < num_items; item++) {
+    item_offsets[item + 1] = item_offsets[item] + item_ids[item].size();
+  }
+  ids.resize(item_offsets[num_items]);
+  distances.resize(item_offsets[num_items]);
+  thread_pool.parallelFor(0, num_items, [&](uint64_t item) {
+    std::copy(item_ids[item].begin(), item_ids[item].end(),
+              ids.begin() + item_offsets[item]);
+    std::copy(item_distances[item].begin(), item_distances[item].end(),
+              distances.begin() + item_offsets[item]);
+  });
+
+  for (uint32_t query_index = 0; query_index <= num_queries; query_index++) {
+    offsets[query_index] = item_offsets[uint64_t(query_index) * num_partitions];
+  }
+  convertKeysToScores(distances);
+  if (!snapshot->duplicates) {
+    return {offsets, ids, distances};
+  }
+
+  // Every row of a duplicate group stands for all of its IDs.
+  const auto &groups = snapshot->duplicates->groups;
+  std::vector<uint64_t> expanded_offsets(num_queries + 1, 0);
+  std::vector<uint64_t> expanded_ids;
+  std::vector<float> expanded_distances;
+  for (uint32_t query_index = 0; query_index < num_queries; query_index++) {
+    for (uint64_t position = offsets[query_index];
+         position < offsets[query_index + 1]; position++) {
+      auto group = groups.find(ids[position]);
+      if (group == groups.end()) {
+        expanded_ids.push_back(ids[position]);
+        expanded_distances.push_back(distances[position]);
+        continue;
+      }
+      for (auto id : group->second.ids) {
+        expanded_ids.push_back(id);
+        expanded_distances.push_back(distances[position]);
+      }
+    }
+    expanded_offsets[query_index + 1] = expanded_ids.size();
+  }
+  return {expanded_offsets, expanded_ids, expanded_distances};
+}
 
-      if (heap.size() > top_k) {
-        heap.pop();
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::expandDuplicates(
+    const Snapshot &snapshot, uint32_t top_k,
+    std::vector<std::vector<float>> &distances,
+    std::vector<std::vector<uint64_t>> &ids) const {
+  if (!snapshot.duplicates) {
+    return;
+  }
+  /**
+   * Every row stands for at least one ID, so the first k IDs of the
+   * expanded top k rows are the top k IDs.
+   */
+  const auto &groups = snapshot.duplicates->groups;
+  for (uint32_t query_index = 0; query_index < ids.size(); query_index++) {
+    std::vector<float> expanded_distances;
+    std::vector<uint64_t> expanded_ids;
+    const auto &query_ids = ids[query_index];
+    for (uint32_t position = 0;
+         position < query_ids.size() && expanded_ids.size() < top_k;
+         position++) {
+      auto group = groups.find(query_ids[position]);
+      if (group == groups.end()) {
+        expanded_ids.push_back(query_ids[position]);
+        expanded_distances.push_back(distances[query_index][position]);
+        continue;
       }
-      while (!heap.empty()) {
-        auto pair = heap.top();
-        top_k_results.emplace_back(std::move(pair));
-        heap.pop();
+      for (auto id : group->second.ids) {
+        if (expanded_ids.size() == top_k) {
+          break;
+        }
+        expanded_ids.push_back(id);
+        expanded_distances.push_back(distances[query_index][position]);
       }
     }
-  } else if (_distance_metric == "euclidean") {
-    std::priority_queue<std::pair<float, uint32_t>> heap;
-    for (uint32_t vec_index = 0; vec_index < _index.size(); vec_index++) {
-      auto distance = lpq::index::computeDistance(
-          /* first_vector = */ query_vector,
-          /* second_vector = */ _index[vec_index].first,
-          /* metric = */ _distance_metric);
+    ids[query_index] = std::move(expanded_ids);
+    distances[query_index] = std::move(expanded_distances);
+  }
+}
+
+template <typename PRECISION_TYPE>
+bool ExactSearchIndex<PRECISION_TYPE>::useBaseParallelism(
+    uint32_t num_queries, uint32_t num_vectors) const {
+  switch (_parallelism) {
+  case SearchParallelism::QueryParallel:
+    return false;
+  case SearchParallelism::BaseParallel:
+    return true;
+  default:
+    /**
+     * Parallelizing over queries has no synchronization at all, so we
+     * prefer it whenever the batch can keep every thread busy. Smaller
+     * batches (in particular single online queries) would leave cores
+     * idle, so we split the base set instead, as long as each partition
+     * is big enough to amortize the merge.
+     */
+    uint32_t num_threads = ThreadPool::global().numThreads();
+    return num_queries < num_threads && num_threads > 1 &&
+           num_vectors >= num_threads * MIN_ROWS_PER_PARTITION;
+  }
+}
+
+template <typename PRECISION_TYPE>
+template <typename QUERY_TYPE, typename PREPARE_FUNCTION>
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+ExactSearchIndex<PRECISION_TYPE>::runSearch(
+    const Snapshot &snapshot,
+    const std::vector<std::vector<QUERY_TYPE>> &queries, uint32_t top_k,
+    const PREPARE_FUNCTION &prepare_function,
+    const std::vector<AllowList> &allow_lists) const {
+  checkAllowLists(/* allow_lists = */ allow_lists,
+                  /* num_queries = */ queries.size());
+  auto getAllowList = [&allow_lists](uint32_t query_index) {
+    if (allow_lists.empty()) {
+      return static_cast<const AllowList *>(nullptr);
+    }
+    return &allow_lists[allow_lists.size() == 1 ? 0 : query_index];
+  };
+
+  std::vector<std::vector<float>> distances(queries.size());
+  std::vector<std::vector<uint64_t>> ids(queries.size());
+
+  // The snapshot is a consistent view of the index for the whole batch,
+  // even if vectors are added while we search.
+  if (snapshot.num_vectors == 0) {
+    return {distances, ids};
+  }
+  // The queries are validated before we start scanning, so that a bad
+  // query fails the batch before any work is done.
+  for (const auto &query_vector : queries) {
+    if (query_vector.size() != _dimension) {
+      throw std::invalid_argument("Input vectors must be of the same size in "
+                                  "order to compute the distance.");
+    }
+  }
+
+  /**
+   * The flag is read once per call, and the scan of a search without
+   * stats is compiled without any of the counting.
+   */
+  if (!_search_stats_enabled.load(std::memory_order_relaxed)) {
+    searchBatch<TopKSelector<uint64_t>>(
+        /* queries = */ queries, /* snapshot = */ snapshot,
+        /* top_k = */ top_k, /* prepare_function = */ prepare_function,
+        /* get_allow_list = */ getAllowList, /* stats_collector = */ nullptr,
+        /* distances = */ distances, /* ids = */ ids);
+    expandDuplicates(/* snapshot = */ snapshot, /* top_k = */ top_k,
+                     /* distances = */ distances, /* ids = */ ids);
+    return {distances, ids};
+  }
+
+  SearchStatsCollector stats_collector;
+  searchBatch<CountingTopKSelector>(
+      /* queries = */ queries, /* snapshot = */ snapshot, /* top_k = */ top_k,
+      /* prepare_function = */ prepare_function,
+      /* get_allow_list = */ getAllowList,
+      /* stats_collector = */ &stats_collector, /* distances = */ distances,
+      /* ids = */ ids);
+  expandDuplicates(/* snapshot = */ snapshot, /* top_k = */ top_k,
+                   /* distances = */ distances, /* ids = */ ids);
+  SearchStats stats = stats_collector.finish();
+  std::lock_guard<std::mutex> lock(_search_stats_mutex);
+  _search_stats.merge(stats);
+  return {distances, ids};
+}
+
+template <typename PRECISION_TYPE>
+template <typename SELECTOR, typename QUERY_TYPE, typename PREPARE_FUNCTION,
+          typename ALLOW_LIST_FUNCTION>
+void ExactSearchIndex<PRECISION_TYPE>::searchBatch(
+    const std::vector<std::vector<QUERY_TYPE>> &queries,
+    const Snapshot &snapshot, uint32_t top_k,
+    const PREPARE_FUNCTION &prepare_function,
+    const ALLOW_LIST_FUNCTION &get_allow_list,
+    SearchStatsCollector *stats_collector,
+    std::vector<std::vector<float>> &distances,
+    std::vector<std::vector<uint64_t>> &ids) const {
+  if (useChunkedScan(snapshot)) {
+    using PreparedQueryType = decltype(prepare_function(queries[0]));
+    std::vector<PreparedQueryType> prepared_queries(queries.size());
+    ThreadPool::global().parallelFor(0, queries.size(), [&](uint64_t index) {
+      prepared_queries[index] = prepare_function(queries[index]);
+    });
+    searchChunked<SELECTOR>(
+        /* queries = */ prepared_queries, /* snapshot = */ snapshot,
+        /* top_k = */ top_k, /* get_allow_list = */ get_allow_list,
+        /* stats_collector = */ stats_collector, /* distances = */ distances,
+        /* ids = */ ids);
+  } else if (useBaseParallelism(queries.size(), snapshot.num_vectors)) {
+    for (uint32_t index = 0; index < queries.size(); index++) {
+      std::tie(distances[index], ids[index]) = searchBaseParallel<SELECTOR>(
+          /* query = */ prepare_function(queries[index]),
+          /* snapshot = */ snapshot, /* top_k = */ top_k,
+          /* allow_list = */ get_allow_list(index),
+          /* stats_collector = */ stats_collector);
+    }
+  } else {
+    /**
+     * Every query is its own task, so threads that finish early steal the
+     * remaining queries. Every thread owns one selector for the whole
+     * batch and resets it per query, so the scan itself never allocates.
+     */
+    auto &thread_pool = ThreadPool::global();
+    thread_pool.parallelFor(
+        0, queries.size(),
+        [&](uint64_t index) {
+          auto &selector = getThreadSelector<SELECTOR>(top_k);
+          scanRange(/* query = */ prepare_function(queries[index]),
+                    /* snapshot = */ snapshot, /* begin = */ 0,
+                    /* end = */ snapshot.num_vectors,
+                    /* allow_list = */ get_allow_list(index),
+                    /* selector = */ selector);
+          selector.extractSorted(/* distances = */ distances[index],
+                                 /* ids = */ ids[index]);
+          convertKeysToScores(distances[index]);
+          if constexpr (COUNTS_SCAN<SELECTOR>) {
+            stats_collector->recordQuery(selector.counters);
+          }
+        },
+        /* grain_size = */ 1);
+  }
+}
+
+template <typename PRECISION_TYPE>
+template <typename SELECTOR, typename PREPARED_QUERY>
+std::tuple<std::vector<float>, std::vector<uint64_t>>
+ExactSearchIndex<PRECISION_TYPE>::searchBaseParallel(
+    const PREPARED_QUERY &query, const Snapshot &snapshot, uint32_t top_k,
+    const AllowList *allow_list,
+    SearchStatsCollector *stats_collector) const {
+  auto &thread_pool = ThreadPool::global();
+  const uint32_t num_partitions = thread_pool.numThreads();
+  const uint32_t num_vectors = snapshot.num_vectors;
+
+  std::vector<std::vector<float>> partition_distances(num_partitions);
+  std::vector<std::vector<uint64_t>> partition_ids(num_partitions);
+  std::vector<ScanCounters> partition_counters(
+      COUNTS_SCAN<SELECTOR> ? num_partitions : 0);
+
+  /**
+   * Each thread scans a contiguous slice of the index into its own
+   * selector. The partial results are sorted, so a k-way merge yields the
+   * global top k.
+   */
+  thread_pool.parallelFor(
+      0, num_partitions,
+      [&](uint64_t partition) {
+        uint64_t begin = uint64_t(num_vectors) * partition / num_partitions;
+        uint64_t end =
+            uint64_t(num_vectors) * (partition + 1) / num_partitions;
+
+        auto &selector = getThreadSelector<SELECTOR>(top_k);
+        scanRange(/* query = */ query, /* snapshot = */ snapshot,
+                  /* begin = */ begin, /* end = */ end,
+                  /* allow_list = */ allow_list, /* selector = */ selector);
+        selector.extractSorted(
+            /* distances = */ partition_distances[partition],
+            /* ids = */ partition_ids[partition]);
+        if constexpr (COUNTS_SCAN<SELECTOR>) {
+          partition_counters[partition] = selector.counters;
+        }
+      },
+      /* grain_size = */ 1);
+
+  std::vector<float> distances;
+  std::vector<uint64_t> ids;
+  mergeSortedTopK(/* distances = */ partition_distances,
+                  /* ids = */ partition_ids, /* top_k = */ top_k,
+                  /* merged_distances = */ distances, /* merged_ids = */ ids);
+  convertKeysToScores(distances);
+  if constexpr (COUNTS_SCAN<SELECTOR>) {
+    ScanCounters counters;
+    for (const auto &partition : partition_counters) {
+      counters.add(partition);
+    }
+    stats_collector->recordQuery(counters);
+  }
+  return {std::move(distances), std::move(ids)};
+}
+
+template <typename PRECISION_TYPE>
+bool ExactSearchIndex<PRECISION_TYPE>::useChunkedScan(
+    const Snapshot &snapshot) const {
+  switch (_parallelism) {
+  case SearchParallelism::ChunkedBatch:
+    return true;
+  case SearchParallelism::Auto:
+    /**
+     * Rows of a loaded index may not be in memory, and reading them from
+     * disk dominates the search. We then pay for that read only once per
+     * batch instead of once per query.
+     */
+    return std::any_of(snapshot.segments.begin(), snapshot.segments.end(),
+                       [](const auto &segment) {
+                         return segment->codes.isMapped();
+                       });
+  default:
+    return false;
+  }
+}
+
+template <typename PRECISION_TYPE>
+template <typename SELECTOR, typename PREPARED_QUERY,
+          typename ALLOW_LIST_FUNCTION>
+void ExactSearchIndex<PRECISION_TYPE>::searchChunked(
+    const std::vector<PREPARED_QUERY> &queries, const Snapshot &snapshot,
+    uint32_t top_k, const ALLOW_LIST_FUNCTION &get_allow_list,
+    SearchStatsCollector *stats_collector,
+    std::vector<std::vector<float>> &distances,
+    std::vector<std::vector<uint64_t>> &ids) const {
+  const uint32_t num_queries = queries.size();
+  const uint32_t num_vectors = snapshot.num_vectors;
+  auto &thread_pool = ThreadPool::global();
+  const uint32_t num_threads = thread_pool.numThreads();
+  const size_t row_bytes =
+      CodeArena<PRECISION_TYPE>::computeStride(_dimension) *
+      sizeof(PRECISION_TYPE);
+  const uint32_t chunk_rows = std::clamp<size_t>(
+      _scan_chunk_bytes / row_bytes, 1, std::max(num_vectors, 1u));
+
+  /**
+   * A batch with fewer queries than threads also splits every chunk into
+   * partitions per query, each with its own selector, so that all threads
+   * stay busy. The partial top k lists are merged at the end, like in
+   * searchBaseParallel.
+   */
+  const uint32_t num_partitions =
+      num_queries >= num_threads
+          ? 1
+          : (num_threads + num_queries - 1) / num_queries;
+  const uint32_t num_items = num_queries * num_partitions;
+  std::vector<SELECTOR> selectors(num_items, SELECTOR(top_k));
 
-      auto current_pair = std::make_pair(distance, _index[vec_index].second);
-      heap.push(current_pair);
+  prefetchMappedRows(/* snapshot = */ snapshot, /* begin = */ 0,
+                     /* end = */ chunk_rows);
+  for (uint64_t chunk_begin = 0; chunk_begin < num_vectors;
+       chunk_begin += chunk_rows) {
+    const uint32_t chunk_end =
+        std::min<uint64_t>(num_vectors, chunk_begin + chunk_rows);
+    // The next chunk is read from disk while this one is scanned.
+    prefetchMappedRows(
+        /* snapshot = */ snapshot, /* begin = */ chunk_end,
+        /* end = */ std::min<uint64_t>(num_vectors, chunk_end + chunk_rows));
 
-      if (heap.size() > top_k) {
-        heap.pop();
+    thread_pool.parallelFor(
+        0, num_items,
+        [&](uint64_t item) {
+          const uint32_t query_index = item / num_partitions;
+          const uint32_t partition = item % num_partitions;
+          const uint64_t chunk_size = chunk_end - chunk_begin;
+          scanRange(/* query = */ queries[query_index],
+                    /* snapshot = */ snapshot,
+                    /* begin = */ chunk_begin +
+                        chunk_size * partition / num_partitions,
+                    /* end = */ chunk_begin +
+                        chunk_size * (partition + 1) / num_partitions,
+                    /* allow_list = */ get_allow_list(query_index),
+                    /* selector = */ selectors[item]);
+        },
+        /* grain_size = */ 1);
+  }
+
+  thread_pool.parallelFor(0, num_queries, [&](uint64_t query_index) {
+    std::vector<std::vector<float>> partition_distances(num_partitions);
+    std::vector<std::vector<uint64_t>> partition_ids(num_partitions);
+    [[maybe_unused]] ScanCounters counters;
+    for (uint32_t partition = 0; partition < num_partitions; partition++) {
+      auto &selector = selectors[query_index * num_partitions + partition];
+      selector.extractSorted(/* distances = */ partition_distances[partition],
+                             /* ids = */ partition_ids[partition]);
+      if constexpr (COUNTS_SCAN<SELECTOR>) {
+        counters.add(selector.counters);
       }
+    }
+    mergeSortedTopK(/* distances = */ partition_distances,
+                    /* ids = */ partition_ids, /* top_k = */ top_k,
+                    /* merged_distances = */ distances[query_index],
+                    /* merged_ids = */ ids[query_index]);
+    convertKeysToScores(distances[query_index]);
+    if constexpr (COUNTS_SCAN<SELECTOR>) {
+      stats_collector->recordQuery(counters);
+    }
+  });
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::prefetchMappedRows(
+    const Snapshot &snapshot, uint32_t begin, uint32_t end) const {
+  for (uint32_t segment_index = 0; segment_index < snapshot.segments.size();
+       segment_index++) {
+    const auto &segment = *snapshot.segments[segment_index];
+    uint32_t segment_begin = snapshot.segment_offsets[segment_index];
+    uint32_t segment_end =
+        segment_begin + snapshot.segment_sizes[segment_index];
+    if (!segment.mapped_file || segment_end <= begin ||
+        segment_begin >= end) {
+      continue;
+    }
+    const uint32_t first_row = std::max(begin, segment_begin) - segment_begin;
+    const uint32_t end_row = std::min(end, segment_end) - segment_begin;
 
-      while (!heap.empty()) {
-        auto pair = heap.top();
-        top_k_results.emplace_back(std::move(pair));
-        heap.pop();
+    const MappedFile &mapped_file = *segment.mapped_file;
+    auto prefetch = [&mapped_file](const void *first, const void *last) {
+      const auto *first_byte = static_cast<const char *>(first);
+      mapped_file.prefetch(
+          /* offset = */ first_byte - mapped_file.data(),
+          /* length = */ static_cast<const char *>(last) - first_byte);
+    };
+    auto prefetchArray = [&prefetch, first_row, end_row](const auto &array) {
+      // Arrays that were rewritten since the load are in memory.
+      if (array.isView()) {
+        prefetch(array.data() + first_row, array.data() + end_row);
       }
+    };
+    if (segment.codes.isMapped()) {
+      prefetch(segment.codes.getRow(first_row), segment.codes.getRow(end_row));
     }
+    prefetchArray(segment.squared_norms);
+    prefetchArray(segment.inverse_norms);
+    prefetchArray(segment.dequantized_norms);
   }
+}
 
-  if (_distance_metric == "angular" || _distance_metric == "dot") {
-    std::sort(top_k_results.begin(), top_k_results.end(),
-              std::greater<std::pair<float, uint32_t>>());
-  } else if (_distance_metric == "euclidean") {
-    std::sort(top_k_results.begin(), top_k_results.end());
+template <typename PRECISION_TYPE>
+template <typename PREPARED_QUERY, typename SELECTOR>
+void ExactSearchIndex<PRECISION_TYPE>::scanRange(
+    const PREPARED_QUERY &query, const Snapshot &snapshot, uint32_t begin,
+    uint32_t end, const AllowList *allow_list, SELECTOR &selector) const {
+  for (uint32_t segment_index = 0; segment_index < snapshot.segments.size();
+       segment_index++) {
+    uint32_t segment_begin = snapshot.segment_offsets[segment_index];
+    uint32_t segment_end =
+        segment_begin + snapshot.segment_sizes[segment_index];
+    if (segment_end <= begin || segment_begin >= end) {
+      continue;
+    }
+    scanSegment(
+        /* query = */ query,
+        /* segment = */ *snapshot.segments[segment_index],
+        /* begin = */ std::max(begin, segment_begin) - segment_begin,
+        /* end = */ std::min(end, segment_end) - segment_begin,
+        /* allow_list = */ allow_list, /* selector = */ selector);
   }
-  std::vector<float> distances(top_k);
-  std::vector<uint32_t> ids(top_k);
+}
+
+template <typename PRECISION_TYPE>
+typename ExactSearchIndex<PRECISION_TYPE>::PreparedQuery
+ExactSearchIndex<PRECISION_TYPE>::prepareQuery(
+    const std::vector<PRECISION_TYPE> &query_vector) const {
+  PreparedQuery query;
+  query.norm = lpq::index::norm(query_vector);
+  query.inverse_norm = lpq::index::inverseNorm(query.norm);
 
-  for (uint32_t i = 0; i < top_k; i++) {
-    distances[i] = top_k_results[i].first;
-    ids[i] = top_k_results[i].second;
+  /**
+   * The query is padded to the row stride of the arena so that kernels
+   * run over whole SIMD registers. If the stored dimensions have been
+   * reordered by variance, the query is permuted the same way.
+   */
+  query.padded_query.assign(
+      CodeArena<PRECISION_TYPE>::computeStride(_dimension), PRECISION_TYPE(0));
+  for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+    query.padded_query[dim_index] =
+        query_vector[getOriginalDimension(dim_index)];
   }
+  return query;
+}
 
-  return {std::move(distances), std::move(ids)};
+template <typename PRECISION_TYPE>
+typename ExactSearchIndex<PRECISION_TYPE>::PreparedAsymmetricQuery
+ExactSearchIndex<PRECISION_TYPE>::prepareAsymmetricQuery(
+    const std::vector<float> &query_vector) const {
+  // The stored dimensions may be reordered by variance.
+  auto query = lpq::index::prepareAsymmetricQuery(
+      /* quantization_parameters = */ _quantization_parameters,
+      /* vector = */ query_vector.data(),
+      /* stride = */ CodeArena<PRECISION_TYPE>::computeStride(_dimension),
+      /* dimension_order = */ _dimension_order);
+  const float inverse_norm = lpq::index::inverseNorm(query.squared_norm);
+  return {std::move(query), inverse_norm};
+}
+
+template <typename PRECISION_TYPE>
+template <typename SELECTOR>
+void ExactSearchIndex<PRECISION_TYPE>::scanSegment(
+    const PreparedQuery &query, const Segment &segment, uint32_t begin,
+    uint32_t end, const AllowList *allow_list, SELECTOR &selector) const {
+  const auto &codes = segment.codes;
+  const auto *query_vector = query.padded_query.data();
+
+  if (useEarlyAbandon()) {
+    selectTopK(
+        /* score_function = */
+        [&](uint32_t vec_index, float threshold) {
+          float distance = lpq::index::earlyAbandonEuclideanDistance(
+              /* first_vector = */ query_vector,
+              /* second_vector = */ codes.getRow(vec_index),
+              /* dimension = */ codes.getStride(),
+              /* threshold = */ threshold);
+          if constexpr (COUNTS_SCAN<SELECTOR>) {
+            selector.counters.early_abandoned += distance > threshold;
+          }
+          return distance;
+        },
+        /* segment = */ segment, /* begin = */ begin, /* end = */ end,
+        /* allow_list = */ allow_list, /* selector = */ selector);
+    return;
+  }
+
+  /**
+   * All metrics go through the same dot product kernel; the cached norms
+   * turn the inner product into a euclidean distance or a cosine
+   * similarity.
+   */
+  selectTopK(
+      /* score_function = */
+      [&](uint32_t vec_index, float /* threshold */) {
+        auto inner_product = lpq::index::dotProduct(
+            /* first_vector = */ query_vector,
+            /* second_vector = */ codes.getRow(vec_index),
+            /* dimension = */ codes.getStride());
+
+        if (_distance_metric == DistanceMetric::Euclidean) {
+          return lpq::index::euclideanDistanceFromNorms(
+              /* first_norm = */ query.norm,
+              /* second_norm = */ segment.squared_norms[vec_index],
+              /* inner_product = */ inner_product);
+        }
+        if (_distance_metric == DistanceMetric::Cosine) {
+          return static_cast<float>(inner_product) * query.inverse_norm *
+                 segment.inverse_norms[vec_index];
+        }
+        return static_cast<float>(inner_product);
+      },
+      /* segment = */ segment, /* begin = */ begin, /* end = */ end,
+      /* allow_list = */ allow_list, /* selector = */ selector);
+}
+
+template <typename PRECISION_TYPE>
+template <typename SELECTOR>
+void ExactSearchIndex<PRECISION_TYPE>::scanSegment(
+    const PreparedAsymmetricQuery &query, const Segment &segment,
+    uint32_t begin, uint32_t end, const AllowList *allow_list,
+    SELECTOR &selector) const {
+  const auto &codes = segment.codes;
+
+  selectTopK(
+      /* score_function = */
+      [&](uint32_t vec_index, float /* threshold */) {
+        float inner_product =
+            lpq::index::asymmetricDotProduct(
+                /* query = */ query.transformed_query.data(),
+                /* codes = */ codes.getRow(vec_index),
+                /* dimension = */ codes.getStride()) -
+            query.zero_point_offset;
+
+        if (_distance_metric == DistanceMetric::Euclidean) {
+          return lpq::index::euclideanDistanceFromNorms(
+              /* first_norm = */ query.squared_norm,
+              /* second_norm = */ segment.dequantized_norms[vec_index],
+              /* inner_product = */ inner_product);
+        }
+        if (_distance_metric == DistanceMetric::Cosine) {
+          return inner_product * query.inverse_norm *
+                 segment.dequantized_norms[vec_index];
+        }
+        return inner_product;
+      },
+      /* segment = */ segment, /* begin = */ begin, /* end = */ end,
+      /* allow_list = */ allow_list, /* selector = */ selector);
+}
+
+template <typename PRECISION_TYPE>
+template <typename SCORE_FUNCTION, typename SELECTOR>
+void ExactSearchIndex<PRECISION_TYPE>::selectTopK(
+    const SCORE_FUNCTION &score_function, const Segment &segment,
+    uint32_t begin, uint32_t end, const AllowList *allow_list,
+    SELECTOR &selector) const {
+  /**
+   * The selector keeps the smallest keys, so similarities are negated on
+   * the way in and restored in `convertKeysToScores`. For the euclidean
+   * metric the selector's threshold is the k^th best distance so far,
+   * which the early-abandon kernel uses to stop scoring hopeless
+   * candidates.
+   */
+  const bool is_similarity = isSimilarityMetric(_distance_metric);
+
+  /**
+   * Rows are visited in blocks of 64, one word of the deletion bitmap
+   * each. The rows to score are the set bits of a single word combining
+   * the block bounds, the tombstones and the allow list, so blocks
+   * without any live, allowed row cost a few word operations.
+   */
+  for (uint32_t word_index = begin / ROWS_PER_BITMAP_WORD;
+       word_index * ROWS_PER_BITMAP_WORD < end; word_index++) {
+    const uint32_t first_row = word_index * ROWS_PER_BITMAP_WORD;
+    const uint32_t end_row = std::min(end, first_row + ROWS_PER_BITMAP_WORD);
+
+    uint64_t rows =
+        ~segment.deleted[word_index].load(std::memory_order_relaxed);
+    if (begin > first_row) {
+      rows &= ~uint64_t(0) << (begin - first_row);
+    }
+    if (end_row - first_row < ROWS_PER_BITMAP_WORD) {
+      rows &= (uint64_t(1) << (end_row - first_row)) - 1;
+    }
+    if (rows && allow_list) {
+      uint64_t allowed_rows = getAllowedRows(/* allow_list = */ *allow_list,
+                                             /* segment = */ segment,
+                                             /* first_row = */ first_row,
+                                             /* end_row = */ end_row);
+      if constexpr (COUNTS_SCAN<SELECTOR>) {
+        selector.counters.filtered_out +=
+            __builtin_popcountll(rows & ~allowed_rows);
+      }
+      rows &= allowed_rows;
+    }
+    if constexpr (COUNTS_SCAN<SELECTOR>) {
+      selector.counters.distances_computed += __builtin_popcountll(rows);
+    }
+
+    while (rows) {
+      uint32_t vec_index = first_row + __builtin_ctzll(rows);
+      rows &= rows - 1;
+
+      if (is_similarity) {
+        float score = score_function(
+            /* vec_index = */ vec_index,
+            /* threshold = */ std::numeric_limits<float>::infinity());
+        selector.push(/* distance = */ -score,
+                      /* id = */ segment.ids[vec_index]);
+      } else {
+        float distance =
+            score_function(/* vec_index = */ vec_index,
+                           /* threshold = */ selector.threshold());
+        selector.push(/* distance = */ distance,
+                      /* id = */ segment.ids[vec_index]);
+      }
+    }
+  }
+}
+
+template <typename PRECISION_TYPE>
+uint64_t ExactSearchIndex<PRECISION_TYPE>::getAllowedRows(
+    const AllowList &allow_list, const Segment &segment, uint32_t first_row,
+    uint32_t end_row) const {
+  uint32_t first_ordinal = segment.ordinals[first_row];
+  uint32_t last_ordinal = segment.ordinals[end_row - 1];
+
+  /**
+   * Rows that were appended together hold consecutive ordinals, so their
+   * membership is a (shifted) word of the allow list. Compaction leaves
+   * gaps in the ordinals; those blocks are checked row by row unless the
+   * allow list has nothing in their ordinal range.
+   */
+  if (last_ordinal - first_ordinal == end_row - 1 - first_row) {
+    return allow_list.getBits(first_ordinal);
+  }
+  if (!allow_list.anyInRange(first_ordinal, last_ordinal)) {
+    return 0;
+  }
+  uint64_t rows = 0;
+  for (uint32_t row_index = first_row; row_index < end_row; row_index++) {
+    if (allow_list.contains(segment.ordinals[row_index])) {
+      rows |= uint64_t(1) << (row_index - first_row);
+    }
+  }
+  return rows;
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::convertKeysToScores(
+    std::vector<float> &distances) const {
+  if (isSimilarityMetric(_distance_metric)) {
+    for (auto &distance : distances) {
+      distance = -distance;
+    }
+  }
+}
+
+template <typename PRECISION_TYPE>
+void ExactSearchIndex<PRECISION_TYPE>::save(const std::string &path) const {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  auto snapshot = getSnapshot();
+  const uint64_t num_vectors = snapshot->num_vectors - snapshot->num_deleted;
+  const uint32_t stride = CodeArena<PRECISION_TYPE>::computeStride(_dimension);
+  const bool cache_dequantized_norms =
+      !_quantization_parameters.empty() &&
+      _distance_metric != DistanceMetric::InnerProduct;
+
+  IndexFileHeader header{};
+  std::memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+  header.version = INDEX_FILE_VERSION;
+  header.byte_order_mark = INDEX_FILE_BYTE_ORDER_MARK;
+  header.precision_tag = getPrecisionTag<PRECISION_TYPE>();
+  header.distance_metric = static_cast<uint32_t>(_distance_metric);
+  header.dimension = _dimension;
+  header.stride = stride;
+  header.num_vectors = num_vectors;
+  header.next_ordinal = _next_ordinal;
+  header.has_external_ids = _has_external_ids;
+  header.id_lookup_enabled = _id_lookup_enabled;
+  header.compaction_threshold = _compaction_threshold;
+  header.deduplication_enabled = _deduplication_enabled;
+  if (snapshot->duplicates) {
+    header.num_duplicate_groups = snapshot->duplicates->groups.size();
+    header.num_duplicate_ids = snapshot->duplicates->group_keys.size();
+  }
+
+  uint64_t *section_sizes = header.section_sizes;
+  section_sizes[DimensionOrderSection] =
+      _dimension_order.size() * sizeof(uint32_t);
+  section_sizes[QuantizationScalesSection] =
+      _quantization_parameters.size() * sizeof(float);
+  section_sizes[QuantizationZeroPointsSection] =
+      _quantization_parameters.size() * sizeof(PRECISION_TYPE);
+  section_sizes[CodesSection] = num_vectors * stride * sizeof(PRECISION_TYPE);
+  section_sizes[SquaredNormsSection] =
+      _distance_metric == DistanceMetric::Euclidean
+          ? num_vectors * sizeof(AccumulatorType)
+          : 0;
+  section_sizes[InverseNormsSection] =
+      _distance_metric == DistanceMetric::Cosine ? num_vectors * sizeof(float)
+                                                 : 0;
+  section_sizes[DequantizedNormsSection] =
+      cache_dequantized_norms ? num_vectors * sizeof(float) : 0;
+  section_sizes[OrdinalsSection] = num_vectors * sizeof(uint32_t);
+  section_sizes[IdsSection] = num_vectors * sizeof(uint64_t);
+  section_sizes[DuplicateGroupsSection] =
+      header.num_duplicate_groups * sizeof(IndexFileDuplicateGroup);
+  section_sizes[DuplicateIdsSection] =
+      header.num_duplicate_ids * sizeof(uint64_t);
+
+  auto alignOffset = [](uint64_t offset) {
+    return (offset + INDEX_FILE_ALIGNMENT - 1) / INDEX_FILE_ALIGNMENT *
+           INDEX_FILE_ALIGNMENT;
+  };
+  uint64_t file_size = alignOffset(sizeof(header));
+  for (uint32_t section = 0; section < NUM_INDEX_FILE_SECTIONS; section++) {
+    header.section_offsets[section] = file_size;
+    file_size = alignOffset(file_size + section_sizes[section]);
+  }
+
+  const std::string temporary_path = path + ".tmp";
+  std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    throw std::invalid_argument("Could not open " + temporary_path +
+                                " for writing.");
+  }
+  auto write = [&file](const void *data, size_t size) {
+    file.write(static_cast<const char *>(data), size);
+  };
+  auto startSection = [&file, &header](uint32_t section) {
+    const uint64_t padding =
+        header.section_offsets[section] - static_cast<uint64_t>(file.tellp());
+    const char zeros[INDEX_FILE_ALIGNMENT] = {};
+    file.write(zeros, padding);
+  };
+  // Writes `row_bytes` bytes at `get_row(segment, row_index)` for every
+  // live row, in index order.
+  auto writeLiveRows = [&snapshot, &write](const auto &get_row,
+                                           size_t row_bytes) {
+    for (uint32_t segment_index = 0;
+         segment_index < snapshot->segments.size(); segment_index++) {
+      const auto &segment = *snapshot->segments[segment_index];
+      for (uint32_t row_index = 0;
+           row_index < snapshot->segment_sizes[segment_index]; row_index++) {
+        uint64_t deleted =
+            segment.deleted[row_index / ROWS_PER_BITMAP_WORD].load(
+                std::memory_order_relaxed);
+        if (!(deleted >> (row_index % ROWS_PER_BITMAP_WORD) & 1)) {
+          write(get_row(segment, row_index), row_bytes);
+        }
+      }
+    }
+  };
+
+  write(&header, sizeof(header));
+  startSection(DimensionOrderSection);
+  write(_dimension_order.data(), section_sizes[DimensionOrderSection]);
+  startSection(QuantizationScalesSection);
+  for (const auto &[scale, zero_point] : _quantization_parameters) {
+    write(&scale, sizeof(scale));
+  }
+  startSection(QuantizationZeroPointsSection);
+  for (const auto &[scale, zero_point] : _quantization_parameters) {
+    write(&zero_point, sizeof(zero_point));
+  }
+  // Rows are written with their padding so that a loaded index can scan
+  // them in place.
+  startSection(CodesSection);
+  writeLiveRows(
+      [](const Segment &segment, uint32_t row) {
+        return segment.codes.getRow(row);
+      },
+      stride * sizeof(PRECISION_TYPE));
+  if (section_sizes[SquaredNormsSection]) {
+    startSection(SquaredNormsSection);
+    writeLiveRows(
+        [](const Segment &segment, uint32_t row) {
+          return &segment.squared_norms[row];
+        },
+        sizeof(AccumulatorType));
+  }
+  if (section_sizes[InverseNormsSection]) {
+    startSection(InverseNormsSection);
+    writeLiveRows(
+        [](const Segment &segment, uint32_t row) {
+          return &segment.inverse_norms[row];
+        },
+        sizeof(float));
+  }
+  if (section_sizes[DequantizedNormsSection]) {
+    startSection(DequantizedNormsSection);
+    writeLiveRows(
+        [](const Segment &segment, uint32_t row) {
+          return &segment.dequantized_norms[row];
+        },
+        sizeof(float));
+  }
+  startSection(OrdinalsSection);
+  writeLiveRows(
+      [](const Segment &segment, uint32_t row) {
+        return &segment.ordinals[row];
+      },
+      sizeof(uint32_t));
+  startSection(IdsSection);
+  writeLiveRows(
+      [](const Segment &segment, uint32_t row) { return &segment.ids[row]; },
+      sizeof(uint64_t));
+  if (snapshot->duplicates) {
+    const auto &groups = snapshot->duplicates->groups;
+    startSection(DuplicateGroupsSection);
+    for (const auto &[key, group] : groups) {
+      IndexFileDuplicateGroup record{
+          /* key = */ key, /* row_ordinal = */ group.row_ordinal,
+          /* num_ids = */ static_cast<uint32_t>(group.ids.size())};
+      write(&record, sizeof(record));
+    }
+    startSection(DuplicateIdsSection);
+    for (const auto &[key, group] : groups) {
+      write(group.ids.data(), group.ids.size() * sizeof(uint64_t));
+    }
+  }
+  // Pad the file to its full size so that every section is in bounds.
+  const char zeros[INDEX_FILE_ALIGNMENT] = {};
+  file.write(zeros, file_size - static_cast<uint64_t>(file.tellp()));
+
+  file.close();
+  if (!file) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Could not write " + temporary_path + ".");
+  }
+  commitIndexFile(/* temporary_path = */ temporary_path, /* path = */ path);
+}
+
+template <typename PRECISION_TYPE>
+std::shared_ptr<ExactSearchIndex<PRECISION_TYPE>>
+ExactSearchIndex<PRECISION_TYPE>::load(const std::string &path) {
+  auto mapped_file = std::make_shared<const MappedFile>(path);
+  IndexFileHeader header;
+  if (mapped_file->size() < sizeof(header)) {
+    throw std::invalid_argument(path + " is not an index file.");
+  }
+  std::memcpy(&header, mapped_file->data(), sizeof(header));
+  validateIndexFileHeader<PRECISION_TYPE>(header, mapped_file->size(), path);
+
+  const uint64_t num_vectors = header.num_vectors;
+  const uint32_t dimension = header.dimension;
+  const auto distance_metric =
+      static_cast<DistanceMetric>(header.distance_metric);
+  const uint64_t num_parameters =
+      header.section_sizes[QuantizationScalesSection] / sizeof(float);
+  const bool cache_dequantized_norms =
+      num_parameters > 0 && distance_metric != DistanceMetric::InnerProduct;
+
+  // Every section size follows from the fields above, so that a corrupted
+  // file cannot make the index read past the end of a section.
+  const uint64_t expected_sizes[NUM_INDEX_FILE_SECTIONS] = {
+      header.section_sizes[DimensionOrderSection] ? dimension * sizeof(uint32_t)
+                                                  : 0,
+      num_parameters ? dimension * sizeof(float) : 0,
+      num_parameters ? dimension * sizeof(PRECISION_TYPE) : 0,
+      num_vectors * header.stride * sizeof(PRECISION_TYPE),
+      distance_metric == DistanceMetric::Euclidean
+          ? num_vectors * sizeof(AccumulatorType)
+          : 0,
+      distance_metric == DistanceMetric::Cosine ? num_vectors * sizeof(float)
+                                                : 0,
+      cache_dequantized_norms ? num_vectors * sizeof(float) : 0,
+      num_vectors * sizeof(uint32_t),
+      num_vectors * sizeof(uint64_t),
+      header.num_duplicate_groups * sizeof(IndexFileDuplicateGroup),
+      header.num_duplicate_ids * sizeof(uint64_t)};
+  bool is_valid =
+      header.distance_metric <= static_cast<uint32_t>(DistanceMetric::Cosine) &&
+      header.stride == CodeArena<PRECISION_TYPE>::computeStride(dimension) &&
+      num_vectors <= header.next_ordinal &&
+      std::equal(expected_sizes, expected_sizes + NUM_INDEX_FILE_SECTIONS,
+                 header.section_sizes);
+  if (!is_valid) {
+    throw std::invalid_argument(path + " is truncated or corrupted.");
+  }
+
+  auto getSection = [&mapped_file, &header](uint32_t section) {
+    return mapped_file->data() + header.section_offsets[section];
+  };
+  // Scans read the codes front to back, so the kernel can read ahead
+  // aggressively and drop pages behind the scan under memory pressure.
+  mapped_file->advise(
+      /* offset = */ header.section_offsets[CodesSection],
+      /* length = */ header.section_sizes[CodesSection],
+      /* advice = */ MADV_SEQUENTIAL);
+
+  std::shared_ptr<ExactSearchIndex> index(
+      new ExactSearchIndex(distance_metric));
+  index->_compaction_threshold = header.compaction_threshold;
+  index->_dimension = dimension;
+  index->_next_ordinal = header.next_ordinal;
+  index->_has_external_ids = header.has_external_ids;
+
+  // The per-dimension arrays are small, so they are copied.
+  const auto *dimension_order =
+      reinterpret_cast<const uint32_t *>(getSection(DimensionOrderSection));
+  index->_dimension_order.assign(
+      dimension_order,
+      dimension_order +
+          header.section_sizes[DimensionOrderSection] / sizeof(uint32_t));
+  for (auto dim_index : index->_dimension_order) {
+    if (dim_index >= dimension) {
+      throw std::invalid_argument(path + " is truncated or corrupted.");
+    }
+  }
+  const auto *scales =
+      reinterpret_cast<const float *>(getSection(QuantizationScalesSection));
+  const auto *zero_points = reinterpret_cast<const PRECISION_TYPE *>(
+      getSection(QuantizationZeroPointsSection));
+  for (uint64_t dim_index = 0; dim_index < num_parameters; dim_index++) {
+    index->_quantization_parameters.emplace_back(scales[dim_index],
+                                                 zero_points[dim_index]);
+  }
+
+  if (num_vectors > 0) {
+    auto segment = std::make_shared<Segment>(
+        CodeArena<PRECISION_TYPE>::fromMappedRows(
+            /* rows = */ reinterpret_cast<const PRECISION_TYPE *>(
+                getSection(CodesSection)),
+            /* dimension = */ dimension, /* num_rows = */ num_vectors));
+    if (distance_metric == DistanceMetric::Euclidean) {
+      segment->squared_norms = MappableVector<AccumulatorType>::view(
+          reinterpret_cast<const AccumulatorType *>(
+              getSection(SquaredNormsSection)),
+          num_vectors);
+    } else if (distance_metric == DistanceMetric::Cosine) {
+      segment->inverse_norms = MappableVector<float>::view(
+          reinterpret_cast<const float *>(getSection(InverseNormsSection)),
+          num_vectors);
+    }
+    if (cache_dequantized_norms) {
+      segment->dequantized_norms = MappableVector<float>::view(
+          reinterpret_cast<const float *>(
+              getSection(DequantizedNormsSection)),
+          num_vectors);
+    }
+    segment->ordinals = MappableVector<uint32_t>::view(
+        reinterpret_cast<const uint32_t *>(getSection(OrdinalsSection)),
+        num_vectors);
+    segment->ids = MappableVector<uint64_t>::view(
+        reinterpret_cast<const uint64_t *>(getSection(IdsSection)),
+        num_vectors);
+    segment->mapped_file = mapped_file;
+
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->segments.push_back(std::move(segment));
+    snapshot->segment_sizes.push_back(num_vectors);
+    snapshot->segment_offsets.push_back(0);
+    snapshot->segment_deleted.push_back(0);
+    snapshot->num_vectors = num_vectors;
+    index->_snapshot = std::move(snapshot);
+  }
+
+  if (header.num_duplicate_groups > 0) {
+    // Groups are small compared to the rows, so they are copied.
+    const auto *records = reinterpret_cast<const IndexFileDuplicateGroup *>(
+        getSection(DuplicateGroupsSection));
+    const auto *group_ids =
+        reinterpret_cast<const uint64_t *>(getSection(DuplicateIdsSection));
+    auto duplicates = std::make_shared<DuplicateGroups>();
+    uint64_t num_ids = 0;
+    for (uint32_t group_index = 0; group_index < header.num_duplicate_groups;
+         group_index++) {
+      const auto &record = records[group_index];
+      if (record.num_ids == 0 || record.row_ordinal >= header.next_ordinal ||
+          record.num_ids > header.num_duplicate_ids - num_ids) {
+        throw std::invalid_argument(path + " is truncated or corrupted.");
+      }
+      auto &group = duplicates->groups[record.key];
+      group.row_ordinal = record.row_ordinal;
+      group.ids.assign(group_ids + num_ids,
+                       group_ids + num_ids + record.num_ids);
+      for (auto id : group.ids) {
+        duplicates->group_keys[id] = record.key;
+      }
+      num_ids += record.num_ids;
+    }
+    if (num_ids != header.num_duplicate_ids ||
+        header.num_duplicate_groups > num_vectors) {
+      throw std::invalid_argument(path + " is truncated or corrupted.");
+    }
+    auto snapshot = std::make_shared<Snapshot>(*index->_snapshot);
+    snapshot->num_duplicates = num_ids - header.num_duplicate_groups;
+    snapshot->duplicates = std::move(duplicates);
+    index->_snapshot = std::move(snapshot);
+  }
+
+  if (header.id_lookup_enabled) {
+    index->setIdLookup(true);
+  }
+  if (header.deduplication_enabled) {
+    index->setDeduplication(true);
+  }
+  return index;
+}
+
+template <typename PRECISION_TYPE>
+size_t ExactSearchIndex<PRECISION_TYPE>::getMemoryUsage() const {
+  std::lock_guard<std::mutex> lock(_write_mutex);
+  auto snapshot = getSnapshot();
+  size_t memory_usage =
+      sizeof(*this) + sizeof(Snapshot) +
+      _quantization_parameters.capacity() *
+          sizeof(std::tuple<float, PRECISION_TYPE>) +
+      _dimension_order.capacity() * sizeof(uint32_t) +
+      snapshot->segments.capacity() * sizeof(std::shared_ptr<Segment>) +
+      snapshot->segment_sizes.capacity() * sizeof(uint32_t) +
+      snapshot->segment_offsets.capacity() * sizeof(uint32_t) +
+      snapshot->segment_deleted.capacity() * sizeof(uint32_t) +
+      _id_to_ordinal.bucket_count() * sizeof(void *) +
+      _id_to_ordinal.size() *
+          (sizeof(std::pair<const uint64_t, uint32_t>) + sizeof(void *)) +
+      _row_hashes.bucket_count() * sizeof(void *) +
+      _row_hashes.size() *
+          (sizeof(std::pair<const uint64_t, uint32_t>) + sizeof(void *));
+
+  if (snapshot->duplicates) {
+    const auto &duplicates = *snapshot->duplicates;
+    memory_usage +=
+        sizeof(DuplicateGroups) +
+        duplicates.groups.bucket_count() * sizeof(void *) +
+        duplicates.group_keys.bucket_count() * sizeof(void *) +
+        duplicates.group_keys.size() *
+            (sizeof(std::pair<const uint64_t, uint64_t>) + sizeof(void *));
+    for (const auto &[key, group] : duplicates.groups) {
+      memory_usage +=
+          sizeof(std::pair<const uint64_t, typename DuplicateGroups::Group>) +
+          sizeof(void *) + group.ids.capacity() * sizeof(uint64_t);
+    }
+  }
+
+  for (const auto &segment : snapshot->segments) {
+    // Rows mapped from a loaded file live in the page cache and are not
+    // counted.
+    memory_usage += sizeof(Segment) + segment->codes.getMemoryUsage() +
+                    segment->squared_norms.getMemoryUsage() +
+                    segment->inverse_norms.getMemoryUsage() +
+                    segment->dequantized_norms.getMemoryUsage() +
+                    segment->ordinals.getMemoryUsage() +
+                    segment->ids.getMemoryUsage() +
+                    segment->deleted.capacity() *
+                        sizeof(std::atomic<uint64_t>);
+  }
+  return memory_usage;
 }
 
 // Floating point based index used for baseline comparision
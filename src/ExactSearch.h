@@ -1,30 +1,112 @@
 #pragma once
 
+#include <atomic>
 #include <memory.h>
+#include <memory>
+#include <mutex>
+#include <src/AllowList.h>
+#include <src/CodeArena.h>
+#include <src/DistanceMetrics.h>
+#include <src/MappableVector.h>
+#include <src/MappedFile.h>
+#include <src/QueryCache.h>
+#include <src/SearchFuture.h>
+#include <src/SearchStats.h>
+#include <src/TopKSelector.h>
+#include <stdexcept>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace lpq::index {
 
+/**
+ * How a batch of queries is spread over threads.
+ *  - QueryParallel: each thread scans the whole index for its own queries.
+ *  - BaseParallel: all threads scan disjoint slices of the index for the
+ *    same query and their partial top k lists are merged. This keeps every
+ *    core busy for batches smaller than the number of threads.
+ *  - ChunkedBatch: the index is scanned once, chunk by chunk, and every
+ *    query of the batch is scored against a chunk before moving on to the
+ *    next. This is what makes an index larger than RAM searchable: each
+ *    chunk is read from disk once per batch instead of once per query.
+ *  - Auto: ChunkedBatch for indices loaded from a file, and otherwise one
+ *    of QueryParallel and BaseParallel based on the batch size.
+ */
+enum class SearchParallelism {
+  Auto,
+  QueryParallel,
+  BaseParallel,
+  ChunkedBatch
+};
+
 /**
  * Exact search index stores all the vectors and performs
  * exhaustive search to compute distances
+ *
+ * Vectors are stored in segments. A segment is a fixed-capacity code
+ * arena plus the cached norms of its rows; capacities grow geometrically
+ * so the number of segments stays logarithmic in the index size. Once a
+ * row has been written it is never moved, so `add` can append new rows
+ * while searches read the existing ones. Searches work on an immutable
+ * snapshot of the segment list that `add` replaces atomically, which
+ * makes every added batch visible all at once.
+ *
+ * Removed vectors are only marked in a per-segment deletion bitmap and
+ * skipped by the scan. Once enough of the index is deleted, the affected
+ * segments are rewritten without their tombstones (compaction), so that
+ * deleted rows stop costing scan bandwidth.
+ *
+ * An index can be saved to a file and loaded back with `load`, which maps
+ * the file instead of reading it. The loaded rows are scanned in place,
+ * so loading takes constant time and processes that load the same file
+ * share one copy of it in the page cache.
+ *
+ * With deduplication enabled, vectors whose codes are already in the
+ * index do not get a row of their own. Their IDs are kept in a posting
+ * list (a duplicate group) of the row holding the codes, and searches
+ * expand every such row into all of its IDs.
  **/
 
-template <typename PRECISION_TYPE> class ExactSearchIndex {
+template <typename PRECISION_TYPE>
+class ExactSearchIndex
+    : public std::enable_shared_from_this<ExactSearchIndex<PRECISION_TYPE>> {
+  using AccumulatorType = typename DistanceAccumulator<PRECISION_TYPE>::type;
 
 public:
-  explicit ExactSearchIndex(const std::string &distance_metric)
-      : _distance_metric(distance_metric) {}
+  explicit ExactSearchIndex(const std::string &distance_metric);
+
+  /**
+   * Appends `vectors` to the index and returns the IDs assigned to them.
+   * Every vector also gets a sequential internal ordinal, which is used as
+   * its ID, so the first vector ever added has ID 0 and so on. The squared
+   * norm (euclidean) or inverse norm (cosine) of every vector is cached so
+   * that search only needs a single inner product per vector.
+   * Calls to `add` are serialized with each other but may run
+   * concurrently with `search`. A search sees either none or all of the
+   * vectors of a batch.
+   **/
+  std::vector<uint64_t>
+  add(const std::vector<std::vector<PRECISION_TYPE>> &vectors);
 
   /**
-   * Adds every vector to the index. Every vector in the dataset
-   * is assigned a unique ID. This assignment is sequential so
-   * that the first vector has ID 0 and so on.
+   * Same as above, but the vectors get the caller's `ids`, which `search`
+   * returns and `remove` accepts. IDs are only checked for uniqueness
+   * when the ID lookup is enabled (see `setIdLookup`).
    **/
-  void addDataset(const std::vector<std::vector<PRECISION_TYPE>> &dataset);
+  std::vector<uint64_t>
+  add(const std::vector<std::vector<PRECISION_TYPE>> &vectors,
+      const std::vector<uint64_t> &ids);
+
+  /**
+   * Adds every vector to the index. Same as `add`, without returning the
+   * assigned IDs.
+   **/
+  void addDataset(const std::vector<std::vector<PRECISION_TYPE>> &dataset) {
+    add(dataset);
+  }
 
   /**
    * Returns a vector of the same size as the size of the input `queries`
@@ -36,25 +118,629 @@ public:
    * of which has dim d.
    */
   std::tuple<std::vector<std::vector<float>>,
-             std::vector<std::vector<uint32_t>>>
+             std::vector<std::vector<uint64_t>>>
   search(const std::vector<std::vector<PRECISION_TYPE>> &queries,
-         uint32_t top_k);
+         uint32_t top_k) const;
+
+  /**
+   * Filtered search: only vectors in the allow list are considered. Pass
+   * either one allow list shared by all queries or one per query. The
+   * filter is applied inside the scan, 64 vectors at a time, and blocks
+   * without any allowed vector are skipped, so a selective filter makes
+   * the search faster.
+   */
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  search(const std::vector<std::vector<PRECISION_TYPE>> &queries,
+         uint32_t top_k, const std::vector<AllowList> &allow_lists) const;
+
+  /**
+   * Queues the (optionally filtered) search of `queries` on the global
+   * SearchExecutor and returns right away. The future yields the same
+   * results as `search`, or can cancel the search before it starts. An
+   * index owned by a shared_ptr is kept alive until the search is done;
+   * otherwise the caller must keep it alive.
+   */
+  SearchFuture
+  searchAsync(std::vector<std::vector<PRECISION_TYPE>> queries,
+              uint32_t top_k,
+              std::vector<AllowList> allow_lists = {}) const;
+
+  /**
+   * Returns every vector within `radius` of each query in CSR layout:
+   * the neighbors of query i are ids[offsets[i]:offsets[i + 1]], with
+   * their scores at the same positions of `distances`, in index order.
+   * For the euclidean metric `radius` bounds the (squared) distance as
+   * returned by `search`. For similarity metrics it is the minimum
+   * similarity.
+   */
+  std::tuple<std::vector<uint64_t>, std::vector<uint64_t>, std::vector<float>>
+  rangeSearch(const std::vector<std::vector<PRECISION_TYPE>> &queries,
+              float radius) const;
+
+  /**
+   * Sets the per-dimension (scale, zero point) pairs that were used to
+   * quantize the indexed vectors, as returned by
+   * LowPrecisionQuantizer::getQuantizationParameters(). They are required
+   * by `searchAsymmetric` and can be set before or after adding vectors,
+   * but not while searches are running.
+   */
+  void setQuantizationParameters(
+      const std::vector<std::tuple<float, PRECISION_TYPE>>
+          &quantization_parameters);
+
+  /**
+   * Returns the parameters set with `setQuantizationParameters`, e.g. to
+   * quantize new vectors or queries on the grid of a loaded index.
+   */
+  const std::vector<std::tuple<float, PRECISION_TYPE>> &
+  getQuantizationParameters() const {
+    return _quantization_parameters;
+  }
+
+  /**
+   * Asymmetric distance computation (ADC) search. The queries are kept
+   * in float instead of being quantized, which avoids the recall lost to
+   * query quantization error while still scanning the compact codes.
+   * The output has the same layout as `search`.
+   */
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  searchAsymmetric(const std::vector<std::vector<float>> &queries,
+                   uint32_t top_k) const;
+
+  // Filtered asymmetric search, see the filtered `search`.
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  searchAsymmetric(const std::vector<std::vector<float>> &queries,
+                   uint32_t top_k,
+                   const std::vector<AllowList> &allow_lists) const;
+
+  /**
+   * Returns an allow list holding the vectors with the given IDs. Unknown
+   * or removed IDs are ignored. Allow lists refer to internal ordinals, so
+   * they stay valid across `add`, `remove` and compaction.
+   */
+  AllowList createAllowList(const std::vector<uint64_t> &ids) const;
+
+  /**
+   * Removes the vectors with the given IDs. Unknown or already removed
+   * IDs are ignored. Returns the number of vectors that were removed.
+   * Removed vectors are skipped by every search that starts after `remove`
+   * returns. If the fraction of removed rows exceeds the compaction
+   * threshold, the index is compacted before returning.
+   * As long as every ID was assigned by the index, rows are found with a
+   * binary search. Caller supplied IDs need the ID lookup, or else every
+   * call scans the IDs of the whole index.
+   **/
+  uint32_t remove(const std::vector<uint64_t> &ids);
+
+  /**
+   * Enables or disables the hash index from IDs to internal ordinals used
+   * by `remove`. While enabled, `add` rejects IDs that are already in the
+   * index.
+   */
+  void setIdLookup(bool enabled);
+
+  /**
+   * Turns the collapsing of exact duplicates on or off. While it is on,
+   * `add` hashes every vector, and a vector whose codes are byte for byte
+   * those of a live row (or of an earlier vector of the batch) joins the
+   * duplicate group of that row instead of getting a row. Searches scan
+   * every row once and expand it into the IDs of its group, which gives
+   * the results of an index without deduplication up to the order of
+   * equal distances. IDs are assumed to be unique.
+   *
+   * Allow lists select rows, so a row passes a filter if any of its IDs
+   * does, and then all of its IDs are returned. Turning deduplication on
+   * hashes the rows already in the index; duplicates among them stay
+   * separate rows. Turning it off keeps the existing groups.
+   */
+  void setDeduplication(bool enabled);
+
+  /**
+   * Rewrites every segment whose fraction of removed rows exceeds the
+   * compaction threshold so that it only holds live rows. Searches keep
+   * running on the previous snapshot while the new segments are built;
+   * only `add` and `remove` wait for compaction to finish.
+   **/
+  void compact();
+
+  /**
+   * Sets the fraction of removed rows above which `remove` compacts the
+   * index. A threshold of 1 disables automatic compaction.
+   */
+  void setCompactionThreshold(float compaction_threshold);
+
+  /**
+   * Writes the index to `path` in the format described in IndexFile.h.
+   * Removed vectors are left out. The file is written under a temporary
+   * name, flushed to disk and renamed at the end (see commitIndexFile),
+   * so a crash never leaves a partially written index at `path`. May run
+   * concurrently with `search`.
+   */
+  void save(const std::string &path) const;
+
+  /**
+   * Loads an index saved with `save`. The file is memory-mapped and the
+   * codes, norms and IDs are used in place, so the file must not be
+   * modified or truncated while the index exists (replacing it via
+   * rename, as `save` does, is fine). The loaded index supports every
+   * operation: added vectors go to new in-memory segments, and mapped
+   * rows are only copied if compaction rewrites them.
+   */
+  static std::shared_ptr<ExactSearchIndex> load(const std::string &path);
+
+  // Number of vectors in the index, not counting removed ones.
+  uint32_t size() const {
+    auto snapshot = getSnapshot();
+    return snapshot->num_vectors - snapshot->num_deleted +
+           snapshot->num_duplicates;
+  }
+
+  void setSearchParallelism(SearchParallelism parallelism) {
+    _parallelism = parallelism;
+  }
+
+  /**
+   * Sets the number of code bytes that a ChunkedBatch search scans per
+   * chunk. Larger chunks mean longer sequential reads, but every chunk
+   * (plus the next one, which is read ahead) must fit in memory.
+   */
+  void setScanChunkSize(size_t chunk_bytes) {
+    if (chunk_bytes == 0) {
+      throw std::invalid_argument("The scan chunk size must be positive.");
+    }
+    _scan_chunk_bytes = chunk_bytes;
+  }
+
+  /**
+   * Turns the collection of SearchStats on or off. Searches (including
+   * asymmetric ones) started while it is on add their statistics to the
+   * ones returned by `getSearchStats`. While it is off, searches run the
+   * scan without any counting.
+   */
+  void setSearchStatsEnabled(bool enabled) {
+    _search_stats_enabled.store(enabled, std::memory_order_relaxed);
+  }
+
+  SearchStats getSearchStats() const {
+    std::lock_guard<std::mutex> lock(_search_stats_mutex);
+    return _search_stats;
+  }
+
+  void resetSearchStats() {
+    std::lock_guard<std::mutex> lock(_search_stats_mutex);
+    _search_stats = SearchStats();
+  }
+
+  /**
+   * Caches the results of up to `capacity` (query, k, allow list) triples
+   * of `search`, so that repeated queries skip the scan. Every add and
+   * remove invalidates the cached results. A capacity of 0 (the default)
+   * turns the cache off, and changing the capacity drops the cache.
+   */
+  void setQueryCacheCapacity(size_t capacity) {
+    std::atomic_store(&_query_cache,
+                      capacity == 0
+                          ? std::shared_ptr<QueryCache>()
+                          : std::make_shared<QueryCache>(capacity));
+  }
+
+  QueryCache::Stats getQueryCacheStats() const {
+    auto query_cache = std::atomic_load(&_query_cache);
+    return query_cache ? query_cache->getStats() : QueryCache::Stats{0, 0, 0};
+  }
+
+  /**
+   * Returns the number of bytes held by the index: the code arenas
+   * (including alignment padding and reserved capacity) plus every cached
+   * per-vector and per-dimension array.
+   */
+  size_t getMemoryUsage() const;
 
 private:
   /**
-   * Computes the distance between the input query vector
-   * and every other query in the index, and returns the top_k
-   * closest queries based on the given distance metric and
-   * the corresponding distances in a sorted order. The output
-   * is returned as a tuple of the top k distances and top k
-   * vector ids.
+   * With automatic parallelism, a base-parallel search gives every thread
+   * at least this many vectors. Below that the merge and the fork/join
+   * cost more than the scan they parallelize.
+   */
+  static constexpr uint32_t MIN_ROWS_PER_PARTITION = 16384;
+
+  /**
+   * Capacity of the first segment. Every new segment is at least as large
+   * as the whole index before it, so capacities double.
+   */
+  static constexpr uint32_t MIN_SEGMENT_CAPACITY = 1024;
+
+  static constexpr float DEFAULT_COMPACTION_THRESHOLD = 0.2f;
+
+  static constexpr size_t DEFAULT_SCAN_CHUNK_BYTES = 64 << 20;
+
+  // Number of rows covered by one word of the deletion bitmap.
+  static constexpr uint32_t ROWS_PER_BITMAP_WORD = 64;
+
+  /**
+   * A block of rows with fixed capacity. Only the writer holding
+   * `_write_mutex` modifies a segment, and only in rows that are not yet
+   * part of any published snapshot. The one exception is the deletion
+   * bitmap, whose words are updated atomically while searches read them.
+   */
+  struct Segment {
+    Segment(uint32_t dimension, uint32_t capacity)
+        : codes(dimension, capacity),
+          deleted((capacity + ROWS_PER_BITMAP_WORD - 1) /
+                  ROWS_PER_BITMAP_WORD) {}
+
+    // A full segment over rows of a loaded index file.
+    explicit Segment(CodeArena<PRECISION_TYPE> mapped_codes)
+        : codes(std::move(mapped_codes)),
+          deleted((codes.capacity() + ROWS_PER_BITMAP_WORD - 1) /
+                  ROWS_PER_BITMAP_WORD) {}
+
+    CodeArena<PRECISION_TYPE> codes;
+    MappableVector<AccumulatorType> squared_norms;
+    MappableVector<float> inverse_norms;
+    MappableVector<float> dequantized_norms;
+    // Internal ordinal of every row. Ordinals increase with the row index,
+    // also across segments, so a row is found with a binary search. Unlike
+    // row indices they do not change during compaction.
+    MappableVector<uint32_t> ordinals;
+    // ID of every row as returned by search.
+    MappableVector<uint64_t> ids;
+    // Bit r % 64 of word r / 64 is set once row r has been removed.
+    std::vector<std::atomic<uint64_t>> deleted;
+    // Keeps the file mapped while the segment uses rows from it.
+    std::shared_ptr<const MappedFile> mapped_file;
+  };
+
+  /**
+   * The rows that hold the codes of more than one vector, see
+   * `setDeduplication`. Like a snapshot, a published instance is never
+   * modified; `add` and `remove` publish a modified copy.
+   */
+  struct DuplicateGroups {
+    struct Group {
+      uint32_t row_ordinal;
+      // Live IDs of the row, in the order they were added.
+      std::vector<uint64_t> ids;
+    };
+
+    // Keyed by the ID the row was written with, which search returns for
+    // the row. That ID is only in `ids` while it has not been removed.
+    std::unordered_map<uint64_t, Group> groups;
+    // The key of the group of every ID in any group.
+    std::unordered_map<uint64_t, uint64_t> group_keys;
+  };
+
+  /**
+   * An immutable view of the index. `segment_sizes` holds the number of
+   * published rows of every segment and `segment_offsets` their prefix
+   * sums, so that row ranges of the whole index can be mapped to segments.
+   * `segment_deleted` counts the removed rows of every segment.
+   */
+  struct Snapshot {
+    std::vector<std::shared_ptr<Segment>> segments;
+    std::vector<uint32_t> segment_sizes;
+    std::vector<uint32_t> segment_offsets;
+    std::vector<uint32_t> segment_deleted;
+    uint32_t num_vectors = 0;
+    uint32_t num_deleted = 0;
+    // Bumped by every add and remove, see QueryCache.
+    uint64_t version = 0;
+    // Null until the first duplicate is collapsed.
+    std::shared_ptr<const DuplicateGroups> duplicates;
+    // Number of live IDs beyond one per live row.
+    uint32_t num_duplicates = 0;
+  };
+
+  /**
+   * Collects every candidate whose key is within the radius, exposing the
+   * same `threshold`/`push` interface as TopKSelector so that both share
+   * the scan. The threshold is fixed, so the early-abandon kernel drops
+   * candidates beyond the radius as soon as their partial distance
+   * exceeds it.
+   */
+  struct RangeCollector {
+    float threshold() const { return radius; }
+
+    void push(float distance, uint64_t id) {
+      if (distance <= radius) {
+        distances->push_back(distance);
+        ids->push_back(id);
+      }
+    }
+
+    float radius;
+    std::vector<float> *distances;
+    std::vector<uint64_t> *ids;
+  };
+
+  /**
+   * A query converted to the layout of the stored codes: padded to the
+   * arena stride and permuted like the stored dimensions.
+   */
+  struct PreparedQuery {
+    AlignedVector<PRECISION_TYPE> padded_query;
+    AccumulatorType norm;
+    float inverse_norm;
+  };
+
+  /**
+   * A float query with the per-dimension quantization scales folded in,
+   * see `prepareAsymmetricQuery`.
+   */
+  struct PreparedAsymmetricQuery : AsymmetricQuery {
+    float inverse_norm;
+  };
+
+  explicit ExactSearchIndex(DistanceMetric distance_metric);
+
+  std::shared_ptr<const Snapshot> getSnapshot() const {
+    return std::atomic_load(&_snapshot);
+  }
+
+  /**
+   * Computes the variance of every dimension over `vectors` and sets
+   * `_dimension_order` so that the stored dimensions come in decreasing
+   * order of variance.
+   */
+  void computeDimensionOrder(
+      const std::vector<std::vector<PRECISION_TYPE>> &vectors);
+
+  /**
+   * Appends `vectors` with the given IDs, or with their ordinals as IDs if
+   * `ids` is null.
+   */
+  std::vector<uint64_t>
+  addVectors(const std::vector<std::vector<PRECISION_TYPE>> &vectors,
+             const uint64_t *ids);
+
+  /**
+   * Copies vectors[first_vector, first_vector + count) into rows starting
+   * at `first_row` of `segment` and caches their norms. Vector
+   * first_vector + i gets ordinals[i] and ids[i].
+   */
+  void writeRows(Segment &segment, uint32_t first_row,
+                 const std::vector<std::vector<PRECISION_TYPE>> &vectors,
+                 uint32_t first_vector, uint32_t count,
+                 const uint32_t *ordinals, const uint64_t *ids);
+
+  /**
+   * Hashes the first `_dimension` codes at `codes`, eight bytes at a time
+   * in four independent lanes.
+   */
+  uint64_t hashCodes(const PRECISION_TYPE *codes) const;
+
+  /**
+   * Returns the ordinal of the row that holds every vector of a batch
+   * whose first vector gets `first_ordinal`: the ordinal of a live row or
+   * of an earlier vector of the batch with the same codes, or the
+   * vector's own ordinal if its codes are new. New codes are added to
+   * `_row_hashes`.
+   */
+  std::vector<uint32_t>
+  findDuplicateRows(const Snapshot &snapshot,
+                    const std::vector<std::vector<PRECISION_TYPE>> &vectors,
+                    uint32_t first_ordinal);
+
+  // Removes a row that is being deleted from `_row_hashes`.
+  void forgetRowHash(const Segment &segment, uint32_t row_index);
+
+  /**
+   * Replaces every row in the results of a search with the IDs of its
+   * duplicate group, keeping the first `top_k` results of every query.
+   */
+  void expandDuplicates(const Snapshot &snapshot, uint32_t top_k,
+                        std::vector<std::vector<float>> &distances,
+                        std::vector<std::vector<uint64_t>> &ids) const;
+
+  /**
+   * Returns the ordinals of the live rows whose ID is in `ids`.
+   */
+  std::vector<uint32_t> findOrdinals(const Snapshot &snapshot,
+                                     const std::vector<uint64_t> &ids) const;
+
+  /**
+   * Finds the segment and row holding `ordinal`. Returns false if no row
+   * of the snapshot holds it.
+   */
+  bool findRow(const Snapshot &snapshot, uint32_t ordinal,
+               uint32_t &segment_index, uint32_t &row_index) const;
+
+  /**
+   * Compacts the segments of the current snapshot. The caller must hold
+   * `_write_mutex`.
+   */
+  void compactSegments();
+
+  /**
+   * Returns a new segment holding only the live rows among the first
+   * `segment_size` rows of `segment`, with room for at least `capacity`
+   * rows.
+   */
+  std::shared_ptr<Segment> rewriteSegment(const Segment &segment,
+                                          uint32_t segment_size,
+                                          uint32_t capacity) const;
+
+  /**
+   * Computes the norm of a row after dequantizing it with
+   * `_quantization_parameters`. We store the squared norm for the
+   * euclidean metric and the inverse norm for the cosine metric.
    */
-  std::tuple<std::vector<float>, std::vector<uint32_t>>
-  getTopKClosestVectors(const std::vector<PRECISION_TYPE> &query_vector,
-                        uint32_t top_k);
+  float computeDequantizedNorm(const PRECISION_TYPE *row) const;
+
+  bool useEarlyAbandon() const;
+
+  /**
+   * Maps a position in the stored (permuted) vectors back to the dimension
+   * of the original input vectors.
+   */
+  uint32_t getOriginalDimension(uint32_t dim_index) const {
+    return _dimension_order.empty() ? dim_index : _dimension_order[dim_index];
+  }
+
+  bool useBaseParallelism(uint32_t num_queries, uint32_t num_vectors) const;
+
+  bool useChunkedScan(const Snapshot &snapshot) const;
+
+  /**
+   * Validates the queries, prepares each of them with `prepare_function`
+   * and collects the sorted top k results from `snapshot`, parallelizing
+   * either over queries or over slices of the index. `allow_lists` is
+   * empty for an unfiltered search.
+   */
+  template <typename QUERY_TYPE, typename PREPARE_FUNCTION>
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  runSearch(const Snapshot &snapshot,
+            const std::vector<std::vector<QUERY_TYPE>> &queries,
+            uint32_t top_k, const PREPARE_FUNCTION &prepare_function,
+            const std::vector<AllowList> &allow_lists) const;
+
+  static void checkAllowLists(const std::vector<AllowList> &allow_lists,
+                              size_t num_queries) {
+    if (allow_lists.size() > 1 && allow_lists.size() != num_queries) {
+      throw std::invalid_argument(
+          "Pass either a single allow list for all queries or one allow "
+          "list per query.");
+    }
+  }
+
+  /**
+   * The body of `runSearch` for a validated batch, which scans with
+   * SELECTOR: a TopKSelector, or a CountingTopKSelector whose counts are
+   * recorded in `stats_collector` (which is null otherwise).
+   */
+  template <typename SELECTOR, typename QUERY_TYPE, typename PREPARE_FUNCTION,
+            typename ALLOW_LIST_FUNCTION>
+  void searchBatch(const std::vector<std::vector<QUERY_TYPE>> &queries,
+                   const Snapshot &snapshot, uint32_t top_k,
+                   const PREPARE_FUNCTION &prepare_function,
+                   const ALLOW_LIST_FUNCTION &get_allow_list,
+                   SearchStatsCollector *stats_collector,
+                   std::vector<std::vector<float>> &distances,
+                   std::vector<std::vector<uint64_t>> &ids) const;
+
+  /**
+   * Answers a single query with all threads: every thread computes the
+   * top k of its own slice of the index and the slices are combined with
+   * a k-way merge.
+   */
+  template <typename SELECTOR, typename PREPARED_QUERY>
+  std::tuple<std::vector<float>, std::vector<uint64_t>>
+  searchBaseParallel(const PREPARED_QUERY &query, const Snapshot &snapshot,
+                     uint32_t top_k, const AllowList *allow_list,
+                     SearchStatsCollector *stats_collector) const;
+
+  /**
+   * Answers a batch of prepared queries with one pass over the index in
+   * chunks of `_scan_chunk_bytes`, see SearchParallelism::ChunkedBatch.
+   * The results are written to `distances` and `ids`.
+   */
+  template <typename SELECTOR, typename PREPARED_QUERY,
+            typename ALLOW_LIST_FUNCTION>
+  void searchChunked(const std::vector<PREPARED_QUERY> &queries,
+                     const Snapshot &snapshot, uint32_t top_k,
+                     const ALLOW_LIST_FUNCTION &get_allow_list,
+                     SearchStatsCollector *stats_collector,
+                     std::vector<std::vector<float>> &distances,
+                     std::vector<std::vector<uint64_t>> &ids) const;
+
+  /**
+   * Asks the kernel to read the codes and norms of rows [begin, end) of
+   * the whole index in the background, for the rows that are mapped from
+   * a file. Rows in memory are skipped.
+   */
+  void prefetchMappedRows(const Snapshot &snapshot, uint32_t begin,
+                          uint32_t end) const;
+
+  /**
+   * Scans rows [begin, end) of the whole index (counted across segments)
+   * and pushes every candidate into `selector`. If `allow_list` is not
+   * null, only rows whose ordinal it contains are scanned.
+   */
+  template <typename PREPARED_QUERY, typename SELECTOR>
+  void scanRange(const PREPARED_QUERY &query, const Snapshot &snapshot,
+                 uint32_t begin, uint32_t end, const AllowList *allow_list,
+                 SELECTOR &selector) const;
+
+  PreparedQuery
+  prepareQuery(const std::vector<PRECISION_TYPE> &query_vector) const;
+
+  PreparedAsymmetricQuery
+  prepareAsymmetricQuery(const std::vector<float> &query_vector) const;
+
+  /**
+   * Computes the distance between the input query and rows
+   * [begin, end) of `segment`, and pushes every candidate into
+   * `selector`, which keeps the top k closest vectors based on
+   * the given distance metric.
+   */
+  template <typename SELECTOR>
+  void scanSegment(const PreparedQuery &query, const Segment &segment,
+                   uint32_t begin, uint32_t end, const AllowList *allow_list,
+                   SELECTOR &selector) const;
+
+  template <typename SELECTOR>
+  void scanSegment(const PreparedAsymmetricQuery &query,
+                   const Segment &segment, uint32_t begin, uint32_t end,
+                   const AllowList *allow_list, SELECTOR &selector) const;
+
+  /**
+   * Runs `score_function` over the live (and allowed) rows in [begin, end)
+   * of `segment` and pushes the scores into `selector`. The score function
+   * is also given the current k^th best distance so that distance-based
+   * metrics can abandon a candidate as soon as it exceeds it.
+   */
+  template <typename SCORE_FUNCTION, typename SELECTOR>
+  void selectTopK(const SCORE_FUNCTION &score_function, const Segment &segment,
+                  uint32_t begin, uint32_t end, const AllowList *allow_list,
+                  SELECTOR &selector) const;
+
+  /**
+   * Returns the rows [first_row, first_row + 64) of `segment` that are in
+   * `allow_list` as a word in which bit i stands for row first_row + i.
+   * Rows at or after `end_row` are not set.
+   */
+  uint64_t getAllowedRows(const AllowList &allow_list, const Segment &segment,
+                          uint32_t first_row, uint32_t end_row) const;
+
+  /**
+   * The selector minimizes, so similarity scores are pushed negated. This
+   * turns the selector's keys back into scores of the distance metric.
+   */
+  void convertKeysToScores(std::vector<float> &distances) const;
+
+  DistanceMetric _distance_metric;
+  SearchParallelism _parallelism;
+  size_t _scan_chunk_bytes;
+  float _compaction_threshold;
+
+  // Set by the first call to `add` and fixed afterwards.
+  uint32_t _dimension;
+  // Ordinal assigned to the next added vector.
+  uint32_t _next_ordinal;
+  // Whether any vector was added with a caller supplied ID.
+  bool _has_external_ids;
+  bool _id_lookup_enabled;
+  std::unordered_map<uint64_t, uint32_t> _id_to_ordinal;
+  bool _deduplication_enabled;
+  // Hash of the codes of every live row (see `hashCodes`) to its ordinal.
+  std::unordered_multimap<uint64_t, uint32_t> _row_hashes;
+  std::vector<uint32_t> _dimension_order;
+
+  std::vector<std::tuple<float, PRECISION_TYPE>> _quantization_parameters;
+
+  std::shared_ptr<const Snapshot> _snapshot;
+  mutable std::mutex _write_mutex;
+
+  // Null while the query cache is off.
+  std::shared_ptr<QueryCache> _query_cache;
 
-  std::string _distance_metric;
-  std::vector<std::pair<std::vector<PRECISION_TYPE>, uint32_t>> _index;
+  std::atomic<bool> _search_stats_enabled;
+  mutable std::mutex _search_stats_mutex;
+  mutable SearchStats _search_stats;
 };
 
-} // namespace lpq::index
\ No newline at end of file
+} // namespace lpq::index
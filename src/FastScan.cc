@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <src/FastScan.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LPQ_FAST_SCAN_SSSE3
+#endif
+
+namespace lpq::index {
+
+void fastScanBlockScalar(const uint8_t *block, const uint8_t *tables,
+                         uint32_t num_subspaces, uint16_t *distances) {
+  std::fill(distances, distances + FAST_SCAN_BLOCK_SIZE, 0);
+  for (uint32_t subspace = 0; subspace < num_subspaces; subspace++) {
+    const uint8_t *codes = block + subspace * 16;
+    const uint8_t *table = tables + subspace * 16;
+    for (uint32_t slot = 0; slot < 16; slot++) {
+      distances[slot] += table[codes[slot] & 0x0f];
+      distances[slot + 16] += table[codes[slot] >> 4];
+    }
+  }
+}
+
+#ifdef LPQ_FAST_SCAN_SSSE3
+
+namespace {
+
+/**
+ * The build does not assume SSSE3, so this function alone is compiled for
+ * it and only called once the CPU is known to support it.
+ */
+__attribute__((target("ssse3"))) void
+fastScanBlockSSSE3(const uint8_t *block, const uint8_t *tables,
+                   uint32_t num_subspaces, uint16_t *distances) {
+  const __m128i low_nibbles = _mm_set1_epi8(0x0f);
+  const __m128i zero = _mm_setzero_si128();
+  // Sums of the vectors in slots [0, 8), [8, 16), [16, 24) and [24, 32).
+  __m128i sums[4] = {zero, zero, zero, zero};
+  for (uint32_t subspace = 0; subspace < num_subspaces; subspace++) {
+    const __m128i codes = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(block + subspace * 16));
+    const __m128i table = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(tables + subspace * 16));
+    const __m128i first_half =
+        _mm_shuffle_epi8(table, _mm_and_si128(codes, low_nibbles));
+    const __m128i second_half = _mm_shuffle_epi8(
+        table, _mm_and_si128(_mm_srli_epi16(codes, 4), low_nibbles));
+    sums[0] = _mm_add_epi16(sums[0], _mm_unpacklo_epi8(first_half, zero));
+    sums[1] = _mm_add_epi16(sums[1], _mm_unpackhi_epi8(first_half, zero));
+    sums[2] = _mm_add_epi16(sums[2], _mm_unpacklo_epi8(second_half, zero));
+    sums[3] = _mm_add_epi16(sums[3], _mm_unpackhi_epi8(second_half, zero));
+  }
+  for (uint32_t part = 0; part < 4; part++) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(distances + 8 * part),
+                     sums[part]);
+  }
+}
+
+} // namespace
+
+#endif
+
+void fastScanBlock(const uint8_t *block, const uint8_t *tables,
+                   uint32_t num_subspaces, uint16_t *distances) {
+#ifdef LPQ_FAST_SCAN_SSSE3
+  static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+  if (has_ssse3) {
+    fastScanBlockSSSE3(block, tables, num_subspaces, distances);
+    return;
+  }
+#endif
+  fastScanBlockScalar(block, tables, num_subspaces, distances);
+}
+
+} // namespace lpq::index
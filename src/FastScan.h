@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lpq::index {
+
+/**
+ * Kernels over 4-bit product quantization codes in the blocked layout of
+ * fast-scan ADC. The codes of FAST_SCAN_BLOCK_SIZE vectors form a block.
+ * Within a block, every subspace takes 16 bytes, and byte i holds the code
+ * of vector i in its low nibble and the code of vector i + 16 in its high
+ * nibble. A block thus takes 16 bytes per subspace, half a byte per vector
+ * and subspace.
+ *
+ * A query's distance tables are quantized to one uint8 entry per (subspace,
+ * centroid) pair, i.e. one 16 byte table per subspace. Since a 16 byte
+ * table fits in a register, a single byte shuffle (pshufb) looks up the
+ * entries of 16 vectors at once.
+ */
+constexpr uint32_t FAST_SCAN_BLOCK_SIZE = 32;
+
+// Number of bytes of one block of codes.
+constexpr uint32_t getFastScanBlockBytes(uint32_t num_subspaces) {
+  return num_subspaces * FAST_SCAN_BLOCK_SIZE / 2;
+}
+
+// Returns the code of the vector in `slot` of `block` for `subspace`.
+inline uint8_t getFastScanCode(const uint8_t *block, uint32_t subspace,
+                               uint32_t slot) {
+  uint8_t byte = block[subspace * 16 + slot % 16];
+  return slot < 16 ? byte & 0x0f : byte >> 4;
+}
+
+// Stores `code` as the code of the vector in `slot` of `block`.
+inline void setFastScanCode(uint8_t *block, uint32_t subspace, uint32_t slot,
+                            uint8_t code) {
+  uint8_t &byte = block[subspace * 16 + slot % 16];
+  byte = slot < 16 ? (byte & 0xf0) | code : (byte & 0x0f) | (code << 4);
+}
+
+/**
+ * Adds up the table entries of the FAST_SCAN_BLOCK_SIZE vectors of `block`
+ * over all subspaces and writes the sums to `distances`. `tables` holds
+ * 16 entries per subspace. The sums are exact as long as there are at
+ * most 257 subspaces. Uses SSSE3 if the CPU supports it.
+ */
+void fastScanBlock(const uint8_t *block, const uint8_t *tables,
+                   uint32_t num_subspaces, uint16_t *distances);
+
+// The portable version of fastScanBlock.
+void fastScanBlockScalar(const uint8_t *block, const uint8_t *tables,
+                         uint32_t num_subspaces, uint16_t *distances);
+
+} // namespace lpq::index
@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <queue>
+#include <src/HNSWIndex.h>
+#include <src/ThreadPool.h>
+#include <src/TopKSelector.h>
+#include <src/VisitedSet.h>
+#include <stdexcept>
+
+namespace lpq::index {
+
+namespace {
+
+thread_local VisitedSet visited_set;
+
+} // namespace
+
+template <typename PRECISION_TYPE>
+HNSWIndex<PRECISION_TYPE>::HNSWIndex(const std::string &distance_metric,
+                                     uint32_t m, uint32_t ef_construction)
+    : _distance_metric(parseDistanceMetric(distance_metric)), _m(m),
+      _ef_construction(ef_construction), _ef_search(DEFAULT_EF_SEARCH),
+      _dimension(0), _num_nodes(0), _level_generator(LEVEL_SEED),
+      _code_size(0), _node_size(0), _lock_capacity(0), _entry_point(NO_NODE),
+      _max_level(-1) {
+  if (m < 2) {
+    throw std::invalid_argument("M must be at least 2.");
+  }
+  if (ef_construction == 0) {
+    throw std::invalid_argument("ef_construction must be positive.");
+  }
+  _level_multiplier = 1. / std::log(static_cast<double>(m));
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint64_t>
+HNSWIndex<PRECISION_TYPE>::add(const std::vector<std::vector<float>> &vectors) {
+  if (vectors.empty()) {
+    return {};
+  }
+  const uint32_t dimension = _num_nodes == 0 ? vectors[0].size() : _dimension;
+  for (const auto &vector : vectors) {
+    if (vector.size() != dimension || dimension == 0) {
+      throw std::invalid_argument(
+          "Every vector in the dataset must have the same, positive "
+          "dimension.");
+    }
+  }
+  std::vector<std::vector<float>> normalized_vectors;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_vectors = lpq::index::normalizeVectors(vectors);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_vectors : vectors;
+
+  std::vector<std::vector<PRECISION_TYPE>> codes;
+  if (_num_nodes == 0) {
+    // The first batch fits the quantization grid that every later batch
+    // is quantized with.
+    _dimension = dimension;
+    codes = _quantizer.quantizeVectors(points);
+    _quantization_parameters = _quantizer.getQuantizationParameters();
+    _code_size = CodeArena<PRECISION_TYPE>::computeStride(dimension) *
+                 sizeof(PRECISION_TYPE);
+    const size_t node_size =
+        _code_size + sizeof(float) + (2 * _m + 1) * sizeof(uint32_t);
+    _node_size = (node_size + CODE_ALIGNMENT - 1) / CODE_ALIGNMENT *
+                 CODE_ALIGNMENT;
+  } else {
+    codes = _quantizer.quantizeVectors(
+        /* vectors = */ points,
+        /* quantization_parameters = */ _quantization_parameters);
+  }
+
+  /**
+   * Everything a concurrent insertion may touch is allocated up front, so
+   * that no buffer moves while the batch is inserted. The levels are drawn
+   * here too, which keeps the graph independent of the thread schedule.
+   */
+  const uint32_t first_node = _num_nodes;
+  const uint32_t num_nodes = first_node + vectors.size();
+  _nodes.resize(size_t(num_nodes) * _node_size, 0);
+  _levels.resize(num_nodes);
+  _upper_links.resize(num_nodes);
+  std::uniform_real_distribution<double> uniform(0., 1.);
+  for (uint32_t node = first_node; node < num_nodes; node++) {
+    _levels[node] = static_cast<uint32_t>(
+        -std::log(1. - uniform(_level_generator)) * _level_multiplier);
+    if (_levels[node] > 0) {
+      const size_t num_links = size_t(_levels[node]) * (_m + 1);
+      _upper_links[node] = std::make_unique<uint32_t[]>(num_links);
+      std::fill_n(_upper_links[node].get(), num_links, 0);
+    }
+  }
+  if (num_nodes > _lock_capacity) {
+    _lock_capacity = std::max(num_nodes, 2 * _lock_capacity);
+    _node_locks = std::make_unique<std::mutex[]>(_lock_capacity);
+  }
+
+  auto &thread_pool = ThreadPool::global();
+  thread_pool.parallelFor(first_node, num_nodes, [&](uint64_t node) {
+    char *block = _nodes.data() + node * _node_size;
+    const auto &code = codes[node - first_node];
+    std::memcpy(block, code.data(), dimension * sizeof(PRECISION_TYPE));
+
+    const float squared_norm = lpq::index::dequantizedSquaredNorm(
+        /* quantization_parameters = */ _quantization_parameters,
+        /* code = */ code.data());
+    std::memcpy(block + _code_size, &squared_norm, sizeof(float));
+  });
+  _num_nodes = num_nodes;
+
+  thread_pool.parallelFor(
+      first_node, num_nodes,
+      [&](uint64_t node) {
+        insert(node, prepareQuery(points[node - first_node].data()));
+      },
+      /* grain_size = */ 1);
+
+  std::vector<uint64_t> ids(vectors.size());
+  std::iota(ids.begin(), ids.end(), first_node);
+  return ids;
+}
+
+template <typename PRECISION_TYPE>
+void HNSWIndex<PRECISION_TYPE>::insert(uint32_t node,
+                                       const PreparedQuery &query) {
+  const uint32_t level = _levels[node];
+
+  // A node that raises the top level keeps the entry lock until it is
+  // linked, so that no other node enters the graph through it too early.
+  std::unique_lock<std::mutex> entry_lock(_entry_mutex);
+  if (_entry_point == NO_NODE) {
+    _entry_point = node;
+    _max_level = level;
+    return;
+  }
+  const uint32_t entry_point = _entry_point;
+  const uint32_t max_level = _max_level;
+  if (level <= max_level) {
+    entry_lock.unlock();
+  }
+
+  Candidate closest{computeDistance(query, entry_point), entry_point};
+  for (uint32_t current_level = max_level; current_level > level;
+       current_level--) {
+    closest = searchGreedy(query, closest, current_level,
+                           /* lock_nodes = */ true);
+  }
+
+  for (int32_t current_level = std::min(level, max_level);
+       current_level >= 0; current_level--) {
+    auto candidates = searchLevel(query, closest, _ef_construction,
+                                  current_level, /* lock_nodes = */ true);
+    closest = *std::min_element(candidates.begin(), candidates.end());
+    auto neighbors = selectNeighbors(/* node = */ node,
+                                     /* candidates = */ std::move(candidates),
+                                     /* max_neighbors = */ _m);
+    const uint32_t max_neighbors = getMaxNeighbors(current_level);
+
+    {
+      std::lock_guard<std::mutex> lock(_node_locks[node]);
+      uint32_t *links = getLinks(node, current_level);
+      /**
+       * A node that reached `node` through a higher level may already have
+       * linked to it on this level. Such back-links are merged with the new
+       * neighbours instead of being overwritten.
+       */
+      if (links[0] == 0) {
+        links[0] = neighbors.size();
+        std::copy(neighbors.begin(), neighbors.end(), links + 1);
+      } else {
+        std::vector<Candidate> linked_candidates;
+        for (auto neighbor : neighbors) {
+          linked_candidates.emplace_back(computeDistance(query, neighbor),
+                                         neighbor);
+        }
+        for (uint32_t position = 1; position <= links[0]; position++) {
+          linked_candidates.emplace_back(
+              computeDistance(query, links[position]), links[position]);
+        }
+        auto kept = selectNeighbors(
+            /* node = */ node,
+            /* candidates = */ std::move(linked_candidates),
+            /* max_neighbors = */ max_neighbors);
+        links[0] = kept.size();
+        std::copy(kept.begin(), kept.end(), links + 1);
+      }
+    }
+
+    // Link the neighbours back, pruning lists that are full.
+    for (auto neighbor : neighbors) {
+      std::lock_guard<std::mutex> lock(_node_locks[neighbor]);
+      uint32_t *links = getLinks(neighbor, current_level);
+      if (links[0] < max_neighbors) {
+        links[links[0] + 1] = node;
+        links[0]++;
+        continue;
+      }
+      auto neighbor_query = prepareNode(neighbor);
+      std::vector<Candidate> neighbor_candidates{
+          {computeDistance(neighbor_query, node), node}};
+      for (uint32_t position = 1; position <= links[0]; position++) {
+        neighbor_candidates.emplace_back(
+            computeDistance(neighbor_query, links[position]), links[position]);
+      }
+      auto kept = selectNeighbors(
+          /* node = */ neighbor,
+          /* candidates = */ std::move(neighbor_candidates),
+          /* max_neighbors = */ max_neighbors);
+      links[0] = kept.size();
+      std::copy(kept.begin(), kept.end(), links + 1);
+    }
+  }
+
+  if (level > max_level) {
+    _entry_point = node;
+    _max_level = level;
+  }
+}
+
+template <typename PRECISION_TYPE>
+typename HNSWIndex<PRECISION_TYPE>::Candidate
+HNSWIndex<PRECISION_TYPE>::searchGreedy(const PreparedQuery &query,
+                                        Candidate entry_point, uint32_t level,
+                                        bool lock_nodes) const {
+  Candidate closest = entry_point;
+  std::vector<uint32_t> neighbors(getMaxNeighbors(level));
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    uint32_t num_neighbors;
+    {
+      std::unique_lock<std::mutex> lock;
+      if (lock_nodes) {
+        lock = std::unique_lock<std::mutex>(_node_locks[closest.second]);
+      }
+      const uint32_t *links = getLinks(closest.second, level);
+      num_neighbors = links[0];
+      std::copy(links + 1, links + 1 + num_neighbors, neighbors.begin());
+    }
+    for (uint32_t position = 0; position < num_neighbors; position++) {
+      float distance = computeDistance(query, neighbors[position]);
+      if (distance < closest.first) {
+        closest = {distance, neighbors[position]};
+        changed = true;
+      }
+    }
+  }
+  return closest;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<typename HNSWIndex<PRECISION_TYPE>::Candidate>
+HNSWIndex<PRECISION_TYPE>::searchLevel(const PreparedQuery &query,
+                                       Candidate entry_point, uint32_t ef,
+                                       uint32_t level, bool lock_nodes) const {
+  visited_set.reset(_num_nodes);
+  visited_set.visit(entry_point.second);
+
+  // Nodes to expand, closest first, and the best `ef` nodes found so far,
+  // farthest first.
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>>
+      to_expand;
+  std::priority_queue<Candidate> results;
+  to_expand.push(entry_point);
+  results.push(entry_point);
+
+  std::vector<uint32_t> neighbors(getMaxNeighbors(level));
+  while (!to_expand.empty()) {
+    Candidate current = to_expand.top();
+    if (current.first > results.top().first && results.size() == ef) {
+      break;
+    }
+    to_expand.pop();
+
+    uint32_t num_neighbors;
+    {
+      std::unique_lock<std::mutex> lock;
+      if (lock_nodes) {
+        lock = std::unique_lock<std::mutex>(_node_locks[current.second]);
+      }
+      const uint32_t *links = getLinks(current.second, level);
+      num_neighbors = links[0];
+      std::copy(links + 1, links + 1 + num_neighbors, neighbors.begin());
+    }
+
+    /**
+     * The neighbours are scattered over the arena, so every one of them is
+     * likely a cache miss. Prefetching all the unvisited ones first lets
+     * their loads overlap with the distance computations.
+     */
+    uint32_t num_unvisited = 0;
+    for (uint32_t position = 0; position < num_neighbors; position++) {
+      if (!visited_set.visit(neighbors[position])) {
+        neighbors[num_unvisited++] = neighbors[position];
+        __builtin_prefetch(_nodes.data() + neighbors[position] * _node_size);
+      }
+    }
+    for (uint32_t position = 0; position < num_unvisited; position++) {
+      const uint32_t neighbor = neighbors[position];
+      float distance = computeDistance(query, neighbor);
+      if (results.size() < ef || distance < results.top().first) {
+        to_expand.emplace(distance, neighbor);
+        results.emplace(distance, neighbor);
+        if (results.size() > ef) {
+          results.pop();
+        }
+      }
+    }
+  }
+
+  std::vector<Candidate> closest;
+  closest.reserve(results.size());
+  while (!results.empty()) {
+    closest.push_back(results.top());
+    results.pop();
+  }
+  return closest;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint32_t> HNSWIndex<PRECISION_TYPE>::selectNeighbors(
+    uint32_t node, std::vector<Candidate> candidates,
+    uint32_t max_neighbors) const {
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+  std::vector<uint32_t> selected;
+  std::vector<PreparedQuery> selected_queries;
+  for (const auto &[distance, candidate] : candidates) {
+    if (selected.size() == max_neighbors) {
+      break;
+    }
+    if (candidate == node) {
+      continue;
+    }
+    bool is_diverse = true;
+    for (const auto &selected_query : selected_queries) {
+      if (computeDistance(selected_query, candidate) < distance) {
+        is_diverse = false;
+        break;
+      }
+    }
+    if (is_diverse) {
+      selected.push_back(candidate);
+      selected_queries.push_back(prepareNode(candidate));
+    }
+  }
+  return selected;
+}
+
+template <typename PRECISION_TYPE>
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+HNSWIndex<PRECISION_TYPE>::search(
+    const std::vector<std::vector<float>> &queries, uint32_t top_k) const {
+  std::vector<std::vector<float>> distances(queries.size());
+  std::vector<std::vector<uint64_t>> ids(queries.size());
+  if (_num_nodes == 0 || top_k == 0) {
+    return {distances, ids};
+  }
+  for (const auto &query : queries) {
+    if (query.size() != _dimension) {
+      throw std::invalid_argument("Input vectors must be of the same size in "
+                                  "order to compute the distance.");
+    }
+  }
+
+  std::vector<std::vector<float>> normalized_queries;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_queries = lpq::index::normalizeVectors(queries);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_queries : queries;
+
+  ThreadPool::global().parallelFor(
+      0, queries.size(),
+      [&](uint64_t index) {
+        auto query = prepareQuery(points[index].data());
+
+        Candidate closest{computeDistance(query, _entry_point), _entry_point};
+        for (int32_t level = _max_level; level > 0; level--) {
+          closest = searchGreedy(query, closest, level,
+                                 /* lock_nodes = */ false);
+        }
+        auto candidates =
+            searchLevel(query, closest, std::max(_ef_search, top_k),
+                        /* level = */ 0, /* lock_nodes = */ false);
+
+        TopKSelector<uint64_t> selector(top_k);
+        for (const auto &[distance, node] : candidates) {
+          selector.push(distance, node);
+        }
+        selector.extractSorted(/* distances = */ distances[index],
+                               /* ids = */ ids[index]);
+        if (isSimilarityMetric(_distance_metric)) {
+          for (auto &distance : distances[index]) {
+            distance = -distance;
+          }
+        }
+      },
+      /* grain_size = */ 1);
+  return {distances, ids};
+}
+
+template <typename PRECISION_TYPE>
+void HNSWIndex<PRECISION_TYPE>::setEfSearch(uint32_t ef_search) {
+  if (ef_search == 0) {
+    throw std::invalid_argument("ef_search must be positive.");
+  }
+  _ef_search = ef_search;
+}
+
+template <typename PRECISION_TYPE>
+size_t HNSWIndex<PRECISION_TYPE>::getMemoryUsage() const {
+  size_t memory_usage =
+      sizeof(*this) + _nodes.capacity() +
+      _quantization_parameters.capacity() *
+          sizeof(std::tuple<float, PRECISION_TYPE>) +
+      _levels.capacity() * sizeof(uint32_t) +
+      _upper_links.capacity() * sizeof(std::unique_ptr<uint32_t[]>) +
+      _lock_capacity * sizeof(std::mutex);
+  for (uint32_t node = 0; node < _num_nodes; node++) {
+    memory_usage += size_t(_levels[node]) * (_m + 1) * sizeof(uint32_t);
+  }
+  return memory_usage;
+}
+
+template <typename PRECISION_TYPE>
+typename HNSWIndex<PRECISION_TYPE>::PreparedQuery
+HNSWIndex<PRECISION_TYPE>::prepareQuery(const float *vector) const {
+  return lpq::index::prepareAsymmetricQuery(
+      /* quantization_parameters = */ _quantization_parameters,
+      /* vector = */ vector,
+      /* stride = */ _code_size / sizeof(PRECISION_TYPE));
+}
+
+template <typename PRECISION_TYPE>
+typename HNSWIndex<PRECISION_TYPE>::PreparedQuery
+HNSWIndex<PRECISION_TYPE>::prepareNode(uint32_t node) const {
+  const PRECISION_TYPE *code = getCode(node);
+  std::vector<float> vector(_dimension);
+  for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+    auto [scale, zero_point] = _quantization_parameters[dim_index];
+    vector[dim_index] = scale * (static_cast<float>(code[dim_index]) -
+                                 static_cast<float>(zero_point));
+  }
+  return prepareQuery(vector.data());
+}
+
+template <typename PRECISION_TYPE>
+float HNSWIndex<PRECISION_TYPE>::computeDistance(const PreparedQuery &query,
+                                                 uint32_t node) const {
+  float inner_product =
+      lpq::index::asymmetricDotProduct(
+          /* query = */ query.transformed_query.data(),
+          /* codes = */ getCode(node),
+          /* dimension = */ query.transformed_query.size()) -
+      query.zero_point_offset;
+  if (_distance_metric == DistanceMetric::Euclidean) {
+    return lpq::index::euclideanDistanceFromNorms(
+        /* first_norm = */ query.squared_norm,
+        /* second_norm = */ getSquaredNorm(node),
+        /* inner_product = */ inner_product);
+  }
+  // The graph is searched for the smallest distance, so similarities are
+  // negated.
+  return -inner_product;
+}
+
+// Codes use the affine int8 grid of LowPrecisionQuantizer.
+template class HNSWIndex<int_least8_t>;
+
+} // namespace lpq::index
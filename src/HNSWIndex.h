@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <src/CodeArena.h>
+#include <src/DistanceMetrics.h>
+#include <src/LPQ.h>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Hierarchical navigable small world graph index. Every vector is a node
+ * of a layered proximity graph: layer 0 holds every node with up to
+ * 2 * M neighbours each, and every higher layer holds an exponentially
+ * smaller random subset with up to M neighbours. A search descends
+ * greedily from the top layer and then runs a best-first search with a
+ * beam of `ef` nodes on layer 0, so it only visits a small part of the
+ * graph.
+ *
+ * The vectors are stored as int8 codes (fitted by LowPrecisionQuantizer
+ * on the first batch, like RerankingIndex) in one flat arena. Every node
+ * of the arena holds the code, the squared norm of the dequantized vector
+ * and the layer 0 neighbour list back to back, so expanding a node reads
+ * one contiguous block. Both construction and search score vectors
+ * against the codes with the asymmetric kernel of ExactSearchIndex.
+ *
+ * Cosine search normalizes the vectors and the queries and then runs as
+ * inner product search. The returned distances are computed from the
+ * codes, so they are approximate.
+ *
+ * `add` inserts the vectors of a batch in parallel, with a lock per node
+ * guarding its neighbour lists. IDs are assigned sequentially starting
+ * from 0. Like RerankingIndex, `add` must not run concurrently with
+ * `search`.
+ */
+template <typename PRECISION_TYPE> class HNSWIndex {
+public:
+  static constexpr uint32_t DEFAULT_M = 16;
+  static constexpr uint32_t DEFAULT_EF_CONSTRUCTION = 200;
+  static constexpr uint32_t DEFAULT_EF_SEARCH = 64;
+
+  /**
+   * `m` is the number of neighbours a node links to on the layers above
+   * layer 0, and `ef_construction` the beam width used to find them.
+   * Larger values build a better connected graph (and a slower and
+   * larger index).
+   */
+  HNSWIndex(const std::string &distance_metric, uint32_t m = DEFAULT_M,
+            uint32_t ef_construction = DEFAULT_EF_CONSTRUCTION);
+
+  /**
+   * Quantizes `vectors`, inserts them into the graph and returns the IDs
+   * assigned to them. The quantization grid is fitted on the first batch
+   * and reused for all later ones.
+   */
+  std::vector<uint64_t> add(const std::vector<std::vector<float>> &vectors);
+
+  /**
+   * Returns the approximate top k vectors for every query, in the same
+   * layout as ExactSearchIndex::search. Queries run in parallel.
+   */
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  search(const std::vector<std::vector<float>> &queries, uint32_t top_k) const;
+
+  /**
+   * Sets the beam width of a search. A search always uses a beam of at
+   * least top_k nodes. Wider beams raise the recall and the latency alike.
+   */
+  void setEfSearch(uint32_t ef_search);
+
+  uint32_t getEfSearch() const { return _ef_search; }
+
+  uint32_t getM() const { return _m; }
+
+  uint32_t getEfConstruction() const { return _ef_construction; }
+
+  uint32_t size() const { return _num_nodes; }
+
+  size_t getMemoryUsage() const;
+
+private:
+  static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+  // Seed of the layer assignment, so that building is reproducible.
+  static constexpr uint32_t LEVEL_SEED = 42;
+
+  // A float vector prepared for the asymmetric kernel.
+  using PreparedQuery = AsymmetricQuery;
+
+  // (distance, node) pairs, where similarities are negated.
+  using Candidate = std::pair<float, uint32_t>;
+
+  PreparedQuery prepareQuery(const float *vector) const;
+
+  // Prepares the dequantized vector of `node` as a query.
+  PreparedQuery prepareNode(uint32_t node) const;
+
+  float computeDistance(const PreparedQuery &query, uint32_t node) const;
+
+  const PRECISION_TYPE *getCode(uint32_t node) const {
+    return reinterpret_cast<const PRECISION_TYPE *>(_nodes.data() +
+                                                    node * _node_size);
+  }
+
+  float getSquaredNorm(uint32_t node) const {
+    return *reinterpret_cast<const float *>(_nodes.data() + node * _node_size +
+                                            _code_size);
+  }
+
+  /**
+   * Returns the neighbour list of `node` on `level`: its length followed
+   * by room for getMaxNeighbors(level) neighbours.
+   */
+  uint32_t *getLinks(uint32_t node, uint32_t level) {
+    if (level == 0) {
+      return reinterpret_cast<uint32_t *>(_nodes.data() + node * _node_size +
+                                          _code_size + sizeof(float));
+    }
+    return _upper_links[node].get() + (level - 1) * (_m + 1);
+  }
+
+  const uint32_t *getLinks(uint32_t node, uint32_t level) const {
+    return const_cast<HNSWIndex *>(this)->getLinks(node, level);
+  }
+
+  uint32_t getMaxNeighbors(uint32_t level) const {
+    return level == 0 ? 2 * _m : _m;
+  }
+
+  /**
+   * Inserts `node`, whose code is already in the arena, into the graph.
+   * Runs concurrently with the insertion of other nodes.
+   */
+  void insert(uint32_t node, const PreparedQuery &query);
+
+  /**
+   * Best-first search of `level` from `entry_point` with a beam of `ef`
+   * nodes. Returns the closest nodes found, in no particular order. Reads
+   * of neighbour lists take the node locks if `lock_nodes` is set, which
+   * is only needed while nodes are being inserted.
+   */
+  std::vector<Candidate> searchLevel(const PreparedQuery &query,
+                                     Candidate entry_point, uint32_t ef,
+                                     uint32_t level, bool lock_nodes) const;
+
+  /**
+   * Moves from `entry_point` to its closest neighbour on `level` until no
+   * neighbour is closer, and returns the node it stops at.
+   */
+  Candidate searchGreedy(const PreparedQuery &query, Candidate entry_point,
+                         uint32_t level, bool lock_nodes) const;
+
+  /**
+   * Picks up to `max_neighbors` of `candidates` with the HNSW heuristic: a
+   * candidate is kept only if it is closer to the base node `node` than
+   * to every candidate kept before it, which spreads the links in all
+   * directions. `node` itself and repeated candidates are skipped.
+   */
+  std::vector<uint32_t> selectNeighbors(uint32_t node,
+                                        std::vector<Candidate> candidates,
+                                        uint32_t max_neighbors) const;
+
+  DistanceMetric _distance_metric;
+  uint32_t _m;
+  uint32_t _ef_construction;
+  uint32_t _ef_search;
+  uint32_t _dimension;
+  uint32_t _num_nodes;
+
+  // Layer sizes shrink by a factor of M per layer.
+  double _level_multiplier;
+  std::mt19937 _level_generator;
+
+  LowPrecisionQuantizer<PRECISION_TYPE> _quantizer;
+  std::vector<std::tuple<float, PRECISION_TYPE>> _quantization_parameters;
+
+  /**
+   * One block of `_node_size` bytes per node: the code (padded to the
+   * arena stride), the squared norm of the dequantized vector and the
+   * layer 0 neighbour list. Blocks are CODE_ALIGNMENT aligned.
+   */
+  AlignedVector<char> _nodes;
+  uint32_t _code_size;
+  uint32_t _node_size;
+
+  // The neighbour lists of every node on the layers above layer 0.
+  std::vector<uint32_t> _levels;
+  std::vector<std::unique_ptr<uint32_t[]>> _upper_links;
+
+  // Guards the neighbour lists of every node while nodes are inserted.
+  std::unique_ptr<std::mutex[]> _node_locks;
+  uint32_t _lock_capacity;
+
+  // Guards the entry point and the top level.
+  std::mutex _entry_mutex;
+  uint32_t _entry_point;
+  int32_t _max_level;
+};
+
+} // namespace lpq::index
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <src/IVFIndex.h>
+#include <src/KMeans.h>
+#include <src/ThreadPool.h>
+#include <src/TopKSelector.h>
+#include <stdexcept>
+
+namespace lpq::index {
+
+template <typename PRECISION_TYPE>
+IVFIndex<PRECISION_TYPE>::IVFIndex(const std::string &distance_metric,
+                                   uint32_t num_lists)
+    : _distance_metric(parseDistanceMetric(distance_metric)),
+      _num_lists(num_lists), _num_probes(DEFAULT_NUM_PROBES), _dimension(0),
+      _num_vectors(0) {
+  if (num_lists == 0) {
+    throw std::invalid_argument("The number of lists must be positive.");
+  }
+}
+
+template <typename PRECISION_TYPE>
+void IVFIndex<PRECISION_TYPE>::train(
+    const std::vector<std::vector<float>> &vectors) {
+  if (isTrained()) {
+    throw std::invalid_argument("The index is already trained.");
+  }
+  if (vectors.size() < _num_lists) {
+    throw std::invalid_argument(
+        "Training needs at least as many vectors as there are lists.");
+  }
+  const uint32_t dimension = vectors[0].size();
+  for (const auto &vector : vectors) {
+    if (vector.size() != dimension || dimension == 0) {
+      throw std::invalid_argument(
+          "Every vector in the dataset must have the same, positive "
+          "dimension.");
+    }
+  }
+  _dimension = dimension;
+  std::vector<std::vector<float>> normalized_vectors;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_vectors = lpq::index::normalizeVectors(vectors);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_vectors : vectors;
+
+  _centroids = trainKMeans(/* vectors = */ points, /* offset = */ 0,
+                           /* dimension = */ dimension,
+                           /* num_centroids = */ _num_lists,
+                           /* num_iterations = */ KMEANS_ITERATIONS,
+                           /* seed = */ KMEANS_SEED);
+  _centroid_squared_norms.resize(_num_lists);
+  for (uint32_t list = 0; list < _num_lists; list++) {
+    const float *centroid = _centroids.getRow(list);
+    _centroid_squared_norms[list] =
+        lpq::index::dotProduct(centroid, centroid, _dimension);
+  }
+
+  // One grid for the residuals of every list.
+  auto residuals = computeResiduals(points, assignToCentroids(points));
+  _quantizer.quantizeVectors(residuals);
+  _quantization_parameters = _quantizer.getQuantizationParameters();
+  _lists.resize(_num_lists);
+  for (auto &list : _lists) {
+    list.codes = CodeArena<PRECISION_TYPE>(dimension);
+  }
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint64_t>
+IVFIndex<PRECISION_TYPE>::add(const std::vector<std::vector<float>> &vectors) {
+  if (vectors.empty()) {
+    return {};
+  }
+  if (!isTrained()) {
+    train(vectors);
+  }
+  for (const auto &vector : vectors) {
+    if (vector.size() != _dimension) {
+      throw std::invalid_argument(
+          "Every vector in the dataset must have the same dimension.");
+    }
+  }
+  std::vector<std::vector<float>> normalized_vectors;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_vectors = lpq::index::normalizeVectors(vectors);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_vectors : vectors;
+
+  auto assignments = assignToCentroids(points);
+  auto codes = _quantizer.quantizeVectors(
+      /* vectors = */ computeResiduals(points, assignments),
+      /* quantization_parameters = */ _quantization_parameters);
+  std::vector<std::vector<uint32_t>> members(_num_lists);
+  for (uint32_t index = 0; index < vectors.size(); index++) {
+    members[assignments[index]].push_back(index);
+  }
+
+  const uint64_t first_id = _num_vectors;
+  ThreadPool::global().parallelFor(0, _num_lists, [&](uint64_t list_index) {
+    auto &list = _lists[list_index];
+    for (auto index : members[list_index]) {
+      list.codes.append(codes[index].data());
+      list.ids.push_back(first_id + index);
+      if (_distance_metric != DistanceMetric::Euclidean) {
+        continue;
+      }
+      list.squared_norms.push_back(lpq::index::dequantizedSquaredNorm(
+          /* quantization_parameters = */ _quantization_parameters,
+          /* code = */ codes[index].data()));
+    }
+  });
+  _num_vectors += vectors.size();
+
+  std::vector<uint64_t> ids(vectors.size());
+  std::iota(ids.begin(), ids.end(), first_id);
+  return ids;
+}
+
+template <typename PRECISION_TYPE>
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+IVFIndex<PRECISION_TYPE>::search(const std::vector<std::vector<float>> &queries,
+                                 uint32_t top_k) const {
+  const uint32_t num_queries = queries.size();
+  std::vector<std::vector<float>> distances(num_queries);
+  std::vector<std::vector<uint64_t>> ids(num_queries);
+  if (_num_vectors == 0) {
+    return {distances, ids};
+  }
+  for (const auto &query : queries) {
+    if (query.size() != _dimension) {
+      throw std::invalid_argument("Input vectors must be of the same size in "
+                                  "order to compute the distance.");
+    }
+  }
+  std::vector<std::vector<float>> normalized_queries;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_queries = lpq::index::normalizeVectors(queries);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_queries : queries;
+
+  auto &thread_pool = ThreadPool::global();
+  const uint32_t num_probes = std::min(_num_probes, _num_lists);
+  std::vector<std::vector<uint32_t>> probes(num_queries);
+  thread_pool.parallelFor(0, num_queries, [&](uint64_t query_index) {
+    probes[query_index] = findProbes(points[query_index]);
+  });
+
+  /**
+   * Every (query, probed list) pair is a task of its own, so that even a
+   * single query scans its lists in parallel. The top k of every list are
+   * merged per query afterwards.
+   */
+  const uint64_t num_items = uint64_t(num_queries) * num_probes;
+  std::vector<std::vector<float>> item_distances(num_items);
+  std::vector<std::vector<uint64_t>> item_ids(num_items);
+  thread_pool.parallelFor(
+      0, num_items,
+      [&](uint64_t item) {
+        const uint32_t query_index = item / num_probes;
+        scanList(/* query = */ points[query_index],
+                 /* list = */ probes[query_index][item % num_probes],
+                 /* top_k = */ top_k, /* distances = */ item_distances[item],
+                 /* ids = */ item_ids[item]);
+      },
+      /* grain_size = */ 1);
+
+  thread_pool.parallelFor(0, num_queries, [&](uint64_t query_index) {
+    TopKSelector<uint64_t> selector(top_k);
+    for (uint64_t item = query_index * num_probes;
+         item < (query_index + 1) * num_probes; item++) {
+      for (uint32_t position = 0; position < item_ids[item].size();
+           position++) {
+        selector.push(item_distances[item][position], item_ids[item][position]);
+      }
+    }
+    selector.extractSorted(/* distances = */ distances[query_index],
+                           /* ids = */ ids[query_index]);
+    if (isSimilarityMetric(_distance_metric)) {
+      for (auto &distance : distances[query_index]) {
+        distance = -distance;
+      }
+    }
+  });
+  return {distances, ids};
+}
+
+template <typename PRECISION_TYPE>
+void IVFIndex<PRECISION_TYPE>::setNumProbes(uint32_t num_probes) {
+  if (num_probes == 0) {
+    throw std::invalid_argument("The number of probes must be positive.");
+  }
+  _num_probes = num_probes;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint32_t> IVFIndex<PRECISION_TYPE>::getListSizes() const {
+  std::vector<uint32_t> list_sizes;
+  for (const auto &list : _lists) {
+    list_sizes.push_back(list.ids.size());
+  }
+  return list_sizes;
+}
+
+template <typename PRECISION_TYPE>
+size_t IVFIndex<PRECISION_TYPE>::getMemoryUsage() const {
+  size_t memory_usage =
+      sizeof(*this) + _centroids.getMemoryUsage() +
+      _centroid_squared_norms.capacity() * sizeof(float) +
+      _quantization_parameters.capacity() *
+          sizeof(std::tuple<float, PRECISION_TYPE>) +
+      _lists.capacity() * sizeof(InvertedList);
+  for (const auto &list : _lists) {
+    memory_usage += list.codes.getMemoryUsage() +
+                    list.ids.capacity() * sizeof(uint64_t) +
+                    list.squared_norms.capacity() * sizeof(float);
+  }
+  return memory_usage;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint32_t> IVFIndex<PRECISION_TYPE>::assignToCentroids(
+    const std::vector<std::vector<float>> &vectors) const {
+  std::vector<uint32_t> assignments(vectors.size());
+  ThreadPool::global().parallelFor(0, vectors.size(), [&](uint64_t index) {
+    // ||x||^2 is the same for every centroid, so it is left out.
+    const float *vector = vectors[index].data();
+    float best_distance = std::numeric_limits<float>::infinity();
+    for (uint32_t list = 0; list < _num_lists; list++) {
+      float distance =
+          _centroid_squared_norms[list] -
+          2 * lpq::index::dotProduct(vector, _centroids.getRow(list),
+                                     _dimension);
+      if (distance < best_distance) {
+        best_distance = distance;
+        assignments[index] = list;
+      }
+    }
+  });
+  return assignments;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<std::vector<float>> IVFIndex<PRECISION_TYPE>::computeResiduals(
+    const std::vector<std::vector<float>> &vectors,
+    const std::vector<uint32_t> &assignments) const {
+  std::vector<std::vector<float>> residuals(vectors);
+  ThreadPool::global().parallelFor(0, vectors.size(), [&](uint64_t index) {
+    const float *centroid = _centroids.getRow(assignments[index]);
+    for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+      residuals[index][dim_index] -= centroid[dim_index];
+    }
+  });
+  return residuals;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<uint32_t>
+IVFIndex<PRECISION_TYPE>::findProbes(const std::vector<float> &query) const {
+  TopKSelector<uint32_t> selector(std::min(_num_probes, _num_lists));
+  for (uint32_t list = 0; list < _num_lists; list++) {
+    float inner_product = lpq::index::dotProduct(
+        query.data(), _centroids.getRow(list), _dimension);
+    selector.push(
+        /* distance = */ _distance_metric == DistanceMetric::Euclidean
+            ? _centroid_squared_norms[list] - 2 * inner_product
+            : -inner_product,
+        /* id = */ list);
+  }
+  std::vector<float> distances;
+  std::vector<uint32_t> lists;
+  selector.extractSorted(/* distances = */ distances, /* ids = */ lists);
+  return lists;
+}
+
+template <typename PRECISION_TYPE>
+void IVFIndex<PRECISION_TYPE>::scanList(const std::vector<float> &query,
+                                        uint32_t list, uint32_t top_k,
+                                        std::vector<float> &distances,
+                                        std::vector<uint64_t> &ids) const {
+  const auto &inverted_list = _lists[list];
+  const auto &codes = inverted_list.codes;
+  const float *centroid = _centroids.getRow(list);
+  const bool is_euclidean = _distance_metric == DistanceMetric::Euclidean;
+
+  /**
+   * A vector is its centroid c plus a residual that dequantizes to
+   * s * (code - z) per dimension. For the euclidean metric we score the
+   * query residual q - c against the residual, and for inner products
+   * q . x = q . c + q . residual. Either way the scales are folded into
+   * the query, so the scan is one asymmetric dot product per code.
+   */
+  std::vector<float> query_residual;
+  float centroid_inner_product = 0.f;
+  if (is_euclidean) {
+    query_residual.resize(_dimension);
+    for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+      query_residual[dim_index] = query[dim_index] - centroid[dim_index];
+    }
+  } else {
+    centroid_inner_product =
+        lpq::index::dotProduct(query.data(), centroid, _dimension);
+  }
+  const auto prepared_query = lpq::index::prepareAsymmetricQuery(
+      /* quantization_parameters = */ _quantization_parameters,
+      /* vector = */ is_euclidean ? query_residual.data() : query.data(),
+      /* stride = */ codes.getStride());
+
+  TopKSelector<uint64_t> selector(top_k);
+  for (uint32_t row = 0; row < codes.size(); row++) {
+    float inner_product =
+        lpq::index::asymmetricDotProduct(
+            /* query = */ prepared_query.transformed_query.data(),
+            /* codes = */ codes.getRow(row),
+            /* dimension = */ codes.getStride()) -
+        prepared_query.zero_point_offset;
+    // The selector minimizes, so similarities are negated.
+    selector.push(
+        /* distance = */ is_euclidean
+            ? lpq::index::euclideanDistanceFromNorms(
+                  /* first_norm = */ prepared_query.squared_norm,
+                  /* second_norm = */ inverted_list.squared_norms[row],
+                  /* inner_product = */ inner_product)
+            : -(centroid_inner_product + inner_product),
+        /* id = */ inverted_list.ids[row]);
+  }
+  selector.extractSorted(/* distances = */ distances, /* ids = */ ids);
+}
+
+// Residuals are quantized with the affine int8 grid of
+// LowPrecisionQuantizer.
+template class IVFIndex<int_least8_t>;
+
+} // namespace lpq::index
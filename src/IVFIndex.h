@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <src/CodeArena.h>
+#include <src/DistanceMetrics.h>
+#include <src/LPQ.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Inverted file index. A k-means coarse quantizer splits the vectors into
+ * `num_lists` clusters, and every vector is stored in the inverted list of
+ * its nearest centroid as the quantized residual to that centroid. A
+ * search only scans the `num_probes` lists whose centroids are closest to
+ * the query, so it reads a fraction of about num_probes / num_lists of
+ * the codes instead of all of them.
+ *
+ * Residuals are much smaller than the vectors themselves, so quantizing
+ * them (with one affine grid for all lists, fitted by LowPrecisionQuantizer)
+ * loses less precision than quantizing the vectors. Every list keeps its
+ * codes in one contiguous CodeArena, and queries are scored in float
+ * against the codes with the asymmetric kernel of ExactSearchIndex.
+ *
+ * Cosine search normalizes the vectors and the queries and then runs as
+ * inner product search. The returned distances are computed from the
+ * quantized residuals, so they are approximate.
+ *
+ * IDs are assigned sequentially starting from 0. Like RerankingIndex,
+ * `add` must not run concurrently with `search`.
+ */
+template <typename PRECISION_TYPE> class IVFIndex {
+public:
+  static constexpr uint32_t DEFAULT_NUM_PROBES = 8;
+
+  IVFIndex(const std::string &distance_metric, uint32_t num_lists);
+
+  /**
+   * Fits the coarse quantizer with k-means and the residual quantization
+   * grid on `vectors`, which must hold at least `num_lists` vectors. Does
+   * not add them. An index can only be trained once.
+   */
+  void train(const std::vector<std::vector<float>> &vectors);
+
+  /**
+   * Appends `vectors` to the lists of their nearest centroids and returns
+   * the IDs assigned to them. An untrained index is trained on the first
+   * batch.
+   */
+  std::vector<uint64_t> add(const std::vector<std::vector<float>> &vectors);
+
+  /**
+   * Returns the top k vectors among the `num_probes` closest lists of
+   * every query, in the same layout as ExactSearchIndex::search. The
+   * queries and the probed lists are scanned in parallel.
+   */
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  search(const std::vector<std::vector<float>> &queries, uint32_t top_k) const;
+
+  /**
+   * Sets the number of lists every query scans. More probes raise the
+   * recall and the cost of a search alike; probing every list gives the
+   * recall of a brute-force scan of the quantized vectors.
+   */
+  void setNumProbes(uint32_t num_probes);
+
+  uint32_t getNumProbes() const { return _num_probes; }
+
+  uint32_t getNumLists() const { return _num_lists; }
+
+  bool isTrained() const { return !_centroids.empty(); }
+
+  uint32_t size() const { return _num_vectors; }
+
+  // Returns the number of vectors in every list.
+  std::vector<uint32_t> getListSizes() const;
+
+  size_t getMemoryUsage() const;
+
+private:
+  static constexpr uint32_t KMEANS_ITERATIONS = 20;
+
+  // Seed of the k-means initialization, so that training is reproducible.
+  static constexpr uint32_t KMEANS_SEED = 42;
+
+  struct InvertedList {
+    CodeArena<PRECISION_TYPE> codes;
+    std::vector<uint64_t> ids;
+    // Squared norms of the dequantized residuals (euclidean metric only).
+    std::vector<float> squared_norms;
+  };
+
+  /**
+   * Returns the index of the centroid with the smallest euclidean distance
+   * to `vector` for every vector.
+   */
+  std::vector<uint32_t>
+  assignToCentroids(const std::vector<std::vector<float>> &vectors) const;
+
+  /**
+   * Returns the residuals of `vectors` to the centroids in `assignments`.
+   */
+  std::vector<std::vector<float>>
+  computeResiduals(const std::vector<std::vector<float>> &vectors,
+                   const std::vector<uint32_t> &assignments) const;
+
+  /**
+   * Returns the `num_probes` lists to scan for `query`: the lists with the
+   * closest centroids for the euclidean metric, and with the largest inner
+   * products otherwise.
+   */
+  std::vector<uint32_t> findProbes(const std::vector<float> &query) const;
+
+  /**
+   * Scans `list` for `query` and returns its top k (distance, id) keys,
+   * where similarities are negated.
+   */
+  void scanList(const std::vector<float> &query, uint32_t list,
+                uint32_t top_k, std::vector<float> &distances,
+                std::vector<uint64_t> &ids) const;
+
+  DistanceMetric _distance_metric;
+  uint32_t _num_lists;
+  uint32_t _num_probes;
+  uint32_t _dimension;
+  uint32_t _num_vectors;
+
+  // One centroid per row, and its squared norm.
+  CodeArena<float> _centroids;
+  std::vector<float> _centroid_squared_norms;
+
+  LowPrecisionQuantizer<PRECISION_TYPE> _quantizer;
+  std::vector<std::tuple<float, PRECISION_TYPE>> _quantization_parameters;
+  std::vector<InvertedList> _lists;
+};
+
+} // namespace lpq::index
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+
+namespace lpq::index {
+
+/**
+ * On-disk layout of a saved index (native byte order):
+ *
+ *   IndexFileHeader | padding | section 0 | padding | section 1 | ...
+ *
+ * Every section starts at a multiple of INDEX_FILE_ALIGNMENT, so that a
+ * mapped file can be used in place: codes keep the padded, cache line
+ * aligned arena layout and can be scanned straight from the page cache.
+ * Sections that the index does not use (e.g. squared norms for the inner
+ * product metric) are empty.
+ *
+ * The version is bumped on every incompatible change, and files with
+ * another version are rejected.
+ */
+constexpr char INDEX_FILE_MAGIC[8] = {'L', 'P', 'Q', 'I', 'N', 'D', 'E', 'X'};
+constexpr uint32_t INDEX_FILE_VERSION = 2;
+constexpr uint64_t INDEX_FILE_ALIGNMENT = 4096;
+// Read back as another value if the file was written on a machine with
+// a different byte order.
+constexpr uint32_t INDEX_FILE_BYTE_ORDER_MARK = 0x01020304;
+
+enum IndexFileSection : uint32_t {
+  DimensionOrderSection,
+  QuantizationScalesSection,
+  QuantizationZeroPointsSection,
+  CodesSection,
+  SquaredNormsSection,
+  InverseNormsSection,
+  DequantizedNormsSection,
+  OrdinalsSection,
+  IdsSection,
+  // An IndexFileDuplicateGroup for every duplicate group.
+  DuplicateGroupsSection,
+  // The IDs of every group, in the order of the groups.
+  DuplicateIdsSection,
+  NUM_INDEX_FILE_SECTIONS
+};
+
+struct IndexFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order_mark;
+  // See getPrecisionTag.
+  uint32_t precision_tag;
+  uint32_t distance_metric;
+  uint32_t dimension;
+  uint32_t stride;
+  uint32_t num_vectors;
+  uint32_t next_ordinal;
+  uint32_t has_external_ids;
+  uint32_t id_lookup_enabled;
+  float compaction_threshold;
+  uint32_t deduplication_enabled;
+  uint32_t num_duplicate_groups;
+  uint32_t num_duplicate_ids;
+  uint64_t section_offsets[NUM_INDEX_FILE_SECTIONS];
+  uint64_t section_sizes[NUM_INDEX_FILE_SECTIONS];
+};
+
+static_assert(std::is_trivially_copyable_v<IndexFileHeader>);
+
+// A row that holds the codes of several vectors, see
+// ExactSearchIndex::setDeduplication.
+struct IndexFileDuplicateGroup {
+  uint64_t key;
+  uint32_t row_ordinal;
+  uint32_t num_ids;
+};
+
+/**
+ * Identifies the code type of a saved index so that e.g. an int8 index
+ * cannot be loaded as a float one.
+ */
+template <typename PRECISION_TYPE> constexpr uint32_t getPrecisionTag() {
+  if constexpr (std::is_floating_point_v<PRECISION_TYPE>) {
+    return 0x100 | sizeof(PRECISION_TYPE);
+  } else if constexpr (std::is_signed_v<PRECISION_TYPE>) {
+    return 0x200 | sizeof(PRECISION_TYPE);
+  } else {
+    return 0x300 | sizeof(PRECISION_TYPE);
+  }
+}
+
+/**
+ * Checks the fixed fields of a header read from `path`. The sections are
+ * validated by the index since their sizes depend on its contents.
+ */
+template <typename PRECISION_TYPE>
+void validateIndexFileHeader(const IndexFileHeader &header,
+                             uint64_t file_size, const std::string &path) {
+  if (std::memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic)) !=
+      0) {
+    throw std::invalid_argument(path + " is not an index file.");
+  }
+  if (header.byte_order_mark != INDEX_FILE_BYTE_ORDER_MARK) {
+    throw std::invalid_argument(
+        path + " was saved on a machine with a different byte order.");
+  }
+  if (header.version != INDEX_FILE_VERSION) {
+    throw std::invalid_argument(
+        path + " has format version " + std::to_string(header.version) +
+        ", but only version " + std::to_string(INDEX_FILE_VERSION) +
+        " is supported.");
+  }
+  if (header.precision_tag != getPrecisionTag<PRECISION_TYPE>()) {
+    throw std::invalid_argument(
+        path + " holds an index of a different precision type.");
+  }
+  for (uint32_t section = 0; section < NUM_INDEX_FILE_SECTIONS; section++) {
+    uint64_t offset = header.section_offsets[section];
+    uint64_t size = header.section_sizes[section];
+    if (offset % INDEX_FILE_ALIGNMENT != 0 || offset > file_size ||
+        size > file_size - offset) {
+      throw std::invalid_argument(path + " is truncated or corrupted.");
+    }
+  }
+}
+
+/**
+ * Moves the completely written file at `temporary_path` to `path`, so that
+ * `path` holds either its previous contents or all of the new ones even
+ * if the machine crashes. The file data is flushed to disk before the
+ * rename and the directory entry after it. On failure the temporary file
+ * is removed and std::runtime_error is thrown.
+ */
+inline void commitIndexFile(const std::string &temporary_path,
+                            const std::string &path) {
+  // Returns 0 or the errno of the failed open or fsync.
+  auto syncPath = [](const std::string &sync_path, int flags) {
+    int file_descriptor = ::open(sync_path.c_str(), flags);
+    if (file_descriptor < 0) {
+      return errno;
+    }
+    int error = ::fsync(file_descriptor) == 0 ? 0 : errno;
+    ::close(file_descriptor);
+    return error;
+  };
+
+  if (int error = syncPath(temporary_path, O_RDONLY)) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Could not flush " + temporary_path + ": " +
+                             std::strerror(error));
+  }
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Could not rename " + temporary_path + " to " +
+                             path + ".");
+  }
+  const size_t separator = path.find_last_of('/');
+  const std::string directory =
+      separator == std::string::npos ? "."
+      : separator == 0               ? "/"
+                                     : path.substr(0, separator);
+  if (int error = syncPath(directory, O_RDONLY | O_DIRECTORY)) {
+    throw std::runtime_error("Could not flush " + directory + ": " +
+                             std::strerror(error));
+  }
+}
+
+} // namespace lpq::index
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <src/DistanceMetrics.h>
+#include <src/KMeans.h>
+#include <src/ThreadPool.h>
+#include <stdexcept>
+
+namespace lpq::index {
+
+CodeArena<float> trainKMeans(const std::vector<std::vector<float>> &vectors,
+                             uint32_t offset, uint32_t dimension,
+                             uint32_t num_centroids, uint32_t num_iterations,
+                             uint32_t seed) {
+  if (num_centroids == 0 || vectors.size() < num_centroids) {
+    throw std::invalid_argument(
+        "k-means needs at least as many vectors as there are centroids.");
+  }
+  const uint64_t num_vectors = vectors.size();
+  std::mt19937 generator(seed);
+  std::vector<uint64_t> sample(num_vectors);
+  std::iota(sample.begin(), sample.end(), 0);
+  std::shuffle(sample.begin(), sample.end(), generator);
+
+  CodeArena<float> centroids(/* dimension = */ dimension,
+                             /* capacity = */ num_centroids);
+  centroids.resize(num_centroids);
+  auto resetCentroid = [&](uint32_t centroid, uint64_t index) {
+    const float *values = vectors[index].data() + offset;
+    std::copy(values, values + dimension, centroids.getMutableRow(centroid));
+  };
+  for (uint32_t centroid = 0; centroid < num_centroids; centroid++) {
+    resetCentroid(centroid, sample[centroid]);
+  }
+
+  auto &thread_pool = ThreadPool::global();
+  std::vector<float> squared_norms(num_centroids);
+  std::vector<uint32_t> assignments(num_vectors);
+  std::uniform_int_distribution<uint64_t> random_vector(0, num_vectors - 1);
+  for (uint32_t iteration = 0; iteration < num_iterations; iteration++) {
+    for (uint32_t centroid = 0; centroid < num_centroids; centroid++) {
+      const float *row = centroids.getRow(centroid);
+      squared_norms[centroid] = lpq::index::dotProduct(row, row, dimension);
+    }
+    thread_pool.parallelFor(0, num_vectors, [&](uint64_t index) {
+      // ||x||^2 is the same for every centroid, so it is left out.
+      const float *values = vectors[index].data() + offset;
+      float best_distance = std::numeric_limits<float>::infinity();
+      for (uint32_t centroid = 0; centroid < num_centroids; centroid++) {
+        float distance = squared_norms[centroid] -
+                         2 * lpq::index::dotProduct(
+                                 values, centroids.getRow(centroid), dimension);
+        if (distance < best_distance) {
+          best_distance = distance;
+          assignments[index] = centroid;
+        }
+      }
+    });
+
+    std::vector<std::vector<uint64_t>> members(num_centroids);
+    for (uint64_t index = 0; index < num_vectors; index++) {
+      members[assignments[index]].push_back(index);
+    }
+    // Every centroid is written by exactly one task.
+    thread_pool.parallelFor(0, num_centroids, [&](uint64_t centroid) {
+      if (members[centroid].empty()) {
+        return;
+      }
+      float *row = centroids.getMutableRow(centroid);
+      std::fill(row, row + dimension, 0.f);
+      for (auto index : members[centroid]) {
+        const float *values = vectors[index].data() + offset;
+        for (uint32_t dim_index = 0; dim_index < dimension; dim_index++) {
+          row[dim_index] += values[dim_index];
+        }
+      }
+      const float inverse_size = 1.f / members[centroid].size();
+      for (uint32_t dim_index = 0; dim_index < dimension; dim_index++) {
+        row[dim_index] *= inverse_size;
+      }
+    });
+    for (uint32_t centroid = 0; centroid < num_centroids; centroid++) {
+      if (members[centroid].empty()) {
+        resetCentroid(centroid, random_vector(generator));
+      }
+    }
+  }
+  return centroids;
+}
+
+} // namespace lpq::index
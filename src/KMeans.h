@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <src/CodeArena.h>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Clusters the values in dimensions [offset, offset + dimension) of every
+ * vector into `num_centroids` clusters with Lloyd's k-means and returns
+ * the centroids, one per row. Taking a range of dimensions lets product
+ * quantizers train one codebook per subspace without copying the
+ * subvectors out first.
+ *
+ * The centroids start from distinct random vectors drawn with `seed`, so
+ * training is reproducible. Clusters that end up empty restart from
+ * another random vector, so that every centroid gets a share of the data.
+ * Throws std::invalid_argument if there are fewer vectors than centroids.
+ */
+CodeArena<float> trainKMeans(const std::vector<std::vector<float>> &vectors,
+                             uint32_t offset, uint32_t dimension,
+                             uint32_t num_centroids, uint32_t num_iterations,
+                             uint32_t seed);
+
+} // namespace lpq::index
@@ -1,4 +1,5 @@
 #include "LPQ.h"
+#include "ThreadPool.h"
 #include <algorithm>
 #include <cassert>
 #include <cmath>
@@ -7,6 +8,7 @@
 #include <limits>
 #include <math.h>
 #include <numeric>
+#include <stdexcept>
 
 namespace lpq {
 
@@ -23,8 +25,6 @@ LowPrecisionQuantizer<PRECISION_TYPE>::quantizeVectors(
     return {};
   }
 
-  std::vector<std::vector<PRECISION_TYPE>> quantized_vectors(vectors.size());
-
   auto min_max_values = getMinMaxValues(/* dataset = */ vectors);
   assert(min_max_values.size() == vectors[0].size());
 
@@ -34,24 +34,44 @@ LowPrecisionQuantizer<PRECISION_TYPE>::quantizeVectors(
         getQuantizationParams(/* min = */ min, /* max = */ max));
   }
 
-#pragma omp parallel for default(none)                                         \
-    shared(vectors, quantization_parameters, quantized_vectors)
-  for (uint32_t vec_index = 0; vec_index < vectors.size(); vec_index++) {
+  auto quantized_vectors =
+      quantizeVectors(/* vectors = */ vectors,
+                      /* quantization_parameters = */ quantization_parameters);
+  _quantization_parameters = std::move(quantization_parameters);
+  return quantized_vectors;
+}
+
+template <typename PRECISION_TYPE>
+std::vector<std::vector<PRECISION_TYPE>>
+LowPrecisionQuantizer<PRECISION_TYPE>::quantizeVectors(
+    const std::vector<std::vector<float>> &vectors,
+    const std::vector<std::tuple<float, PRECISION_TYPE>>
+        &quantization_parameters) {
+  if (vectors.size() == 0) {
+    return {};
+  }
+  for (const auto &vector : vectors) {
+    if (vector.size() != quantization_parameters.size()) {
+      throw std::invalid_argument(
+          "Every vector must have one dimension per (scale, zero point) "
+          "pair of the quantization parameters.");
+    }
+  }
+  std::vector<std::vector<PRECISION_TYPE>> quantized_vectors(vectors.size());
 
+  // Every vector is written by exactly one task, so no locking is needed.
+  ThreadPool::global().parallelFor(0, vectors.size(), [&](uint64_t vec_index) {
     std::vector<PRECISION_TYPE> quantized_vector(vectors[vec_index].size());
-#pragma omp critical
-    {
-      for (uint32_t dim_index = 0; dim_index < vectors[0].size(); dim_index++) {
-        auto [scale, zero_point] = quantization_parameters[dim_index];
-
-        PRECISION_TYPE quantized_value =
-            affine_quantize(/* value = */ vectors[vec_index][dim_index],
-                            /* scale = */ scale, /* zero_point = */ zero_point);
-        quantized_vector[dim_index] = quantized_value;
-      }
+    for (uint32_t dim_index = 0; dim_index < vectors[0].size(); dim_index++) {
+      auto [scale, zero_point] = quantization_parameters[dim_index];
+
+      PRECISION_TYPE quantized_value =
+          affine_quantize(/* value = */ vectors[vec_index][dim_index],
+                          /* scale = */ scale, /* zero_point = */ zero_point);
+      quantized_vector[dim_index] = quantized_value;
     }
     quantized_vectors[vec_index] = std::move(quantized_vector);
-  }
+  });
   return quantized_vectors;
 }
 
@@ -66,9 +86,8 @@ LowPrecisionQuantizer<PRECISION_TYPE>::getDatasetStatistics(
   auto dataset_size = dataset.size();
   std::vector<std::tuple<float, float>> output(output_dimension);
 
-#pragma omp parallel for default(none)                                         \
-    shared(dataset, output_dimension, dataset_size, output)
-  for (uint32_t dim_index = 0; dim_index < output_dimension; dim_index++) {
+  auto &thread_pool = ThreadPool::global();
+  thread_pool.parallelFor(0, output_dimension, [&](uint64_t dim_index) {
     float mean = 0.0000000;
     float variance = 0.0000000;
     for (uint32_t row_index = 0; row_index < dataset_size; row_index++) {
@@ -82,7 +101,7 @@ LowPrecisionQuantizer<PRECISION_TYPE>::getDatasetStatistics(
     variance /= (dataset_size - 1);
     auto current_statistics = std::make_tuple(mean, sqrt(variance));
     output[dim_index] = current_statistics;
-  }
+  });
   return output;
 }
 
@@ -117,19 +136,15 @@ LowPrecisionQuantizer<PRECISION_TYPE>::getMinMaxValues(
   }
   std::vector<std::tuple<float, float>> output(dataset[0].size());
 
-#pragma omp parallel for default(none) shared(output, dataset)
-  for (uint32_t dim_index = 0; dim_index < dataset[0].size(); dim_index++) {
+  ThreadPool::global().parallelFor(0, output.size(), [&](uint64_t dim_index) {
     float min = dataset[0][dim_index];
     float max = dataset[0][dim_index];
-#pragma omp critical
-    {
-      for (uint32_t row_index = 0; row_index < dataset.size(); row_index++) {
-        min = std::min(min, dataset[row_index][dim_index]);
-        max = std::max(max, dataset[row_index][dim_index]);
-      }
+    for (uint32_t row_index = 0; row_index < dataset.size(); row_index++) {
+      min = std::min(min, dataset[row_index][dim_index]);
+      max = std::max(max, dataset[row_index][dim_index]);
     }
     output[dim_index] = std::make_tuple(min, max);
-  }
+  });
   return output;
 } // namespace lpq
 
@@ -17,8 +17,30 @@ public:
   std::vector<std::vector<PRECISION_TYPE>>
   quantizeVectors(const std::vector<std::vector<float>> &vectors);
 
+  /**
+   * Quantizes `vectors` with the given per-dimension (scale, zero point)
+   * pairs instead of computing new ones. This keeps data that is quantized
+   * in several batches (e.g. streamed from disk) on the same grid. Throws
+   * std::invalid_argument unless every vector has one dimension per pair.
+   **/
+  std::vector<std::vector<PRECISION_TYPE>>
+  quantizeVectors(const std::vector<std::vector<float>> &vectors,
+                  const std::vector<std::tuple<float, PRECISION_TYPE>>
+                      &quantization_parameters);
+
   constexpr uint32_t getBitWidth() const { return _bit_width; }
 
+  /**
+   * Returns the per-dimension (scale, zero point) pairs computed by the
+   * most recent call to `quantizeVectors`. A code c in dimension j
+   * dequantizes to scale_j * (c - zero_point_j). Search indices use these
+   * to score float queries directly against the quantized codes.
+   **/
+  const std::vector<std::tuple<float, PRECISION_TYPE>> &
+  getQuantizationParameters() const {
+    return _quantization_parameters;
+  }
+
 private:
   /**
    * A low-precision quantization sub-routine as defined in the original
@@ -61,5 +83,6 @@ private:
   PRECISION_TYPE affine_quantize(float value, float scale,
                                  PRECISION_TYPE zero_point);
   uint32_t _bit_width;
+  std::vector<std::tuple<float, PRECISION_TYPE>> _quantization_parameters;
 };
 } // namespace lpq
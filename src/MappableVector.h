@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * A std::vector replacement that either owns its elements or is a
+ * read-only view of elements that live elsewhere, e.g. in a memory-mapped
+ * index file. Views let a loaded index use the file contents in place
+ * instead of copying them.
+ *
+ * Writing through a view is not allowed (the mapped pages are read-only).
+ * `resize` first copies a view into owned memory, so code that resizes
+ * an array before writing to it works for both.
+ */
+template <typename T> class MappableVector {
+public:
+  MappableVector() = default;
+
+  /**
+   * Returns a view of `size` elements at `data`. The memory must outlive
+   * the view and every copy of it.
+   */
+  static MappableVector view(const T *data, size_t size) {
+    MappableVector vector;
+    vector._view = data;
+    vector._view_size = size;
+    return vector;
+  }
+
+  void resize(size_t size) {
+    if (_view) {
+      _owned.assign(_view, _view + std::min(size, _view_size));
+      _view = nullptr;
+      _view_size = 0;
+    }
+    _owned.resize(size);
+  }
+
+  const T *data() const { return _view ? _view : _owned.data(); }
+  size_t size() const { return _view ? _view_size : _owned.size(); }
+  bool empty() const { return size() == 0; }
+  bool isView() const { return _view != nullptr; }
+
+  const T &operator[](size_t index) const { return data()[index]; }
+  // Only owned elements are writable; `resize` turns a view into those.
+  T &operator[](size_t index) {
+    assert(!isView());
+    return _owned[index];
+  }
+
+  const T *begin() const { return data(); }
+  const T *end() const { return data() + size(); }
+
+  // Bytes owned by the vector. Views do not own any.
+  size_t getMemoryUsage() const { return _owned.capacity() * sizeof(T); }
+
+private:
+  std::vector<T> _owned;
+  const T *_view = nullptr;
+  size_t _view_size = 0;
+};
+
+} // namespace lpq::index
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lpq::index {
+
+/**
+ * Read-only memory mapping of a whole file. The pages are loaded by the
+ * kernel on first access, so a mapped file can be much larger than RAM
+ * and only the parts that are actually read take up memory.
+ */
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    int file_descriptor = ::open(path.c_str(), O_RDONLY);
+    if (file_descriptor < 0) {
+      throw std::invalid_argument("Could not open " + path + ": " +
+                                  std::strerror(errno));
+    }
+    struct stat file_stat;
+    if (::fstat(file_descriptor, &file_stat) != 0) {
+      ::close(file_descriptor);
+      throw std::runtime_error("Could not stat " + path + ": " +
+                               std::strerror(errno));
+    }
+    _size = file_stat.st_size;
+
+    if (_size > 0) {
+      void *data =
+          ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, file_descriptor, 0);
+      if (data == MAP_FAILED) {
+        ::close(file_descriptor);
+        throw std::runtime_error("Could not map " + path + ": " +
+                                 std::strerror(errno));
+      }
+      _data = static_cast<const char *>(data);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    ::close(file_descriptor);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (_data) {
+      ::munmap(const_cast<char *>(_data), _size);
+    }
+  }
+
+  const char *data() const { return _data; }
+  size_t size() const { return _size; }
+
+  /**
+   * Asks the kernel to start reading the pages of [offset, offset +
+   * length) in the background, so that a later access does not block on
+   * a page fault. This is only a hint.
+   */
+  void prefetch(size_t offset, size_t length) const {
+    advise(offset, length, MADV_WILLNEED);
+  }
+
+  /**
+   * Passes an madvise(2) hint for the pages of [offset, offset + length),
+   * e.g. MADV_SEQUENTIAL for data that is read front to back.
+   */
+  void advise(size_t offset, size_t length, int advice) const {
+    if (!_data || length == 0 || offset >= _size) {
+      return;
+    }
+    const size_t page_size = getPageSize();
+    size_t first_page = offset / page_size * page_size;
+    ::madvise(const_cast<char *>(_data) + first_page,
+              std::min(offset + length, _size) - first_page, advice);
+  }
+
+  // Granularity of the hints, the size of a virtual memory page.
+  static size_t getPageSize() {
+    static const size_t page_size = ::sysconf(_SC_PAGESIZE);
+    return page_size;
+  }
+
+private:
+  const char *_data = nullptr;
+  size_t _size = 0;
+};
+
+} // namespace lpq::index
@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <src/KMeans.h>
+#include <src/PQIndex.h>
+#include <src/ThreadPool.h>
+#include <src/TopKSelector.h>
+#include <stdexcept>
+
+namespace lpq::index {
+
+PQIndex::PQIndex(const std::string &distance_metric, uint32_t num_subspaces,
+                 uint32_t rerank_oversample)
+    : _distance_metric(parseDistanceMetric(distance_metric)),
+      _num_subspaces(num_subspaces), _rerank_oversample(rerank_oversample),
+      _dimension(0), _num_vectors(0) {
+  if (num_subspaces == 0 || num_subspaces > MAX_NUM_SUBSPACES) {
+    throw std::invalid_argument(
+        "The number of subspaces must be between 1 and " +
+        std::to_string(MAX_NUM_SUBSPACES) + ".");
+  }
+}
+
+void PQIndex::train(const std::vector<std::vector<float>> &vectors) {
+  if (isTrained()) {
+    throw std::invalid_argument("The index is already trained.");
+  }
+  if (vectors.size() < NUM_CENTROIDS) {
+    throw std::invalid_argument("Training needs at least " +
+                                std::to_string(NUM_CENTROIDS) + " vectors.");
+  }
+  const uint32_t dimension = vectors[0].size();
+  for (const auto &vector : vectors) {
+    if (vector.size() != dimension) {
+      throw std::invalid_argument(
+          "Every vector in the dataset must have the same dimension.");
+    }
+  }
+  if (dimension < _num_subspaces) {
+    throw std::invalid_argument(
+        "The dimension must be at least the number of subspaces.");
+  }
+  _dimension = dimension;
+  std::vector<std::vector<float>> normalized_vectors;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_vectors = lpq::index::normalizeVectors(vectors);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_vectors : vectors;
+
+  // Subspaces differ in size by at most one dimension.
+  _subspace_offsets.resize(_num_subspaces + 1);
+  for (uint32_t subspace = 0; subspace <= _num_subspaces; subspace++) {
+    _subspace_offsets[subspace] =
+        uint64_t(subspace) * dimension / _num_subspaces;
+  }
+  std::vector<CodeArena<float>> codebooks;
+  for (uint32_t subspace = 0; subspace < _num_subspaces; subspace++) {
+    codebooks.push_back(trainKMeans(
+        /* vectors = */ points, /* offset = */ _subspace_offsets[subspace],
+        /* dimension = */ getSubspaceDimension(subspace),
+        /* num_centroids = */ NUM_CENTROIDS,
+        /* num_iterations = */ KMEANS_ITERATIONS,
+        /* seed = */ KMEANS_SEED + subspace));
+  }
+  _codebooks = std::move(codebooks);
+
+  if (_rerank_oversample > 0) {
+    _quantizer.quantizeVectors(points);
+    _quantization_parameters = _quantizer.getQuantizationParameters();
+    _rerank_codes = CodeArena<int_least8_t>(dimension);
+  }
+}
+
+std::vector<uint64_t>
+PQIndex::add(const std::vector<std::vector<float>> &vectors) {
+  if (vectors.empty()) {
+    return {};
+  }
+  if (!isTrained()) {
+    train(vectors);
+  }
+  for (const auto &vector : vectors) {
+    if (vector.size() != _dimension) {
+      throw std::invalid_argument(
+          "Every vector in the dataset must have the same dimension.");
+    }
+  }
+  std::vector<std::vector<float>> normalized_vectors;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_vectors = lpq::index::normalizeVectors(vectors);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_vectors : vectors;
+
+  const uint64_t num_vectors = vectors.size();
+  std::vector<uint8_t> codes(num_vectors * _num_subspaces);
+  auto &thread_pool = ThreadPool::global();
+  thread_pool.parallelFor(0, num_vectors, [&](uint64_t index) {
+    for (uint32_t subspace = 0; subspace < _num_subspaces; subspace++) {
+      const float *values =
+          points[index].data() + _subspace_offsets[subspace];
+      const uint32_t dimension = getSubspaceDimension(subspace);
+      float best_distance = std::numeric_limits<float>::infinity();
+      for (uint32_t centroid = 0; centroid < NUM_CENTROIDS; centroid++) {
+        const float *row = _codebooks[subspace].getRow(centroid);
+        float distance = 0.f;
+        for (uint32_t dim_index = 0; dim_index < dimension; dim_index++) {
+          float difference = values[dim_index] - row[dim_index];
+          distance += difference * difference;
+        }
+        if (distance < best_distance) {
+          best_distance = distance;
+          codes[index * _num_subspaces + subspace] = centroid;
+        }
+      }
+    }
+  });
+
+  // A partly filled last block is filled up before new blocks start.
+  const uint64_t first_id = _num_vectors;
+  const uint64_t end_id = first_id + num_vectors;
+  const uint32_t block_bytes = getFastScanBlockBytes(_num_subspaces);
+  const uint64_t first_block = first_id / FAST_SCAN_BLOCK_SIZE;
+  const uint64_t num_blocks =
+      (end_id + FAST_SCAN_BLOCK_SIZE - 1) / FAST_SCAN_BLOCK_SIZE;
+  _blocks.resize(num_blocks * block_bytes, 0);
+  thread_pool.parallelFor(first_block, num_blocks, [&](uint64_t block) {
+    uint8_t *block_codes = _blocks.data() + block * block_bytes;
+    const uint64_t begin =
+        std::max(first_id, block * FAST_SCAN_BLOCK_SIZE);
+    const uint64_t end =
+        std::min(end_id, (block + 1) * FAST_SCAN_BLOCK_SIZE);
+    for (uint64_t id = begin; id < end; id++) {
+      for (uint32_t subspace = 0; subspace < _num_subspaces; subspace++) {
+        setFastScanCode(
+            block_codes, subspace, id % FAST_SCAN_BLOCK_SIZE,
+            codes[(id - first_id) * _num_subspaces + subspace]);
+      }
+    }
+  });
+
+  if (_rerank_oversample > 0) {
+    auto rerank_codes = _quantizer.quantizeVectors(
+        /* vectors = */ points,
+        /* quantization_parameters = */ _quantization_parameters);
+    for (uint64_t index = 0; index < num_vectors; index++) {
+      _rerank_codes.append(rerank_codes[index].data());
+      if (_distance_metric != DistanceMetric::Euclidean) {
+        continue;
+      }
+      _rerank_squared_norms.push_back(lpq::index::dequantizedSquaredNorm(
+          /* quantization_parameters = */ _quantization_parameters,
+          /* code = */ rerank_codes[index].data()));
+    }
+  }
+  _num_vectors = end_id;
+
+  std::vector<uint64_t> ids(num_vectors);
+  std::iota(ids.begin(), ids.end(), first_id);
+  return ids;
+}
+
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+PQIndex::search(const std::vector<std::vector<float>> &queries,
+                uint32_t top_k) const {
+  std::vector<std::vector<float>> distances(queries.size());
+  std::vector<std::vector<uint64_t>> ids(queries.size());
+  if (_num_vectors == 0) {
+    return {distances, ids};
+  }
+  for (const auto &query : queries) {
+    if (query.size() != _dimension) {
+      throw std::invalid_argument("Input vectors must be of the same size in "
+                                  "order to compute the distance.");
+    }
+  }
+  std::vector<std::vector<float>> normalized_queries;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_queries = lpq::index::normalizeVectors(queries);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_queries : queries;
+
+  ThreadPool::global().parallelFor(
+      0, queries.size(),
+      [&](uint64_t index) {
+        const auto &query = points[index];
+        auto table = computeDistanceTable(query);
+        auto candidates = fastScan(
+            table, top_k * std::max<uint32_t>(_rerank_oversample, 1));
+
+        TopKSelector<uint64_t> selector(top_k);
+        if (_rerank_oversample == 0) {
+          // The exact PQ distances of the candidates, from the float table.
+          for (auto id : candidates) {
+            const uint8_t *block = getBlock(id / FAST_SCAN_BLOCK_SIZE);
+            float distance = 0.f;
+            for (uint32_t subspace = 0; subspace < _num_subspaces;
+                 subspace++) {
+              distance += table[subspace * NUM_CENTROIDS +
+                                getFastScanCode(block, subspace,
+                                                id % FAST_SCAN_BLOCK_SIZE)];
+            }
+            selector.push(distance, id);
+          }
+        } else {
+          // Every candidate is scored with one asymmetric dot product.
+          const auto prepared_query = lpq::index::prepareAsymmetricQuery(
+              /* quantization_parameters = */ _quantization_parameters,
+              /* vector = */ query.data(),
+              /* stride = */ _rerank_codes.getStride());
+          for (auto id : candidates) {
+            float inner_product =
+                lpq::index::asymmetricDotProduct(
+                    /* query = */ prepared_query.transformed_query.data(),
+                    /* codes = */ _rerank_codes.getRow(id),
+                    /* dimension = */ _rerank_codes.getStride()) -
+                prepared_query.zero_point_offset;
+            selector.push(
+                /* distance = */ _distance_metric == DistanceMetric::Euclidean
+                    ? lpq::index::euclideanDistanceFromNorms(
+                          /* first_norm = */ prepared_query.squared_norm,
+                          /* second_norm = */ _rerank_squared_norms[id],
+                          /* inner_product = */ inner_product)
+                    : -inner_product,
+                /* id = */ id);
+          }
+        }
+
+        selector.extractSorted(/* distances = */ distances[index],
+                               /* ids = */ ids[index]);
+        if (isSimilarityMetric(_distance_metric)) {
+          for (auto &distance : distances[index]) {
+            distance = -distance;
+          }
+        }
+      },
+      /* grain_size = */ 1);
+  return {distances, ids};
+}
+
+std::vector<float>
+PQIndex::computeDistanceTable(const std::vector<float> &query) const {
+  std::vector<float> table(_num_subspaces * NUM_CENTROIDS);
+  for (uint32_t subspace = 0; subspace < _num_subspaces; subspace++) {
+    const float *values = query.data() + _subspace_offsets[subspace];
+    const uint32_t dimension = getSubspaceDimension(subspace);
+    for (uint32_t centroid = 0; centroid < NUM_CENTROIDS; centroid++) {
+      const float *row = _codebooks[subspace].getRow(centroid);
+      float entry = 0.f;
+      for (uint32_t dim_index = 0; dim_index < dimension; dim_index++) {
+        if (_distance_metric == DistanceMetric::Euclidean) {
+          float difference = values[dim_index] - row[dim_index];
+          entry += difference * difference;
+        } else {
+          entry -= values[dim_index] * row[dim_index];
+        }
+      }
+      table[subspace * NUM_CENTROIDS + centroid] = entry;
+    }
+  }
+  return table;
+}
+
+std::vector<uint64_t> PQIndex::fastScan(const std::vector<float> &table,
+                                        uint32_t num_candidates) const {
+  /**
+   * Every subspace table is shifted to start at 0, and all of them share
+   * one scale that maps the widest table onto [0, 255]. The shifts add the
+   * same constant to every vector, so they do not change the ranking.
+   */
+  float max_range = 0.f;
+  std::vector<float> minima(_num_subspaces);
+  for (uint32_t subspace = 0; subspace < _num_subspaces; subspace++) {
+    auto [minimum, maximum] =
+        std::minmax_element(table.begin() + subspace * NUM_CENTROIDS,
+                            table.begin() + (subspace + 1) * NUM_CENTROIDS);
+    minima[subspace] = *minimum;
+    max_range = std::max(max_range, *maximum - *minimum);
+  }
+  const float scale = max_range > 0.f ? 255.f / max_range : 0.f;
+  AlignedVector<uint8_t> quantized_table(table.size());
+  for (uint32_t entry = 0; entry < table.size(); entry++) {
+    float value = (table[entry] - minima[entry / NUM_CENTROIDS]) * scale;
+    quantized_table[entry] =
+        static_cast<uint8_t>(std::min(std::round(value), 255.f));
+  }
+
+  TopKSelector<uint64_t> selector(num_candidates);
+  uint16_t block_distances[FAST_SCAN_BLOCK_SIZE];
+  const uint64_t num_blocks =
+      (_num_vectors + FAST_SCAN_BLOCK_SIZE - 1) / FAST_SCAN_BLOCK_SIZE;
+  for (uint64_t block = 0; block < num_blocks; block++) {
+    fastScanBlock(getBlock(block), quantized_table.data(), _num_subspaces,
+                  block_distances);
+    // The last block may be partly filled.
+    const uint64_t first_id = block * FAST_SCAN_BLOCK_SIZE;
+    const uint32_t num_slots = std::min<uint64_t>(
+        FAST_SCAN_BLOCK_SIZE, _num_vectors - first_id);
+    for (uint32_t slot = 0; slot < num_slots; slot++) {
+      selector.push(block_distances[slot], first_id + slot);
+    }
+  }
+
+  std::vector<float> distances;
+  std::vector<uint64_t> ids;
+  selector.extractSorted(/* distances = */ distances, /* ids = */ ids);
+  return ids;
+}
+
+size_t PQIndex::getMemoryUsage() const {
+  size_t memory_usage =
+      sizeof(*this) + _blocks.capacity() +
+      _subspace_offsets.capacity() * sizeof(uint32_t) +
+      _codebooks.capacity() * sizeof(CodeArena<float>) +
+      _quantization_parameters.capacity() *
+          sizeof(std::tuple<float, int_least8_t>) +
+      _rerank_codes.getMemoryUsage() +
+      _rerank_squared_norms.capacity() * sizeof(float);
+  for (const auto &codebook : _codebooks) {
+    memory_usage += codebook.getMemoryUsage();
+  }
+  return memory_usage;
+}
+
+} // namespace lpq::index
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <src/CodeArena.h>
+#include <src/DistanceMetrics.h>
+#include <src/FastScan.h>
+#include <src/LPQ.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Product quantization index. The dimensions are split into
+ * `num_subspaces` contiguous subspaces, every subspace gets a codebook of
+ * 16 centroids trained with k-means, and every vector is stored as the
+ * 4-bit index of its nearest centroid in each subspace. A vector thus
+ * takes num_subspaces / 2 bytes, e.g. 16 bytes for 32 subspaces instead of
+ * 128 bytes of int8 codes for 128 dimensions.
+ *
+ * Searches use fast-scan ADC (see FastScan.h): the distance tables of a
+ * query are quantized to uint8 and the codes are stored in blocks of 32
+ * vectors that are scored with in-register table lookups. The PQ distances
+ * of the best candidates are then recomputed exactly from the float
+ * tables.
+ *
+ * With `rerank_oversample` > 0 the index also keeps int8 codes of the
+ * vectors (like RerankingIndex keeps float vectors), collects
+ * `top_k * rerank_oversample` candidates with the fast scan and reranks
+ * them against the int8 codes with the asymmetric kernel. This recovers
+ * most of the recall lost to product quantization at the cost of one byte
+ * per dimension.
+ *
+ * Cosine search normalizes the vectors and the queries and then runs as
+ * inner product search. The returned distances are approximate.
+ *
+ * IDs are assigned sequentially starting from 0. Like RerankingIndex,
+ * `add` must not run concurrently with `search`.
+ */
+class PQIndex {
+public:
+  // Number of centroids per codebook, the most a 4-bit code can address.
+  static constexpr uint32_t NUM_CENTROIDS = 16;
+
+  /**
+   * The fast scan sums one uint8 table entry per subspace in 16 bits, so
+   * the number of subspaces is bounded.
+   */
+  static constexpr uint32_t MAX_NUM_SUBSPACES = 256;
+
+  PQIndex(const std::string &distance_metric, uint32_t num_subspaces,
+          uint32_t rerank_oversample = 0);
+
+  /**
+   * Trains the codebooks (and the int8 grid if reranking is on) on
+   * `vectors`, which must hold at least NUM_CENTROIDS vectors of at least
+   * `num_subspaces` dimensions. Does not add them. An index can only be
+   * trained once.
+   */
+  void train(const std::vector<std::vector<float>> &vectors);
+
+  /**
+   * Encodes and appends `vectors` and returns the IDs assigned to them. An
+   * untrained index is trained on the first batch.
+   */
+  std::vector<uint64_t> add(const std::vector<std::vector<float>> &vectors);
+
+  /**
+   * Returns the approximate top k vectors for every query, in the same
+   * layout as ExactSearchIndex::search. Queries run in parallel.
+   */
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  search(const std::vector<std::vector<float>> &queries, uint32_t top_k) const;
+
+  uint32_t getNumSubspaces() const { return _num_subspaces; }
+
+  uint32_t getRerankOversample() const { return _rerank_oversample; }
+
+  bool isTrained() const { return !_codebooks.empty(); }
+
+  uint32_t size() const { return _num_vectors; }
+
+  size_t getMemoryUsage() const;
+
+private:
+  static constexpr uint32_t KMEANS_ITERATIONS = 20;
+
+  // Seed of the k-means initialization, so that training is reproducible.
+  static constexpr uint32_t KMEANS_SEED = 42;
+
+  /**
+   * Returns the float distance table of `query`: NUM_CENTROIDS entries per
+   * subspace, where similarities are negated so that the distance of a
+   * vector is the sum of the entries of its codes.
+   */
+  std::vector<float>
+  computeDistanceTable(const std::vector<float> &query) const;
+
+  /**
+   * Returns the `num_candidates` vectors with the smallest fast-scan
+   * distances for `table`, in no particular order.
+   */
+  std::vector<uint64_t> fastScan(const std::vector<float> &table,
+                                 uint32_t num_candidates) const;
+
+  uint32_t getSubspaceDimension(uint32_t subspace) const {
+    return _subspace_offsets[subspace + 1] - _subspace_offsets[subspace];
+  }
+
+  const uint8_t *getBlock(uint64_t block) const {
+    return _blocks.data() + block * getFastScanBlockBytes(_num_subspaces);
+  }
+
+  DistanceMetric _distance_metric;
+  uint32_t _num_subspaces;
+  uint32_t _rerank_oversample;
+  uint32_t _dimension;
+  uint32_t _num_vectors;
+
+  // Subspace j holds dimensions [_subspace_offsets[j], _subspace_offsets[j+1]).
+  std::vector<uint32_t> _subspace_offsets;
+  std::vector<CodeArena<float>> _codebooks;
+
+  // The 4-bit codes in the fast-scan block layout.
+  AlignedVector<uint8_t> _blocks;
+
+  // Reranking data, unused unless `rerank_oversample` > 0.
+  LowPrecisionQuantizer<int_least8_t> _quantizer;
+  std::vector<std::tuple<float, int_least8_t>> _quantization_parameters;
+  CodeArena<int_least8_t> _rerank_codes;
+  // Squared norms of the dequantized int8 codes (euclidean metric only).
+  std::vector<float> _rerank_squared_norms;
+};
+
+} // namespace lpq::index
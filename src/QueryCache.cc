@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <src/QueryCache.h>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace lpq::index {
+
+QueryCache::QueryCache(size_t capacity) : _hits(0), _misses(0) {
+  if (capacity == 0) {
+    throw std::invalid_argument("The query cache capacity must be positive.");
+  }
+  const size_t num_shards = std::min(capacity, MAX_NUM_SHARDS);
+  for (size_t shard = 0; shard < num_shards; shard++) {
+    _shards.push_back(std::make_unique<Shard>());
+  }
+  _shard_capacity = (capacity + num_shards - 1) / num_shards;
+}
+
+QueryCache::Key QueryCache::makeKey(const void *codes, size_t num_bytes,
+                                    uint32_t top_k,
+                                    uint64_t filter_fingerprint) {
+  Key key;
+  key.codes.assign(static_cast<const char *>(codes), num_bytes);
+  key.top_k = top_k;
+  key.filter_fingerprint = filter_fingerprint;
+
+  uint64_t hash = std::hash<std::string_view>()(key.codes);
+  for (uint64_t value : {uint64_t(top_k), filter_fingerprint}) {
+    hash = (hash ^ value) * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 32;
+  }
+  key.hash = hash;
+  return key;
+}
+
+bool QueryCache::lookup(const Key &key, uint64_t version,
+                        std::vector<float> &distances,
+                        std::vector<uint64_t> &ids) {
+  Shard &shard = getShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto position = shard.positions.find(key);
+  if (position == shard.positions.end() ||
+      position->second->version != version) {
+    // Results of an older version can never be returned again.
+    if (position != shard.positions.end() &&
+        position->second->version < version) {
+      shard.entries.erase(position->second);
+      shard.positions.erase(position);
+    }
+    _misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  shard.entries.splice(shard.entries.begin(), shard.entries,
+                       position->second);
+  distances = position->second->distances;
+  ids = position->second->ids;
+  _hits.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void QueryCache::insert(Key key, uint64_t version,
+                        std::vector<float> distances,
+                        std::vector<uint64_t> ids) {
+  Shard &shard = getShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto position = shard.positions.find(key);
+  if (position != shard.positions.end()) {
+    // A search of an older snapshot must not replace newer results.
+    if (position->second->version > version) {
+      return;
+    }
+    shard.entries.erase(position->second);
+    shard.positions.erase(position);
+  } else if (shard.entries.size() == _shard_capacity) {
+    shard.positions.erase(shard.entries.back().key);
+    shard.entries.pop_back();
+  }
+  shard.entries.push_front({std::move(key), version, std::move(distances),
+                            std::move(ids)});
+  shard.positions.emplace(shard.entries.front().key, shard.entries.begin());
+}
+
+QueryCache::Stats QueryCache::getStats() const {
+  Stats stats{/* hits = */ _hits.load(std::memory_order_relaxed),
+              /* misses = */ _misses.load(std::memory_order_relaxed),
+              /* entries = */ 0};
+  for (const auto &shard : _shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats.entries += shard->entries.size();
+  }
+  return stats;
+}
+
+} // namespace lpq::index
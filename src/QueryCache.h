@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * A cache of search results for repeated queries, see
+ * ExactSearchIndex::setQueryCacheCapacity. Queries are looked up by the
+ * exact bytes of their (quantized) codes together with k and the
+ * fingerprint of their allow list, so only identical queries hit.
+ *
+ * Every entry records the version of the index it was computed on. The
+ * index bumps its version on every add and remove, and an entry of an
+ * older version is dropped instead of returned, so results never outlive
+ * the index contents they were computed from.
+ *
+ * The entries are spread over shards by the hash of their key, and every
+ * shard is a separate LRU list behind its own mutex, so that concurrent
+ * searches rarely wait for each other.
+ */
+class QueryCache {
+public:
+  struct Key {
+    std::string codes;
+    uint32_t top_k;
+    uint64_t filter_fingerprint;
+    uint64_t hash;
+
+    bool operator==(const Key &other) const {
+      return hash == other.hash && top_k == other.top_k &&
+             filter_fingerprint == other.filter_fingerprint &&
+             codes == other.codes;
+    }
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t entries;
+  };
+
+  /**
+   * Holds up to `capacity` results in total. Every shard holds an equal
+   * share, so a cache smaller than the number of shards uses fewer shards.
+   */
+  explicit QueryCache(size_t capacity);
+
+  /**
+   * Builds the key of a query with `num_bytes` bytes of codes at `codes`.
+   * Unfiltered searches use a filter fingerprint of 0.
+   */
+  static Key makeKey(const void *codes, size_t num_bytes, uint32_t top_k,
+                     uint64_t filter_fingerprint);
+
+  /**
+   * Copies the results cached for `key` at index version `version` into
+   * `distances` and `ids` and returns true, or returns false if there are
+   * none.
+   */
+  bool lookup(const Key &key, uint64_t version, std::vector<float> &distances,
+              std::vector<uint64_t> &ids);
+
+  /**
+   * Caches the results of `key` computed at index version `version`,
+   * evicting the least recently used entry of its shard if it is full.
+   */
+  void insert(Key key, uint64_t version, std::vector<float> distances,
+              std::vector<uint64_t> ids);
+
+  Stats getStats() const;
+
+private:
+  struct Entry {
+    Key key;
+    uint64_t version;
+    std::vector<float> distances;
+    std::vector<uint64_t> ids;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const { return key.hash; }
+  };
+
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> positions;
+  };
+
+  Shard &getShard(const Key &key) {
+    // The low bits of the hash pick the bucket inside the shard's map.
+    return *_shards[(key.hash >> 48) % _shards.size()];
+  }
+
+  static constexpr size_t MAX_NUM_SHARDS = 16;
+
+  std::vector<std::unique_ptr<Shard>> _shards;
+  size_t _shard_capacity;
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+};
+
+} // namespace lpq::index
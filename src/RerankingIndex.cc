@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <src/RerankingIndex.h>
+#include <src/ThreadPool.h>
+#include <src/TopKSelector.h>
+#include <stdexcept>
+#include <utility>
+
+namespace lpq::index {
+
+RerankingIndex::RerankingIndex(const std::string &distance_metric,
+                               uint32_t oversample)
+    : _distance_metric(parseDistanceMetric(distance_metric)),
+      _oversample(oversample), _dimension(0), _codes(distance_metric),
+      _mapped_vectors(nullptr) {
+  if (oversample == 0) {
+    throw std::invalid_argument("The oversample factor must be positive.");
+  }
+}
+
+std::vector<uint64_t>
+RerankingIndex::add(const std::vector<std::vector<float>> &vectors) {
+  if (_mapped_file) {
+    throw std::invalid_argument(
+        "Vectors cannot be added to an index built from a file.");
+  }
+  if (vectors.empty()) {
+    return {};
+  }
+  auto ids = addQuantized(vectors);
+
+  uint64_t first_row = _float_vectors.size();
+  _float_vectors.resize(first_row + vectors.size());
+  ThreadPool::global().parallelFor(0, vectors.size(), [&](uint64_t index) {
+    std::copy(vectors[index].begin(), vectors[index].end(),
+              _float_vectors.getMutableRow(first_row + index));
+  });
+  return ids;
+}
+
+void RerankingIndex::addFromFile(const std::string &path,
+                                 uint32_t dimension) {
+  if (size() > 0) {
+    throw std::invalid_argument(
+        "Only an empty index can be built from a file.");
+  }
+  if (dimension == 0) {
+    throw std::invalid_argument("The dimension must be positive.");
+  }
+  auto mapped_file = std::make_unique<MappedFile>(path);
+  const size_t row_bytes = dimension * sizeof(float);
+  if (mapped_file->size() % row_bytes != 0) {
+    throw std::invalid_argument(
+        "The size of " + path +
+        " is not a multiple of the size of a row with the given dimension.");
+  }
+  const size_t num_vectors = mapped_file->size() / row_bytes;
+  const auto *rows = reinterpret_cast<const float *>(mapped_file->data());
+
+  auto getBatch = [rows, dimension](size_t begin, size_t end) {
+    std::vector<std::vector<float>> batch(end - begin);
+    for (size_t row = begin; row < end; row++) {
+      batch[row - begin].assign(rows + row * dimension,
+                                rows + (row + 1) * dimension);
+    }
+    return batch;
+  };
+
+  /**
+   * The file may not fit in RAM, so the quantization grid is fitted on a
+   * prefix of it and the rows are then quantized and indexed in batches.
+   * Values outside the range of the prefix are clamped; the rerank stage
+   * works on the exact values anyway.
+   */
+  _dimension = dimension;
+  _quantizer.quantizeVectors(
+      getBatch(0, std::min<size_t>(num_vectors, QUANTIZATION_SAMPLE_SIZE)));
+  _quantization_parameters = _quantizer.getQuantizationParameters();
+  _codes.setQuantizationParameters(_quantization_parameters);
+
+  for (size_t begin = 0; begin < num_vectors; begin += FILE_BATCH_SIZE) {
+    size_t end = std::min<size_t>(num_vectors, begin + FILE_BATCH_SIZE);
+    addQuantized(getBatch(begin, end));
+  }
+  _mapped_file = std::move(mapped_file);
+  _mapped_vectors = rows;
+}
+
+std::vector<uint64_t>
+RerankingIndex::addQuantized(const std::vector<std::vector<float>> &vectors) {
+  const uint32_t dimension = size() == 0 && _quantization_parameters.empty()
+                                 ? vectors[0].size()
+                                 : _dimension;
+  for (const auto &vector : vectors) {
+    if (vector.size() != dimension) {
+      throw std::invalid_argument(
+          "Every vector in the dataset must have the same dimension.");
+    }
+  }
+
+  if (_quantization_parameters.empty()) {
+    // The first batch fits the quantization grid that every later batch
+    // is quantized with.
+    _dimension = dimension;
+    _float_vectors = CodeArena<float>(dimension);
+    auto codes = _quantizer.quantizeVectors(vectors);
+    _quantization_parameters = _quantizer.getQuantizationParameters();
+    _codes.setQuantizationParameters(_quantization_parameters);
+    return _codes.add(codes);
+  }
+  return _codes.add(_quantizer.quantizeVectors(
+      /* vectors = */ vectors,
+      /* quantization_parameters = */ _quantization_parameters));
+}
+
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+RerankingIndex::search(const std::vector<std::vector<float>> &queries,
+                       uint32_t top_k) const {
+  std::vector<std::vector<float>> distances(queries.size());
+  std::vector<std::vector<uint64_t>> ids(queries.size());
+  if (size() == 0) {
+    return {distances, ids};
+  }
+
+  /**
+   * The first stage keeps the queries in float and scores them against
+   * the int8 codes (asymmetric distance computation). It still only reads
+   * the int8 codes, but ranks candidates better than quantized queries
+   * would, so a smaller oversample factor reaches the same recall.
+   */
+  auto [candidate_distances, candidate_ids] =
+      _codes.searchAsymmetric(queries, top_k * _oversample);
+
+  auto &thread_pool = ThreadPool::global();
+  thread_pool.parallelFor(
+      0, queries.size(),
+      [&](uint64_t index) {
+        std::tie(distances[index], ids[index]) = rerank(
+            /* query = */ queries[index],
+            /* candidates = */ candidate_ids[index], /* top_k = */ top_k);
+      },
+      /* grain_size = */ 1);
+  return {distances, ids};
+}
+
+std::tuple<std::vector<float>, std::vector<uint64_t>>
+RerankingIndex::rerank(const std::vector<float> &query,
+                       const std::vector<uint64_t> &candidates,
+                       uint32_t top_k) const {
+  const float *query_vector = query.data();
+  const float query_inverse_norm = lpq::index::inverseNorm(
+      lpq::index::dotProduct(query_vector, query_vector, _dimension));
+  const uint32_t num_candidates = candidates.size();
+
+  /**
+   * Candidate rows are scattered over the float vectors, so every row is
+   * likely a cache miss (or a page fault for a mapped file). We prefetch
+   * the next batch of rows while the current one is scored so that their
+   * loads overlap with useful work.
+   */
+  prefetchRows(candidates.data(),
+               std::min(num_candidates, PREFETCH_BATCH_SIZE));
+
+  TopKSelector<uint64_t> selector(top_k);
+  for (uint32_t index = 0; index < num_candidates; index++) {
+    if (index % PREFETCH_BATCH_SIZE == 0 &&
+        index + PREFETCH_BATCH_SIZE < num_candidates) {
+      prefetchRows(candidates.data() + index + PREFETCH_BATCH_SIZE,
+                   std::min(PREFETCH_BATCH_SIZE,
+                            num_candidates - index - PREFETCH_BATCH_SIZE));
+    }
+
+    uint64_t id = candidates[index];
+    const float *vector = getFloatVector(id);
+    if (_distance_metric == DistanceMetric::Euclidean) {
+      selector.push(
+          /* distance = */ lpq::index::earlyAbandonEuclideanDistance(
+              /* first_vector = */ query_vector,
+              /* second_vector = */ vector, /* dimension = */ _dimension,
+              /* threshold = */ selector.threshold()),
+          /* id = */ id);
+      continue;
+    }
+
+    float score = lpq::index::dotProduct(query_vector, vector, _dimension);
+    if (_distance_metric == DistanceMetric::Cosine) {
+      score *= query_inverse_norm *
+               lpq::index::inverseNorm(
+                   lpq::index::dotProduct(vector, vector, _dimension));
+    }
+    // The selector minimizes, so similarities are negated.
+    selector.push(/* distance = */ -score, /* id = */ id);
+  }
+
+  std::vector<float> distances;
+  std::vector<uint64_t> ids;
+  selector.extractSorted(/* distances = */ distances, /* ids = */ ids);
+  if (isSimilarityMetric(_distance_metric)) {
+    for (auto &distance : distances) {
+      distance = -distance;
+    }
+  }
+  return {std::move(distances), std::move(ids)};
+}
+
+void RerankingIndex::prefetchRows(const uint64_t *ids, uint32_t count) const {
+  const size_t row_bytes = _dimension * sizeof(float);
+  if (_mapped_file && count > 0) {
+    /**
+     * One madvise per row would cost a system call per candidate. The rows
+     * are sorted by offset instead and rows within the same or adjacent
+     * pages are merged into one range per hint.
+     */
+    std::array<uint64_t, PREFETCH_BATCH_SIZE> sorted_ids;
+    std::copy(ids, ids + count, sorted_ids.begin());
+    std::sort(sorted_ids.begin(), sorted_ids.begin() + count);
+    const size_t page_size = MappedFile::getPageSize();
+    size_t range_begin = sorted_ids[0] * row_bytes;
+    size_t range_end = range_begin + row_bytes;
+    for (uint32_t index = 1; index < count; index++) {
+      const size_t row_begin = sorted_ids[index] * row_bytes;
+      if (row_begin / page_size > (range_end - 1) / page_size + 1) {
+        _mapped_file->prefetch(range_begin, range_end - range_begin);
+        range_begin = row_begin;
+      }
+      range_end = std::max(range_end, row_begin + row_bytes);
+    }
+    _mapped_file->prefetch(range_begin, range_end - range_begin);
+  }
+  for (uint32_t index = 0; index < count; index++) {
+    const auto *row =
+        reinterpret_cast<const char *>(getFloatVector(ids[index]));
+    for (size_t line = 0; line < row_bytes; line += CODE_ALIGNMENT) {
+      __builtin_prefetch(row + line);
+    }
+  }
+}
+
+size_t RerankingIndex::getMemoryUsage() const {
+  return sizeof(*this) + _codes.getMemoryUsage() +
+         _float_vectors.getMemoryUsage() +
+         _quantization_parameters.capacity() *
+             sizeof(std::tuple<float, int_least8_t>);
+}
+
+} // namespace lpq::index
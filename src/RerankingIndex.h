@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <src/CodeArena.h>
+#include <src/DistanceMetrics.h>
+#include <src/ExactSearch.h>
+#include <src/LPQ.h>
+#include <src/MappedFile.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Two-stage search index. The vectors are quantized to int8 and scanned
+ * with an ExactSearchIndex to collect `top_k * oversample` candidates,
+ * which are then reranked with exact float distances against the
+ * original vectors. The scan reads a quarter of the bytes a float scan
+ * would, and the rerank recovers most of the recall lost to quantization.
+ *
+ * The original vectors are either kept in RAM (`add`) or read from a
+ * memory-mapped file of raw float32 rows (`addFromFile`), in which case
+ * only the rows of the candidates are ever paged in.
+ *
+ * IDs are assigned sequentially starting from 0, and the ID of a vector is
+ * its row in the float vectors. Unlike ExactSearchIndex, `add` must not
+ * run concurrently with `search`.
+ */
+class RerankingIndex {
+public:
+  static constexpr uint32_t DEFAULT_OVERSAMPLE = 4;
+
+  RerankingIndex(const std::string &distance_metric,
+                 uint32_t oversample = DEFAULT_OVERSAMPLE);
+
+  /**
+   * Quantizes and indexes `vectors` and keeps a float copy for reranking.
+   * The quantization grid is fitted on the first batch and reused for all
+   * later ones. Returns the IDs assigned to the vectors.
+   */
+  std::vector<uint64_t> add(const std::vector<std::vector<float>> &vectors);
+
+  /**
+   * Indexes every row of a file that holds `dimension` float32 values per
+   * row and nothing else (e.g. the output of numpy's `tofile`). The file
+   * is mapped instead of copied and must not change while the index
+   * exists. Only an empty index can be built from a file, and no vectors
+   * can be added afterwards.
+   */
+  void addFromFile(const std::string &path, uint32_t dimension);
+
+  /**
+   * Returns the top k vectors for every query, with exact float distances,
+   * in the same layout as ExactSearchIndex::search.
+   */
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  search(const std::vector<std::vector<float>> &queries,
+         uint32_t top_k) const;
+
+  uint32_t size() const { return _codes.size(); }
+
+  /**
+   * Returns the number of bytes held in RAM by the index. Float vectors
+   * read from a mapped file are not included.
+   */
+  size_t getMemoryUsage() const;
+
+private:
+  /**
+   * Number of candidate rows whose memory is prefetched ahead of the row
+   * that is being reranked.
+   */
+  static constexpr uint32_t PREFETCH_BATCH_SIZE = 16;
+
+  /**
+   * Number of rows that are read from a mapped file and quantized at a
+   * time while building the index.
+   */
+  static constexpr uint32_t FILE_BATCH_SIZE = 65536;
+
+  /**
+   * Number of rows of a mapped file used to fit the quantization grid.
+   */
+  static constexpr uint32_t QUANTIZATION_SAMPLE_SIZE = 100000;
+
+  const float *getFloatVector(uint64_t id) const {
+    return _mapped_vectors ? _mapped_vectors + id * _dimension
+                           : _float_vectors.getRow(id);
+  }
+
+  /**
+   * Issues prefetches for the float rows of `ids`: page read-ahead hints
+   * for mapped rows, one per run of nearby pages, and cache line
+   * prefetches for all rows. At most PREFETCH_BATCH_SIZE rows.
+   */
+  void prefetchRows(const uint64_t *ids, uint32_t count) const;
+
+  /**
+   * Reranks `candidates` with exact float distances and returns the best
+   * `top_k` of them.
+   */
+  std::tuple<std::vector<float>, std::vector<uint64_t>>
+  rerank(const std::vector<float> &query,
+         const std::vector<uint64_t> &candidates, uint32_t top_k) const;
+
+  std::vector<uint64_t>
+  addQuantized(const std::vector<std::vector<float>> &vectors);
+
+  DistanceMetric _distance_metric;
+  uint32_t _oversample;
+  uint32_t _dimension;
+
+  LowPrecisionQuantizer<int_least8_t> _quantizer;
+  std::vector<std::tuple<float, int_least8_t>> _quantization_parameters;
+  ExactSearchIndex<int_least8_t> _codes;
+
+  // Float vectors kept in RAM, unused if the index was built from a file.
+  CodeArena<float> _float_vectors;
+  std::unique_ptr<MappedFile> _mapped_file;
+  const float *_mapped_vectors;
+};
+
+} // namespace lpq::index
@@ -0,0 +1,157 @@
+#include <src/SearchFuture.h>
+#include <utility>
+
+namespace lpq::index {
+
+bool SearchFuture::isReady() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  return _state->status == Status::Finished ||
+         _state->status == Status::Cancelled;
+}
+
+void SearchFuture::wait() const {
+  std::unique_lock<std::mutex> lock(_state->mutex);
+  _state->ready.wait(lock, [this] {
+    return _state->status == Status::Finished ||
+           _state->status == Status::Cancelled;
+  });
+}
+
+const SearchResults &SearchFuture::get() const {
+  wait();
+  // The state no longer changes once it is ready.
+  if (_state->exception) {
+    std::rethrow_exception(_state->exception);
+  }
+  return _state->results;
+}
+
+bool SearchFuture::cancel() {
+  std::unique_lock<std::mutex> lock(_state->mutex);
+  if (_state->status != Status::Queued) {
+    return false;
+  }
+  _state->exception = std::make_exception_ptr(
+      SearchCancelled("The search was cancelled before it started."));
+  complete(/* lock = */ lock, /* status = */ Status::Cancelled);
+  return true;
+}
+
+bool SearchFuture::isCancelled() const {
+  std::lock_guard<std::mutex> lock(_state->mutex);
+  return _state->status == Status::Cancelled;
+}
+
+void SearchFuture::onComplete(Callback callback) {
+  std::unique_lock<std::mutex> lock(_state->mutex);
+  if (_state->status != Status::Finished &&
+      _state->status != Status::Cancelled) {
+    _state->callbacks.push_back(std::move(callback));
+    return;
+  }
+  lock.unlock();
+  try {
+    callback(*this);
+  } catch (...) {
+  }
+}
+
+void SearchFuture::complete(std::unique_lock<std::mutex> &lock,
+                            Status status) {
+  _state->status = status;
+  auto callbacks = std::move(_state->callbacks);
+  lock.unlock();
+  _state->ready.notify_all();
+  for (auto &callback : callbacks) {
+    try {
+      callback(*this);
+    } catch (...) {
+    }
+  }
+}
+
+SearchExecutor::SearchExecutor(uint32_t num_threads) : _stopping(false) {
+  if (num_threads == 0) {
+    throw std::invalid_argument(
+        "A search executor needs at least one thread.");
+  }
+  for (uint32_t thread = 0; thread < num_threads; thread++) {
+    _threads.emplace_back(&SearchExecutor::dispatchLoop, this);
+  }
+}
+
+SearchExecutor::~SearchExecutor() {
+  std::deque<Submission> queue;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+    queue = std::move(_queue);
+  }
+  _submitted.notify_all();
+  for (auto &submission : queue) {
+    submission.future.cancel();
+  }
+  for (auto &thread : _threads) {
+    thread.join();
+  }
+}
+
+SearchExecutor &SearchExecutor::global() {
+  static SearchExecutor executor(/* num_threads = */ DEFAULT_NUM_THREADS);
+  return executor;
+}
+
+SearchFuture SearchExecutor::submit(std::function<SearchResults()> search) {
+  SearchFuture future(std::make_shared<SearchFuture::State>());
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_stopping) {
+      throw std::runtime_error("The search executor is shutting down.");
+    }
+    _queue.push_back({future, std::move(search)});
+  }
+  _submitted.notify_one();
+  return future;
+}
+
+void SearchExecutor::dispatchLoop() {
+  while (true) {
+    std::unique_lock<std::mutex> queue_lock(_mutex);
+    _submitted.wait(queue_lock,
+                    [this] { return _stopping || !_queue.empty(); });
+    if (_queue.empty()) {
+      return;
+    }
+    Submission submission = std::move(_queue.front());
+    _queue.pop_front();
+    queue_lock.unlock();
+
+    auto &state = *submission.future._state;
+    {
+      // Cancelled searches stay in the queue until we get to them.
+      std::lock_guard<std::mutex> lock(state.mutex);
+      if (state.status == SearchFuture::Status::Cancelled) {
+        continue;
+      }
+      state.status = SearchFuture::Status::Running;
+    }
+
+    SearchResults results;
+    std::exception_ptr exception;
+    try {
+      results = submission.search();
+    } catch (...) {
+      exception = std::current_exception();
+    }
+    // Destroys whatever the search captured before the callbacks run.
+    submission.search = nullptr;
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.results = std::move(results);
+    state.exception = exception;
+    submission.future.complete(
+        /* lock = */ lock, /* status = */ SearchFuture::Status::Finished);
+  }
+}
+
+} // namespace lpq::index
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace lpq::index {
+
+// Distances and ids of a batch, in the layout of ExactSearchIndex::search.
+using SearchResults = std::tuple<std::vector<std::vector<float>>,
+                                 std::vector<std::vector<uint64_t>>>;
+
+// Thrown by SearchFuture::get for a search that was cancelled.
+class SearchCancelled : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+/**
+ * The result of a search submitted to a SearchExecutor, see
+ * ExactSearchIndex::searchAsync. Copies of a future share the same
+ * search.
+ */
+class SearchFuture {
+public:
+  using Callback = std::function<void(const SearchFuture &)>;
+
+  // True once the search finished, failed or was cancelled.
+  bool isReady() const;
+
+  void wait() const;
+
+  /**
+   * Waits for the search and returns its results. Rethrows the exception
+   * of a failed search, and throws SearchCancelled if it was cancelled.
+   */
+  const SearchResults &get() const;
+
+  /**
+   * Cancels the search if it has not started yet and returns whether it
+   * did. A search that is already running is finished.
+   */
+  bool cancel();
+
+  bool isCancelled() const;
+
+  /**
+   * Calls `callback` once the future is ready: on the thread that
+   * completes or cancels the search, or right away if it already is.
+   * Exceptions thrown by callbacks are ignored.
+   */
+  void onComplete(Callback callback);
+
+private:
+  enum class Status { Queued, Running, Finished, Cancelled };
+
+  struct State {
+    std::mutex mutex;
+    std::condition_variable ready;
+    Status status = Status::Queued;
+    SearchResults results;
+    std::exception_ptr exception;
+    std::vector<Callback> callbacks;
+  };
+
+  explicit SearchFuture(std::shared_ptr<State> state)
+      : _state(std::move(state)) {}
+
+  /**
+   * Moves the future to `status` and runs its callbacks. The caller must
+   * hold `lock` on the state, which is released.
+   */
+  void complete(std::unique_lock<std::mutex> &lock, Status status);
+
+  std::shared_ptr<State> _state;
+
+  friend class SearchExecutor;
+};
+
+/**
+ * Runs searches in the background on a few dispatch threads, in the order
+ * they were submitted. The dispatch threads only drive the searches: each
+ * search still spreads its work over the global ThreadPool, so a second
+ * dispatch thread is enough to overlap a small batch with the next one.
+ */
+class SearchExecutor {
+public:
+  explicit SearchExecutor(uint32_t num_threads);
+
+  SearchExecutor(const SearchExecutor &) = delete;
+  SearchExecutor &operator=(const SearchExecutor &) = delete;
+
+  // Cancels the searches that have not started and waits for the others.
+  ~SearchExecutor();
+
+  // The executor used by ExactSearchIndex::searchAsync.
+  static SearchExecutor &global();
+
+  // Queues `search` and returns the future of its results.
+  SearchFuture submit(std::function<SearchResults()> search);
+
+private:
+  struct Submission {
+    SearchFuture future;
+    std::function<SearchResults()> search;
+  };
+
+  void dispatchLoop();
+
+  static constexpr uint32_t DEFAULT_NUM_THREADS = 2;
+
+  std::mutex _mutex;
+  std::condition_variable _submitted;
+  std::deque<Submission> _queue;
+  bool _stopping;
+  std::vector<std::thread> _threads;
+};
+
+} // namespace lpq::index
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <cmath>
+#include <src/SearchStats.h>
+
+namespace lpq::index {
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+  for (uint32_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+    _counts[bucket] += other._counts[bucket];
+  }
+  _count += other._count;
+  _sum += other._sum;
+}
+
+uint64_t LatencyHistogram::min() const {
+  for (uint32_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+    if (_counts[bucket] > 0) {
+      return getBucketStart(bucket);
+    }
+  }
+  return 0;
+}
+
+uint64_t LatencyHistogram::max() const {
+  for (uint32_t bucket = NUM_BUCKETS; bucket-- > 0;) {
+    if (_counts[bucket] > 0) {
+      return getBucketEnd(bucket);
+    }
+  }
+  return 0;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const {
+  if (_count == 0) {
+    return 0;
+  }
+  percentile = std::clamp(percentile, 0., 100.);
+  const uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(percentile / 100. * _count)));
+  uint64_t seen = 0;
+  for (uint32_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+    seen += _counts[bucket];
+    if (seen >= rank) {
+      return getBucketEnd(bucket);
+    }
+  }
+  return max();
+}
+
+uint64_t LatencyHistogram::getBucketStart(uint32_t bucket) {
+  const uint32_t shift =
+      bucket < (2u << SUB_BUCKET_BITS) ? 0 : (bucket >> SUB_BUCKET_BITS) - 1;
+  const uint64_t mantissa = bucket - (uint64_t(shift) << SUB_BUCKET_BITS);
+  return mantissa << shift;
+}
+
+uint64_t LatencyHistogram::getBucketEnd(uint32_t bucket) {
+  const uint32_t shift =
+      bucket < (2u << SUB_BUCKET_BITS) ? 0 : (bucket >> SUB_BUCKET_BITS) - 1;
+  return getBucketStart(bucket) + (uint64_t(1) << shift) - 1;
+}
+
+void SearchStats::merge(const SearchStats &other) {
+  num_searches += other.num_searches;
+  num_queries += other.num_queries;
+  if (other.num_searches > 0) {
+    last_search_nanoseconds = other.last_search_nanoseconds;
+  }
+  total_search_nanoseconds += other.total_search_nanoseconds;
+  scan.add(other.scan);
+  search_latency.merge(other.search_latency);
+  query_latency.merge(other.query_latency);
+}
+
+} // namespace lpq::index
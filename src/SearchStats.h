@@ -0,0 +1,188 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <src/TopKSelector.h>
+#include <type_traits>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * A histogram of latencies in nanoseconds with a bounded relative error,
+ * in the style of HdrHistogram. Every power of two is split into 32
+ * linear buckets, so a recorded value is reported with an error of at
+ * most 1/32 (about 3%), whatever its magnitude, in 1920 counters.
+ */
+class LatencyHistogram {
+public:
+  LatencyHistogram() : _counts(NUM_BUCKETS, 0), _count(0), _sum(0) {}
+
+  void record(uint64_t nanoseconds) {
+    _counts[getBucket(nanoseconds)]++;
+    _count++;
+    _sum += nanoseconds;
+  }
+
+  void merge(const LatencyHistogram &other);
+
+  uint64_t count() const { return _count; }
+
+  double mean() const { return _count == 0 ? 0. : double(_sum) / _count; }
+
+  uint64_t min() const;
+
+  uint64_t max() const;
+
+  /**
+   * Returns the smallest latency that at least `percentile` percent of
+   * the recorded latencies do not exceed, rounded up to the end of its
+   * bucket. Returns 0 for an empty histogram.
+   */
+  uint64_t percentile(double percentile) const;
+
+private:
+  static constexpr uint32_t SUB_BUCKET_BITS = 5;
+  static constexpr uint32_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1)
+                                          << SUB_BUCKET_BITS;
+
+  /**
+   * Values below 32 have a bucket each. Larger values keep their leading
+   * 6 bits (the mantissa, between 32 and 63) and the number of bits
+   * shifted out, and both make up the bucket.
+   */
+  static uint32_t getBucket(uint64_t value) {
+    const uint32_t highest_bit = 63 - __builtin_clzll(value | 1);
+    const uint32_t shift =
+        highest_bit < SUB_BUCKET_BITS ? 0 : highest_bit - SUB_BUCKET_BITS;
+    return (shift << SUB_BUCKET_BITS) + (value >> shift);
+  }
+
+  static uint64_t getBucketStart(uint32_t bucket);
+
+  static uint64_t getBucketEnd(uint32_t bucket);
+
+  std::vector<uint64_t> _counts;
+  uint64_t _count;
+  uint64_t _sum;
+};
+
+/**
+ * Work done by the scans of a search. Each scan task counts into its own
+ * copy, which is added up once the task is done.
+ */
+struct ScanCounters {
+  // Candidates scored (fully or until they were abandoned).
+  uint64_t distances_computed = 0;
+  // Euclidean candidates whose partial distance already exceeded the
+  // k^th best, so scoring them stopped early.
+  uint64_t early_abandoned = 0;
+  // Live rows skipped because they are not in the allow list.
+  uint64_t filtered_out = 0;
+  // Candidates that made it into the top k selector.
+  uint64_t heap_insertions = 0;
+
+  void add(const ScanCounters &other) {
+    distances_computed += other.distances_computed;
+    early_abandoned += other.early_abandoned;
+    filtered_out += other.filtered_out;
+    heap_insertions += other.heap_insertions;
+  }
+};
+
+/**
+ * Statistics of the searches of an index since stats were enabled or last
+ * reset, see ExactSearchIndex::setSearchStatsEnabled.
+ */
+struct SearchStats {
+  uint64_t num_searches = 0;
+  uint64_t num_queries = 0;
+  // Wall time of the last call and of all calls together.
+  uint64_t last_search_nanoseconds = 0;
+  uint64_t total_search_nanoseconds = 0;
+  ScanCounters scan;
+  // Wall time of every call.
+  LatencyHistogram search_latency;
+  // Time from the start of its call until the results of a query were
+  // final, for every query.
+  LatencyHistogram query_latency;
+
+  void merge(const SearchStats &other);
+};
+
+/**
+ * A TopKSelector that counts the work of the scans it is passed to. The
+ * search only uses it while stats are enabled, so that the scan of a
+ * search without stats does not count anything.
+ */
+class CountingTopKSelector {
+public:
+  explicit CountingTopKSelector(uint32_t top_k = 0) : _selector(top_k) {}
+
+  // Empties the selector and its counters, see TopKSelector::reset.
+  void reset(uint32_t top_k) {
+    _selector.reset(top_k);
+    counters = ScanCounters();
+  }
+
+  float threshold() const { return _selector.threshold(); }
+
+  void push(float distance, uint64_t id) {
+    counters.heap_insertions += _selector.push(distance, id);
+  }
+
+  void extractSorted(std::vector<float> &distances,
+                     std::vector<uint64_t> &ids) {
+    _selector.extractSorted(distances, ids);
+  }
+
+  ScanCounters counters;
+
+private:
+  TopKSelector<uint64_t> _selector;
+};
+
+template <typename SELECTOR>
+constexpr bool COUNTS_SCAN = std::is_same_v<SELECTOR, CountingTopKSelector>;
+
+/**
+ * Collects the statistics of one search call from its scan tasks. The
+ * clock starts when the collector is created.
+ */
+class SearchStatsCollector {
+public:
+  SearchStatsCollector() : _start(std::chrono::steady_clock::now()) {}
+
+  // Adds the counters of a query whose results are final.
+  void recordQuery(const ScanCounters &counters) {
+    uint64_t nanoseconds = getElapsedNanoseconds();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.num_queries++;
+    _stats.scan.add(counters);
+    _stats.query_latency.record(nanoseconds);
+  }
+
+  // Returns the statistics of the whole call.
+  SearchStats finish() {
+    uint64_t nanoseconds = getElapsedNanoseconds();
+    _stats.num_searches = 1;
+    _stats.last_search_nanoseconds = nanoseconds;
+    _stats.total_search_nanoseconds = nanoseconds;
+    _stats.search_latency.record(nanoseconds);
+    return std::move(_stats);
+  }
+
+private:
+  uint64_t getElapsedNanoseconds() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - _start)
+        .count();
+  }
+
+  std::chrono::steady_clock::time_point _start;
+  std::mutex _mutex;
+  SearchStats _stats;
+};
+
+} // namespace lpq::index
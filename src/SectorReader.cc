@@ -0,0 +1,111 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <src/SectorReader.h>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace lpq::index {
+
+SectorReader::SectorReader(const std::string &path, uint32_t num_threads)
+    : _path(path), _stopping(false) {
+  _file_descriptor = ::open(path.c_str(), O_RDONLY);
+  if (_file_descriptor < 0) {
+    throw std::invalid_argument("Could not open " + path + ": " +
+                                std::strerror(errno));
+  }
+  ::posix_fadvise(_file_descriptor, 0, 0, POSIX_FADV_RANDOM);
+  for (uint32_t thread = 0; thread < num_threads; thread++) {
+    _threads.emplace_back([this] { workerLoop(); });
+  }
+}
+
+SectorReader::~SectorReader() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _jobs_available.notify_all();
+  for (auto &thread : _threads) {
+    thread.join();
+  }
+  ::close(_file_descriptor);
+}
+
+void SectorReader::read(const Request *requests, uint32_t num_requests) {
+  if (num_requests == 0) {
+    return;
+  }
+  Batch batch{/* remaining = */ num_requests, /* error = */ 0};
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (uint32_t index = 0; index < num_requests; index++) {
+    _jobs.push_back({&requests[index], &batch});
+  }
+  _jobs_available.notify_all();
+
+  // Helping with whatever is queued keeps the disk busy even when every
+  // I/O thread is blocked on another batch.
+  while (batch.remaining > 0) {
+    if (_jobs.empty()) {
+      _batch_done.wait(lock);
+      continue;
+    }
+    Job job = _jobs.front();
+    _jobs.pop_front();
+    lock.unlock();
+    int error = readRange(*job.request);
+    lock.lock();
+    finishJob(job, error);
+  }
+  if (batch.error != 0) {
+    throw std::runtime_error("Could not read " + _path + ": " +
+                             std::strerror(batch.error));
+  }
+}
+
+int SectorReader::readRange(const Request &request) const {
+  uint64_t done = 0;
+  while (done < request.length) {
+    ssize_t result = ::pread(_file_descriptor, request.buffer + done,
+                             request.length - done, request.offset + done);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    if (result == 0) {
+      // The range ends past the end of the file.
+      return EIO;
+    }
+    done += result;
+  }
+  return 0;
+}
+
+void SectorReader::finishJob(const Job &job, int error) {
+  if (error != 0) {
+    job.batch->error = error;
+  }
+  if (--job.batch->remaining == 0) {
+    _batch_done.notify_all();
+  }
+}
+
+void SectorReader::workerLoop() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    _jobs_available.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+    if (_stopping) {
+      return;
+    }
+    Job job = _jobs.front();
+    _jobs.pop_front();
+    lock.unlock();
+    int error = readRange(*job.request);
+    lock.lock();
+    finishJob(job, error);
+  }
+}
+
+} // namespace lpq::index
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Reads batches of byte ranges of a file in parallel with a small pool of
+ * threads issuing pread(2) calls. A disk-resident index issues all the
+ * reads of one search step as a batch, so that an SSD serves them
+ * concurrently instead of one round trip at a time. The calling thread
+ * runs reads as well while it waits for its batch.
+ *
+ * The file is opened with a random access hint, so that the kernel does
+ * not read ahead around every small read.
+ */
+class SectorReader {
+public:
+  struct Request {
+    uint64_t offset;
+    uint64_t length;
+    char *buffer;
+  };
+
+  /**
+   * Opens `path` for reading with `num_threads` I/O threads in addition
+   * to the threads calling `read`. With 0 threads every batch is read by
+   * its caller.
+   */
+  SectorReader(const std::string &path, uint32_t num_threads);
+
+  SectorReader(const SectorReader &) = delete;
+  SectorReader &operator=(const SectorReader &) = delete;
+
+  ~SectorReader();
+
+  /**
+   * Reads every request into its buffer and returns once all of them are
+   * done. Throws std::runtime_error if a read fails or hits the end of the
+   * file. Can be called from several threads at once.
+   */
+  void read(const Request *requests, uint32_t num_requests);
+
+private:
+  struct Batch {
+    uint32_t remaining;
+    int error;
+  };
+
+  struct Job {
+    const Request *request;
+    Batch *batch;
+  };
+
+  // Runs one read and returns 0 or the errno of the failure.
+  int readRange(const Request &request) const;
+
+  // Records the result of a read of `job`. Requires `_mutex`.
+  void finishJob(const Job &job, int error);
+
+  void workerLoop();
+
+  std::string _path;
+  int _file_descriptor;
+
+  std::mutex _mutex;
+  std::condition_variable _jobs_available;
+  std::condition_variable _batch_done;
+  std::deque<Job> _jobs;
+  bool _stopping;
+  std::vector<std::thread> _threads;
+};
+
+} // namespace lpq::index
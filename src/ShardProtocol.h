@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace lpq::index {
+
+/**
+ * Messages exchanged between a ShardedSearchIndex and its shard workers
+ * over a Unix domain stream socket. Both ends run on the same machine, so
+ * everything is sent in native byte order.
+ *
+ *  - Once the shard is loaded, the worker sends a ShardResponseHeader
+ *    with no results (or an error).
+ *  - Every search sends a ShardRequestHeader followed by
+ *    num_queries * dimension int8 codes. The worker answers with a
+ *    ShardResponseHeader followed by, for every query, a uint32_t count
+ *    and `count` distances (float) and ids (uint64_t).
+ *  - Errors are answered with a non-zero status and `message_size` bytes
+ *    of error message.
+ *  - Closing the socket shuts the worker down.
+ */
+struct ShardRequestHeader {
+  uint32_t num_queries;
+  uint32_t dimension;
+  uint32_t top_k;
+};
+
+struct ShardResponseHeader {
+  uint32_t status;
+  uint32_t num_queries;
+  uint64_t message_size;
+};
+
+enum ShardStatus : uint32_t { ShardOk = 0, ShardError = 1 };
+
+// File descriptor of the socket in a worker process.
+constexpr int SHARD_WORKER_SOCKET_FD = 3;
+
+/**
+ * Reads exactly `size` bytes. Returns false if the peer closed the socket
+ * before the first byte, and throws if it closed it in the middle.
+ */
+inline bool readFully(int socket, void *data, size_t size) {
+  auto *bytes = static_cast<char *>(data);
+  size_t bytes_read = 0;
+  while (bytes_read < size) {
+    ssize_t result = ::read(socket, bytes + bytes_read, size - bytes_read);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0) {
+      throw std::runtime_error(std::string("Could not read from socket: ") +
+                               std::strerror(errno));
+    }
+    if (result == 0) {
+      if (bytes_read == 0) {
+        return false;
+      }
+      throw std::runtime_error("The socket was closed in the middle of a "
+                               "message.");
+    }
+    bytes_read += result;
+  }
+  return true;
+}
+
+inline void writeFully(int socket, const void *data, size_t size) {
+  const auto *bytes = static_cast<const char *>(data);
+  size_t bytes_written = 0;
+  while (bytes_written < size) {
+    // MSG_NOSIGNAL turns writes to a dead peer into EPIPE errors instead
+    // of killing the process with SIGPIPE.
+    ssize_t result = ::send(socket, bytes + bytes_written,
+                            size - bytes_written, MSG_NOSIGNAL);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result < 0) {
+      throw std::runtime_error(std::string("Could not write to socket: ") +
+                               std::strerror(errno));
+    }
+    bytes_written += result;
+  }
+}
+
+} // namespace lpq::index
@@ -0,0 +1,103 @@
+#include <cstdint>
+#include <exception>
+#include <sched.h>
+#include <sstream>
+#include <src/ExactSearch.h>
+#include <src/ShardProtocol.h>
+#include <src/ShardWorker.h>
+#include <src/ThreadPool.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace lpq::index {
+
+uint32_t pinToCpus(const std::string &cpu_list) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+
+  std::stringstream stream(cpu_list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    size_t separator = range.find('-');
+    try {
+      int first_cpu = std::stoi(range.substr(0, separator));
+      int last_cpu = separator == std::string::npos
+                         ? first_cpu
+                         : std::stoi(range.substr(separator + 1));
+      for (int cpu = first_cpu; cpu <= last_cpu && cpu < CPU_SETSIZE; cpu++) {
+        CPU_SET(cpu, &cpu_set);
+      }
+    } catch (const std::logic_error &) {
+      throw std::invalid_argument("Invalid CPU list: " + cpu_list);
+    }
+  }
+  if (CPU_COUNT(&cpu_set) == 0 ||
+      ::sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    throw std::invalid_argument("Could not pin the process to CPUs " +
+                                cpu_list);
+  }
+  return CPU_COUNT(&cpu_set);
+}
+
+void pinWorkerToCpus(const std::string &cpu_list) {
+  const uint32_t num_cpus = pinToCpus(cpu_list);
+  ThreadPool::global().resize(num_cpus);
+}
+
+static void sendError(int socket, const std::string &message) {
+  ShardResponseHeader header{/* status = */ ShardError, /* num_queries = */ 0,
+                             /* message_size = */ message.size()};
+  writeFully(socket, &header, sizeof(header));
+  writeFully(socket, message.data(), message.size());
+}
+
+int runShardWorker(int socket, const std::string &shard_path) {
+  std::shared_ptr<ExactSearchIndex<int_least8_t>> shard_index;
+  try {
+    shard_index = ExactSearchIndex<int_least8_t>::load(shard_path);
+  } catch (const std::exception &exception) {
+    sendError(socket, exception.what());
+    return 1;
+  }
+  ShardResponseHeader ready{/* status = */ ShardOk, /* num_queries = */ 0,
+                            /* message_size = */ 0};
+  writeFully(socket, &ready, sizeof(ready));
+
+  ShardRequestHeader request;
+  std::vector<int_least8_t> codes;
+  while (readFully(socket, &request, sizeof(request))) {
+    codes.resize(uint64_t(request.num_queries) * request.dimension);
+    readFully(socket, codes.data(), codes.size());
+
+    std::vector<std::vector<int_least8_t>> queries(request.num_queries);
+    for (uint32_t index = 0; index < request.num_queries; index++) {
+      queries[index].assign(
+          codes.begin() + uint64_t(index) * request.dimension,
+          codes.begin() + uint64_t(index + 1) * request.dimension);
+    }
+
+    std::vector<std::vector<float>> distances;
+    std::vector<std::vector<uint64_t>> ids;
+    try {
+      std::tie(distances, ids) = shard_index->search(queries, request.top_k);
+    } catch (const std::exception &exception) {
+      sendError(socket, exception.what());
+      continue;
+    }
+
+    ShardResponseHeader response{/* status = */ ShardOk,
+                                 /* num_queries = */ request.num_queries,
+                                 /* message_size = */ 0};
+    writeFully(socket, &response, sizeof(response));
+    for (uint32_t index = 0; index < request.num_queries; index++) {
+      uint32_t count = ids[index].size();
+      writeFully(socket, &count, sizeof(count));
+      writeFully(socket, distances[index].data(), count * sizeof(float));
+      writeFully(socket, ids[index].data(), count * sizeof(uint64_t));
+    }
+  }
+  return 0;
+}
+
+} // namespace lpq::index
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace lpq::index {
+
+/**
+ * Restricts the calling process to the CPUs of `cpu_list`, given in the
+ * kernel's list format (e.g. "0-7,16-23"), and returns their number.
+ * Memory is allocated on the NUMA node of the CPU that first touches it,
+ * so a worker pinned to the CPUs of one node also keeps its pages on that
+ * node.
+ */
+uint32_t pinToCpus(const std::string &cpu_list);
+
+/**
+ * Pins a worker to `cpu_list` and sizes the global thread pool to one
+ * thread per CPU of the list. The pool is otherwise sized by OpenMP from
+ * the affinity the process started with, i.e. the whole machine.
+ */
+void pinWorkerToCpus(const std::string &cpu_list);
+
+/**
+ * Serves searches on the saved index at `shard_path` over `socket`, see
+ * ShardProtocol.h, until the coordinator closes the socket. Returns the
+ * exit code of the worker process.
+ */
+int runShardWorker(int socket, const std::string &shard_path);
+
+} // namespace lpq::index
@@ -0,0 +1,293 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <numeric>
+#include <spawn.h>
+#include <src/ExactSearch.h>
+#include <src/IndexFile.h>
+#include <src/MappedFile.h>
+#include <src/ShardProtocol.h>
+#include <src/ShardedSearch.h>
+#include <src/TopKSelector.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+
+extern char **environ;
+
+namespace lpq::index {
+
+std::vector<std::string> ShardedSearchIndex::writeShards(
+    const std::string &distance_metric,
+    const std::vector<std::vector<int_least8_t>> &dataset, uint32_t num_shards,
+    const std::string &directory) {
+  if (num_shards == 0 || num_shards > dataset.size()) {
+    throw std::invalid_argument(
+        "The number of shards must be between 1 and the dataset size.");
+  }
+  std::vector<std::string> shard_paths;
+  for (uint32_t shard = 0; shard < num_shards; shard++) {
+    uint64_t begin = dataset.size() * shard / num_shards;
+    uint64_t end = dataset.size() * (shard + 1) / num_shards;
+    std::vector<std::vector<int_least8_t>> vectors(dataset.begin() + begin,
+                                                   dataset.begin() + end);
+    std::vector<uint64_t> ids(end - begin);
+    std::iota(ids.begin(), ids.end(), begin);
+
+    ExactSearchIndex<int_least8_t> index(distance_metric);
+    index.add(vectors, ids);
+    shard_paths.push_back(directory + "/shard_" + std::to_string(shard) +
+                          ".lpq");
+    index.save(shard_paths.back());
+  }
+  return shard_paths;
+}
+
+ShardedSearchIndex::ShardedSearchIndex(
+    const std::vector<std::string> &shard_paths,
+    const std::string &worker_executable, bool pin_workers)
+    : _distance_metric(DistanceMetric::Euclidean), _dimension(0),
+      _num_vectors(0) {
+  if (shard_paths.empty()) {
+    throw std::invalid_argument("At least one shard is required.");
+  }
+  // The coordinator only reads the headers, the workers map the rest.
+  for (uint32_t shard = 0; shard < shard_paths.size(); shard++) {
+    const std::string &path = shard_paths[shard];
+    MappedFile file(path);
+    IndexFileHeader header;
+    if (file.size() < sizeof(header)) {
+      throw std::invalid_argument(path + " is not an index file.");
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    validateIndexFileHeader<int_least8_t>(header, file.size(), path);
+
+    auto distance_metric = static_cast<DistanceMetric>(header.distance_metric);
+    if (shard > 0 && (distance_metric != _distance_metric ||
+                      header.dimension != _dimension)) {
+      throw std::invalid_argument(
+          "Every shard must use the same distance metric and dimension.");
+    }
+    _distance_metric = distance_metric;
+    _dimension = header.dimension;
+    _num_vectors += header.num_vectors + header.num_duplicate_ids -
+                    header.num_duplicate_groups;
+  }
+
+  std::vector<std::string> cpu_lists;
+  if (pin_workers) {
+    cpu_lists = getNumaNodeCpuLists();
+  }
+  // Pinning every worker to the same node would only take CPUs away.
+  if (cpu_lists.size() < 2) {
+    cpu_lists.clear();
+  }
+
+  try {
+    for (uint32_t shard = 0; shard < shard_paths.size(); shard++) {
+      startWorker(/* shard_path = */ shard_paths[shard],
+                  /* worker_executable = */ worker_executable,
+                  /* cpu_list = */ cpu_lists.empty()
+                      ? ""
+                      : cpu_lists[shard % cpu_lists.size()]);
+    }
+    // The workers load their shards in parallel.
+    for (const auto &worker : _workers) {
+      readResponseHeader(/* worker = */ worker,
+                         /* expected_num_queries = */ 0);
+    }
+  } catch (...) {
+    stopWorkers();
+    throw;
+  }
+}
+
+ShardedSearchIndex::~ShardedSearchIndex() { stopWorkers(); }
+
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+ShardedSearchIndex::search(
+    const std::vector<std::vector<int_least8_t>> &queries,
+    uint32_t top_k) const {
+  std::lock_guard<std::mutex> lock(_search_mutex);
+  const uint32_t num_queries = queries.size();
+  const uint32_t num_shards = _workers.size();
+  std::vector<std::vector<float>> distances(num_queries);
+  std::vector<std::vector<uint64_t>> ids(num_queries);
+  if (_num_vectors == 0 || num_queries == 0) {
+    return {distances, ids};
+  }
+  for (const auto &query : queries) {
+    if (query.size() != _dimension) {
+      throw std::invalid_argument("Input vectors must be of the same size in "
+                                  "order to compute the distance.");
+    }
+  }
+
+  ShardRequestHeader request{/* num_queries = */ num_queries,
+                             /* dimension = */ _dimension,
+                             /* top_k = */ top_k};
+  std::vector<char> message(sizeof(request) +
+                            uint64_t(num_queries) * _dimension);
+  std::memcpy(message.data(), &request, sizeof(request));
+  char *codes = message.data() + sizeof(request);
+  for (const auto &query : queries) {
+    std::memcpy(codes, query.data(), _dimension);
+    codes += _dimension;
+  }
+  for (const auto &worker : _workers) {
+    writeFully(worker.socket, message.data(), message.size());
+  }
+
+  /**
+   * The workers scan their shards in parallel while we read the responses
+   * one after the other. Every response is read completely, even after an
+   * error, so that the sockets stay in sync for the next search.
+   */
+  std::vector<std::vector<std::vector<float>>> shard_distances(
+      num_queries, std::vector<std::vector<float>>(num_shards));
+  std::vector<std::vector<std::vector<uint64_t>>> shard_ids(
+      num_queries, std::vector<std::vector<uint64_t>>(num_shards));
+  std::string error;
+  for (uint32_t shard = 0; shard < num_shards; shard++) {
+    try {
+      readResponseHeader(/* worker = */ _workers[shard],
+                         /* expected_num_queries = */ num_queries);
+    } catch (const std::runtime_error &exception) {
+      error = exception.what();
+      continue;
+    }
+    for (uint32_t query = 0; query < num_queries; query++) {
+      uint32_t count;
+      readFully(_workers[shard].socket, &count, sizeof(count));
+      shard_distances[query][shard].resize(count);
+      shard_ids[query][shard].resize(count);
+      readFully(_workers[shard].socket, shard_distances[query][shard].data(),
+                count * sizeof(float));
+      readFully(_workers[shard].socket, shard_ids[query][shard].data(),
+                count * sizeof(uint64_t));
+    }
+  }
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+
+  // Similarities are negated so that all metrics merge in ascending order.
+  const bool is_similarity = isSimilarityMetric(_distance_metric);
+  for (uint32_t query = 0; query < num_queries; query++) {
+    if (is_similarity) {
+      for (auto &list : shard_distances[query]) {
+        for (auto &distance : list) {
+          distance = -distance;
+        }
+      }
+    }
+    mergeSortedTopK(/* distances = */ shard_distances[query],
+                    /* ids = */ shard_ids[query], /* top_k = */ top_k,
+                    /* merged_distances = */ distances[query],
+                    /* merged_ids = */ ids[query]);
+    if (is_similarity) {
+      for (auto &distance : distances[query]) {
+        distance = -distance;
+      }
+    }
+  }
+  return {distances, ids};
+}
+
+std::vector<std::string> ShardedSearchIndex::getNumaNodeCpuLists() {
+  std::vector<std::string> cpu_lists;
+  for (uint32_t node = 0;; node++) {
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist");
+    if (!file) {
+      break;
+    }
+    std::string cpu_list;
+    std::getline(file, cpu_list);
+    // Nodes with memory but without CPUs cannot run a worker.
+    if (!cpu_list.empty()) {
+      cpu_lists.push_back(cpu_list);
+    }
+  }
+  return cpu_lists;
+}
+
+void ShardedSearchIndex::startWorker(const std::string &shard_path,
+                                     const std::string &worker_executable,
+                                     const std::string &cpu_list) {
+  // Close-on-exec keeps the sockets of one worker out of all the others.
+  int sockets[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) {
+    throw std::runtime_error(std::string("Could not create a socket: ") +
+                             std::strerror(errno));
+  }
+  int worker_socket = sockets[1];
+  // dup2 onto the same descriptor would keep the close-on-exec flag.
+  if (worker_socket == SHARD_WORKER_SOCKET_FD) {
+    worker_socket = ::fcntl(sockets[1], F_DUPFD_CLOEXEC,
+                            SHARD_WORKER_SOCKET_FD + 1);
+    ::close(sockets[1]);
+  }
+
+  std::vector<std::string> arguments = {worker_executable, shard_path};
+  if (!cpu_list.empty()) {
+    arguments.push_back(cpu_list);
+  }
+  std::vector<char *> argv;
+  for (auto &argument : arguments) {
+    argv.push_back(argument.data());
+  }
+  argv.push_back(nullptr);
+
+  posix_spawn_file_actions_t file_actions;
+  posix_spawn_file_actions_init(&file_actions);
+  posix_spawn_file_actions_adddup2(&file_actions, worker_socket,
+                                   SHARD_WORKER_SOCKET_FD);
+  pid_t pid;
+  int error = ::posix_spawn(&pid, worker_executable.c_str(), &file_actions,
+                            nullptr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&file_actions);
+  ::close(worker_socket);
+  if (error != 0) {
+    ::close(sockets[0]);
+    throw std::runtime_error("Could not start " + worker_executable + ": " +
+                             std::strerror(error));
+  }
+  _workers.push_back({/* pid = */ pid, /* socket = */ sockets[0]});
+}
+
+void ShardedSearchIndex::readResponseHeader(
+    const Worker &worker, uint32_t expected_num_queries) const {
+  ShardResponseHeader header;
+  if (!readFully(worker.socket, &header, sizeof(header))) {
+    throw std::runtime_error("Shard worker " + std::to_string(worker.pid) +
+                             " exited unexpectedly.");
+  }
+  if (header.status != ShardOk) {
+    std::string message(header.message_size, '\0');
+    readFully(worker.socket, message.data(), message.size());
+    throw std::runtime_error("Shard worker " + std::to_string(worker.pid) +
+                             " failed: " + message);
+  }
+  if (header.num_queries != expected_num_queries) {
+    throw std::runtime_error("Shard worker " + std::to_string(worker.pid) +
+                             " answered the wrong number of queries.");
+  }
+}
+
+void ShardedSearchIndex::stopWorkers() {
+  // Workers exit once they read the end of their socket.
+  for (const auto &worker : _workers) {
+    ::close(worker.socket);
+  }
+  for (const auto &worker : _workers) {
+    while (::waitpid(worker.pid, nullptr, 0) < 0 && errno == EINTR) {
+    }
+  }
+  _workers.clear();
+}
+
+} // namespace lpq::index
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <src/DistanceMetrics.h>
+#include <string>
+#include <sys/types.h>
+#include <tuple>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Exact search over an int8 index split into shards that are served by
+ * separate worker processes (see ShardWorker.h), so that every shard can
+ * use the memory bandwidth of its own NUMA node. A search sends the query
+ * batch to all workers over Unix domain sockets, lets them scan their
+ * shards in parallel and k-way merges their top k lists.
+ *
+ * The shards are index files written by `writeShards` (or by
+ * ExactSearchIndex::save), which the workers memory-map, so starting a
+ * worker is cheap and workers on the same machine share the page cache.
+ * Shards store the global ids of their vectors, so results need no
+ * translation.
+ */
+class ShardedSearchIndex {
+public:
+  /**
+   * Splits `dataset` into `num_shards` contiguous shards, in which vector
+   * i keeps id i, and saves them as `directory`/shard_<n>.lpq. Returns the
+   * paths of the shard files.
+   */
+  static std::vector<std::string>
+  writeShards(const std::string &distance_metric,
+              const std::vector<std::vector<int_least8_t>> &dataset,
+              uint32_t num_shards, const std::string &directory);
+
+  /**
+   * Starts one `worker_executable` process per shard file and waits until
+   * every worker has loaded its shard. With `pin_workers`, worker i is
+   * pinned to the CPUs of NUMA node i % (number of nodes) on machines
+   * with more than one node.
+   */
+  ShardedSearchIndex(const std::vector<std::string> &shard_paths,
+                     const std::string &worker_executable,
+                     bool pin_workers = true);
+
+  ShardedSearchIndex(const ShardedSearchIndex &) = delete;
+  ShardedSearchIndex &operator=(const ShardedSearchIndex &) = delete;
+
+  // Shuts down and reaps the workers.
+  ~ShardedSearchIndex();
+
+  /**
+   * Returns the top k vectors of all shards for every query, in the same
+   * layout as ExactSearchIndex::search. Concurrent calls are serialized.
+   */
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  search(const std::vector<std::vector<int_least8_t>> &queries,
+         uint32_t top_k) const;
+
+  uint32_t numShards() const { return _workers.size(); }
+  uint64_t size() const { return _num_vectors; }
+
+private:
+  struct Worker {
+    pid_t pid;
+    int socket;
+  };
+
+  /**
+   * Returns the CPU list of every NUMA node, or an empty list if the
+   * topology is unknown.
+   */
+  static std::vector<std::string> getNumaNodeCpuLists();
+
+  void startWorker(const std::string &shard_path,
+                   const std::string &worker_executable,
+                   const std::string &cpu_list);
+
+  /**
+   * Reads the response header of `worker` and throws with the worker's
+   * message if it reports an error.
+   */
+  void readResponseHeader(const Worker &worker,
+                          uint32_t expected_num_queries) const;
+
+  void stopWorkers();
+
+  DistanceMetric _distance_metric;
+  uint32_t _dimension;
+  uint64_t _num_vectors;
+  std::vector<Worker> _workers;
+  mutable std::mutex _search_mutex;
+};
+
+} // namespace lpq::index
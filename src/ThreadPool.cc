@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <src/ThreadPool.h>
+#include <stdexcept>
+
+namespace lpq {
+
+thread_local const ThreadPool *ThreadPool::_current_pool = nullptr;
+thread_local uint32_t ThreadPool::_current_worker = 0;
+
+ThreadPool::ThreadPool(uint32_t num_threads, bool pin_threads)
+    : _queued_tasks(0), _stopping(false), _next_worker(0) {
+  start(/* num_threads = */ num_threads, /* pin_threads = */ pin_threads);
+}
+
+ThreadPool::~ThreadPool() { stop(); }
+
+ThreadPool &ThreadPool::global() {
+  static ThreadPool pool(/* num_threads = */ omp_get_max_threads());
+  return pool;
+}
+
+void ThreadPool::resize(uint32_t num_threads, bool pin_threads) {
+  stop();
+  start(/* num_threads = */ num_threads, /* pin_threads = */ pin_threads);
+}
+
+void ThreadPool::start(uint32_t num_threads, bool pin_threads) {
+  if (num_threads == 0) {
+    throw std::invalid_argument("A thread pool needs at least one thread.");
+  }
+  std::vector<int> cpus;
+  if (pin_threads) {
+    cpu_set_t cpu_set;
+    if (::sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpu_set)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+  }
+
+  for (uint32_t worker = 0; worker + 1 < num_threads; worker++) {
+    _workers.push_back(std::make_unique<Worker>());
+  }
+  for (uint32_t worker = 0; worker + 1 < num_threads; worker++) {
+    _threads.emplace_back(&ThreadPool::workerLoop, this, worker);
+    if (cpus.empty()) {
+      continue;
+    }
+    // CPU 0 is left to the calling thread.
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpus[(worker + 1) % cpus.size()], &cpu_set);
+    if (::pthread_setaffinity_np(_threads.back().native_handle(),
+                                 sizeof(cpu_set), &cpu_set) != 0) {
+      stop();
+      throw std::runtime_error("Could not pin the thread pool workers.");
+    }
+  }
+}
+
+void ThreadPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_sleep_mutex);
+    _stopping = true;
+  }
+  _wake_up.notify_all();
+  for (auto &thread : _threads) {
+    thread.join();
+  }
+  _threads.clear();
+  _workers.clear();
+  _stopping = false;
+}
+
+void ThreadPool::run(uint64_t begin, uint64_t end, uint64_t grain_size,
+                     RangeFunction run_range, const void *function) {
+  const uint32_t num_workers = _workers.size();
+  const uint64_t num_indices = end - begin;
+  if (grain_size == 0) {
+    // A few tasks per thread, so that stealing can even out the load.
+    const uint64_t num_tasks = uint64_t(numThreads()) * 4;
+    grain_size = std::max<uint64_t>(1, (num_indices + num_tasks - 1) /
+                                           num_tasks);
+  }
+  const uint64_t num_tasks = (num_indices + grain_size - 1) / grain_size;
+  if (num_workers == 0 || num_tasks == 1) {
+    run_range(function, begin, end);
+    return;
+  }
+
+  Job job;
+  job.run_range = run_range;
+  job.function = function;
+  job.remaining_tasks = num_tasks;
+  job.failed = false;
+
+  {
+    // Counted before they are pushed, so that the count never drops
+    // below the number of tasks in the deques.
+    std::lock_guard<std::mutex> lock(_sleep_mutex);
+    _queued_tasks += num_tasks;
+  }
+
+  /**
+   * A worker that starts a nested loop keeps the tasks in its own deque,
+   * where idle workers steal them. Loops started from outside the pool
+   * are dealt out round robin, starting at a different worker every time
+   * so that small batches do not all land on the same worker.
+   */
+  const bool is_worker = _current_pool == this;
+  const uint32_t caller = is_worker ? _current_worker : num_workers;
+  const uint32_t first_worker =
+      is_worker ? caller : _next_worker.fetch_add(1) % num_workers;
+  const uint32_t num_targets =
+      is_worker ? 1 : std::min<uint64_t>(num_workers, num_tasks);
+  for (uint32_t target = 0; target < num_targets; target++) {
+    Worker &worker = *_workers[(first_worker + target) % num_workers];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    for (uint64_t task = target; task < num_tasks; task += num_targets) {
+      const uint64_t task_begin = begin + task * grain_size;
+      worker.tasks.push_back(
+          {&job, task_begin, std::min(end, task_begin + grain_size)});
+    }
+  }
+  _wake_up.notify_all();
+
+  // The caller runs tasks as well until its own loop is done.
+  Task task;
+  while (job.remaining_tasks.load(std::memory_order_acquire) > 0) {
+    if (takeTask(/* worker_index = */ caller, /* task = */ task)) {
+      runTask(task);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  if (job.exception) {
+    std::rethrow_exception(job.exception);
+  }
+}
+
+bool ThreadPool::takeTask(uint32_t worker_index, Task &task) {
+  const uint32_t num_workers = _workers.size();
+  if (_queued_tasks.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+  if (worker_index < num_workers) {
+    Worker &worker = *_workers[worker_index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      task = worker.tasks.back();
+      worker.tasks.pop_back();
+      _queued_tasks--;
+      return true;
+    }
+  }
+  for (uint32_t offset = 1; offset <= num_workers; offset++) {
+    Worker &victim = *_workers[(worker_index + offset) % num_workers];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.front();
+      victim.tasks.pop_front();
+      _queued_tasks--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::runTask(const Task &task) {
+  Job &job = *task.job;
+  if (!job.failed.load(std::memory_order_relaxed)) {
+    try {
+      job.run_range(job.function, task.begin, task.end);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(job.exception_mutex);
+      if (!job.exception) {
+        job.exception = std::current_exception();
+      }
+      job.failed = true;
+    }
+  }
+  // The caller may return as soon as this reaches 0, so the job must not
+  // be touched afterwards.
+  job.remaining_tasks.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ThreadPool::workerLoop(uint32_t worker_index) {
+  _current_pool = this;
+  _current_worker = worker_index;
+
+  Task task;
+  uint32_t idle_rounds = 0;
+  while (true) {
+    if (takeTask(/* worker_index = */ worker_index, /* task = */ task)) {
+      runTask(task);
+      idle_rounds = 0;
+      continue;
+    }
+    if (++idle_rounds < SPIN_ROUNDS) {
+      std::this_thread::yield();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(_sleep_mutex);
+    _wake_up.wait(lock, [this] { return _stopping || _queued_tasks > 0; });
+    if (_stopping && _queued_tasks == 0) {
+      return;
+    }
+    idle_rounds = 0;
+  }
+}
+
+} // namespace lpq
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lpq {
+
+/**
+ * A persistent pool of worker threads for the latency sensitive loops of
+ * search and quantization. Starting an OpenMP parallel region wakes the
+ * team and ends in a barrier every time, which is a noticeable share of a
+ * search over a small batch. The workers of this pool stay alive between
+ * calls and spin for a short while before they go to sleep, so a batch
+ * that follows shortly after the previous one starts without a wake up.
+ *
+ * Every worker owns a deque of tasks. A parallel loop is cut into tasks
+ * that are spread over the deques; workers take tasks from the back of
+ * their own deque and steal from the front of the others once it runs
+ * empty, so uneven tasks (e.g. queries with very different allow lists)
+ * still balance. The calling thread takes part in running the tasks, so
+ * a pool of n threads has n - 1 workers, and loops can be nested.
+ */
+class ThreadPool {
+public:
+  /**
+   * Starts `num_threads` - 1 workers. With `pin_threads`, thread i is
+   * pinned to the i^th CPU the process may run on, which keeps the
+   * caches of every worker warm across calls.
+   */
+  explicit ThreadPool(uint32_t num_threads, bool pin_threads = false);
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool();
+
+  /**
+   * The pool shared by all indexes and quantizers of the process. It is
+   * started on first use with as many threads as OpenMP would use.
+   */
+  static ThreadPool &global();
+
+  /**
+   * Restarts the pool with a different number of threads. This must not
+   * be called while a loop is running on the pool.
+   */
+  void resize(uint32_t num_threads, bool pin_threads = false);
+
+  // The number of threads running tasks, including the calling thread.
+  uint32_t numThreads() const { return _workers.size() + 1; }
+
+  /**
+   * Calls `function(index)` for every index in [begin, end), in tasks of
+   * `grain_size` consecutive indices (by default enough tasks to balance
+   * the load over all threads), and returns once all of them ran. The
+   * first exception thrown by `function` is rethrown here; the tasks that
+   * have not started by then are skipped.
+   */
+  template <typename FUNCTION>
+  void parallelFor(uint64_t begin, uint64_t end, const FUNCTION &function,
+                   uint64_t grain_size = 0) {
+    if (begin >= end) {
+      return;
+    }
+    auto run_range = [](const void *function, uint64_t begin, uint64_t end) {
+      const auto &typed_function = *static_cast<const FUNCTION *>(function);
+      for (uint64_t index = begin; index < end; index++) {
+        typed_function(index);
+      }
+    };
+    run(/* begin = */ begin, /* end = */ end, /* grain_size = */ grain_size,
+        /* run_range = */ run_range, /* function = */ &function);
+  }
+
+private:
+  using RangeFunction = void (*)(const void *, uint64_t, uint64_t);
+
+  // One call of parallelFor.
+  struct Job {
+    RangeFunction run_range;
+    const void *function;
+    std::atomic<uint64_t> remaining_tasks;
+    std::atomic<bool> failed;
+    std::exception_ptr exception;
+    std::mutex exception_mutex;
+  };
+
+  struct Task {
+    Job *job;
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  struct alignas(64) Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void run(uint64_t begin, uint64_t end, uint64_t grain_size,
+           RangeFunction run_range, const void *function);
+
+  void start(uint32_t num_threads, bool pin_threads);
+
+  void stop();
+
+  void workerLoop(uint32_t worker_index);
+
+  /**
+   * Pops a task from the back of worker `worker_index`'s deque or, failing
+   * that, steals one from the front of another deque. Threads outside the
+   * pool pass the number of workers and only steal.
+   */
+  bool takeTask(uint32_t worker_index, Task &task);
+
+  static void runTask(const Task &task);
+
+  // Spin this many rounds for new tasks before a worker goes to sleep.
+  static constexpr uint32_t SPIN_ROUNDS = 4096;
+
+  // The index of the pool worker running on this thread, if any.
+  static thread_local const ThreadPool *_current_pool;
+  static thread_local uint32_t _current_worker;
+
+  std::vector<std::unique_ptr<Worker>> _workers;
+  std::vector<std::thread> _threads;
+  // Tasks pushed but not yet taken, so that idle workers know to look.
+  std::atomic<uint64_t> _queued_tasks;
+  std::atomic<bool> _stopping;
+  std::mutex _sleep_mutex;
+  std::condition_variable _wake_up;
+  std::atomic<uint32_t> _next_worker;
+};
+
+} // namespace lpq
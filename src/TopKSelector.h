@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Keeps the k smallest (distance, id) pairs out of a stream of candidates.
+ * Similarity metrics push negated scores so that the selector only ever
+ * has to minimize.
+ *
+ * The selector is meant to be allocated once per thread and `reset` for
+ * every query, so the scan loop never allocates. Every candidate is first
+ * compared against the current k^th best distance, so most candidates of
+ * a long scan are rejected with a single compare. Accepted candidates go
+ * into a sorted array with insertion for small k, and into a bounded max
+ * heap for larger k. Either way `extractSorted` returns the results in
+ * ascending order without a separate sort. Ties are broken by the smaller
+ * id.
+ */
+template <typename ID_TYPE> class TopKSelector {
+public:
+  /**
+   * Up to this many results we keep a sorted array. Shifting a few cache
+   * lines on insertion is cheaper than the unpredictable branches of a
+   * heap sift.
+   */
+  static constexpr uint32_t MAX_INSERTION_SORT_K = 32;
+
+  explicit TopKSelector(uint32_t top_k = 0) { reset(top_k); }
+
+  /**
+   * Empties the selector and sets k. Previously allocated storage is
+   * reused, so resetting with a k that is not larger than before does not
+   * allocate.
+   */
+  void reset(uint32_t top_k) {
+    _top_k = top_k;
+    _entries.clear();
+    _entries.reserve(top_k);
+    _threshold = top_k == 0 ? -std::numeric_limits<float>::infinity()
+                            : std::numeric_limits<float>::infinity();
+  }
+
+  /**
+   * The distance a candidate has to beat to be accepted. This is +inf
+   * until k candidates have been seen and the k^th best distance after
+   * that.
+   */
+  float threshold() const { return _threshold; }
+
+  uint32_t size() const { return _entries.size(); }
+
+  // Returns whether the candidate was inserted.
+  bool push(float distance, ID_TYPE id) {
+    // -inf and NaN pass the threshold of k = 0, so k = 0 is checked first.
+    if (_top_k == 0 || distance > _threshold) {
+      return false;
+    }
+    if (_entries.size() == _top_k &&
+        !(std::make_pair(distance, id) < _entries[worstIndex()])) {
+      return false;
+    }
+
+    if (_top_k <= MAX_INSERTION_SORT_K) {
+      insertSorted(distance, id);
+    } else {
+      insertHeap(distance, id);
+    }
+    if (_entries.size() == _top_k) {
+      _threshold = _entries[worstIndex()].first;
+    }
+    return true;
+  }
+
+  /**
+   * Moves the selected candidates out in ascending order of distance and
+   * leaves the selector empty.
+   */
+  void extractSorted(std::vector<float> &distances, std::vector<ID_TYPE> &ids) {
+    if (_top_k > MAX_INSERTION_SORT_K) {
+      // In-place heap sort: repeatedly move the largest entry to the back.
+      for (size_t end = _entries.size(); end > 1; end--) {
+        std::swap(_entries[0], _entries[end - 1]);
+        siftDown(0, end - 1);
+      }
+    }
+    distances.resize(_entries.size());
+    ids.resize(_entries.size());
+    for (size_t i = 0; i < _entries.size(); i++) {
+      distances[i] = _entries[i].first;
+      ids[i] = _entries[i].second;
+    }
+    reset(_top_k);
+  }
+
+private:
+  using Entry = std::pair<float, ID_TYPE>;
+
+  size_t worstIndex() const {
+    return _top_k <= MAX_INSERTION_SORT_K ? _entries.size() - 1 : 0;
+  }
+
+  void insertSorted(float distance, ID_TYPE id) {
+    Entry entry(distance, id);
+    if (_entries.size() < _top_k) {
+      _entries.emplace_back(entry);
+    }
+    // Shift larger entries one slot to the right, dropping the last one
+    // when the array is full.
+    size_t position = _entries.size() - 1;
+    while (position > 0 && entry < _entries[position - 1]) {
+      _entries[position] = _entries[position - 1];
+      position--;
+    }
+    _entries[position] = entry;
+  }
+
+  void insertHeap(float distance, ID_TYPE id) {
+    Entry entry(distance, id);
+    if (_entries.size() < _top_k) {
+      _entries.emplace_back(entry);
+      siftUp(_entries.size() - 1);
+      return;
+    }
+    _entries[0] = entry;
+    siftDown(0, _entries.size());
+  }
+
+  void siftUp(size_t position) {
+    Entry entry = _entries[position];
+    while (position > 0) {
+      size_t parent = (position - 1) / 2;
+      if (!(_entries[parent] < entry)) {
+        break;
+      }
+      _entries[position] = _entries[parent];
+      position = parent;
+    }
+    _entries[position] = entry;
+  }
+
+  void siftDown(size_t position, size_t heap_size) {
+    Entry entry = _entries[position];
+    while (true) {
+      size_t child = 2 * position + 1;
+      if (child >= heap_size) {
+        break;
+      }
+      if (child + 1 < heap_size && _entries[child] < _entries[child + 1]) {
+        child++;
+      }
+      if (!(entry < _entries[child])) {
+        break;
+      }
+      _entries[position] = _entries[child];
+      position = child;
+    }
+    _entries[position] = entry;
+  }
+
+  uint32_t _top_k;
+  float _threshold;
+  std::vector<Entry> _entries;
+};
+
+/**
+ * K-way merge of several result lists that are each sorted in ascending
+ * order of distance (as returned by TopKSelector::extractSorted). Keeps
+ * the first `top_k` entries of the merged order. A small min heap holds
+ * the head of every list, so this costs O(k log(number of lists)).
+ */
+template <typename ID_TYPE>
+static void mergeSortedTopK(const std::vector<std::vector<float>> &distances,
+                            const std::vector<std::vector<ID_TYPE>> &ids,
+                            uint32_t top_k,
+                            std::vector<float> &merged_distances,
+                            std::vector<ID_TYPE> &merged_ids) {
+  // (distance, id, list index, position in the list)
+  using Head = std::tuple<float, ID_TYPE, uint32_t, uint32_t>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  for (uint32_t list = 0; list < distances.size(); list++) {
+    if (!distances[list].empty()) {
+      heads.emplace(distances[list][0], ids[list][0], list, 0);
+    }
+  }
+
+  merged_distances.clear();
+  merged_ids.clear();
+  while (!heads.empty() && merged_ids.size() < top_k) {
+    auto [distance, id, list, position] = heads.top();
+    heads.pop();
+    merged_distances.push_back(distance);
+    merged_ids.push_back(id);
+
+    if (position + 1 < distances[list].size()) {
+      heads.emplace(distances[list][position + 1], ids[list][position + 1],
+                    list, position + 1);
+    }
+  }
+}
+
+} // namespace lpq::index
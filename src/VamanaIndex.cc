@@ -0,0 +1,664 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <src/IndexFile.h>
+#include <src/LPQ.h>
+#include <src/MappedFile.h>
+#include <src/ThreadPool.h>
+#include <src/TopKSelector.h>
+#include <src/VamanaIndex.h>
+#include <src/VisitedSet.h>
+#include <stdexcept>
+
+namespace lpq::index {
+
+namespace {
+
+thread_local VisitedSet visited_set;
+
+/**
+ * The candidates of a graph search: the `capacity` closest nodes found so
+ * far, sorted by distance, and whether they have been expanded yet.
+ */
+class CandidateList {
+public:
+  explicit CandidateList(uint32_t capacity) : _capacity(capacity) {
+    _entries.reserve(capacity + 1);
+  }
+
+  void insert(float distance, uint32_t node) {
+    if (_entries.size() == _capacity && distance >= _entries.back().distance) {
+      return;
+    }
+    auto position = std::upper_bound(
+        _entries.begin(), _entries.end(), distance,
+        [](float value, const Entry &entry) { return value < entry.distance; });
+    _entries.insert(position, {distance, node, false});
+    if (_entries.size() > _capacity) {
+      _entries.pop_back();
+    }
+  }
+
+  /**
+   * Marks up to `count` of the closest unexpanded nodes as expanded,
+   * writes them to `nodes` and returns how many there were.
+   */
+  uint32_t expandClosest(uint32_t count, uint32_t *nodes) {
+    uint32_t num_nodes = 0;
+    for (auto &entry : _entries) {
+      if (num_nodes == count) {
+        break;
+      }
+      if (!entry.expanded) {
+        entry.expanded = true;
+        nodes[num_nodes++] = entry.node;
+      }
+    }
+    return num_nodes;
+  }
+
+private:
+  struct Entry {
+    float distance;
+    uint32_t node;
+    bool expanded;
+  };
+
+  uint32_t _capacity;
+  std::vector<Entry> _entries;
+};
+
+/**
+ * Builds a Vamana graph in RAM: starting from a random graph, every node
+ * is linked to the candidates of a search for itself, pruned with the
+ * alpha rule, and its neighbours are linked back to it. A first pass runs
+ * with alpha = 1 and a second one with the given alpha. Nodes are
+ * inserted in parallel, with a lock per node guarding its neighbours.
+ */
+class GraphBuilder {
+public:
+  GraphBuilder(const std::vector<std::vector<float>> &points,
+               DistanceMetric distance_metric, uint32_t max_degree,
+               uint32_t list_size, float alpha)
+      : _points(points), _num_nodes(points.size()),
+        _dimension(points[0].size()), _max_degree(max_degree),
+        _list_size(list_size), _alpha(alpha),
+        _neighbors(size_t(_num_nodes) * max_degree), _degrees(_num_nodes, 0),
+        _locks(std::make_unique<std::mutex[]>(_num_nodes)) {
+    /**
+     * For inner products every vector x gets an extra dimension
+     * sqrt(M^2 - ||x||^2), where M is the largest norm. All extended
+     * vectors then have norm M, so their euclidean distances order them
+     * by inner product.
+     */
+    _squared_norms.resize(_num_nodes);
+    _extra_dimension.assign(_num_nodes, 0.f);
+    ThreadPool::global().parallelFor(0, _num_nodes, [&](uint64_t node) {
+      const float *vector = points[node].data();
+      _squared_norms[node] =
+          lpq::index::dotProduct(vector, vector, _dimension);
+    });
+    if (distance_metric != DistanceMetric::Euclidean) {
+      const float max_squared_norm =
+          *std::max_element(_squared_norms.begin(), _squared_norms.end());
+      for (uint32_t node = 0; node < _num_nodes; node++) {
+        _extra_dimension[node] =
+            std::sqrt(std::max(max_squared_norm - _squared_norms[node], 0.f));
+        _squared_norms[node] = max_squared_norm;
+      }
+    }
+  }
+
+  void build() {
+    _medoid = findMedoid();
+
+    std::mt19937 generator(BUILD_SEED);
+    std::uniform_int_distribution<uint32_t> random_node(0, _num_nodes - 1);
+    const uint32_t initial_degree = std::min(_max_degree, _num_nodes - 1);
+    for (uint32_t node = 0; node < _num_nodes; node++) {
+      uint32_t *neighbors = getMutableNeighbors(node);
+      while (_degrees[node] < initial_degree) {
+        uint32_t neighbor = random_node(generator);
+        if (neighbor != node &&
+            std::find(neighbors, neighbors + _degrees[node], neighbor) ==
+                neighbors + _degrees[node]) {
+          neighbors[_degrees[node]++] = neighbor;
+        }
+      }
+    }
+
+    std::vector<uint32_t> order(_num_nodes);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), generator);
+    for (float alpha : {1.f, _alpha}) {
+      ThreadPool::global().parallelFor(
+          0, _num_nodes, [&](uint64_t index) { insert(order[index], alpha); },
+          /* grain_size = */ 1);
+    }
+  }
+
+  uint32_t getMedoid() const { return _medoid; }
+
+  uint32_t getDegree(uint32_t node) const { return _degrees[node]; }
+
+  const uint32_t *getNeighbors(uint32_t node) const {
+    return _neighbors.data() + size_t(node) * _max_degree;
+  }
+
+private:
+  using Candidate = std::pair<float, uint32_t>;
+
+  static constexpr uint32_t BUILD_SEED = 42;
+
+  uint32_t *getMutableNeighbors(uint32_t node) {
+    return _neighbors.data() + size_t(node) * _max_degree;
+  }
+
+  float computeDistance(uint32_t first, uint32_t second) const {
+    float inner_product =
+        lpq::index::dotProduct(_points[first].data(), _points[second].data(),
+                               _dimension) +
+        _extra_dimension[first] * _extra_dimension[second];
+    return lpq::index::euclideanDistanceFromNorms(
+        /* first_norm = */ _squared_norms[first],
+        /* second_norm = */ _squared_norms[second],
+        /* inner_product = */ inner_product);
+  }
+
+  // Returns the vector closest to the mean of all vectors.
+  uint32_t findMedoid() const {
+    std::vector<float> mean(_dimension, 0.f);
+    for (const auto &point : _points) {
+      for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+        mean[dim_index] += point[dim_index] / _num_nodes;
+      }
+    }
+    std::vector<float> distances(_num_nodes);
+    ThreadPool::global().parallelFor(0, _num_nodes, [&](uint64_t node) {
+      float distance = 0.f;
+      for (uint32_t dim_index = 0; dim_index < _dimension; dim_index++) {
+        float difference = _points[node][dim_index] - mean[dim_index];
+        distance += difference * difference;
+      }
+      distances[node] = distance;
+    });
+    return std::min_element(distances.begin(), distances.end()) -
+           distances.begin();
+  }
+
+  // Searches for `node` from the medoid and returns every expanded node.
+  std::vector<Candidate> searchFor(uint32_t node) const {
+    visited_set.reset(_num_nodes);
+    visited_set.visit(_medoid);
+    CandidateList candidates(_list_size);
+    candidates.insert(computeDistance(node, _medoid), _medoid);
+
+    std::vector<Candidate> expanded;
+    std::vector<uint32_t> neighbors(_max_degree);
+    uint32_t current;
+    while (candidates.expandClosest(1, &current) > 0) {
+      expanded.emplace_back(computeDistance(node, current), current);
+      uint32_t degree;
+      {
+        std::lock_guard<std::mutex> lock(_locks[current]);
+        degree = _degrees[current];
+        std::copy_n(getNeighbors(current), degree, neighbors.begin());
+      }
+      for (uint32_t position = 0; position < degree; position++) {
+        const uint32_t neighbor = neighbors[position];
+        if (!visited_set.visit(neighbor)) {
+          candidates.insert(computeDistance(node, neighbor), neighbor);
+        }
+      }
+    }
+    return expanded;
+  }
+
+  /**
+   * Replaces the neighbours of `node` with the closest of `candidates`
+   * that survive the alpha rule: a candidate c is dropped if a closer,
+   * already chosen neighbour p has alpha * d(p, c) <= d(node, c), since
+   * the search can reach c through p. Requires the lock of `node`.
+   */
+  void prune(uint32_t node, std::vector<Candidate> candidates, float alpha) {
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+    std::vector<bool> dropped(candidates.size(), false);
+    uint32_t *neighbors = getMutableNeighbors(node);
+    uint32_t degree = 0;
+    for (uint32_t index = 0;
+         index < candidates.size() && degree < _max_degree; index++) {
+      const uint32_t candidate = candidates[index].second;
+      if (dropped[index] || candidate == node) {
+        continue;
+      }
+      neighbors[degree++] = candidate;
+      for (uint32_t other = index + 1; other < candidates.size(); other++) {
+        if (!dropped[other] &&
+            alpha * computeDistance(candidate, candidates[other].second) <=
+                candidates[other].first) {
+          dropped[other] = true;
+        }
+      }
+    }
+    _degrees[node] = degree;
+  }
+
+  void insert(uint32_t node, float alpha) {
+    auto candidates = searchFor(node);
+    std::vector<uint32_t> neighbors;
+    {
+      std::lock_guard<std::mutex> lock(_locks[node]);
+      const uint32_t *current_neighbors = getNeighbors(node);
+      for (uint32_t position = 0; position < _degrees[node]; position++) {
+        candidates.emplace_back(
+            computeDistance(node, current_neighbors[position]),
+            current_neighbors[position]);
+      }
+      prune(node, std::move(candidates), alpha);
+      neighbors.assign(getNeighbors(node), getNeighbors(node) + _degrees[node]);
+    }
+
+    // Link the neighbours back, pruning lists that are full.
+    for (auto neighbor : neighbors) {
+      std::lock_guard<std::mutex> lock(_locks[neighbor]);
+      uint32_t *links = getMutableNeighbors(neighbor);
+      const uint32_t degree = _degrees[neighbor];
+      if (std::find(links, links + degree, node) != links + degree) {
+        continue;
+      }
+      if (degree < _max_degree) {
+        links[_degrees[neighbor]++] = node;
+        continue;
+      }
+      std::vector<Candidate> neighbor_candidates{
+          {computeDistance(neighbor, node), node}};
+      for (uint32_t position = 0; position < degree; position++) {
+        neighbor_candidates.emplace_back(
+            computeDistance(neighbor, links[position]), links[position]);
+      }
+      prune(neighbor, std::move(neighbor_candidates), alpha);
+    }
+  }
+
+  const std::vector<std::vector<float>> &_points;
+  uint32_t _num_nodes;
+  uint32_t _dimension;
+  uint32_t _max_degree;
+  uint32_t _list_size;
+  float _alpha;
+  uint32_t _medoid;
+
+  std::vector<float> _squared_norms;
+  std::vector<float> _extra_dimension;
+  std::vector<uint32_t> _neighbors;
+  std::vector<uint32_t> _degrees;
+  std::unique_ptr<std::mutex[]> _locks;
+};
+
+uint64_t alignToSector(uint64_t offset) {
+  return (offset + VamanaIndex::SECTOR_SIZE - 1) / VamanaIndex::SECTOR_SIZE *
+         VamanaIndex::SECTOR_SIZE;
+}
+
+} // namespace
+
+void VamanaIndex::build(const std::vector<std::vector<float>> &vectors,
+                        const std::string &distance_metric,
+                        const std::string &path, uint32_t max_degree,
+                        uint32_t build_list_size, float alpha) {
+  const DistanceMetric metric = parseDistanceMetric(distance_metric);
+  if (vectors.empty() || vectors.size() > UINT32_MAX) {
+    throw std::invalid_argument(
+        "An index needs between 1 and 2^32 - 1 vectors.");
+  }
+  if (max_degree == 0 || build_list_size == 0) {
+    throw std::invalid_argument(
+        "The maximum degree and the build list size must be positive.");
+  }
+  if (!(alpha >= 1.f)) {
+    throw std::invalid_argument("alpha must be at least 1.");
+  }
+  const uint32_t dimension = vectors[0].size();
+  for (const auto &vector : vectors) {
+    if (vector.size() != dimension || dimension == 0) {
+      throw std::invalid_argument(
+          "Every vector in the dataset must have the same, positive "
+          "dimension.");
+    }
+  }
+  std::vector<std::vector<float>> normalized_vectors;
+  if (metric == DistanceMetric::Cosine) {
+    normalized_vectors = lpq::index::normalizeVectors(vectors);
+  }
+  const auto &points =
+      metric == DistanceMetric::Cosine ? normalized_vectors : vectors;
+  const uint32_t num_vectors = points.size();
+
+  LowPrecisionQuantizer<int_least8_t> quantizer;
+  auto codes = quantizer.quantizeVectors(points);
+  const auto &quantization_parameters = quantizer.getQuantizationParameters();
+
+  GraphBuilder builder(/* points = */ points, /* distance_metric = */ metric,
+                       /* max_degree = */ max_degree,
+                       /* list_size = */ build_list_size, /* alpha = */ alpha);
+  builder.build();
+
+  FileHeader header{};
+  std::memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+  header.version = FILE_VERSION;
+  header.byte_order_mark = FILE_BYTE_ORDER_MARK;
+  header.distance_metric = static_cast<uint32_t>(metric);
+  header.dimension = dimension;
+  header.num_vectors = num_vectors;
+  header.max_degree = max_degree;
+  header.medoid = builder.getMedoid();
+  header.node_size = (dimension + 1 + max_degree) * sizeof(uint32_t);
+  header.nodes_per_sector = SECTOR_SIZE / header.node_size;
+  header.sectors_per_node =
+      header.nodes_per_sector > 0 ? 1 : alignToSector(header.node_size) /
+                                            SECTOR_SIZE;
+  const uint32_t stride = CodeArena<int_least8_t>::computeStride(dimension);
+  header.scales_offset = alignToSector(sizeof(header));
+  header.zero_points_offset =
+      alignToSector(header.scales_offset + dimension * sizeof(float));
+  header.codes_offset = alignToSector(header.zero_points_offset + dimension);
+  header.nodes_offset =
+      alignToSector(header.codes_offset + uint64_t(num_vectors) * stride);
+
+  const std::string temporary_path = path + ".tmp";
+  std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    throw std::invalid_argument("Could not open " + temporary_path +
+                                " for writing.");
+  }
+  auto padTo = [&file](uint64_t offset) {
+    const char zeros[SECTOR_SIZE] = {};
+    file.write(zeros, offset - static_cast<uint64_t>(file.tellp()));
+  };
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  padTo(header.scales_offset);
+  for (const auto &[scale, zero_point] : quantization_parameters) {
+    file.write(reinterpret_cast<const char *>(&scale), sizeof(scale));
+  }
+  padTo(header.zero_points_offset);
+  for (const auto &[scale, zero_point] : quantization_parameters) {
+    file.write(reinterpret_cast<const char *>(&zero_point),
+               sizeof(zero_point));
+  }
+  // Codes are written with their padding, so that they can be read into
+  // an arena as they are.
+  padTo(header.codes_offset);
+  std::vector<int_least8_t> row(stride, 0);
+  for (const auto &code : codes) {
+    std::copy(code.begin(), code.end(), row.begin());
+    file.write(reinterpret_cast<const char *>(row.data()), stride);
+  }
+  padTo(header.nodes_offset);
+
+  const uint32_t nodes_per_read = std::max(header.nodes_per_sector, 1u);
+  std::vector<char> sectors(nodes_per_read > 1
+                                ? SECTOR_SIZE
+                                : header.sectors_per_node * SECTOR_SIZE);
+  for (uint32_t first_node = 0; first_node < num_vectors;
+       first_node += nodes_per_read) {
+    std::fill(sectors.begin(), sectors.end(), 0);
+    const uint32_t end_node =
+        std::min<uint64_t>(num_vectors, uint64_t(first_node) + nodes_per_read);
+    for (uint32_t node = first_node; node < end_node; node++) {
+      char *data = sectors.data() + (node - first_node) * header.node_size;
+      const uint32_t degree = builder.getDegree(node);
+      std::memcpy(data, points[node].data(), dimension * sizeof(float));
+      std::memcpy(data + dimension * sizeof(float), &degree, sizeof(degree));
+      std::memcpy(data + (dimension + 1) * sizeof(float),
+                  builder.getNeighbors(node), degree * sizeof(uint32_t));
+    }
+    file.write(sectors.data(), sectors.size());
+  }
+
+  file.close();
+  if (!file) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Could not write " + temporary_path + ".");
+  }
+  commitIndexFile(/* temporary_path = */ temporary_path, /* path = */ path);
+}
+
+std::shared_ptr<VamanaIndex> VamanaIndex::load(const std::string &path,
+                                               uint32_t num_io_threads) {
+  // The constructor is private, which rules out std::make_shared.
+  return std::shared_ptr<VamanaIndex>(new VamanaIndex(path, num_io_threads));
+}
+
+VamanaIndex::VamanaIndex(const std::string &path, uint32_t num_io_threads)
+    : _search_list_size(DEFAULT_SEARCH_LIST_SIZE),
+      _beam_width(DEFAULT_BEAM_WIDTH), _num_node_reads(0) {
+  /**
+   * Only the header, the quantization grid and the codes are read here,
+   * through a mapping that is dropped again once they are copied. Nodes
+   * are read on demand by the searches.
+   */
+  MappedFile mapped_file(path);
+  FileHeader header;
+  if (mapped_file.size() < sizeof(header)) {
+    throw std::invalid_argument(path + " is not a Vamana index file.");
+  }
+  std::memcpy(&header, mapped_file.data(), sizeof(header));
+  if (std::memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0) {
+    throw std::invalid_argument(path + " is not a Vamana index file.");
+  }
+  if (header.byte_order_mark != FILE_BYTE_ORDER_MARK) {
+    throw std::invalid_argument(
+        path + " was saved on a machine with a different byte order.");
+  }
+  if (header.version != FILE_VERSION) {
+    throw std::invalid_argument(
+        path + " has format version " + std::to_string(header.version) +
+        ", but only version " + std::to_string(FILE_VERSION) +
+        " is supported.");
+  }
+
+  const uint32_t dimension = header.dimension;
+  const uint32_t num_vectors = header.num_vectors;
+  const uint32_t stride = CodeArena<int_least8_t>::computeStride(dimension);
+  const uint64_t node_size =
+      (uint64_t(dimension) + 1 + header.max_degree) * sizeof(uint32_t);
+  const uint64_t nodes_per_sector = SECTOR_SIZE / node_size;
+  const uint64_t sectors_per_node =
+      nodes_per_sector > 0 ? 1 : alignToSector(node_size) / SECTOR_SIZE;
+  const uint64_t num_node_sectors =
+      nodes_per_sector > 0
+          ? (num_vectors + nodes_per_sector - 1) / nodes_per_sector
+          : num_vectors * sectors_per_node;
+  auto isInFile = [&mapped_file](uint64_t offset, uint64_t size) {
+    return offset % SECTOR_SIZE == 0 && offset <= mapped_file.size() &&
+           size <= mapped_file.size() - offset;
+  };
+  if (header.distance_metric > static_cast<uint32_t>(DistanceMetric::Cosine) ||
+      dimension == 0 || num_vectors == 0 || header.max_degree == 0 ||
+      header.medoid >= num_vectors || header.node_size != node_size ||
+      header.nodes_per_sector != nodes_per_sector ||
+      header.sectors_per_node != sectors_per_node ||
+      !isInFile(header.scales_offset, dimension * sizeof(float)) ||
+      !isInFile(header.zero_points_offset, dimension) ||
+      !isInFile(header.codes_offset, uint64_t(num_vectors) * stride) ||
+      !isInFile(header.nodes_offset, num_node_sectors * SECTOR_SIZE)) {
+    throw std::invalid_argument(path + " is truncated or corrupted.");
+  }
+
+  _distance_metric = static_cast<DistanceMetric>(header.distance_metric);
+  _dimension = dimension;
+  _num_vectors = num_vectors;
+  _max_degree = header.max_degree;
+  _medoid = header.medoid;
+  _node_size = header.node_size;
+  _nodes_per_sector = header.nodes_per_sector;
+  _sectors_per_node = header.sectors_per_node;
+  _nodes_offset = header.nodes_offset;
+
+  const char *data = mapped_file.data();
+  for (uint32_t dim_index = 0; dim_index < dimension; dim_index++) {
+    float scale;
+    std::memcpy(&scale, data + header.scales_offset + dim_index * sizeof(float),
+                sizeof(float));
+    auto zero_point = static_cast<int_least8_t>(
+        data[header.zero_points_offset + dim_index]);
+    _quantization_parameters.emplace_back(scale, zero_point);
+  }
+  _codes = CodeArena<int_least8_t>(/* dimension = */ dimension,
+                                   /* capacity = */ num_vectors);
+  _codes.resize(num_vectors);
+  std::memcpy(_codes.getMutableRow(0), data + header.codes_offset,
+              uint64_t(num_vectors) * stride);
+  if (_distance_metric == DistanceMetric::Euclidean) {
+    _squared_norms.resize(num_vectors);
+    ThreadPool::global().parallelFor(0, num_vectors, [&](uint64_t row) {
+      _squared_norms[row] = lpq::index::dequantizedSquaredNorm(
+          /* quantization_parameters = */ _quantization_parameters,
+          /* code = */ _codes.getRow(row));
+    });
+  }
+  _reader = std::make_unique<SectorReader>(path, num_io_threads);
+}
+
+std::tuple<std::vector<std::vector<float>>, std::vector<std::vector<uint64_t>>>
+VamanaIndex::search(const std::vector<std::vector<float>> &queries,
+                    uint32_t top_k) const {
+  std::vector<std::vector<float>> distances(queries.size());
+  std::vector<std::vector<uint64_t>> ids(queries.size());
+  for (const auto &query : queries) {
+    if (query.size() != _dimension) {
+      throw std::invalid_argument("Input vectors must be of the same size in "
+                                  "order to compute the distance.");
+    }
+  }
+  if (top_k == 0) {
+    return {distances, ids};
+  }
+  std::vector<std::vector<float>> normalized_queries;
+  if (_distance_metric == DistanceMetric::Cosine) {
+    normalized_queries = lpq::index::normalizeVectors(queries);
+  }
+  const auto &points =
+      _distance_metric == DistanceMetric::Cosine ? normalized_queries : queries;
+
+  // Queries spend most of their time waiting for reads, so every query is
+  // a task of its own.
+  ThreadPool::global().parallelFor(
+      0, queries.size(),
+      [&](uint64_t index) {
+        searchQuery(points[index], top_k, distances[index], ids[index]);
+        if (isSimilarityMetric(_distance_metric)) {
+          for (auto &distance : distances[index]) {
+            distance = -distance;
+          }
+        }
+      },
+      /* grain_size = */ 1);
+  return {distances, ids};
+}
+
+void VamanaIndex::searchQuery(const std::vector<float> &query, uint32_t top_k,
+                              std::vector<float> &distances,
+                              std::vector<uint64_t> &ids) const {
+  const bool is_euclidean = _distance_metric == DistanceMetric::Euclidean;
+  const float *query_vector = query.data();
+  const auto prepared_query = lpq::index::prepareAsymmetricQuery(
+      /* quantization_parameters = */ _quantization_parameters,
+      /* vector = */ query_vector, /* stride = */ _codes.getStride());
+  auto getCodeDistance = [&](uint32_t node) {
+    float inner_product =
+        lpq::index::asymmetricDotProduct(
+            /* query = */ prepared_query.transformed_query.data(),
+            /* codes = */ _codes.getRow(node),
+            /* dimension = */ _codes.getStride()) -
+        prepared_query.zero_point_offset;
+    return is_euclidean ? lpq::index::euclideanDistanceFromNorms(
+                              /* first_norm = */ prepared_query.squared_norm,
+                              /* second_norm = */ _squared_norms[node],
+                              /* inner_product = */ inner_product)
+                        : -inner_product;
+  };
+
+  visited_set.reset(_num_vectors);
+  visited_set.visit(_medoid);
+  CandidateList candidates(std::max(_search_list_size, top_k));
+  candidates.insert(getCodeDistance(_medoid), _medoid);
+  TopKSelector<uint64_t> selector(top_k);
+
+  const uint64_t read_size = getNodeReadSize();
+  AlignedVector<char> buffer(_beam_width * read_size);
+  std::vector<uint32_t> beam(_beam_width);
+  std::vector<SectorReader::Request> requests(_beam_width);
+  uint32_t num_nodes;
+  while ((num_nodes = candidates.expandClosest(_beam_width, beam.data())) >
+         0) {
+    for (uint32_t index = 0; index < num_nodes; index++) {
+      requests[index] = {/* offset = */ getNodeSectorOffset(beam[index]),
+                         /* length = */ read_size,
+                         /* buffer = */ buffer.data() + index * read_size};
+    }
+    _reader->read(requests.data(), num_nodes);
+    _num_node_reads.fetch_add(num_nodes, std::memory_order_relaxed);
+
+    for (uint32_t index = 0; index < num_nodes; index++) {
+      const char *node = buffer.data() + index * read_size +
+                         getNodeOffsetInSector(beam[index]);
+      const auto *vector = reinterpret_cast<const float *>(node);
+      const float inner_product =
+          lpq::index::dotProduct(query_vector, vector, _dimension);
+      selector.push(
+          /* distance = */ is_euclidean
+              ? lpq::index::euclideanDistanceFromNorms(
+                    /* first_norm = */ prepared_query.squared_norm,
+                    /* second_norm = */ lpq::index::dotProduct(vector, vector,
+                                                               _dimension),
+                    /* inner_product = */ inner_product)
+              : -inner_product,
+          /* id = */ beam[index]);
+
+      uint32_t degree;
+      std::memcpy(&degree, node + _dimension * sizeof(float), sizeof(degree));
+      const auto *neighbors = reinterpret_cast<const uint32_t *>(
+          node + (_dimension + 1) * sizeof(float));
+      for (uint32_t position = 0; position < std::min(degree, _max_degree);
+           position++) {
+        const uint32_t neighbor = neighbors[position];
+        if (neighbor < _num_vectors && !visited_set.visit(neighbor)) {
+          candidates.insert(getCodeDistance(neighbor), neighbor);
+        }
+      }
+    }
+  }
+  selector.extractSorted(/* distances = */ distances, /* ids = */ ids);
+}
+
+void VamanaIndex::setSearchListSize(uint32_t search_list_size) {
+  if (search_list_size == 0) {
+    throw std::invalid_argument("The search list size must be positive.");
+  }
+  _search_list_size = search_list_size;
+}
+
+void VamanaIndex::setBeamWidth(uint32_t beam_width) {
+  if (beam_width == 0) {
+    throw std::invalid_argument("The beam width must be positive.");
+  }
+  _beam_width = beam_width;
+}
+
+size_t VamanaIndex::getMemoryUsage() const {
+  return sizeof(*this) + sizeof(SectorReader) + _codes.getMemoryUsage() +
+         _squared_norms.capacity() * sizeof(float) +
+         _quantization_parameters.capacity() *
+             sizeof(std::tuple<float, int_least8_t>);
+}
+
+} // namespace lpq::index
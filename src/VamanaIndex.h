@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <src/CodeArena.h>
+#include <src/DistanceMetrics.h>
+#include <src/SectorReader.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * Disk-resident graph index in the style of DiskANN. `build` constructs a
+ * Vamana graph over the vectors in RAM and writes it to a file in which
+ * every node (its float vector followed by its neighbour list) sits in
+ * one SECTOR_SIZE sector, or in a run of whole sectors if it is larger.
+ * `load` keeps only the int8 codes of the vectors (from
+ * LowPrecisionQuantizer) in RAM, about one byte per dimension, and leaves
+ * the graph and the float vectors on disk.
+ *
+ * A search is a beam search from the medoid. The candidates are ranked by
+ * their int8 distances, computed in RAM. Every step reads the nodes of
+ * the `beam_width` best unexpanded candidates in one batch of parallel
+ * reads, scores them exactly with their float vectors and adds their
+ * neighbours as candidates. The search stops once the best
+ * `search_list_size` candidates are all expanded, so it reads about
+ * search_list_size nodes, and the top k are the expanded nodes with the
+ * best exact distances.
+ *
+ * Cosine search normalizes the vectors and the queries and runs as inner
+ * product search. For inner products the graph is built on the euclidean
+ * distances of the vectors extended by one dimension that gives all of
+ * them the same norm, which orders neighbours by inner product.
+ *
+ * IDs are the positions of the vectors passed to `build`. Searches can run
+ * concurrently.
+ */
+class VamanaIndex {
+public:
+  static constexpr uint32_t DEFAULT_MAX_DEGREE = 64;
+  static constexpr uint32_t DEFAULT_BUILD_LIST_SIZE = 100;
+  static constexpr float DEFAULT_ALPHA = 1.2f;
+  static constexpr uint32_t DEFAULT_SEARCH_LIST_SIZE = 64;
+  static constexpr uint32_t DEFAULT_BEAM_WIDTH = 4;
+  static constexpr uint32_t DEFAULT_NUM_IO_THREADS = 8;
+
+  // Granularity of reads; every section of the file is aligned to it.
+  static constexpr uint64_t SECTOR_SIZE = 4096;
+
+  /**
+   * Builds the graph over `vectors` and writes the index to `path`. Nodes
+   * link to at most `max_degree` neighbours, chosen from the candidates
+   * of a search with a list of `build_list_size` nodes. `alpha` >= 1
+   * keeps links to farther nodes that make the graph easier to navigate.
+   */
+  static void build(const std::vector<std::vector<float>> &vectors,
+                    const std::string &distance_metric,
+                    const std::string &path,
+                    uint32_t max_degree = DEFAULT_MAX_DEGREE,
+                    uint32_t build_list_size = DEFAULT_BUILD_LIST_SIZE,
+                    float alpha = DEFAULT_ALPHA);
+
+  /**
+   * Opens an index written by `build`, reading the int8 codes into RAM.
+   * Node reads are served by `num_io_threads` threads.
+   */
+  static std::shared_ptr<VamanaIndex>
+  load(const std::string &path,
+       uint32_t num_io_threads = DEFAULT_NUM_IO_THREADS);
+
+  /**
+   * Returns the top k vectors for every query, with exact float distances,
+   * in the same layout as ExactSearchIndex::search. Queries run in
+   * parallel.
+   */
+  std::tuple<std::vector<std::vector<float>>,
+             std::vector<std::vector<uint64_t>>>
+  search(const std::vector<std::vector<float>> &queries,
+         uint32_t top_k) const;
+
+  /**
+   * Sets the number of candidates a search keeps. It always keeps at
+   * least top_k. Larger lists raise the recall and the number of reads.
+   */
+  void setSearchListSize(uint32_t search_list_size);
+
+  uint32_t getSearchListSize() const { return _search_list_size; }
+
+  // Sets the number of nodes read per step of a search.
+  void setBeamWidth(uint32_t beam_width);
+
+  uint32_t getBeamWidth() const { return _beam_width; }
+
+  uint32_t getMaxDegree() const { return _max_degree; }
+
+  uint32_t size() const { return _num_vectors; }
+
+  // Returns the number of nodes read from disk by all searches so far.
+  uint64_t getNumNodeReads() const {
+    return _num_node_reads.load(std::memory_order_relaxed);
+  }
+
+  // Returns the number of bytes held in RAM by the index.
+  size_t getMemoryUsage() const;
+
+private:
+  /**
+   * On-disk layout (native byte order), every part starting at a multiple
+   * of SECTOR_SIZE:
+   *
+   *   FileHeader | quantization scales | zero points | int8 codes | nodes
+   *
+   * Codes are padded to the arena stride. A node is the float vector, the
+   * number of neighbours and `max_degree` neighbour slots. Nodes never
+   * straddle a sector boundary: `nodes_per_sector` nodes share a sector,
+   * or a node takes `sectors_per_node` whole sectors.
+   */
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order_mark;
+    uint32_t distance_metric;
+    uint32_t dimension;
+    uint32_t num_vectors;
+    uint32_t max_degree;
+    uint32_t medoid;
+    uint32_t node_size;
+    uint32_t nodes_per_sector;
+    uint32_t sectors_per_node;
+    uint64_t scales_offset;
+    uint64_t zero_points_offset;
+    uint64_t codes_offset;
+    uint64_t nodes_offset;
+  };
+
+  static constexpr char FILE_MAGIC[8] = {'L', 'P', 'Q', 'V', 'A', 'M', 'N',
+                                         'A'};
+  static constexpr uint32_t FILE_VERSION = 1;
+  static constexpr uint32_t FILE_BYTE_ORDER_MARK = 0x01020304;
+
+  VamanaIndex(const std::string &path, uint32_t num_io_threads);
+
+  // Returns the offset of the sectors that hold `node`.
+  uint64_t getNodeSectorOffset(uint32_t node) const {
+    return _nodes_offset +
+           (_nodes_per_sector > 0
+                ? uint64_t(node / _nodes_per_sector) * SECTOR_SIZE
+                : uint64_t(node) * _sectors_per_node * SECTOR_SIZE);
+  }
+
+  // Returns the offset of `node` within its first sector.
+  uint64_t getNodeOffsetInSector(uint32_t node) const {
+    return _nodes_per_sector > 0
+               ? uint64_t(node % _nodes_per_sector) * _node_size
+               : 0;
+  }
+
+  uint64_t getNodeReadSize() const {
+    return _nodes_per_sector > 0 ? SECTOR_SIZE
+                                 : _sectors_per_node * SECTOR_SIZE;
+  }
+
+  /**
+   * Searches for one (normalized, for cosine) query and returns its top k
+   * (distance, id) keys, where similarities are negated.
+   */
+  void searchQuery(const std::vector<float> &query, uint32_t top_k,
+                   std::vector<float> &distances,
+                   std::vector<uint64_t> &ids) const;
+
+  DistanceMetric _distance_metric;
+  uint32_t _dimension;
+  uint32_t _num_vectors;
+  uint32_t _max_degree;
+  uint32_t _medoid;
+  uint32_t _node_size;
+  uint32_t _nodes_per_sector;
+  uint32_t _sectors_per_node;
+  uint64_t _nodes_offset;
+
+  uint32_t _search_list_size;
+  uint32_t _beam_width;
+
+  std::vector<std::tuple<float, int_least8_t>> _quantization_parameters;
+  CodeArena<int_least8_t> _codes;
+  // Squared norms of the dequantized codes (euclidean metric only).
+  std::vector<float> _squared_norms;
+
+  std::unique_ptr<SectorReader> _reader;
+  mutable std::atomic<uint64_t> _num_node_reads;
+};
+
+} // namespace lpq::index
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace lpq::index {
+
+/**
+ * The nodes visited by a graph search. Marks are tagged with the number
+ * of the search that set them, so starting a new search does not need to
+ * clear them. Graph indices keep one set per thread (thread_local) across
+ * searches, so that a search does not allocate a mark per node either.
+ */
+struct VisitedSet {
+  std::vector<uint32_t> marks;
+  uint32_t epoch = 0;
+
+  // Starts a new search over a graph of `num_nodes` nodes.
+  void reset(uint32_t num_nodes) {
+    if (marks.size() < num_nodes) {
+      marks.resize(num_nodes, 0);
+    }
+    if (++epoch == 0) {
+      std::fill(marks.begin(), marks.end(), 0);
+      epoch = 1;
+    }
+  }
+
+  // Marks `node` and returns whether it was marked before.
+  bool visit(uint32_t node) {
+    if (marks[node] == epoch) {
+      return true;
+    }
+    marks[node] = epoch;
+    return false;
+  }
+};
+
+} // namespace lpq::index
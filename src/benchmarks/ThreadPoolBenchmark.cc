@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <omp.h>
+#include <random>
+#include <src/ThreadPool.h>
+#include <vector>
+
+/**
+ * Compares the latency of an OpenMP parallel loop with the same loop on
+ * the global ThreadPool, for query batches of 1 to 256 queries:
+ *
+ *   thread_pool_benchmark [<num vectors> [<dimension>]]
+ *
+ * Every query scans a small int8 base set, which is the work of a search
+ * over a small index. The smaller the batch and the base set, the larger
+ * the share of the fork/join overhead in the latency.
+ */
+
+using lpq::ThreadPool;
+
+static int32_t scanBase(const std::vector<int8_t> &base,
+                        const int8_t *query, uint32_t dimension) {
+  int32_t best = std::numeric_limits<int32_t>::max();
+  for (size_t row = 0; row < base.size(); row += dimension) {
+    int32_t distance = 0;
+    for (uint32_t dim = 0; dim < dimension; dim++) {
+      int32_t difference = int32_t(base[row + dim]) - query[dim];
+      distance += difference * difference;
+    }
+    best = std::min(best, distance);
+  }
+  return best;
+}
+
+template <typename FUNCTION>
+static double medianMicroseconds(uint32_t repetitions,
+                                 const FUNCTION &function) {
+  std::vector<double> timings;
+  for (uint32_t repetition = 0; repetition < repetitions; repetition++) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    timings.push_back(
+        std::chrono::duration<double, std::micro>(end - start).count());
+  }
+  std::nth_element(timings.begin(), timings.begin() + timings.size() / 2,
+                   timings.end());
+  return timings[timings.size() / 2];
+}
+
+int main(int argc, char **argv) {
+  const uint32_t num_vectors = argc > 1 ? std::atoi(argv[1]) : 10000;
+  const uint32_t dimension = argc > 2 ? std::atoi(argv[2]) : 128;
+  if (num_vectors == 0 || dimension == 0) {
+    std::cerr << "Usage: " << argv[0] << " [<num vectors> [<dimension>]]\n";
+    return 2;
+  }
+
+  std::mt19937 generator(0);
+  std::uniform_int_distribution<int> distribution(-128, 127);
+  std::vector<int8_t> base(uint64_t(num_vectors) * dimension);
+  std::vector<int8_t> queries(256 * dimension);
+  for (auto &value : base) {
+    value = distribution(generator);
+  }
+  for (auto &value : queries) {
+    value = distribution(generator);
+  }
+
+  auto &thread_pool = ThreadPool::global();
+  std::cout << "threads: " << thread_pool.numThreads()
+            << ", vectors: " << num_vectors << ", dimension: " << dimension
+            << "\n\n";
+  std::cout << std::setw(8) << "batch" << std::setw(14) << "openmp (us)"
+            << std::setw(14) << "pool (us)" << std::setw(10) << "speedup"
+            << '\n';
+
+  std::vector<int32_t> results(256);
+  for (uint32_t batch_size = 1; batch_size <= 256; batch_size *= 2) {
+    // Enough repetitions for a stable median, at least 2048 queries.
+    const uint32_t repetitions = std::max(20u, 2048 / batch_size);
+
+    double openmp_time = medianMicroseconds(repetitions, [&] {
+#pragma omp parallel for default(none) schedule(dynamic)                       \
+    shared(batch_size, base, queries, dimension, results)
+      for (uint32_t query = 0; query < batch_size; query++) {
+        results[query] = scanBase(base, &queries[query * dimension], dimension);
+      }
+    });
+
+    double pool_time = medianMicroseconds(repetitions, [&] {
+      thread_pool.parallelFor(
+          0, batch_size,
+          [&](uint64_t query) {
+            results[query] =
+                scanBase(base, &queries[query * dimension], dimension);
+          },
+          /* grain_size = */ 1);
+    });
+
+    std::cout << std::setw(8) << batch_size << std::fixed
+              << std::setprecision(1) << std::setw(14) << openmp_time
+              << std::setw(14) << pool_time << std::setprecision(2)
+              << std::setw(9) << openmp_time / pool_time << "x\n";
+  }
+  return 0;
+}
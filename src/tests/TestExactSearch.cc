@@ -0,0 +1,1177 @@
+#include "../AllowList.h"
+#include "../DistanceMetrics.h"
+#include "../ExactSearch.h"
+#include "../LPQ.h"
+#include "../ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using lpq::ThreadPool;
+using lpq::index::AllowList;
+using lpq::index::ExactSearchIndex;
+using lpq::index::LatencyHistogram;
+using lpq::index::QueryCache;
+using lpq::index::SearchCancelled;
+using lpq::index::SearchExecutor;
+using lpq::index::SearchFuture;
+using lpq::index::SearchParallelism;
+using lpq::index::SearchResults;
+using lpq::index::TopKSelector;
+
+constexpr uint32_t NUM_VECTORS = 200;
+constexpr uint32_t NUM_QUERIES = 10;
+constexpr uint32_t VECTOR_DIMENSION = 64;
+constexpr uint32_t TOP_K = 10;
+
+/**
+ * Constructs random vectors whose entries are drawn uniformly from
+ * [min_value, max_value].
+ */
+template <typename PRECISION_TYPE>
+std::vector<std::vector<PRECISION_TYPE>>
+getRandomVectors(uint32_t num_vectors, float min_value, float max_value,
+                 uint32_t seed, uint32_t dimension = VECTOR_DIMENSION) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> distribution(min_value, max_value);
+
+  std::vector<std::vector<PRECISION_TYPE>> output(num_vectors);
+  for (auto &vector : output) {
+    vector.reserve(dimension);
+    for (uint32_t i = 0; i < dimension; i++) {
+      vector.emplace_back(static_cast<PRECISION_TYPE>(distribution(generator)));
+    }
+  }
+  return output;
+}
+
+/**
+ * Computes the expected top k ids with the reference (non-indexed)
+ * distance functions. Ties are broken by the smaller id.
+ */
+template <typename PRECISION_TYPE>
+std::vector<uint64_t>
+getExpectedNeighbors(const std::vector<std::vector<PRECISION_TYPE>> &dataset,
+                     const std::vector<PRECISION_TYPE> &query,
+                     const std::string &metric, uint32_t top_k) {
+  bool is_similarity = metric != "euclidean";
+  std::vector<std::pair<float, uint32_t>> scores;
+  for (uint32_t i = 0; i < dataset.size(); i++) {
+    float score = lpq::index::computeDistance(query, dataset[i], metric);
+    scores.emplace_back(is_similarity ? -score : score, i);
+  }
+  std::sort(scores.begin(), scores.end());
+
+  std::vector<uint64_t> ids;
+  for (uint32_t i = 0; i < top_k; i++) {
+    ids.push_back(scores[i].second);
+  }
+  return ids;
+}
+
+TEST(ExactSearchTest, EuclideanFromNormsMatchesBruteForceInt8) {
+  auto dataset = getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 0);
+  auto queries = getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 1);
+
+  ExactSearchIndex<int_least8_t> index("euclidean");
+  index.addDataset(dataset);
+  auto [distances, ids] = index.search(queries, TOP_K);
+
+  for (uint32_t query_index = 0; query_index < NUM_QUERIES; query_index++) {
+    auto expected_ids = getExpectedNeighbors(dataset, queries[query_index],
+                                             "euclidean", TOP_K);
+    ASSERT_EQ(ids[query_index], expected_ids);
+    for (uint32_t i = 0; i < TOP_K; i++) {
+      ASSERT_EQ(distances[query_index][i],
+                lpq::index::euclideanDistance(queries[query_index],
+                                              dataset[ids[query_index][i]]));
+    }
+  }
+}
+
+TEST(ExactSearchTest, EuclideanFromNormsMatchesBruteForceFloat) {
+  auto dataset = getRandomVectors<float>(NUM_VECTORS, -1, 1, 2);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 3);
+
+  ExactSearchIndex<float> index("Euclidean");
+  index.addDataset(dataset);
+  auto [distances, ids] = index.search(queries, TOP_K);
+
+  for (uint32_t query_index = 0; query_index < NUM_QUERIES; query_index++) {
+    for (uint32_t i = 0; i < TOP_K; i++) {
+      ASSERT_NEAR(distances[query_index][i],
+                  lpq::index::euclideanDistance(queries[query_index],
+                                                dataset[ids[query_index][i]]),
+                  1e-4);
+    }
+  }
+}
+
+TEST(ExactSearchTest, EarlyAbandonMatchesBruteForceHighDimension) {
+  // Several early-abandon blocks per vector, with a few high variance
+  // dimensions at the end so that the reordering actually permutes them.
+  constexpr uint32_t dimension = 300;
+  auto dataset =
+      getRandomVectors<int_least8_t>(NUM_VECTORS, -10, 10, 12, dimension);
+  auto queries =
+      getRandomVectors<int_least8_t>(NUM_QUERIES, -10, 10, 13, dimension);
+  std::mt19937 generator(14);
+  std::uniform_int_distribution<int> distribution(-128, 127);
+  for (auto *vectors : {&dataset, &queries}) {
+    for (auto &vector : *vectors) {
+      for (uint32_t i = dimension - 20; i < dimension; i++) {
+        vector[i] = distribution(generator);
+      }
+    }
+  }
+
+  ExactSearchIndex<int_least8_t> index("euclidean");
+  index.addDataset(dataset);
+  auto [distances, ids] = index.search(queries, TOP_K);
+
+  for (uint32_t query_index = 0; query_index < NUM_QUERIES; query_index++) {
+    auto expected_ids = getExpectedNeighbors(dataset, queries[query_index],
+                                             "euclidean", TOP_K);
+    ASSERT_EQ(ids[query_index], expected_ids);
+    for (uint32_t i = 0; i < TOP_K; i++) {
+      ASSERT_EQ(distances[query_index][i],
+                lpq::index::euclideanDistance(queries[query_index],
+                                              dataset[expected_ids[i]]));
+    }
+  }
+}
+
+TEST(ExactSearchTest, InnerProductMatchesBruteForceInt8) {
+  auto dataset = getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 4);
+  auto queries = getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 5);
+
+  ExactSearchIndex<int_least8_t> index("dot");
+  index.addDataset(dataset);
+  auto [distances, ids] = index.search(queries, TOP_K);
+
+  for (uint32_t query_index = 0; query_index < NUM_QUERIES; query_index++) {
+    auto expected_ids =
+        getExpectedNeighbors(dataset, queries[query_index], "dot", TOP_K);
+    ASSERT_EQ(ids[query_index], expected_ids);
+  }
+}
+
+TEST(ExactSearchTest, CosineMatchesBruteForceOnUnnormalizedVectors) {
+  auto dataset = getRandomVectors<float>(NUM_VECTORS, -5, 20, 10);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -5, 20, 11);
+
+  ExactSearchIndex<float> index("angular");
+  index.addDataset(dataset);
+  auto [distances, ids] = index.search(queries, TOP_K);
+
+  for (uint32_t query_index = 0; query_index < NUM_QUERIES; query_index++) {
+    auto expected_ids =
+        getExpectedNeighbors(dataset, queries[query_index], "cosine", TOP_K);
+    ASSERT_EQ(ids[query_index], expected_ids);
+    for (uint32_t i = 0; i < TOP_K; i++) {
+      ASSERT_NEAR(distances[query_index][i],
+                  lpq::index::cosineSimilarity(queries[query_index],
+                                               dataset[expected_ids[i]]),
+                  1e-5);
+    }
+  }
+}
+
+TEST(ExactSearchTest, UnknownMetricThrows) {
+  ASSERT_THROW(ExactSearchIndex<float>("manhattan"), std::invalid_argument);
+}
+
+TEST(ExactSearchTest, AsymmetricSearchMatchesDequantizedBruteForce) {
+  // Large enough for the euclidean index to reorder its dimensions.
+  constexpr uint32_t dimension = 2 * VECTOR_DIMENSION;
+  auto float_dataset =
+      getRandomVectors<float>(NUM_VECTORS, -1, 1, 6, dimension);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 7, dimension);
+
+  lpq::LowPrecisionQuantizer<int_least8_t> quantizer;
+  auto codes = quantizer.quantizeVectors(float_dataset);
+  const auto &parameters = quantizer.getQuantizationParameters();
+
+  std::vector<std::vector<float>> dequantized(codes.size());
+  for (uint32_t i = 0; i < codes.size(); i++) {
+    for (uint32_t j = 0; j < dimension; j++) {
+      auto [scale, zero_point] = parameters[j];
+      dequantized[i].push_back(scale * (codes[i][j] - zero_point));
+    }
+  }
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    ExactSearchIndex<int_least8_t> index(metric);
+    index.setQuantizationParameters(parameters);
+    index.addDataset(codes);
+    auto [distances, ids] = index.searchAsymmetric(queries, TOP_K);
+
+    for (uint32_t query_index = 0; query_index < NUM_QUERIES; query_index++) {
+      auto expected_ids = getExpectedNeighbors(
+          dequantized, queries[query_index], metric, TOP_K);
+      ASSERT_EQ(ids[query_index], expected_ids);
+      for (uint32_t i = 0; i < TOP_K; i++) {
+        ASSERT_NEAR(distances[query_index][i],
+                    lpq::index::computeDistance(queries[query_index],
+                                                dequantized[expected_ids[i]],
+                                                metric),
+                    1e-4);
+      }
+    }
+  }
+}
+
+TEST(ExactSearchTest, AsymmetricSearchRequiresQuantizationParameters) {
+  ExactSearchIndex<int_least8_t> index("euclidean");
+  index.addDataset(getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 8));
+  ASSERT_THROW(index.searchAsymmetric(
+                   getRandomVectors<float>(NUM_QUERIES, -1, 1, 9), TOP_K),
+               std::invalid_argument);
+}
+
+TEST(ExactSearchTest, MemoryUsageAccountsForPaddedCodes) {
+  // 100 int8 dimensions are padded to a 128 byte stride.
+  constexpr uint32_t dimension = 100;
+  auto dataset =
+      getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 15, dimension);
+
+  ExactSearchIndex<int_least8_t> index("dot");
+  auto empty_usage = index.getMemoryUsage();
+  index.addDataset(dataset);
+
+  // The first segment reserves room for 1024 rows, each with a padded
+  // code, a 4 byte ordinal and an 8 byte id.
+  constexpr uint32_t segment_capacity = 1024;
+  constexpr uint32_t row_bytes = 128 + sizeof(uint32_t) + sizeof(uint64_t);
+  ASSERT_EQ(index.size(), NUM_VECTORS);
+  ASSERT_GE(index.getMemoryUsage(), empty_usage + segment_capacity * row_bytes);
+  ASSERT_LT(index.getMemoryUsage(),
+            empty_usage + segment_capacity * row_bytes + 4096);
+}
+
+TEST(ExactSearchTest, IncrementalAddMatchesSingleAdd) {
+  // Large enough to fill the first segment and allocate two more.
+  constexpr uint32_t num_vectors = 5000;
+  auto dataset = getRandomVectors<float>(num_vectors, -1, 1, 17);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 18);
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    ExactSearchIndex<float> single_index(metric);
+    single_index.addDataset(dataset);
+
+    ExactSearchIndex<float> incremental_index(metric);
+    std::vector<uint32_t> batch_sizes = {300, 900, 1, 2000, 1799};
+    uint32_t next_id = 0;
+    for (auto batch_size : batch_sizes) {
+      std::vector<std::vector<float>> batch(
+          dataset.begin() + next_id, dataset.begin() + next_id + batch_size);
+      auto ids = incremental_index.add(batch);
+
+      ASSERT_EQ(ids.size(), batch_size);
+      for (uint32_t i = 0; i < batch_size; i++) {
+        ASSERT_EQ(ids[i], next_id + i);
+      }
+      next_id += batch_size;
+    }
+    ASSERT_EQ(incremental_index.size(), num_vectors);
+
+    auto [expected_distances, expected_ids] =
+        single_index.search(queries, TOP_K);
+    auto [distances, ids] = incremental_index.search(queries, TOP_K);
+    ASSERT_EQ(ids, expected_ids);
+    for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+      for (uint32_t i = 0; i < TOP_K; i++) {
+        ASSERT_NEAR(distances[query][i], expected_distances[query][i], 1e-4);
+      }
+    }
+  }
+}
+
+TEST(ExactSearchTest, SearchWhileAddingSeesWholeBatches) {
+  constexpr uint32_t batch_size = 500;
+  constexpr uint32_t num_batches = 20;
+  auto dataset =
+      getRandomVectors<float>(batch_size * num_batches, -1, 1, 19);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 20);
+
+  ExactSearchIndex<float> index("euclidean");
+  std::thread writer([&index, &dataset]() {
+    for (uint32_t batch = 0; batch < num_batches; batch++) {
+      index.add(std::vector<std::vector<float>>(
+          dataset.begin() + batch * batch_size,
+          dataset.begin() + (batch + 1) * batch_size));
+    }
+  });
+
+  // Every search sees a whole number of batches, so it never returns an
+  // id that was not published when it finished.
+  uint32_t size_before = 0;
+  while (size_before < batch_size * num_batches) {
+    size_before = index.size();
+    ASSERT_EQ(size_before % batch_size, 0);
+
+    auto [distances, ids] = index.search(queries, TOP_K);
+    uint32_t size_after = index.size();
+    for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+      ASSERT_GE(ids[query].size(), std::min(size_before, TOP_K));
+      for (auto id : ids[query]) {
+        ASSERT_LT(id, size_after);
+      }
+    }
+  }
+  writer.join();
+
+  std::vector<std::vector<float>> empty_batch;
+  ASSERT_TRUE(index.add(empty_batch).empty());
+
+  auto [distances, ids] = index.search(queries, TOP_K);
+  for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+    ASSERT_EQ(ids[query], getExpectedNeighbors(dataset, queries[query],
+                                               "euclidean", TOP_K));
+  }
+}
+
+TEST(ExactSearchTest, RemovedVectorsAreSkippedBySearch) {
+  constexpr uint32_t num_vectors = 3000;
+  auto dataset = getRandomVectors<float>(num_vectors, -1, 1, 21);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 22);
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    ExactSearchIndex<float> index(metric);
+    // Disable compaction so that the search has to skip the tombstones.
+    index.setCompactionThreshold(1.f);
+    index.add(std::vector<std::vector<float>>(dataset.begin(),
+                                              dataset.begin() + 1000));
+    index.add(std::vector<std::vector<float>>(dataset.begin() + 1000,
+                                              dataset.end()));
+
+    // Remove the current top k of every query, plus a whole bitmap word.
+    auto [distances, ids] = index.search(queries, TOP_K);
+    std::vector<uint64_t> removed_ids;
+    for (const auto &query_ids : ids) {
+      removed_ids.insert(removed_ids.end(), query_ids.begin(),
+                         query_ids.end());
+    }
+    for (uint32_t id = 128; id < 192; id++) {
+      removed_ids.push_back(id);
+    }
+    std::sort(removed_ids.begin(), removed_ids.end());
+    removed_ids.erase(std::unique(removed_ids.begin(), removed_ids.end()),
+                      removed_ids.end());
+
+    // Unknown and repeated ids are ignored.
+    auto ids_to_remove = removed_ids;
+    ids_to_remove.push_back(num_vectors + 5);
+    ids_to_remove.push_back(removed_ids[0]);
+    ASSERT_EQ(index.remove(ids_to_remove), removed_ids.size());
+    ASSERT_EQ(index.size(), num_vectors - removed_ids.size());
+
+    std::vector<std::vector<float>> remaining_vectors;
+    std::vector<uint32_t> remaining_ids;
+    for (uint32_t id = 0; id < num_vectors; id++) {
+      if (!std::binary_search(removed_ids.begin(), removed_ids.end(), id)) {
+        remaining_vectors.push_back(dataset[id]);
+        remaining_ids.push_back(id);
+      }
+    }
+
+    auto [new_distances, new_ids] = index.search(queries, TOP_K);
+    for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+      auto expected = getExpectedNeighbors(remaining_vectors, queries[query],
+                                           metric, TOP_K);
+      for (uint32_t i = 0; i < TOP_K; i++) {
+        ASSERT_EQ(new_ids[query][i], remaining_ids[expected[i]]);
+      }
+    }
+  }
+}
+
+TEST(ExactSearchTest, CompactionPreservesResults) {
+  constexpr uint32_t num_vectors = 4000;
+  auto dataset = getRandomVectors<float>(num_vectors, -1, 1, 23);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 24);
+
+  ExactSearchIndex<float> index("euclidean");
+  index.setCompactionThreshold(1.f);
+  index.add(std::vector<std::vector<float>>(dataset.begin(),
+                                            dataset.begin() + 1500));
+  index.add(std::vector<std::vector<float>>(dataset.begin() + 1500,
+                                            dataset.end()));
+
+  // Remove every third vector.
+  std::vector<uint64_t> removed_ids;
+  for (uint32_t id = 0; id < num_vectors; id += 3) {
+    removed_ids.push_back(id);
+  }
+  index.remove(removed_ids);
+  auto [expected_distances, expected_ids] = index.search(queries, TOP_K);
+  auto usage_before_compaction = index.getMemoryUsage();
+
+  index.setCompactionThreshold(0.2f);
+  index.compact();
+  ASSERT_LT(index.getMemoryUsage(), usage_before_compaction);
+  ASSERT_EQ(index.size(), num_vectors - removed_ids.size());
+
+  auto [distances, ids] = index.search(queries, TOP_K);
+  ASSERT_EQ(ids, expected_ids);
+  ASSERT_EQ(distances, expected_distances);
+
+  // Ids stay stable after compaction, and new ids continue the sequence.
+  ASSERT_EQ(index.remove({1, 2}), 2);
+  ASSERT_EQ(index.remove({0}), 0);
+  auto new_ids = index.add({dataset[0]});
+  ASSERT_EQ(new_ids[0], num_vectors);
+
+  auto [single_distances, single_ids] = index.search({dataset[0]}, 1);
+  ASSERT_EQ(single_ids[0][0], num_vectors);
+}
+
+TEST(ExactSearchTest, SearchReturnsExternalIds) {
+  auto dataset = getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 25);
+  auto queries = getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 26);
+
+  // Large ids that do not fit into 32 bits.
+  auto getExternalId = [](uint64_t ordinal) {
+    return (uint64_t(1) << 40) + 7 * ordinal;
+  };
+  std::vector<uint64_t> external_ids;
+  for (uint32_t i = 0; i < NUM_VECTORS; i++) {
+    external_ids.push_back(getExternalId(i));
+  }
+
+  for (bool id_lookup : {false, true}) {
+    ExactSearchIndex<int_least8_t> index("euclidean");
+    index.setIdLookup(id_lookup);
+    ASSERT_EQ(index.add(dataset, external_ids), external_ids);
+
+    auto [distances, ids] = index.search(queries, TOP_K);
+    for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+      auto expected =
+          getExpectedNeighbors(dataset, queries[query], "euclidean", TOP_K);
+      for (uint32_t i = 0; i < TOP_K; i++) {
+        ASSERT_EQ(ids[query][i], getExternalId(expected[i]));
+      }
+    }
+
+    // Removing by external id, including an unknown one.
+    ASSERT_EQ(index.remove({ids[0][0], ids[0][0] + 1}), 1);
+    ASSERT_EQ(index.size(), NUM_VECTORS - 1);
+    auto [new_distances, new_ids] = index.search({queries[0]}, TOP_K);
+    ASSERT_EQ(new_ids[0][0], ids[0][1]);
+  }
+}
+
+TEST(ExactSearchTest, IdLookupRejectsDuplicateIds) {
+  auto dataset = getRandomVectors<float>(4, -1, 1, 27);
+
+  ExactSearchIndex<float> index("dot");
+  index.setIdLookup(true);
+  index.add({dataset[0], dataset[1]}, {10, 20});
+  ASSERT_THROW(index.add({dataset[2]}, {20}), std::invalid_argument);
+  ASSERT_THROW(index.add({dataset[2], dataset[3]}, {30, 30}),
+               std::invalid_argument);
+  ASSERT_THROW(index.add({dataset[2]}, {30, 40}), std::invalid_argument);
+  ASSERT_EQ(index.size(), 2);
+
+  // A removed id can be added again.
+  ASSERT_EQ(index.remove({20}), 1);
+  index.add({dataset[2]}, {20});
+  ASSERT_EQ(index.size(), 2);
+}
+
+TEST(ExactSearchTest, AllowListMatchesKeySetForSparseAndDenseChunks) {
+  std::mt19937 generator(28);
+  // A sparse chunk, a dense chunk and a sparse chunk after a gap.
+  std::vector<uint32_t> keys;
+  std::uniform_int_distribution<uint32_t> sparse_keys(0, (1 << 16) - 1);
+  std::uniform_int_distribution<uint32_t> dense_keys(1 << 16, (2 << 16) - 1);
+  std::uniform_int_distribution<uint32_t> far_keys(5 << 16, (6 << 16) - 1);
+  for (uint32_t i = 0; i < 1000; i++) {
+    keys.push_back(sparse_keys(generator));
+    keys.push_back(far_keys(generator));
+  }
+  for (uint32_t i = 0; i < 30000; i++) {
+    keys.push_back(dense_keys(generator));
+  }
+  std::vector<bool> expected(6 << 16, false);
+  for (auto key : keys) {
+    expected[key] = true;
+  }
+
+  std::vector<uint64_t> words(expected.size() / 64, 0);
+  for (uint32_t key = 0; key < expected.size(); key++) {
+    if (expected[key]) {
+      words[key / 64] |= uint64_t(1) << (key % 64);
+    }
+  }
+  AllowList dense_allow_list = AllowList::fromBitmap(words);
+  AllowList allow_list(keys);
+  ASSERT_EQ(allow_list.cardinality(),
+            std::count(expected.begin(), expected.end(), true));
+  ASSERT_EQ(dense_allow_list.cardinality(), allow_list.cardinality());
+  ASSERT_LT(allow_list.getMemoryUsage(), dense_allow_list.getMemoryUsage());
+
+  // Unaligned windows, including ones across chunk boundaries.
+  for (uint32_t first_key = 0; first_key + 64 < expected.size();
+       first_key += 61) {
+    uint64_t expected_bits = 0;
+    for (uint32_t i = 0; i < 64; i++) {
+      expected_bits |= uint64_t(expected[first_key + i]) << i;
+    }
+    ASSERT_EQ(allow_list.getBits(first_key), expected_bits);
+    ASSERT_EQ(dense_allow_list.getBits(first_key), expected_bits);
+    ASSERT_EQ(allow_list.contains(first_key), expected[first_key]);
+    ASSERT_EQ(allow_list.anyInRange(first_key, first_key + 63),
+              expected_bits != 0);
+  }
+  ASSERT_FALSE(allow_list.anyInRange(2 << 16, (5 << 16) - 1));
+  ASSERT_FALSE(allow_list.contains(uint32_t(-1)));
+}
+
+TEST(ExactSearchTest, FilteredSearchMatchesBruteForceOnSubset) {
+  constexpr uint32_t num_vectors = 3000;
+  auto dataset = getRandomVectors<float>(num_vectors, -1, 1, 29);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 30);
+
+  // Every query gets its own "tenant", and query 0 a tenant too small to
+  // fill the top k.
+  std::vector<std::vector<uint32_t>> tenant_ids(NUM_QUERIES);
+  std::mt19937 generator(31);
+  for (uint32_t id = 0; id < num_vectors; id++) {
+    tenant_ids[1 + generator() % (NUM_QUERIES - 1)].push_back(id);
+  }
+  tenant_ids[0] = {5, 1500, 2999};
+
+  ExactSearchIndex<float> index("euclidean");
+  index.setCompactionThreshold(1.f);
+  index.add(std::vector<std::vector<float>>(dataset.begin(),
+                                            dataset.begin() + 1000));
+  index.add(std::vector<std::vector<float>>(dataset.begin() + 1000,
+                                            dataset.end()));
+  // Removing a block of rows and compacting leaves segments whose
+  // ordinals are not contiguous.
+  std::vector<uint64_t> removed_ids;
+  for (uint32_t id = 100; id < 400; id++) {
+    removed_ids.push_back(id);
+  }
+  index.remove(removed_ids);
+  index.setCompactionThreshold(0.1f);
+  index.compact();
+
+  std::vector<AllowList> allow_lists;
+  for (const auto &ids : tenant_ids) {
+    allow_lists.push_back(
+        index.createAllowList(std::vector<uint64_t>(ids.begin(), ids.end())));
+  }
+
+  for (auto parallelism :
+       {SearchParallelism::QueryParallel, SearchParallelism::BaseParallel}) {
+    index.setSearchParallelism(parallelism);
+    auto [distances, ids] = index.search(queries, TOP_K, allow_lists);
+
+    for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+      std::vector<std::vector<float>> subset;
+      std::vector<uint32_t> subset_ids;
+      for (auto id : tenant_ids[query]) {
+        if (id < 100 || id >= 400) {
+          subset.push_back(dataset[id]);
+          subset_ids.push_back(id);
+        }
+      }
+      uint32_t expected_size = std::min<uint32_t>(TOP_K, subset.size());
+      auto expected = getExpectedNeighbors(subset, queries[query], "euclidean",
+                                           expected_size);
+      ASSERT_EQ(ids[query].size(), expected_size);
+      for (uint32_t i = 0; i < expected_size; i++) {
+        ASSERT_EQ(ids[query][i], subset_ids[expected[i]]);
+      }
+    }
+  }
+
+  // A single allow list is shared by all queries.
+  auto [shared_distances, shared_ids] =
+      index.search(queries, TOP_K, {allow_lists[0]});
+  for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+    auto sorted_ids = shared_ids[query];
+    std::sort(sorted_ids.begin(), sorted_ids.end());
+    ASSERT_EQ(sorted_ids, std::vector<uint64_t>({5, 1500, 2999}));
+  }
+
+  ASSERT_THROW(index.search(queries, TOP_K, {allow_lists[0], allow_lists[1]}),
+               std::invalid_argument);
+}
+
+TEST(ExactSearchTest, TopKSelectorReturnsSortedSmallestForSmallAndLargeK) {
+  std::mt19937 generator(16);
+  std::uniform_int_distribution<int> distribution(0, 500);
+  std::vector<std::pair<float, uint32_t>> candidates;
+  for (uint32_t id = 0; id < 2000; id++) {
+    // Plenty of ties, which must be broken by the smaller id.
+    candidates.emplace_back(distribution(generator), id);
+  }
+  std::shuffle(candidates.begin(), candidates.end(), generator);
+  auto sorted_candidates = candidates;
+  std::sort(sorted_candidates.begin(), sorted_candidates.end());
+
+  TopKSelector<uint32_t> selector;
+  for (uint32_t top_k : {0, 1, 5, 32, 33, 100, 2000, 3000}) {
+    selector.reset(top_k);
+    for (auto [distance, id] : candidates) {
+      selector.push(distance, id);
+    }
+    std::vector<float> distances;
+    std::vector<uint32_t> ids;
+    selector.extractSorted(distances, ids);
+
+    uint32_t expected_size = std::min<uint32_t>(top_k, candidates.size());
+    ASSERT_EQ(ids.size(), expected_size);
+    for (uint32_t i = 0; i < expected_size; i++) {
+      ASSERT_EQ(distances[i], sorted_candidates[i].first);
+      ASSERT_EQ(ids[i], sorted_candidates[i].second);
+    }
+  }
+}
+
+TEST(ExactSearchTest, ZeroKSelectsNothing) {
+  TopKSelector<uint32_t> selector(/* top_k = */ 0);
+  for (float distance : {-std::numeric_limits<float>::infinity(),
+                         std::numeric_limits<float>::quiet_NaN(), 0.f}) {
+    ASSERT_FALSE(selector.push(distance, /* id = */ 1));
+  }
+  ASSERT_EQ(selector.size(), 0);
+
+  auto dataset = getRandomVectors<float>(NUM_VECTORS, -1, 1, 41);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 42);
+  // NaN scores pass a threshold of -inf.
+  dataset[3][0] = std::numeric_limits<float>::quiet_NaN();
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    ExactSearchIndex<float> index(metric);
+    index.add(dataset);
+    auto [distances, ids] = index.search(queries, /* top_k = */ 0);
+    ASSERT_EQ(ids.size(), NUM_QUERIES);
+    for (uint32_t query_index = 0; query_index < NUM_QUERIES; query_index++) {
+      ASSERT_TRUE(ids[query_index].empty());
+      ASSERT_TRUE(distances[query_index].empty());
+    }
+  }
+}
+
+TEST(ExactSearchTest, SearchWithLargeK) {
+  auto dataset = getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 17);
+  auto queries = getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 18);
+
+  ExactSearchIndex<int_least8_t> index("dot");
+  index.addDataset(dataset);
+  auto [distances, ids] = index.search(queries, 2 * NUM_VECTORS);
+
+  for (uint32_t query_index = 0; query_index < NUM_QUERIES; query_index++) {
+    ASSERT_EQ(ids[query_index], getExpectedNeighbors(dataset,
+                                                     queries[query_index],
+                                                     "dot", NUM_VECTORS));
+    ASSERT_TRUE(std::is_sorted(distances[query_index].rbegin(),
+                               distances[query_index].rend()));
+  }
+}
+
+TEST(ExactSearchTest, BaseParallelSearchMatchesQueryParallelSearch) {
+  constexpr uint32_t dimension = 100;
+  auto dataset =
+      getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 19, dimension);
+  auto queries =
+      getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 20, dimension);
+
+  auto &thread_pool = ThreadPool::global();
+  auto num_pool_threads = thread_pool.numThreads();
+  thread_pool.resize(4);
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    ExactSearchIndex<int_least8_t> index(metric);
+    index.addDataset(dataset);
+
+    index.setSearchParallelism(SearchParallelism::QueryParallel);
+    auto [expected_distances, expected_ids] = index.search(queries, TOP_K);
+
+    index.setSearchParallelism(SearchParallelism::BaseParallel);
+    auto [distances, ids] = index.search(queries, TOP_K);
+
+    ASSERT_EQ(ids, expected_ids);
+    ASSERT_EQ(distances, expected_distances);
+  }
+  thread_pool.resize(num_pool_threads);
+}
+
+TEST(ExactSearchTest, RangeSearchMatchesBruteForce) {
+  // More than 64 dimensions so that the euclidean scan abandons early.
+  constexpr uint32_t dimension = 128;
+  auto dataset = getRandomVectors<float>(1000, -1, 1, 32, dimension);
+  auto queries = getRandomVectors<float>(NUM_QUERIES, -1, 1, 33, dimension);
+
+  auto &thread_pool = ThreadPool::global();
+  auto num_pool_threads = thread_pool.numThreads();
+  thread_pool.resize(4);
+  for (const std::string metric : {"euclidean", "cosine"}) {
+    ExactSearchIndex<float> index(metric);
+    index.add(dataset);
+    index.remove({3, 500});
+
+    // A radius that keeps a few percent of the dataset.
+    float radius = metric == "euclidean" ? 75.f : 0.12f;
+    for (auto parallelism :
+         {SearchParallelism::QueryParallel, SearchParallelism::BaseParallel}) {
+      index.setSearchParallelism(parallelism);
+      auto [offsets, ids, distances] = index.rangeSearch(queries, radius);
+      ASSERT_EQ(offsets.size(), NUM_QUERIES + 1);
+      ASSERT_EQ(offsets.back(), ids.size());
+      ASSERT_EQ(distances.size(), ids.size());
+
+      for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+        std::vector<uint64_t> expected_ids;
+        for (uint32_t id = 0; id < dataset.size(); id++) {
+          float score =
+              lpq::index::computeDistance(queries[query], dataset[id], metric);
+          bool in_range = metric == "euclidean" ? score <= radius
+                                                : score >= radius;
+          if (in_range && id != 3 && id != 500) {
+            expected_ids.push_back(id);
+          }
+        }
+        ASSERT_GT(expected_ids.size(), 0);
+
+        std::vector<uint64_t> query_ids(ids.begin() + offsets[query],
+                                        ids.begin() + offsets[query + 1]);
+        ASSERT_EQ(query_ids, expected_ids);
+        for (uint64_t i = offsets[query]; i < offsets[query + 1]; i++) {
+          ASSERT_NEAR(distances[i],
+                      lpq::index::computeDistance(queries[query],
+                                                  dataset[ids[i]], metric),
+                      1e-3);
+        }
+      }
+    }
+  }
+  thread_pool.resize(num_pool_threads);
+}
+
+TEST(ExactSearchTest, LoadedIndexMatchesSavedIndex) {
+  // Large enough for the euclidean index to reorder its dimensions.
+  constexpr uint32_t dimension = 2 * VECTOR_DIMENSION;
+  auto float_dataset =
+      getRandomVectors<float>(NUM_VECTORS, -1, 1, 34, dimension);
+  auto float_queries =
+      getRandomVectors<float>(NUM_QUERIES, -1, 1, 35, dimension);
+
+  lpq::LowPrecisionQuantizer<int_least8_t> quantizer;
+  auto codes = quantizer.quantizeVectors(float_dataset);
+  auto queries = quantizer.quantizeVectors(float_queries);
+  std::vector<uint64_t> external_ids(NUM_VECTORS);
+  for (uint32_t i = 0; i < NUM_VECTORS; i++) {
+    external_ids[i] = 1000 + 7 * i;
+  }
+  std::string path = testing::TempDir() + "exact_search_index.lpq";
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    ExactSearchIndex<int_least8_t> index(metric);
+    index.setQuantizationParameters(quantizer.getQuantizationParameters());
+    index.add(codes, external_ids);
+    index.setIdLookup(true);
+    index.remove({external_ids[5], external_ids[150]});
+    index.save(path);
+
+    auto loaded_index = ExactSearchIndex<int_least8_t>::load(path);
+    ASSERT_EQ(loaded_index->size(), index.size());
+    ASSERT_EQ(loaded_index->getQuantizationParameters(),
+              index.getQuantizationParameters());
+    ASSERT_EQ(loaded_index->search(queries, TOP_K),
+              index.search(queries, TOP_K));
+    ASSERT_EQ(loaded_index->searchAsymmetric(float_queries, TOP_K),
+              index.searchAsymmetric(float_queries, TOP_K));
+    // The mapped rows are not held in memory.
+    ASSERT_LT(loaded_index->getMemoryUsage(), index.getMemoryUsage() / 2);
+
+    // The loaded index keeps its ids and accepts further updates.
+    ASSERT_THROW(loaded_index->add({codes[0]}, {external_ids[0]}),
+                 std::invalid_argument);
+    for (auto *updated_index : {&index, loaded_index.get()}) {
+      updated_index->add({codes[5]}, {1});
+      updated_index->remove({external_ids[0], external_ids[1]});
+      updated_index->compact();
+    }
+    ASSERT_EQ(loaded_index->search(queries, TOP_K),
+              index.search(queries, TOP_K));
+  }
+  std::remove(path.c_str());
+}
+
+TEST(ExactSearchTest, LoadRejectsIncompatibleFiles) {
+  std::string path = testing::TempDir() + "exact_search_index.lpq";
+  ExactSearchIndex<float> index("euclidean");
+  index.add(getRandomVectors<float>(NUM_VECTORS, -1, 1, 36));
+  index.save(path);
+  ASSERT_EQ(ExactSearchIndex<float>::load(path)->size(), NUM_VECTORS);
+
+  // Wrong precision type.
+  ASSERT_THROW(ExactSearchIndex<int_least8_t>::load(path),
+               std::invalid_argument);
+
+  // Truncated file.
+  std::filesystem::resize_file(path, 5000);
+  ASSERT_THROW(ExactSearchIndex<float>::load(path), std::invalid_argument);
+
+  // Not an index file.
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << std::string(8192, 'x');
+  }
+  ASSERT_THROW(ExactSearchIndex<float>::load(path), std::invalid_argument);
+  std::remove(path.c_str());
+  ASSERT_THROW(ExactSearchIndex<float>::load(path), std::invalid_argument);
+}
+
+TEST(ExactSearchTest, ChunkedSearchMatchesQueryParallelSearch) {
+  auto dataset = getRandomVectors<int_least8_t>(1000, -128, 127, 37);
+  auto queries = getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 38);
+  std::string path = testing::TempDir() + "exact_search_index.lpq";
+
+  auto &thread_pool = ThreadPool::global();
+  auto num_pool_threads = thread_pool.numThreads();
+  thread_pool.resize(4);
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    ExactSearchIndex<int_least8_t> index(metric);
+    index.add(dataset);
+    index.remove({2, 700});
+    index.setSearchParallelism(SearchParallelism::QueryParallel);
+    auto allow_list = index.createAllowList({1, 2, 3, 500, 501, 900});
+
+    index.save(path);
+    auto loaded_index = ExactSearchIndex<int_least8_t>::load(path);
+    // Rows added after loading are in memory and scanned along with the
+    // mapped ones.
+    index.add({dataset[2]});
+    loaded_index->add({dataset[2]});
+    // A few rows per chunk, so that chunks end inside bitmap words.
+    loaded_index->setScanChunkSize(100 * VECTOR_DIMENSION);
+
+    // Fewer and more queries than threads.
+    for (uint32_t num_queries : {1u, NUM_QUERIES}) {
+      std::vector<std::vector<int_least8_t>> batch(
+          queries.begin(), queries.begin() + num_queries);
+      ASSERT_EQ(loaded_index->search(batch, TOP_K),
+                index.search(batch, TOP_K));
+      ASSERT_EQ(loaded_index->search(batch, TOP_K, {allow_list}),
+                index.search(batch, TOP_K, {allow_list}));
+    }
+  }
+  thread_pool.resize(num_pool_threads);
+  std::remove(path.c_str());
+}
+
+TEST(ExactSearchTest, SearchAsyncMatchesSearch) {
+  auto dataset = getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 39);
+  auto queries = getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 40);
+  auto index = std::make_shared<ExactSearchIndex<int_least8_t>>("euclidean");
+  index->add(dataset);
+  auto allow_list = index->createAllowList({1, 5, 50, 150});
+
+  std::atomic<uint32_t> num_callbacks = 0;
+  auto future = index->searchAsync(queries, TOP_K);
+  auto filtered_future = index->searchAsync(queries, TOP_K, {allow_list});
+  future.onComplete([&](const SearchFuture &completed) {
+    ASSERT_TRUE(completed.isReady());
+    num_callbacks++;
+  });
+
+  ASSERT_EQ(future.get(), index->search(queries, TOP_K));
+  ASSERT_EQ(filtered_future.get(), index->search(queries, TOP_K, {allow_list}));
+  ASSERT_FALSE(future.cancel());
+  // Callbacks added to a ready future run right away.
+  future.onComplete([&](const SearchFuture &) { num_callbacks++; });
+  ASSERT_EQ(num_callbacks, 2);
+
+  // Errors are rethrown by get.
+  auto failed_future = index->searchAsync({{1, 2, 3}}, TOP_K);
+  ASSERT_THROW(failed_future.get(), std::invalid_argument);
+}
+
+TEST(ExactSearchTest, SearchAsyncCancelsQueuedSearches) {
+  auto dataset = getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 41);
+  auto queries = getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 42);
+  ExactSearchIndex<int_least8_t> index("dot");
+  index.add(dataset);
+
+  // Occupies every dispatch thread, so that the searches stay queued.
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::vector<SearchFuture> blockers;
+  for (uint32_t blocker = 0; blocker < 8; blocker++) {
+    blockers.push_back(SearchExecutor::global().submit([released] {
+      released.wait();
+      return SearchResults();
+    }));
+  }
+
+  std::atomic<uint32_t> num_callbacks = 0;
+  std::vector<SearchFuture> futures;
+  for (uint32_t search = 0; search < 4; search++) {
+    futures.push_back(index.searchAsync(queries, TOP_K));
+    futures.back().onComplete([&](const SearchFuture &completed) {
+      ASSERT_TRUE(completed.isCancelled());
+      num_callbacks++;
+    });
+  }
+  for (auto &future : futures) {
+    ASSERT_TRUE(future.cancel());
+    ASSERT_TRUE(future.isReady());
+    ASSERT_THROW(future.get(), SearchCancelled);
+  }
+  ASSERT_EQ(num_callbacks, futures.size());
+
+  release.set_value();
+  for (auto &blocker : blockers) {
+    blocker.wait();
+  }
+  ASSERT_EQ(index.searchAsync(queries, TOP_K).get(),
+            index.search(queries, TOP_K));
+}
+
+TEST(ExactSearchTest, SearchStatsCountTheScan) {
+  // More than 64 dimensions so that the euclidean scan abandons early.
+  constexpr uint32_t dimension = 128;
+  auto dataset =
+      getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 43, dimension);
+  auto queries =
+      getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 44, dimension);
+  ExactSearchIndex<int_least8_t> index("euclidean");
+  index.add(dataset);
+  index.remove({0, 1});
+  const uint64_t num_live_vectors = NUM_VECTORS - 2;
+
+  // Stats are off by default.
+  auto expected = index.search(queries, TOP_K);
+  ASSERT_EQ(index.getSearchStats().num_searches, 0);
+
+  index.setSearchStatsEnabled(true);
+  for (auto parallelism :
+       {SearchParallelism::QueryParallel, SearchParallelism::BaseParallel}) {
+    index.setSearchParallelism(parallelism);
+    index.resetSearchStats();
+    ASSERT_EQ(index.search(queries, TOP_K), expected);
+    auto stats = index.getSearchStats();
+    ASSERT_EQ(stats.num_searches, 1);
+    ASSERT_EQ(stats.num_queries, NUM_QUERIES);
+    ASSERT_EQ(stats.scan.distances_computed, NUM_QUERIES * num_live_vectors);
+    ASSERT_EQ(stats.scan.filtered_out, 0);
+    ASSERT_GT(stats.scan.early_abandoned, 0);
+    ASSERT_GE(stats.scan.heap_insertions, NUM_QUERIES * TOP_K);
+  }
+
+  auto allow_list = index.createAllowList({1, 2, 3, 50, 100, 150});
+  index.search(queries, TOP_K, {allow_list});
+  auto stats = index.getSearchStats();
+  ASSERT_EQ(stats.num_searches, 2);
+  ASSERT_EQ(stats.num_queries, 2 * NUM_QUERIES);
+  // Vector 1 was removed, so 5 of the allowed vectors are scanned.
+  ASSERT_EQ(stats.scan.distances_computed,
+            NUM_QUERIES * (num_live_vectors + 5));
+  ASSERT_EQ(stats.scan.filtered_out, NUM_QUERIES * (num_live_vectors - 5));
+  ASSERT_EQ(stats.search_latency.count(), 2);
+  ASSERT_EQ(stats.query_latency.count(), 2 * NUM_QUERIES);
+  ASSERT_LE(stats.query_latency.max(), stats.search_latency.max());
+  ASSERT_GE(stats.total_search_nanoseconds, stats.last_search_nanoseconds);
+
+  index.resetSearchStats();
+  ASSERT_EQ(index.getSearchStats().num_queries, 0);
+}
+
+TEST(ExactSearchTest, QueryCacheReturnsResultsUntilIndexChanges) {
+  auto dataset = getRandomVectors<int_least8_t>(NUM_VECTORS, -128, 127, 45);
+  auto queries = getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 46);
+  ExactSearchIndex<int_least8_t> index("euclidean");
+  index.add(dataset);
+  auto expected = index.search(queries, TOP_K);
+
+  index.setQueryCacheCapacity(4 * NUM_QUERIES);
+  ASSERT_EQ(index.search(queries, TOP_K), expected);
+  ASSERT_EQ(index.getQueryCacheStats().misses, NUM_QUERIES);
+  ASSERT_EQ(index.getQueryCacheStats().entries, NUM_QUERIES);
+  ASSERT_EQ(index.search(queries, TOP_K), expected);
+  ASSERT_EQ(index.getQueryCacheStats().hits, NUM_QUERIES);
+
+  // A different k or filter is a different key. Half of the batch hits.
+  std::vector<std::vector<int_least8_t>> mixed_batch(queries.begin(),
+                                                     queries.begin() + 2);
+  mixed_batch.push_back(dataset[7]);
+  mixed_batch.push_back(dataset[8]);
+  auto [distances, ids] = index.search(mixed_batch, TOP_K);
+  ASSERT_EQ(distances[1], std::get<0>(expected)[1]);
+  ASSERT_EQ(ids[3][0], 8);
+  auto allow_list = index.createAllowList({3, 5, 8});
+  auto [filtered_distances, filtered_ids] =
+      index.search(mixed_batch, TOP_K, {allow_list});
+  ASSERT_EQ(filtered_ids[3].size(), 3);
+  ASSERT_EQ(filtered_ids[3][0], 8);
+  index.search(mixed_batch, 1);
+  auto stats = index.getQueryCacheStats();
+  ASSERT_EQ(stats.hits, NUM_QUERIES + 2);
+  ASSERT_EQ(stats.misses, NUM_QUERIES + 2 + 4 + 4);
+
+  // Removing and adding vectors invalidates every cached result.
+  index.remove({8});
+  std::tie(distances, ids) = index.search(mixed_batch, TOP_K);
+  ASSERT_NE(ids[3][0], 8);
+  index.add({dataset[8]});
+  std::tie(distances, ids) = index.search(mixed_batch, TOP_K);
+  ASSERT_EQ(ids[3][0], NUM_VECTORS);
+  ASSERT_EQ(index.getQueryCacheStats().hits, stats.hits);
+
+  index.setQueryCacheCapacity(0);
+  ASSERT_EQ(index.getQueryCacheStats().entries, 0);
+}
+
+TEST(ExactSearchTest, DeduplicationCollapsesIdenticalCodes) {
+  // 50 unique vectors, each added 3 times: 0..49 in the first batch and
+  // twice more in the second.
+  constexpr uint32_t num_unique = 50;
+  auto unique_vectors =
+      getRandomVectors<int_least8_t>(num_unique, -128, 127, 47, 100);
+  auto queries =
+      getRandomVectors<int_least8_t>(NUM_QUERIES, -128, 127, 48, 100);
+  std::vector<std::vector<int_least8_t>> second_batch;
+  for (uint32_t copy = 0; copy < 2; copy++) {
+    second_batch.insert(second_batch.end(), unique_vectors.begin(),
+                        unique_vectors.end());
+  }
+
+  ExactSearchIndex<int_least8_t> plain_index("euclidean");
+  ExactSearchIndex<int_least8_t> index("euclidean");
+  index.setDeduplication(true);
+  for (auto *target : {&plain_index, &index}) {
+    target->add(unique_vectors);
+    target->add(second_batch);
+  }
+  ASSERT_EQ(index.size(), 3 * num_unique);
+
+  // Without truncation both return every ID, up to the order of ties.
+  auto sortResults = [](const auto &results) {
+    std::vector<std::vector<std::pair<float, uint64_t>>> sorted;
+    for (uint32_t query = 0; query < std::get<1>(results).size(); query++) {
+      sorted.emplace_back();
+      for (uint32_t position = 0;
+           position < std::get<1>(results)[query].size(); position++) {
+        sorted.back().emplace_back(std::get<0>(results)[query][position],
+                                   std::get<1>(results)[query][position]);
+      }
+      std::sort(sorted.back().begin(), sorted.back().end());
+    }
+    return sorted;
+  };
+  ASSERT_EQ(sortResults(index.search(queries, 3 * num_unique)),
+            sortResults(plain_index.search(queries, 3 * num_unique)));
+  ASSERT_EQ(std::get<0>(index.search(queries, TOP_K)),
+            std::get<0>(plain_index.search(queries, TOP_K)));
+
+  // Vector 7 was added as IDs 7, 57 and 107.
+  auto [distances, ids] = index.search({unique_vectors[7]}, 3);
+  ASSERT_EQ(ids[0], (std::vector<uint64_t>{7, 57, 107}));
+  ASSERT_EQ(distances[0], (std::vector<float>{0, 0, 0}));
+  auto allow_list = index.createAllowList({107});
+  std::tie(distances, ids) = index.search({unique_vectors[7]}, 5, {allow_list});
+  ASSERT_EQ(ids[0], (std::vector<uint64_t>{7, 57, 107}));
+
+  // The row stays until its last ID is removed.
+  ASSERT_EQ(index.remove({7, 57, 7}), 2);
+  std::tie(distances, ids) = index.search({unique_vectors[7]}, 2);
+  ASSERT_EQ(ids[0][0], 107);
+  ASSERT_NE(distances[0][1], 0);
+  ASSERT_EQ(index.size(), 3 * num_unique - 2);
+  auto [offsets, range_ids, range_distances] =
+      index.rangeSearch({unique_vectors[8]}, 0);
+  ASSERT_EQ(range_ids, (std::vector<uint64_t>{8, 58, 108}));
+
+  std::string path = testing::TempDir() + "deduplicated_index.lpq";
+  index.save(path);
+  auto loaded_index = ExactSearchIndex<int_least8_t>::load(path);
+  std::remove(path.c_str());
+  ASSERT_EQ(loaded_index->size(), index.size());
+  ASSERT_EQ(loaded_index->search(queries, TOP_K), index.search(queries, TOP_K));
+
+  for (auto *target : {&index, loaded_index.get()}) {
+    ASSERT_EQ(target->remove({107}), 1);
+    std::tie(distances, ids) = target->search({unique_vectors[7]}, 1);
+    ASSERT_NE(distances[0][0], 0);
+    // The codes are new again once their row is gone.
+    target->add({unique_vectors[7], unique_vectors[7]});
+    std::tie(distances, ids) = target->search({unique_vectors[7]}, 3);
+    ASSERT_EQ(ids[0][0], 3 * num_unique);
+    ASSERT_EQ(ids[0][1], 3 * num_unique + 1);
+    ASSERT_NE(distances[0][2], 0);
+  }
+}
+
+TEST(QueryCacheTest, EvictsLeastRecentlyUsedEntries) {
+  // One shard per entry, so the shards hold a single result each.
+  QueryCache cache(/* capacity = */ 2);
+  std::vector<QueryCache::Key> keys;
+  for (uint32_t code = 0; keys.size() < 3; code++) {
+    auto key = QueryCache::makeKey(/* codes = */ &code,
+                                   /* num_bytes = */ sizeof(code),
+                                   /* top_k = */ 1,
+                                   /* filter_fingerprint = */ 0);
+    // Keep keys that fall into the same shard as the first one.
+    if (keys.empty() || (key.hash >> 48) % 2 == (keys[0].hash >> 48) % 2) {
+      keys.push_back(std::move(key));
+    }
+  }
+
+  std::vector<float> distances;
+  std::vector<uint64_t> ids;
+  cache.insert(keys[0], /* version = */ 1, {1.f}, {1});
+  ASSERT_TRUE(cache.lookup(keys[0], /* version = */ 1, distances, ids));
+  ASSERT_EQ(ids, std::vector<uint64_t>{1});
+  cache.insert(keys[1], /* version = */ 1, {2.f}, {2});
+  ASSERT_FALSE(cache.lookup(keys[0], /* version = */ 1, distances, ids));
+  ASSERT_TRUE(cache.lookup(keys[1], /* version = */ 1, distances, ids));
+
+  // Results of an older version are never returned and never replace
+  // newer ones.
+  ASSERT_FALSE(cache.lookup(keys[1], /* version = */ 2, distances, ids));
+  cache.insert(keys[2], /* version = */ 3, {3.f}, {3});
+  cache.insert(keys[2], /* version = */ 2, {4.f}, {4});
+  ASSERT_TRUE(cache.lookup(keys[2], /* version = */ 3, distances, ids));
+  ASSERT_EQ(ids, std::vector<uint64_t>{3});
+  ASSERT_EQ(cache.getStats().hits, 3);
+  ASSERT_EQ(cache.getStats().entries, 1);
+  ASSERT_THROW(QueryCache(/* capacity = */ 0), std::invalid_argument);
+}
+
+TEST(LatencyHistogramTest, PercentilesHaveBoundedRelativeError) {
+  LatencyHistogram histogram;
+  ASSERT_EQ(histogram.percentile(50), 0);
+  for (uint64_t value = 1; value <= 100000; value++) {
+    histogram.record(value * 1000);
+  }
+  ASSERT_EQ(histogram.count(), 100000);
+  for (double percentile : {1., 50., 90., 99., 99.9, 100.}) {
+    double expected = percentile * 1000 * 1000;
+    double value = histogram.percentile(percentile);
+    ASSERT_GE(value, expected);
+    ASSERT_LE(value, expected * (1. + 1. / 32));
+  }
+  ASSERT_LE(histogram.min(), 1000);
+  ASSERT_GE(histogram.max(), 100000000);
+  ASSERT_NEAR(histogram.mean(), 50000500, 1);
+
+  LatencyHistogram other;
+  other.record(7);
+  histogram.merge(other);
+  ASSERT_EQ(histogram.count(), 100001);
+  ASSERT_EQ(histogram.min(), 7);
+}
@@ -0,0 +1,93 @@
+#include "../DistanceMetrics.h"
+#include "../HNSWIndex.h"
+#include "TestUtils.h"
+#include <algorithm>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using lpq::index::HNSWIndex;
+using lpq::test_utils::computeRecall;
+using lpq::test_utils::getGaussianVectors;
+
+constexpr uint32_t NUM_VECTORS = 5000;
+constexpr uint32_t NUM_QUERIES = 50;
+constexpr uint32_t VECTOR_DIMENSION = 32;
+constexpr uint32_t TOP_K = 10;
+
+TEST(HNSWIndexTest, ReachesHighRecallForEveryMetric) {
+  auto dataset =
+      getGaussianVectors(NUM_VECTORS, VECTOR_DIMENSION, /* seed = */ 1);
+  auto queries =
+      getGaussianVectors(NUM_QUERIES, VECTOR_DIMENSION, /* seed = */ 2);
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    HNSWIndex<int8_t> index(metric);
+    // Later batches are inserted into the graph built from the first one.
+    std::vector<std::vector<float>> first_half(
+        dataset.begin(), dataset.begin() + NUM_VECTORS / 2);
+    std::vector<std::vector<float>> second_half(
+        dataset.begin() + NUM_VECTORS / 2, dataset.end());
+    index.add(first_half);
+    auto ids = index.add(second_half);
+    ASSERT_EQ(ids.front(), NUM_VECTORS / 2);
+    ASSERT_EQ(ids.back(), NUM_VECTORS - 1);
+    ASSERT_EQ(index.size(), NUM_VECTORS);
+
+    index.setEfSearch(TOP_K);
+    float low_recall = computeRecall(index, dataset, queries, metric, TOP_K);
+    index.setEfSearch(128);
+    float high_recall = computeRecall(index, dataset, queries, metric, TOP_K);
+    EXPECT_GE(high_recall, 0.9) << metric;
+    EXPECT_LE(low_recall, high_recall) << metric;
+  }
+}
+
+TEST(HNSWIndexTest, DistancesApproximateFloatDistances) {
+  auto dataset =
+      getGaussianVectors(NUM_VECTORS, VECTOR_DIMENSION, /* seed = */ 3);
+  auto queries =
+      getGaussianVectors(NUM_QUERIES, VECTOR_DIMENSION, /* seed = */ 4);
+
+  HNSWIndex<int8_t> index("euclidean");
+  index.add(dataset);
+  auto [distances, ids] = index.search(queries, TOP_K);
+  for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+    ASSERT_TRUE(
+        std::is_sorted(distances[query].begin(), distances[query].end()));
+    for (uint32_t rank = 0; rank < ids[query].size(); rank++) {
+      float expected = lpq::index::computeDistance(
+          queries[query], dataset[ids[query][rank]], "euclidean");
+      EXPECT_NEAR(distances[query][rank], expected, 0.05 * expected + 0.5);
+    }
+  }
+
+  // Every vector finds itself.
+  std::vector<std::vector<float>> own_vectors(dataset.begin(),
+                                              dataset.begin() + NUM_QUERIES);
+  auto own_ids = std::get<1>(index.search(own_vectors, /* top_k = */ 1));
+  for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+    EXPECT_EQ(own_ids[query][0], query);
+  }
+}
+
+TEST(HNSWIndexTest, RejectsInvalidArguments) {
+  EXPECT_THROW(HNSWIndex<int8_t>("euclidean", /* m = */ 1),
+               std::invalid_argument);
+  EXPECT_THROW(HNSWIndex<int8_t>("euclidean", /* m = */ 16,
+                                 /* ef_construction = */ 0),
+               std::invalid_argument);
+
+  HNSWIndex<int8_t> index("euclidean");
+  EXPECT_THROW(index.setEfSearch(0), std::invalid_argument);
+  auto dataset = getGaussianVectors(100, VECTOR_DIMENSION, /* seed = */ 5);
+  // Searching an empty index returns no results.
+  EXPECT_TRUE(std::get<1>(index.search(dataset, TOP_K))[0].empty());
+
+  index.add(dataset);
+  EXPECT_THROW(index.add({std::vector<float>(VECTOR_DIMENSION + 1)}),
+               std::invalid_argument);
+  EXPECT_THROW(index.search({std::vector<float>(VECTOR_DIMENSION - 1)}, TOP_K),
+               std::invalid_argument);
+}
@@ -0,0 +1,122 @@
+#include "../DistanceMetrics.h"
+#include "../IVFIndex.h"
+#include "TestUtils.h"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+using lpq::index::IVFIndex;
+using lpq::test_utils::computeRecall;
+using lpq::test_utils::getGaussianVectors;
+
+constexpr uint32_t NUM_VECTORS = 4000;
+constexpr uint32_t NUM_QUERIES = 20;
+constexpr uint32_t NUM_CLUSTERS = 32;
+constexpr uint32_t NUM_LISTS = 32;
+constexpr uint32_t VECTOR_DIMENSION = 32;
+constexpr uint32_t TOP_K = 10;
+
+/**
+ * Returns vectors drawn around NUM_CLUSTERS random centers, so that the
+ * data has the cluster structure an IVF index relies on.
+ */
+std::vector<std::vector<float>> getClusteredVectors(uint32_t num_vectors,
+                                                    uint32_t seed) {
+  auto centers = getGaussianVectors(NUM_CLUSTERS, VECTOR_DIMENSION,
+                                    /* seed = */ 0,
+                                    /* standard_deviation = */ 4.f);
+
+  std::mt19937 generator(seed);
+  std::normal_distribution<float> distribution(0.f, 1.f);
+  std::uniform_int_distribution<uint32_t> cluster(0, NUM_CLUSTERS - 1);
+  std::vector<std::vector<float>> output(num_vectors,
+                                         std::vector<float>(VECTOR_DIMENSION));
+  for (auto &vector : output) {
+    const auto &center = centers[cluster(generator)];
+    for (uint32_t dim = 0; dim < VECTOR_DIMENSION; dim++) {
+      vector[dim] = center[dim] + distribution(generator);
+    }
+  }
+  return output;
+}
+
+TEST(IVFIndexTest, RecallGrowsWithTheNumberOfProbes) {
+  auto dataset = getClusteredVectors(NUM_VECTORS, /* seed = */ 1);
+  auto queries = getClusteredVectors(NUM_QUERIES, /* seed = */ 2);
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    IVFIndex<int8_t> index(metric, NUM_LISTS);
+    // The first batch trains the index, later ones reuse its centroids.
+    std::vector<std::vector<float>> first_half(
+        dataset.begin(), dataset.begin() + NUM_VECTORS / 2);
+    std::vector<std::vector<float>> second_half(
+        dataset.begin() + NUM_VECTORS / 2, dataset.end());
+    index.add(first_half);
+    ASSERT_TRUE(index.isTrained());
+    auto ids = index.add(second_half);
+    ASSERT_EQ(ids.front(), NUM_VECTORS / 2);
+    ASSERT_EQ(ids.back(), NUM_VECTORS - 1);
+    ASSERT_EQ(index.size(), NUM_VECTORS);
+
+    auto list_sizes = index.getListSizes();
+    ASSERT_EQ(list_sizes.size(), NUM_LISTS);
+    EXPECT_EQ(std::accumulate(list_sizes.begin(), list_sizes.end(), 0u),
+              NUM_VECTORS);
+
+    index.setNumProbes(NUM_LISTS);
+    float full_recall = computeRecall(index, dataset, queries, metric, TOP_K);
+    EXPECT_GE(full_recall, 0.9) << metric;
+
+    index.setNumProbes(4);
+    float partial_recall =
+        computeRecall(index, dataset, queries, metric, TOP_K);
+    EXPECT_GE(partial_recall, 0.8) << metric;
+    EXPECT_LE(partial_recall, full_recall) << metric;
+  }
+}
+
+TEST(IVFIndexTest, DistancesApproximateFloatDistances) {
+  auto dataset = getClusteredVectors(NUM_VECTORS, /* seed = */ 3);
+  auto queries = getClusteredVectors(NUM_QUERIES, /* seed = */ 4);
+
+  IVFIndex<int8_t> index("euclidean", NUM_LISTS);
+  index.add(dataset);
+  auto [distances, ids] = index.search(queries, TOP_K);
+  for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+    ASSERT_TRUE(std::is_sorted(distances[query].begin(),
+                               distances[query].end()));
+    for (uint32_t rank = 0; rank < ids[query].size(); rank++) {
+      float expected = lpq::index::computeDistance(
+          queries[query], dataset[ids[query][rank]], "euclidean");
+      EXPECT_NEAR(distances[query][rank], expected, 0.05 * expected + 0.5);
+    }
+  }
+}
+
+TEST(IVFIndexTest, RejectsInvalidArguments) {
+  auto dataset = getClusteredVectors(NUM_LISTS - 1, /* seed = */ 5);
+
+  EXPECT_THROW(IVFIndex<int8_t>("euclidean", 0), std::invalid_argument);
+  IVFIndex<int8_t> index("euclidean", NUM_LISTS);
+  EXPECT_THROW(index.setNumProbes(0), std::invalid_argument);
+  // Training needs at least one vector per list.
+  EXPECT_THROW(index.add(dataset), std::invalid_argument);
+  EXPECT_FALSE(index.isTrained());
+
+  // Searching an empty index returns no results.
+  auto [distances, ids] = index.search(dataset, TOP_K);
+  EXPECT_TRUE(ids[0].empty());
+
+  dataset = getClusteredVectors(NUM_VECTORS, /* seed = */ 6);
+  index.train(dataset);
+  EXPECT_EQ(index.size(), 0);
+  EXPECT_THROW(index.train(dataset), std::invalid_argument);
+  EXPECT_THROW(index.add({std::vector<float>(VECTOR_DIMENSION + 1)}),
+               std::invalid_argument);
+  index.add(dataset);
+  EXPECT_THROW(index.search({std::vector<float>(VECTOR_DIMENSION - 1)}, TOP_K),
+               std::invalid_argument);
+}
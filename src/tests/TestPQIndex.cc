@@ -0,0 +1,127 @@
+#include "../DistanceMetrics.h"
+#include "../FastScan.h"
+#include "../PQIndex.h"
+#include "TestUtils.h"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using lpq::index::PQIndex;
+using lpq::test_utils::computeRecall;
+using lpq::test_utils::getGaussianVectors;
+
+constexpr uint32_t NUM_VECTORS = 3000;
+constexpr uint32_t NUM_QUERIES = 20;
+constexpr uint32_t VECTOR_DIMENSION = 64;
+constexpr uint32_t NUM_SUBSPACES = 32;
+constexpr uint32_t TOP_K = 10;
+
+TEST(PQIndexTest, FastScanKernelMatchesScalarKernel) {
+  std::mt19937 generator(0);
+  std::uniform_int_distribution<uint32_t> random_byte(0, 255);
+  for (uint32_t num_subspaces : {1, 7, 64, 257}) {
+    std::vector<uint8_t> block(
+        lpq::index::getFastScanBlockBytes(num_subspaces));
+    std::vector<uint8_t> tables(num_subspaces * 16);
+    for (auto &byte : block) {
+      byte = random_byte(generator);
+    }
+    for (auto &entry : tables) {
+      entry = random_byte(generator);
+    }
+    uint16_t distances[lpq::index::FAST_SCAN_BLOCK_SIZE];
+    uint16_t expected[lpq::index::FAST_SCAN_BLOCK_SIZE];
+    lpq::index::fastScanBlock(block.data(), tables.data(), num_subspaces,
+                              distances);
+    lpq::index::fastScanBlockScalar(block.data(), tables.data(),
+                                    num_subspaces, expected);
+    for (uint32_t slot = 0; slot < lpq::index::FAST_SCAN_BLOCK_SIZE;
+         slot++) {
+      ASSERT_EQ(distances[slot], expected[slot]) << num_subspaces;
+
+      uint32_t sum = 0;
+      for (uint32_t subspace = 0; subspace < num_subspaces; subspace++) {
+        sum += tables[subspace * 16 + lpq::index::getFastScanCode(
+                                          block.data(), subspace, slot)];
+      }
+      ASSERT_EQ(expected[slot], sum);
+    }
+  }
+}
+
+TEST(PQIndexTest, RerankingRecoversRecall) {
+  auto dataset =
+      getGaussianVectors(NUM_VECTORS, VECTOR_DIMENSION, /* seed = */ 1);
+  auto queries =
+      getGaussianVectors(NUM_QUERIES, VECTOR_DIMENSION, /* seed = */ 2);
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    PQIndex index(metric, NUM_SUBSPACES);
+    PQIndex reranking_index(metric, NUM_SUBSPACES,
+                            /* rerank_oversample = */ 20);
+    // Batches that do not end on a block boundary fill up the last block.
+    for (auto [begin, end] : {std::pair<uint32_t, uint32_t>{0, 1000},
+                              {1000, 1037},
+                              {1037, NUM_VECTORS}}) {
+      std::vector<std::vector<float>> batch(dataset.begin() + begin,
+                                            dataset.begin() + end);
+      auto ids = index.add(batch);
+      ASSERT_EQ(ids.front(), begin);
+      ASSERT_EQ(ids.back(), end - 1);
+      reranking_index.add(batch);
+    }
+    ASSERT_EQ(index.size(), NUM_VECTORS);
+
+    float recall = computeRecall(index, dataset, queries, metric, TOP_K);
+    float reranked_recall =
+        computeRecall(reranking_index, dataset, queries, metric, TOP_K);
+    EXPECT_GE(recall, 0.4) << metric;
+    EXPECT_GE(reranked_recall, 0.9) << metric;
+    EXPECT_LT(index.getMemoryUsage(), reranking_index.getMemoryUsage());
+  }
+}
+
+TEST(PQIndexTest, EveryVectorFindsItself) {
+  auto dataset =
+      getGaussianVectors(NUM_VECTORS, VECTOR_DIMENSION, /* seed = */ 3);
+  PQIndex index("euclidean", NUM_SUBSPACES, /* rerank_oversample = */ 4);
+  index.add(dataset);
+
+  std::vector<std::vector<float>> queries(dataset.begin(),
+                                          dataset.begin() + NUM_QUERIES);
+  auto [distances, ids] = index.search(queries, /* top_k = */ 1);
+  for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+    EXPECT_EQ(ids[query][0], query);
+    EXPECT_NEAR(distances[query][0], 0.f, 0.5);
+  }
+}
+
+TEST(PQIndexTest, RejectsInvalidArguments) {
+  EXPECT_THROW(PQIndex("euclidean", 0), std::invalid_argument);
+  EXPECT_THROW(PQIndex("euclidean", PQIndex::MAX_NUM_SUBSPACES + 1),
+               std::invalid_argument);
+
+  PQIndex index("euclidean", NUM_SUBSPACES);
+  // Training needs a vector per centroid and a dimension per subspace.
+  EXPECT_THROW(index.add(getGaussianVectors(PQIndex::NUM_CENTROIDS - 1,
+                                            VECTOR_DIMENSION,
+                                            /* seed = */ 4)),
+               std::invalid_argument);
+  EXPECT_THROW(
+      index.add(std::vector<std::vector<float>>(
+          100, std::vector<float>(NUM_SUBSPACES - 1, 1.f))),
+      std::invalid_argument);
+  EXPECT_FALSE(index.isTrained());
+
+  auto dataset = getGaussianVectors(100, VECTOR_DIMENSION, /* seed = */ 5);
+  index.train(dataset);
+  EXPECT_EQ(index.size(), 0);
+  EXPECT_THROW(index.train(dataset), std::invalid_argument);
+  EXPECT_THROW(index.add({std::vector<float>(VECTOR_DIMENSION + 1)}),
+               std::invalid_argument);
+  index.add(dataset);
+  EXPECT_THROW(index.search({std::vector<float>(VECTOR_DIMENSION - 1)}, TOP_K),
+               std::invalid_argument);
+}
@@ -103,3 +103,22 @@ TEST(LPQTest, TestCorrectQuantizedValuesInt8) {
     }
   }
 }
+
+TEST(LPQTest, QuantizeWithParametersRejectsMismatchedDimensions) {
+  auto testing_vectors = getTestingVectors();
+  LowPrecisionQuantizer<int8_t> quantizer;
+  quantizer.quantizeVectors(testing_vectors);
+  auto quantization_parameters = quantizer.getQuantizationParameters();
+
+  ASSERT_EQ(quantizer.quantizeVectors(testing_vectors, quantization_parameters),
+            quantizer.quantizeVectors(testing_vectors));
+
+  quantization_parameters.pop_back();
+  ASSERT_THROW(
+      quantizer.quantizeVectors(testing_vectors, quantization_parameters),
+      std::invalid_argument);
+  testing_vectors[3].push_back(1.f);
+  ASSERT_THROW(quantizer.quantizeVectors(testing_vectors,
+                                         quantizer.getQuantizationParameters()),
+               std::invalid_argument);
+}
@@ -0,0 +1,104 @@
+#include "../DistanceMetrics.h"
+#include "../RerankingIndex.h"
+#include "TestUtils.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using lpq::index::RerankingIndex;
+using lpq::test_utils::getExpectedNeighbors;
+using lpq::test_utils::getGaussianVectors;
+
+constexpr uint32_t NUM_VECTORS = 2000;
+constexpr uint32_t NUM_QUERIES = 20;
+constexpr uint32_t VECTOR_DIMENSION = 48;
+constexpr uint32_t TOP_K = 10;
+
+/**
+ * Checks that the reranked results reach a high recall against the exact
+ * float neighbors and that the reported distances are the float ones.
+ */
+void checkResults(const RerankingIndex &index,
+                  const std::vector<std::vector<float>> &dataset,
+                  const std::vector<std::vector<float>> &queries,
+                  const std::string &metric) {
+  auto [distances, ids] = index.search(queries, TOP_K);
+  ASSERT_EQ(ids.size(), NUM_QUERIES);
+
+  uint32_t num_found = 0;
+  for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+    ASSERT_EQ(ids[query].size(), TOP_K);
+    auto expected =
+        getExpectedNeighbors(dataset, queries[query], metric, TOP_K);
+    for (uint32_t rank = 0; rank < TOP_K; rank++) {
+      uint64_t id = ids[query][rank];
+      ASSERT_LT(id, dataset.size());
+      EXPECT_NEAR(
+          distances[query][rank],
+          lpq::index::computeDistance(queries[query], dataset[id], metric),
+          1e-3);
+      num_found += std::count(expected.begin(), expected.end(), id);
+    }
+  }
+  EXPECT_GE(num_found, 0.95 * NUM_QUERIES * TOP_K) << metric;
+}
+
+TEST(RerankingIndexTest, RerankedResultsMatchFloatSearch) {
+  auto dataset =
+      getGaussianVectors(NUM_VECTORS, VECTOR_DIMENSION, /* seed = */ 1);
+  auto queries =
+      getGaussianVectors(NUM_QUERIES, VECTOR_DIMENSION, /* seed = */ 2);
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    RerankingIndex index(metric);
+    // Later batches are quantized with the grid fitted on the first one.
+    std::vector<std::vector<float>> first_half(
+        dataset.begin(), dataset.begin() + NUM_VECTORS / 2);
+    std::vector<std::vector<float>> second_half(
+        dataset.begin() + NUM_VECTORS / 2, dataset.end());
+    index.add(first_half);
+    auto ids = index.add(second_half);
+    ASSERT_EQ(ids.front(), NUM_VECTORS / 2);
+    ASSERT_EQ(index.size(), NUM_VECTORS);
+
+    checkResults(index, dataset, queries, metric);
+  }
+}
+
+TEST(RerankingIndexTest, SearchOnMappedFileMatchesInMemorySearch) {
+  auto dataset =
+      getGaussianVectors(NUM_VECTORS, VECTOR_DIMENSION, /* seed = */ 3);
+  auto queries =
+      getGaussianVectors(NUM_QUERIES, VECTOR_DIMENSION, /* seed = */ 4);
+
+  std::string path = testing::TempDir() + "reranking_index_vectors.bin";
+  {
+    std::ofstream file(path, std::ios::binary);
+    for (const auto &vector : dataset) {
+      file.write(reinterpret_cast<const char *>(vector.data()),
+                 vector.size() * sizeof(float));
+    }
+  }
+
+  RerankingIndex mapped_index("euclidean");
+  mapped_index.addFromFile(path, VECTOR_DIMENSION);
+  ASSERT_EQ(mapped_index.size(), NUM_VECTORS);
+  checkResults(mapped_index, dataset, queries, "euclidean");
+
+  RerankingIndex in_memory_index("euclidean");
+  in_memory_index.add(dataset);
+  EXPECT_EQ(std::get<1>(mapped_index.search(queries, TOP_K)),
+            std::get<1>(in_memory_index.search(queries, TOP_K)));
+  EXPECT_LT(mapped_index.getMemoryUsage(), in_memory_index.getMemoryUsage());
+
+  EXPECT_THROW(mapped_index.add(dataset), std::invalid_argument);
+  EXPECT_THROW(in_memory_index.addFromFile(path, VECTOR_DIMENSION),
+               std::invalid_argument);
+  EXPECT_THROW(RerankingIndex("euclidean").addFromFile(path, 7),
+               std::invalid_argument);
+  std::remove(path.c_str());
+}
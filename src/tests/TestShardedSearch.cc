@@ -0,0 +1,120 @@
+#include "../ExactSearch.h"
+#include "../ShardWorker.h"
+#include "../ShardedSearch.h"
+#include "../ThreadPool.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <random>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+using lpq::index::ExactSearchIndex;
+using lpq::index::ShardedSearchIndex;
+
+constexpr uint32_t NUM_VECTORS = 1000;
+constexpr uint32_t NUM_QUERIES = 10;
+constexpr uint32_t VECTOR_DIMENSION = 64;
+constexpr uint32_t TOP_K = 10;
+
+// Path of the worker executable, set by the build.
+const std::string WORKER_EXECUTABLE = LPQ_SHARD_WORKER;
+
+std::vector<std::vector<int_least8_t>> getRandomCodes(uint32_t num_vectors,
+                                                      uint32_t seed) {
+  std::mt19937 generator(seed);
+  std::uniform_int_distribution<int> distribution(-128, 127);
+
+  std::vector<std::vector<int_least8_t>> output(
+      num_vectors, std::vector<int_least8_t>(VECTOR_DIMENSION));
+  for (auto &vector : output) {
+    for (auto &value : vector) {
+      value = distribution(generator);
+    }
+  }
+  return output;
+}
+
+TEST(ShardedSearchTest, ShardedSearchMatchesSingleIndex) {
+  auto dataset = getRandomCodes(NUM_VECTORS, /* seed = */ 1);
+  auto queries = getRandomCodes(NUM_QUERIES, /* seed = */ 2);
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    auto shard_paths = ShardedSearchIndex::writeShards(
+        /* distance_metric = */ metric, /* dataset = */ dataset,
+        /* num_shards = */ 3, /* directory = */ testing::TempDir());
+    ShardedSearchIndex sharded_index(shard_paths, WORKER_EXECUTABLE);
+    ASSERT_EQ(sharded_index.numShards(), 3);
+    ASSERT_EQ(sharded_index.size(), NUM_VECTORS);
+
+    ExactSearchIndex<int_least8_t> index(metric);
+    index.add(dataset);
+    auto [expected_distances, expected_ids] = index.search(queries, TOP_K);
+    // Searches can be repeated over the same workers.
+    for (uint32_t repetition = 0; repetition < 2; repetition++) {
+      auto [distances, ids] = sharded_index.search(queries, TOP_K);
+      ASSERT_EQ(ids, expected_ids);
+      ASSERT_EQ(distances, expected_distances);
+    }
+
+    ASSERT_THROW(sharded_index.search({std::vector<int_least8_t>(3)}, TOP_K),
+                 std::invalid_argument);
+    for (const auto &path : shard_paths) {
+      std::remove(path.c_str());
+    }
+  }
+}
+
+TEST(ShardedSearchTest, InvalidShardsOrWorkersAreRejected) {
+  auto shard_paths = ShardedSearchIndex::writeShards(
+      /* distance_metric = */ "euclidean",
+      /* dataset = */ getRandomCodes(100, /* seed = */ 3),
+      /* num_shards = */ 2, /* directory = */ testing::TempDir());
+
+  ASSERT_THROW(ShardedSearchIndex({}, WORKER_EXECUTABLE),
+               std::invalid_argument);
+  ASSERT_THROW(ShardedSearchIndex({shard_paths[0], "/nonexistent/shard.lpq"},
+                                  WORKER_EXECUTABLE),
+               std::invalid_argument);
+  ASSERT_THROW(ShardedSearchIndex(shard_paths, "/nonexistent/worker"),
+               std::runtime_error);
+  for (const auto &path : shard_paths) {
+    std::remove(path.c_str());
+  }
+}
+
+/**
+ * Pins the process like a worker started with `cpu_list` and exits with 0
+ * if its thread pool then has `num_cpus` threads. The pool starts larger,
+ * as in a worker that OpenMP sized for the whole machine.
+ */
+void exitWithPinnedPoolCheck(const std::string &cpu_list, uint32_t num_cpus) {
+  lpq::ThreadPool::global().resize(num_cpus + 7);
+  lpq::index::pinWorkerToCpus(cpu_list);
+  std::exit(lpq::ThreadPool::global().numThreads() == num_cpus ? 0 : 1);
+}
+
+TEST(ShardedSearchTest, PinnedWorkerSizesItsPoolToItsCpus) {
+  cpu_set_t cpu_set;
+  ASSERT_EQ(::sched_getaffinity(0, sizeof(cpu_set), &cpu_set), 0);
+  std::vector<std::string> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &cpu_set)) {
+      cpus.push_back(std::to_string(cpu));
+    }
+  }
+  std::string all_cpus = cpus[0];
+  for (uint32_t index = 1; index < cpus.size(); index++) {
+    all_cpus += "," + cpus[index];
+  }
+
+  // Pinning applies to the whole process, so every check runs in a fresh
+  // child process.
+  ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+  EXPECT_EXIT(exitWithPinnedPoolCheck(cpus[0], /* num_cpus = */ 1),
+              ::testing::ExitedWithCode(0), "");
+  EXPECT_EXIT(exitWithPinnedPoolCheck(all_cpus, cpus.size()),
+              ::testing::ExitedWithCode(0), "");
+}
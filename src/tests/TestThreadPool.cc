@@ -0,0 +1,74 @@
+#include "../ThreadPool.h"
+#include <atomic>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+using lpq::ThreadPool;
+
+TEST(ThreadPoolTest, RunsEveryIndexExactlyOnce) {
+  ThreadPool thread_pool(/* num_threads = */ 4);
+  ASSERT_EQ(thread_pool.numThreads(), 4);
+
+  for (uint64_t grain_size : {0, 1, 7, 1000}) {
+    std::vector<std::atomic<uint32_t>> counts(1000);
+    thread_pool.parallelFor(
+        10, counts.size(), [&](uint64_t index) { counts[index]++; },
+        /* grain_size = */ grain_size);
+    for (uint64_t index = 0; index < counts.size(); index++) {
+      ASSERT_EQ(counts[index], index < 10 ? 0 : 1);
+    }
+  }
+}
+
+TEST(ThreadPoolTest, RunsNestedLoops) {
+  ThreadPool thread_pool(/* num_threads = */ 4);
+  std::vector<uint64_t> sums(16);
+  thread_pool.parallelFor(
+      0, sums.size(),
+      [&](uint64_t outer) {
+        std::vector<uint64_t> values(100);
+        thread_pool.parallelFor(
+            0, values.size(),
+            [&](uint64_t inner) { values[inner] = outer * inner; },
+            /* grain_size = */ 1);
+        sums[outer] = std::accumulate(values.begin(), values.end(), 0ull);
+      },
+      /* grain_size = */ 1);
+  for (uint64_t outer = 0; outer < sums.size(); outer++) {
+    ASSERT_EQ(sums[outer], outer * 4950);
+  }
+}
+
+TEST(ThreadPoolTest, RethrowsExceptions) {
+  ThreadPool thread_pool(/* num_threads = */ 4);
+  auto throw_on_index = [](uint64_t index) {
+    if (index == 37) {
+      throw std::invalid_argument("index 37");
+    }
+  };
+  ASSERT_THROW(thread_pool.parallelFor(0, 100, throw_on_index,
+                                       /* grain_size = */ 1),
+               std::invalid_argument);
+
+  // The pool keeps working after a failed loop.
+  std::atomic<uint32_t> count = 0;
+  thread_pool.parallelFor(0, 100, [&](uint64_t) { count++; });
+  ASSERT_EQ(count, 100);
+}
+
+TEST(ThreadPoolTest, Resizes) {
+  ThreadPool thread_pool(/* num_threads = */ 1);
+  ASSERT_EQ(thread_pool.numThreads(), 1);
+  thread_pool.resize(/* num_threads = */ 3, /* pin_threads = */ true);
+  ASSERT_EQ(thread_pool.numThreads(), 3);
+
+  std::atomic<uint32_t> count = 0;
+  thread_pool.parallelFor(0, 50, [&](uint64_t) { count++; });
+  ASSERT_EQ(count, 50);
+
+  ASSERT_THROW(thread_pool.resize(/* num_threads = */ 0),
+               std::invalid_argument);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../DistanceMetrics.h"
+#include <algorithm>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Data generators and brute-force references shared by the index tests.
+ */
+namespace lpq::test_utils {
+
+/**
+ * Returns `num_vectors` vectors of `dimension` values drawn from a normal
+ * distribution with mean 0. Equal seeds give equal vectors.
+ */
+inline std::vector<std::vector<float>>
+getGaussianVectors(uint32_t num_vectors, uint32_t dimension, uint32_t seed,
+                   float standard_deviation = 1.f) {
+  std::mt19937 generator(seed);
+  std::normal_distribution<float> distribution(0.f, standard_deviation);
+
+  std::vector<std::vector<float>> output(num_vectors,
+                                         std::vector<float>(dimension));
+  for (auto &vector : output) {
+    for (auto &value : vector) {
+      value = distribution(generator);
+    }
+  }
+  return output;
+}
+
+/**
+ * Returns `num_vectors` vectors of `dimension` values drawn uniformly from
+ * [-1, 1]. Equal seeds give equal vectors.
+ */
+inline std::vector<std::vector<float>>
+getUniformVectors(uint32_t num_vectors, uint32_t dimension, uint32_t seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+
+  std::vector<std::vector<float>> output(num_vectors,
+                                         std::vector<float>(dimension));
+  for (auto &vector : output) {
+    for (auto &value : vector) {
+      value = distribution(generator);
+    }
+  }
+  return output;
+}
+
+/**
+ * Returns the exact top k ids of `query` among the float vectors of
+ * `dataset`, best first.
+ */
+inline std::vector<uint64_t>
+getExpectedNeighbors(const std::vector<std::vector<float>> &dataset,
+                     const std::vector<float> &query,
+                     const std::string &metric, uint32_t top_k) {
+  const bool is_similarity = metric != "euclidean";
+  std::vector<std::pair<float, uint64_t>> scores;
+  for (uint64_t i = 0; i < dataset.size(); i++) {
+    float score = lpq::index::computeDistance(query, dataset[i], metric);
+    scores.emplace_back(is_similarity ? -score : score, i);
+  }
+  top_k = std::min<uint64_t>(top_k, scores.size());
+  std::partial_sort(scores.begin(), scores.begin() + top_k, scores.end());
+
+  std::vector<uint64_t> ids;
+  for (uint32_t i = 0; i < top_k; i++) {
+    ids.push_back(scores[i].second);
+  }
+  return ids;
+}
+
+/**
+ * Returns the fraction of the exact float top k of `queries` that
+ * `index.search` finds. Also checks that every query gets k results,
+ * best first.
+ */
+template <typename INDEX_TYPE>
+float computeRecall(const INDEX_TYPE &index,
+                    const std::vector<std::vector<float>> &dataset,
+                    const std::vector<std::vector<float>> &queries,
+                    const std::string &metric, uint32_t top_k) {
+  auto [distances, ids] = index.search(queries, top_k);
+  EXPECT_EQ(ids.size(), queries.size());
+
+  const bool is_similarity = metric != "euclidean";
+  uint32_t num_found = 0;
+  for (uint32_t query = 0; query < queries.size(); query++) {
+    EXPECT_EQ(ids[query].size(), top_k);
+    EXPECT_TRUE(is_similarity ? std::is_sorted(distances[query].rbegin(),
+                                               distances[query].rend())
+                              : std::is_sorted(distances[query].begin(),
+                                               distances[query].end()));
+    for (auto id : getExpectedNeighbors(dataset, queries[query], metric,
+                                        top_k)) {
+      num_found += std::count(ids[query].begin(), ids[query].end(), id);
+    }
+  }
+  return static_cast<float>(num_found) / (queries.size() * top_k);
+}
+
+} // namespace lpq::test_utils
@@ -0,0 +1,159 @@
+#include "../DistanceMetrics.h"
+#include "../SectorReader.h"
+#include "../VamanaIndex.h"
+#include "TestUtils.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using lpq::index::SectorReader;
+using lpq::index::VamanaIndex;
+using lpq::test_utils::computeRecall;
+using lpq::test_utils::getUniformVectors;
+
+constexpr uint32_t NUM_VECTORS = 3000;
+constexpr uint32_t NUM_QUERIES = 20;
+constexpr uint32_t VECTOR_DIMENSION = 32;
+constexpr uint32_t MAX_DEGREE = 32;
+constexpr uint32_t BUILD_LIST_SIZE = 64;
+constexpr uint32_t TOP_K = 10;
+
+TEST(VamanaIndexTest, SearchFindsNearestNeighborsWithFewReads) {
+  auto dataset = getUniformVectors(NUM_VECTORS, VECTOR_DIMENSION, 1);
+  auto queries = getUniformVectors(NUM_QUERIES, VECTOR_DIMENSION, 2);
+  std::string path = testing::TempDir() + "vamana_index.lpq";
+
+  for (const std::string metric : {"euclidean", "dot", "cosine"}) {
+    VamanaIndex::build(dataset, metric, path, MAX_DEGREE, BUILD_LIST_SIZE);
+    auto index = VamanaIndex::load(path);
+    ASSERT_EQ(index->size(), NUM_VECTORS);
+    ASSERT_EQ(index->getMaxDegree(), MAX_DEGREE);
+    index->setSearchListSize(64);
+
+    EXPECT_GE(computeRecall(*index, dataset, queries, metric, TOP_K), 0.9)
+        << metric;
+    // A search reads about search_list_size nodes, not the whole file.
+    EXPECT_LT(index->getNumNodeReads(), NUM_QUERIES * NUM_VECTORS / 10)
+        << metric;
+    // Only the int8 codes, padded to 64 bytes, are held in RAM.
+    EXPECT_LT(index->getMemoryUsage(),
+              NUM_VECTORS * VECTOR_DIMENSION * sizeof(float));
+
+    // Exact distances are returned for the nodes read from disk.
+    auto [distances, ids] = index->search({dataset[7]}, TOP_K);
+    auto position = std::find(ids[0].begin(), ids[0].end(), 7);
+    ASSERT_NE(position, ids[0].end()) << metric;
+    EXPECT_NEAR(distances[0][position - ids[0].begin()],
+                lpq::index::computeDistance(dataset[7], dataset[7], metric),
+                1e-4);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(VamanaIndexTest, RecallHoldsAcrossBeamWidths) {
+  auto dataset = getUniformVectors(NUM_VECTORS, VECTOR_DIMENSION, 3);
+  auto queries = getUniformVectors(NUM_QUERIES, VECTOR_DIMENSION, 4);
+  std::string path = testing::TempDir() + "vamana_index.lpq";
+  VamanaIndex::build(dataset, "euclidean", path, MAX_DEGREE, BUILD_LIST_SIZE);
+  auto index = VamanaIndex::load(path, /* num_io_threads = */ 2);
+
+  for (uint32_t beam_width : {1, 8}) {
+    index->setBeamWidth(beam_width);
+    EXPECT_GE(computeRecall(*index, dataset, queries, "euclidean", TOP_K), 0.9)
+        << beam_width;
+  }
+  std::remove(path.c_str());
+}
+
+TEST(VamanaIndexTest, LargeNodesSpanSeveralSectors) {
+  // 4 * (1100 + 1 + 16) bytes per node take two sectors.
+  constexpr uint32_t dimension = 1100;
+  auto dataset = getUniformVectors(300, dimension, 5);
+  std::string path = testing::TempDir() + "vamana_index.lpq";
+  VamanaIndex::build(dataset, "cosine", path, /* max_degree = */ 16,
+                     /* build_list_size = */ 32);
+  auto index = VamanaIndex::load(path);
+
+  std::vector<std::vector<float>> queries(dataset.begin(),
+                                          dataset.begin() + NUM_QUERIES);
+  auto [distances, ids] = index->search(queries, /* top_k = */ 1);
+  for (uint32_t query = 0; query < NUM_QUERIES; query++) {
+    EXPECT_EQ(ids[query][0], query);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(VamanaIndexTest, SectorReaderReadsFileContents) {
+  std::string path = testing::TempDir() + "sector_reader.bin";
+  std::string contents(100000, '\0');
+  for (uint32_t i = 0; i < contents.size(); i++) {
+    contents[i] = static_cast<char>(i * 31 + i / 256);
+  }
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << contents;
+  }
+
+  SectorReader reader(path, /* num_threads = */ 3);
+  std::vector<std::string> buffers(10, std::string(5000, '\0'));
+  std::vector<SectorReader::Request> requests;
+  for (uint32_t i = 0; i < buffers.size(); i++) {
+    requests.push_back({/* offset = */ i * 9001ull, /* length = */ 5000,
+                        /* buffer = */ buffers[i].data()});
+  }
+  reader.read(requests.data(), requests.size());
+  for (uint32_t i = 0; i < buffers.size(); i++) {
+    EXPECT_EQ(buffers[i], contents.substr(i * 9001, 5000));
+  }
+
+  // Reads past the end of the file fail.
+  requests[0].offset = contents.size() - 10;
+  EXPECT_THROW(reader.read(requests.data(), 1), std::runtime_error);
+  std::remove(path.c_str());
+  EXPECT_THROW(SectorReader(path, 1), std::invalid_argument);
+}
+
+TEST(VamanaIndexTest, RejectsInvalidArgumentsAndFiles) {
+  auto dataset = getUniformVectors(200, VECTOR_DIMENSION, 6);
+  std::string path = testing::TempDir() + "vamana_index.lpq";
+
+  EXPECT_THROW(VamanaIndex::build({}, "euclidean", path),
+               std::invalid_argument);
+  EXPECT_THROW(VamanaIndex::build(dataset, "hamming", path),
+               std::invalid_argument);
+  EXPECT_THROW(VamanaIndex::build(dataset, "euclidean", path,
+                                  /* max_degree = */ 0),
+               std::invalid_argument);
+  EXPECT_THROW(VamanaIndex::build(dataset, "euclidean", path, MAX_DEGREE,
+                                  BUILD_LIST_SIZE, /* alpha = */ 0.5f),
+               std::invalid_argument);
+  auto ragged_dataset = dataset;
+  ragged_dataset[10].pop_back();
+  EXPECT_THROW(VamanaIndex::build(ragged_dataset, "euclidean", path),
+               std::invalid_argument);
+
+  VamanaIndex::build(dataset, "euclidean", path, MAX_DEGREE, BUILD_LIST_SIZE);
+  auto index = VamanaIndex::load(path);
+  EXPECT_THROW(index->setSearchListSize(0), std::invalid_argument);
+  EXPECT_THROW(index->setBeamWidth(0), std::invalid_argument);
+  EXPECT_THROW(index->search({std::vector<float>(VECTOR_DIMENSION + 1)}, 1),
+               std::invalid_argument);
+
+  // Truncated file.
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  EXPECT_THROW(VamanaIndex::load(path), std::invalid_argument);
+
+  // Not an index file.
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << std::string(8192, 'x');
+  }
+  EXPECT_THROW(VamanaIndex::load(path), std::invalid_argument);
+  std::remove(path.c_str());
+  EXPECT_THROW(VamanaIndex::load(path), std::invalid_argument);
+}
@@ -0,0 +1,34 @@
+#include <exception>
+#include <iostream>
+#include <src/ShardProtocol.h>
+#include <src/ShardWorker.h>
+
+/**
+ * Worker process of a ShardedSearchIndex:
+ *
+ *   lpq_shard_worker <shard path> [<cpu list>]
+ *
+ * The coordinator passes its end of the socket as file descriptor
+ * SHARD_WORKER_SOCKET_FD.
+ */
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: " << argv[0] << " <shard path> [<cpu list>]\n";
+    return 2;
+  }
+  if (argc == 3) {
+    try {
+      lpq::index::pinWorkerToCpus(argv[2]);
+    } catch (const std::exception &exception) {
+      // Pinning only affects performance, so we serve the shard anyway.
+      std::cerr << exception.what() << '\n';
+    }
+  }
+  try {
+    return lpq::index::runShardWorker(lpq::index::SHARD_WORKER_SOCKET_FD,
+                                      argv[1]);
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << '\n';
+    return 1;
+  }
+}